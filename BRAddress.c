@@ -27,6 +27,7 @@
 #include "BRBech32.h"
 #include "BRInt.h"
 #include <inttypes.h>
+#include <strings.h>
 #include <assert.h>
 
 #define VAR_INT16_HEADER  0xfd
@@ -235,6 +236,12 @@ const uint8_t *BRScriptPKH(const uint8_t *script, size_t scriptLen)
     assert(script != NULL || scriptLen == 0);
     if (! script || scriptLen == 0 || scriptLen > MAX_SCRIPT_LENGTH) return NULL;
 
+    BRScriptTemplate t = BRScriptClassify(script, scriptLen);
+    
+    if (t.type == BRScriptTypeP2PKH || t.type == BRScriptTypeP2SH || t.type == BRScriptTypeP2WPKH) {
+        return &script[t.dataOff];
+    }
+
     const uint8_t *elems[BRScriptElements(NULL, 0, script, scriptLen)], *r = NULL;
     size_t l, count = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), script, scriptLen);
     
@@ -252,6 +259,69 @@ const uint8_t *BRScriptPKH(const uint8_t *script, size_t scriptLen)
     return r;
 }
 
+// classifies script against the standard scriptPubKey templates in one pass by length and opcode pattern, without
+// tokenizing it, returns BR_SCRIPT_TEMPLATE_NONE if script is non-standard
+BRScriptTemplate BRScriptClassify(const uint8_t *script, size_t scriptLen)
+{
+    BRScriptTemplate t = BR_SCRIPT_TEMPLATE_NONE;
+    
+    assert(script != NULL || scriptLen == 0);
+    if (! script || scriptLen == 0 || scriptLen > MAX_SCRIPT_LENGTH) return t;
+    
+    if (scriptLen == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+        t = (BRScriptTemplate) { BRScriptTypeP2PKH, 3, 20 };
+    }
+    else if (scriptLen == 23 && script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL) {
+        t = (BRScriptTemplate) { BRScriptTypeP2SH, 2, 20 };
+    }
+    else if (scriptLen == 22 && script[0] == OP_0 && script[1] == 20) {
+        t = (BRScriptTemplate) { BRScriptTypeP2WPKH, 2, 20 };
+    }
+    else if (scriptLen == 34 && script[0] == OP_0 && script[1] == 32) {
+        t = (BRScriptTemplate) { BRScriptTypeP2WSH, 2, 32 };
+    }
+    else if ((scriptLen == 35 || scriptLen == 67) && script[0] == scriptLen - 2 && script[scriptLen - 1] == OP_CHECKSIG) {
+        t = (BRScriptTemplate) { BRScriptTypeP2PK, 1, script[0] };
+    }
+    else if (script[0] == OP_RETURN) {
+        t = (BRScriptTemplate) { BRScriptTypeNullData, 1, scriptLen - 1 };
+        
+        if (scriptLen >= 2 && script[1] < OP_PUSHDATA1 && 2 + script[1] <= scriptLen) {
+            t.dataOff = 2, t.dataLen = script[1];
+        }
+        else if (scriptLen >= 3 && script[1] == OP_PUSHDATA1 && 3 + script[2] <= scriptLen) {
+            t.dataOff = 3, t.dataLen = script[2];
+        }
+        
+        if (t.dataLen >= 2 && script[t.dataOff] == 'D' && script[t.dataOff + 1] == 'A') t.type = BRScriptTypeDigiAsset;
+    }
+    
+    return t;
+}
+
+// true if addr starts with the bech32 human readable part for the current network and is otherwise made of letters and
+// digits all in the same case, so bech32 decoding is tried first, callers still fall back to base58 if it fails
+static int _BRAddressIsBech32(const char *addr)
+{
+    const char *prefix = DIGIBYTE_PUBKEY_BECH32 "1";
+    int upper = 0, lower = 0;
+
+#if BITCOIN_TESTNET
+    prefix = DIGIBYTE_PUBKEY_BECH32 "t1";
+#endif
+
+    if (strncasecmp(addr, prefix, strlen(prefix)) != 0) return 0;
+
+    for (const char *c = addr; *c; c++) {
+        if (*c >= 'a' && *c <= 'z') lower = 1;
+        else if (*c >= 'A' && *c <= 'Z') upper = 1;
+        else if (*c < '0' || *c > '9') return 0;
+    }
+
+    return ! (upper && lower);
+}
+
 // NOTE: It's important here to be permissive with scriptSig (spends) and strict with scriptPubKey (receives). If we
 // miss a receive transaction, only that transaction's funds are missed, however if we accept a receive transaction that
 // we are unable to correctly sign later, then the entire wallet balance after that point would become stuck with the
@@ -265,9 +335,50 @@ size_t BRAddressFromScriptPubKey(char *addr, size_t addrLen, const uint8_t *scri
     if (! script || scriptLen == 0 || scriptLen > MAX_SCRIPT_LENGTH) return 0;
     
     uint8_t data[21];
-    const uint8_t *d, *elems[BRScriptElements(NULL, 0, script, scriptLen)];
+    const uint8_t *d;
     char a[91];
-    size_t r = 0, l = 0, count = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), script, scriptLen);
+    size_t r = 0, l = 0;
+    BRScriptTemplate t = BRScriptClassify(script, scriptLen);
+    
+    switch (t.type) {
+        case BRScriptTypeP2PKH: // fall through
+        case BRScriptTypeP2SH:
+            data[0] = DIGIBYTE_PUBKEY_LEGACY;
+#if BITCOIN_TESTNET
+            data[0] = (t.type == BRScriptTypeP2PKH) ? BITCOIN_PUBKEY_ADDRESS_TEST : BITCOIN_SCRIPT_ADDRESS_TEST;
+#endif
+            memcpy(&data[1], &script[t.dataOff], 20);
+            return BRBase58CheckEncode(addr, addrLen, data, 21);
+            
+        case BRScriptTypeP2PK:
+            data[0] = DIGIBYTE_PUBKEY_LEGACY;
+#if BITCOIN_TESTNET
+            data[0] = BITCOIN_PUBKEY_ADDRESS_TEST;
+#endif
+            BRHash160(&data[1], &script[t.dataOff], t.dataLen);
+            return BRBase58CheckEncode(addr, addrLen, data, 21);
+            
+        case BRScriptTypeP2WPKH: // fall through
+        case BRScriptTypeP2WSH:
+            r = BRBech32Encode(a, DIGIBYTE_PUBKEY_BECH32, script);
+#if BITCOIN_TESTNET
+            r = BRBech32Encode(a, DIGIBYTE_PUBKEY_BECH32 "t", script);
+#endif
+            if (addr && r > addrLen) r = 0;
+            if (addr) memcpy(addr, a, r);
+            return r;
+            
+        case BRScriptTypeNullData: // fall through
+        case BRScriptTypeDigiAsset:
+            return 0;
+    }
+    
+    // the only non-standard scripts with an address start with OP_DUP or a witness version, skip tokenizing the rest
+    if (script[0] != OP_DUP && (script[0] < OP_1 || script[0] > OP_16)) return 0;
+    
+    const uint8_t *elems[BRScriptElements(NULL, 0, script, scriptLen)];
+    size_t count = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), script, scriptLen);
+
     if ((count == 5 || count == 8) && *elems[0] == OP_DUP && *elems[1] == OP_HASH160 && *elems[2] == 20 && *elems[3] == OP_EQUALVERIFY
         && *elems[4] == OP_CHECKSIG) {
         // pay-to-pubkey-hash scriptPubKey
@@ -374,7 +485,16 @@ size_t BRAddressScriptPubKey(uint8_t *script, size_t scriptLen, const char *addr
     bech32Prefix = "dgbt";
 #endif
     
-    if (BRBase58CheckDecode(data, sizeof(data), addr) == 21) {
+    if (_BRAddressIsBech32(addr)) {
+        dataLen = BRBech32Decode(hrp, data, addr);
+        
+        if (dataLen > 2 && strcmp(hrp, bech32Prefix) == 0 && (data[0] != OP_0 || data[1] == 20 || data[1] == 32)) {
+            if (script && dataLen <= scriptLen) memcpy(script, data, dataLen);
+            r = (! script || dataLen <= scriptLen) ? dataLen : 0;
+        }
+    }
+    
+    if (r == 0 && BRBase58CheckDecode(data, sizeof(data), addr) == 21) {
         if (data[0] == pubkeyAddress) {
             if (script && 25 <= scriptLen) {
                 script[0] = OP_DUP;
@@ -398,14 +518,6 @@ size_t BRAddressScriptPubKey(uint8_t *script, size_t scriptLen, const char *addr
             r = (! script || 23 <= scriptLen) ? 23 : 0;
         }
     }
-    else {
-        dataLen = BRBech32Decode(hrp, data, addr);
-        
-        if (dataLen > 2 && strcmp(hrp, bech32Prefix) == 0 && (data[0] != OP_0 || data[1] == 20 || data[1] == 32)) {
-            if (script && dataLen <= scriptLen) memcpy(script, data, dataLen);
-            r = (! script || dataLen <= scriptLen) ? dataLen : 0;
-        }
-    }
 
     return r;
 }
@@ -419,7 +531,15 @@ int BRAddressIsValid(const char *addr)
     
     assert(addr != NULL);
     
-    if (BRBase58CheckDecode(data, sizeof(data), addr) == 21) {
+    if (_BRAddressIsBech32(addr) && BRBech32Decode(hrp, data, addr) > 2) {
+        r = (strcmp(hrp, DIGIBYTE_PUBKEY_BECH32) == 0 && (data[0] != OP_0 || data[1] == 20 || data[1] == 32));
+
+#if BITCOIN_TESTNET
+        r = (strcmp(hrp, DIGIBYTE_PUBKEY_BECH32 "t") == 0 && (data[0] != OP_0 || data[1] == 20 || data[1] == 32));
+#endif
+    }
+    
+    if (! r && BRBase58CheckDecode(data, sizeof(data), addr) == 21) {
         r = (data[0] == DIGIBYTE_PUBKEY_LEGACY || data[0] == DIGIBYTE_SCRIPT_ADDRESS_LEGACY);
         if (!r) r = (data[0] == DIGIBYTE_SCRIPT_ADDRESS); // check new multisig
     
@@ -427,26 +547,123 @@ int BRAddressIsValid(const char *addr)
         r = (data[0] == BITCOIN_PUBKEY_ADDRESS_TEST || data[0] == BITCOIN_SCRIPT_ADDRESS_TEST);
 #endif
     }
-    else if (BRBech32Decode(hrp, data, addr) > 2) {
-        r = (strcmp(hrp, DIGIBYTE_PUBKEY_BECH32) == 0 && (data[0] != OP_0 || data[1] == 20 || data[1] == 32));
-
-#if BITCOIN_TESTNET
-        r = (strcmp(hrp, "dgbt") == 0 && (data[0] != OP_0 || data[1] == 20 || data[1] == 32));
-#endif
-    }
     
     return r;
 }
 
 // writes the 20 byte hash160 of addr to md20 and returns true on success
+// for bech32 addresses this is the witness program of a pay-to-witness-pubkey-hash address
 int BRAddressHash160(void *md20, const char *addr)
 {
-    uint8_t data[21];
+    uint8_t data[42];
+    char hrp[84];
     int r = 0;
     
     assert(md20 != NULL);
     assert(addr != NULL);
-    r = (BRBase58CheckDecode(data, sizeof(data), addr) == 21);
-    if (r) memcpy(md20, &data[1], 20);
+    
+    if (_BRAddressIsBech32(addr) && BRBech32Decode(hrp, data, addr) == 22 && data[0] == OP_0 && data[1] == 20) {
+        memcpy(md20, &data[2], 20);
+        r = 1;
+    }
+    
+    if (! r && BRBase58CheckDecode(data, sizeof(data), addr) == 21) {
+        memcpy(md20, &data[1], 20);
+        r = 1;
+    }
+
+    return r;
+}
+
+// writes the 20 byte hash160 paid to by a standard pay-to-pubkey-hash, pay-to-script-hash, pay-to-witness-pubkey-hash
+// or pay-to-pubkey scriptPubKey to md20 and returns true, without rendering an address string
+int BRScriptPubKeyHash160(void *md20, const uint8_t *script, size_t scriptLen)
+{
+    BRScriptTemplate t;
+    int r = 0;
+    
+    assert(md20 != NULL);
+    assert(script != NULL || scriptLen == 0);
+    t = BRScriptClassify(script, scriptLen);
+    
+    if (t.type == BRScriptTypeP2PKH || t.type == BRScriptTypeP2SH || t.type == BRScriptTypeP2WPKH) {
+        memcpy(md20, &script[t.dataOff], 20);
+        r = 1;
+    }
+    else if (t.type == BRScriptTypeP2PK) {
+        BRHash160(md20, &script[t.dataOff], t.dataLen);
+        r = 1;
+    }
+    
+    return r;
+}
+
+// writes the address for each of scripts[i] to addrs[i], or an empty string if there is none
+// returns the number of non-empty addresses written
+size_t BRAddressFromScriptPubKeyList(BRAddress addrs[], const uint8_t *scripts[], const size_t scriptLens[],
+                                     size_t count)
+{
+    size_t r = 0;
+    
+    assert(addrs != NULL || count == 0);
+    assert(scripts != NULL || count == 0);
+    assert(scriptLens != NULL || count == 0);
+    
+    for (size_t i = 0; i < count; i++) {
+        addrs[i] = BR_ADDRESS_NONE;
+        if (BRAddressFromScriptPubKey(addrs[i].s, sizeof(addrs[i].s), scripts[i], scriptLens[i]) > 0) r++;
+    }
+    
+    return r;
+}
+
+// writes the hash160 paid to by each of scripts[i] to md20s[i], or UINT160_ZERO if there is none
+// returns the number of non-zero hashes written
+size_t BRScriptPubKeyHash160List(UInt160 md20s[], const uint8_t *scripts[], const size_t scriptLens[], size_t count)
+{
+    size_t r = 0;
+    
+    assert(md20s != NULL || count == 0);
+    assert(scripts != NULL || count == 0);
+    assert(scriptLens != NULL || count == 0);
+    
+    for (size_t i = 0; i < count; i++) {
+        md20s[i] = UINT160_ZERO;
+        if (BRScriptPubKeyHash160(&md20s[i], scripts[i], scriptLens[i])) r++;
+    }
+    
+    return r;
+}
+
+// writes true to results[i] if addrs[i] is a valid bitcoin address, and returns the number of valid addresses
+size_t BRAddressIsValidList(int results[], const char *addrs[], size_t count)
+{
+    size_t r = 0;
+    
+    assert(results != NULL || count == 0);
+    assert(addrs != NULL || count == 0);
+    
+    for (size_t i = 0; i < count; i++) {
+        results[i] = BRAddressIsValid(addrs[i]);
+        if (results[i]) r++;
+    }
+    
+    return r;
+}
+
+// writes the hash160 of each of addrs[i] to md20s[i], or UINT160_ZERO if addrs[i] isn't valid
+// returns the number of non-zero hashes written
+size_t BRAddressHash160List(UInt160 md20s[], const char *addrs[], size_t count)
+{
+    size_t r = 0;
+    
+    assert(md20s != NULL || count == 0);
+    assert(addrs != NULL || count == 0);
+    
+    for (size_t i = 0; i < count; i++) {
+        md20s[i] = UINT160_ZERO;
+        if (BRAddressHash160(&md20s[i], addrs[i])) r++;
+    }
+    
     return r;
 }
@@ -26,6 +26,7 @@
 #define BRAddress_h
 
 #include "BRCrypto.h"
+#include "BRInt.h"
 #include <string.h>
 #include <stddef.h>
 #include <inttypes.h>
@@ -59,9 +60,30 @@ extern "C" {
 #define OP_DUP         0x76
 #define OP_EQUAL       0x87
 #define OP_EQUALVERIFY 0x88
+#define OP_RETURN      0x6a
 #define OP_HASH160     0xa9
 #define OP_CHECKSIG    0xac
 
+typedef enum {
+    BRScriptTypeNonStandard = 0,
+    BRScriptTypeP2PKH,     // OP_DUP OP_HASH160 <20 byte hash> OP_EQUALVERIFY OP_CHECKSIG
+    BRScriptTypeP2SH,      // OP_HASH160 <20 byte hash> OP_EQUAL
+    BRScriptTypeP2WPKH,    // OP_0 <20 byte hash>
+    BRScriptTypeP2WSH,     // OP_0 <32 byte hash>
+    BRScriptTypeP2PK,      // <33 or 65 byte pubkey> OP_CHECKSIG
+    BRScriptTypeNullData,  // OP_RETURN <data>
+    BRScriptTypeDigiAsset  // OP_RETURN <data starting with "DA">
+} BRScriptType;
+
+// compact descriptor of a scriptPubKey matching one of the standard templates
+typedef struct {
+    uint8_t type;     // BRScriptType
+    uint8_t dataOff;  // offset in the script of the hash, pubkey or OP_RETURN data
+    uint16_t dataLen; // length of the hash, pubkey or OP_RETURN data
+} BRScriptTemplate;
+
+#define BR_SCRIPT_TEMPLATE_NONE ((BRScriptTemplate) { BRScriptTypeNonStandard, 0, 0 })
+
 // reads a varint from buf and stores its length in intLen if intLen is non-NULL
 // returns the varint value
 uint64_t BRVarInt(const uint8_t *buf, size_t bufLen, size_t *intLen);
@@ -86,6 +108,10 @@ size_t BRScriptPushData(uint8_t *script, size_t scriptLen, const uint8_t *data,
 // returns a pointer to the 20byte pubkey hash, or NULL if none
 const uint8_t *BRScriptPKH(const uint8_t *script, size_t scriptLen);
 
+// classifies script against the standard scriptPubKey templates in one pass by length and opcode pattern, without
+// tokenizing it, returns BR_SCRIPT_TEMPLATE_NONE if script is non-standard
+BRScriptTemplate BRScriptClassify(const uint8_t *script, size_t scriptLen);
+
 typedef struct {
     char s[36];
 } BRAddress;
@@ -112,8 +138,32 @@ size_t BRAddressScriptPubKey(uint8_t *script, size_t scriptLen, const char *addr
 int BRAddressIsValid(const char *addr);
 
 // writes the 20 byte hash160 of addr to md20 and returns true on success
+// for bech32 addresses this is the witness program of a pay-to-witness-pubkey-hash address
 int BRAddressHash160(void *md20, const char *addr);
 
+// writes the 20 byte hash160 paid to by a standard pay-to-pubkey-hash, pay-to-script-hash, pay-to-witness-pubkey-hash
+// or pay-to-pubkey scriptPubKey to md20 and returns true, without rendering an address string
+int BRScriptPubKeyHash160(void *md20, const uint8_t *script, size_t scriptLen);
+
+// batch versions of the above functions for processing many scripts or addresses in one call
+// standard templates are matched by length and opcode pattern, so only non-standard scripts are fully tokenized
+
+// writes the address for each of scripts[i] to addrs[i], or an empty string if there is none
+// returns the number of non-empty addresses written
+size_t BRAddressFromScriptPubKeyList(BRAddress addrs[], const uint8_t *scripts[], const size_t scriptLens[],
+                                     size_t count);
+
+// writes the hash160 paid to by each of scripts[i] to md20s[i], or UINT160_ZERO if there is none
+// returns the number of non-zero hashes written
+size_t BRScriptPubKeyHash160List(UInt160 md20s[], const uint8_t *scripts[], const size_t scriptLens[], size_t count);
+
+// writes true to results[i] if addrs[i] is a valid bitcoin address, and returns the number of valid addresses
+size_t BRAddressIsValidList(int results[], const char *addrs[], size_t count);
+
+// writes the hash160 of each of addrs[i] to md20s[i], or UINT160_ZERO if addrs[i] isn't valid
+// returns the number of non-zero hashes written
+size_t BRAddressHash160List(UInt160 md20s[], const char *addrs[], size_t count);
+
 // returns a hash value for addr suitable for use in a hashtable
 inline static size_t BRAddressHash(const void *addr)
 {
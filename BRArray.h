@@ -83,6 +83,9 @@ extern "C" {
 
 #define array_count(array) (((size_t *)(array))[-1])
 
+// bytes of heap memory allocated for array, including the space reserved for growth
+#define array_mem_size(array) (sizeof(size_t)*2 + array_capacity(array)*sizeof(*(array)))
+
 #define array_set_count(array, count) do {\
     size_t _array_cnt = (count);\
     assert((array) != NULL);\
@@ -177,6 +180,151 @@ extern "C" {
     free((size_t *)(array) - 2);\
 } while (0)
 
+// growable ring buffers with type checking, for queues that add items at one end and remove them from the other
+// adding or removing an item at either end is O(1), the first item is not kept at index 0 so members must be accessed
+// with queue_at()
+//
+// example:
+//
+// int *myQueue;                            // queue of ints
+//
+// queue_new(myQueue, 2);                   // initialize myQueue with a capacity of 2 items
+// queue_add(myQueue, 1);                   // add 1 to the end of myQueue
+// queue_add(myQueue, 2);                   // add 2 to the end of myQueue
+// queue_add_first(myQueue, 0);             // add 0 to the start of myQueue (capacity is auto-increased)
+//
+// for (int i = 0; i < queue_count(myQueue); i++) {
+//     printf("%d, ", queue_at(myQueue, i)); // 0, 1, 2,
+// }
+//
+// queue_rm_first(myQueue);                 // remove 0 from start of myQueue
+// queue_rm_last(myQueue);                  // remove 2 from end of myQueue
+// queue_clear(myQueue);                    // myQueue is now empty
+// queue_free(myQueue);                     // free memory allocated for myQueue
+//
+// NOTE: when new items are added to a queue past its current capacity, its memory location may change, and existing
+// items may move to new indexes in the underlying buffer
+
+#define queue_new(queue, capacity) do {\
+    size_t _queue_cap = (capacity);\
+    (queue) = (void *)((size_t *)calloc(1, _queue_cap*sizeof(*(queue)) + sizeof(size_t)*3) + 3);\
+    assert((queue) != NULL);\
+    queue_capacity(queue) = _queue_cap;\
+    queue_first_idx(queue) = 0;\
+    queue_count(queue) = 0;\
+} while (0)
+
+#define queue_capacity(queue) (((size_t *)(queue))[-3])
+
+#define queue_first_idx(queue) (((size_t *)(queue))[-2])
+
+#define queue_count(queue) (((size_t *)(queue))[-1])
+
+// bytes of heap memory allocated for queue, including the space reserved for growth
+#define queue_mem_size(queue) (sizeof(size_t)*3 + queue_capacity(queue)*sizeof(*(queue)))
+
+#define queue_at(queue, index) ((queue)[(queue_first_idx(queue) + (index)) % queue_capacity(queue)])
+
+#define queue_first(queue) queue_at(queue, 0)
+
+#define queue_last(queue) queue_at(queue, queue_count(queue) - 1)
+
+// items are copied to the start of the new buffer, so this is O(n) and only happens as the queue grows
+#define queue_set_capacity(queue, capacity) do {\
+    assert((queue) != NULL);\
+    size_t _queue_cap = (capacity), _queue_cnt = queue_count(queue), _queue_idx = queue_first_idx(queue),\
+           _queue_n = (_queue_idx + _queue_cnt <= queue_capacity(queue)) ? _queue_cnt :\
+                      queue_capacity(queue) - _queue_idx, *_queue_buf;\
+    assert(_queue_cap >= _queue_cnt);\
+    _queue_buf = calloc(1, _queue_cap*sizeof(*(queue)) + sizeof(size_t)*3);\
+    assert(_queue_buf != NULL);\
+    memcpy(_queue_buf + 3, (queue) + _queue_idx, _queue_n*sizeof(*(queue)));\
+    memcpy((char *)(_queue_buf + 3) + _queue_n*sizeof(*(queue)), (queue), (_queue_cnt - _queue_n)*sizeof(*(queue)));\
+    free((size_t *)(queue) - 3);\
+    (queue) = (void *)(_queue_buf + 3);\
+    queue_capacity(queue) = _queue_cap;\
+    queue_first_idx(queue) = 0;\
+    queue_count(queue) = _queue_cnt;\
+} while (0)
+
+#define queue_add(queue, item) do {\
+    assert((queue) != NULL);\
+    if (queue_count(queue) + 1 > queue_capacity(queue))\
+        queue_set_capacity(queue, (queue_capacity(queue) + 1)*3/2);\
+    queue_at(queue, queue_count(queue)) = (item);\
+    queue_count(queue)++;\
+} while (0)
+
+#define queue_add_first(queue, item) do {\
+    assert((queue) != NULL);\
+    if (queue_count(queue) + 1 > queue_capacity(queue))\
+        queue_set_capacity(queue, (queue_capacity(queue) + 1)*3/2);\
+    queue_first_idx(queue) = (queue_first_idx(queue) + queue_capacity(queue) - 1) % queue_capacity(queue);\
+    queue_count(queue)++;\
+    queue_first(queue) = (item);\
+} while (0)
+
+#define queue_rm_first(queue) do {\
+    assert((queue) != NULL);\
+    if (queue_count(queue) > 0) {\
+        memset(&queue_first(queue), 0, sizeof(*(queue)));\
+        queue_first_idx(queue) = (queue_first_idx(queue) + 1) % queue_capacity(queue);\
+        queue_count(queue)--;\
+    }\
+} while (0)
+
+#define queue_rm_last(queue) do {\
+    assert((queue) != NULL);\
+    if (queue_count(queue) > 0) {\
+        memset(&queue_last(queue), 0, sizeof(*(queue)));\
+        queue_count(queue)--;\
+    }\
+} while (0)
+
+// removes len items from the start of queue
+#define queue_rm_range_first(queue, len) do {\
+    size_t _queue_len = (len), _queue_n;\
+    assert((queue) != NULL);\
+    assert(_queue_len <= queue_count(queue));\
+    if (_queue_len > 0) {\
+        _queue_n = queue_capacity(queue) - queue_first_idx(queue);\
+        if (_queue_n > _queue_len) _queue_n = _queue_len;\
+        memset((queue) + queue_first_idx(queue), 0, _queue_n*sizeof(*(queue)));\
+        memset((queue), 0, (_queue_len - _queue_n)*sizeof(*(queue)));\
+        queue_first_idx(queue) = (queue_first_idx(queue) + _queue_len) % queue_capacity(queue);\
+        queue_count(queue) -= _queue_len;\
+    }\
+} while (0)
+
+// removes the item at index, moving whichever side of the queue has fewer items to fill the gap
+#define queue_rm(queue, index) do {\
+    size_t _queue_i = (index);\
+    assert((queue) != NULL);\
+    assert(_queue_i < queue_count(queue));\
+    if (_queue_i < queue_count(queue)/2) {\
+        for (; _queue_i > 0; _queue_i--)\
+            queue_at(queue, _queue_i) = queue_at(queue, _queue_i - 1);\
+        queue_rm_first(queue);\
+    }\
+    else {\
+        for (; _queue_i + 1 < queue_count(queue); _queue_i++)\
+            queue_at(queue, _queue_i) = queue_at(queue, _queue_i + 1);\
+        queue_rm_last(queue);\
+    }\
+} while (0)
+
+#define queue_clear(queue) do {\
+    assert((queue) != NULL);\
+    memset((queue), 0, queue_capacity(queue)*sizeof(*(queue)));\
+    queue_first_idx(queue) = 0;\
+    queue_count(queue) = 0;\
+} while (0)
+
+#define queue_free(queue) do {\
+    assert((queue) != NULL);\
+    free((size_t *)(queue) - 3);\
+} while (0)
+
 #ifdef __cplusplus
 }
 #endif
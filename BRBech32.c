@@ -29,52 +29,67 @@
 #include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <assert.h>
 
 // bech32 address format: https://github.com/bitcoin/bips/blob/master/bip-0173.mediawiki
 
-#define polymod(x) ((((x) & 0x1ffffff) << 5) ^ (-(((x) >> 25) & 1) & 0x3b6a57b2) ^\
-                    (-(((x) >> 26) & 1) & 0x26508e6d) ^ (-(((x) >> 27) & 1) & 0x1ea119fa) ^\
-                    (-(((x) >> 28) & 1) & 0x3d4233dd) ^ (-(((x) >> 29) & 1) & 0x2a1462b3))
+// polymod generator xors for each possible value of the top five bits of the checksum state
+static const uint32_t _polymodTable[32] = {
+    0x00000000, 0x3b6a57b2, 0x26508e6d, 0x1d3ad9df, 0x1ea119fa, 0x25cb4e48, 0x38f19797, 0x039bc025,
+    0x3d4233dd, 0x0628646f, 0x1b12bdb0, 0x2078ea02, 0x23e32a27, 0x18897d95, 0x05b3a44a, 0x3ed9f3f8,
+    0x2a1462b3, 0x117e3501, 0x0c44ecde, 0x372ebb6c, 0x34b57b49, 0x0fdf2cfb, 0x12e5f524, 0x298fa296,
+    0x1756516e, 0x2c3c06dc, 0x3106df03, 0x0a6c88b1, 0x09f74894, 0x329d1f26, 0x2fa7c6f9, 0x14cd914b
+};
 
-// returns the number of bytes written to data42 (maximum of 42)
-size_t BRBech32Decode(char *hrp84, uint8_t *data42, const char *addr)
-{
-    size_t i, j, bufLen, addrLen = (addr) ? strlen(addr) : 0, sep = addrLen;
-    uint32_t x, chk = 1;
-    uint8_t c, ver = 0xff, buf[52], upper = 0, lower = 0;
+// bech32 digit values for each ascii character, upper or lower case, or -1 if not a bech32 digit
+static const int8_t _bech32Digits[128] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    15, -1, 10, 17, 21, 20, 26, 30,  7,  5, -1, -1, -1, -1, -1, -1,
+    -1, 29, -1, 24, 13, 25,  9,  8, 23, -1, 18, 22, 31, 27, 19, -1,
+     1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1,
+    -1, 29, -1, 24, 13, 25,  9,  8, 23, -1, 18, 22, 31, 27, 19, -1,
+     1,  0,  3, 16, 11, 28, 12, 14,  6,  4,  2, -1, -1, -1, -1, -1
+};
 
-    assert(hrp84 != NULL);
-    assert(data42 != NULL);
-    assert(addr != NULL);
+#define polymod(x) ((((x) & 0x1ffffff) << 5) ^ _polymodTable[((x) >> 25) & 0x1f])
+
+// checks addr for invalid characters, mixed case and length
+// returns the position of the separator between the hrp and data parts, or 0 if addr is malformed
+static size_t _BRBech32Separator(const char *addr, size_t addrLen)
+{
+    size_t i, sep = addrLen;
+    uint8_t upper = 0, lower = 0;
     
     for (i = 0; i < addrLen; i++) {
         if (addr[i] < 33 || addr[i] > 126) return 0;
         if (islower(addr[i])) lower = 1;
         if (isupper(addr[i])) upper = 1;
     }
-
+    
     while (sep > 0 && addr[sep] != '1') sep--;
     if (addrLen < 8 || addrLen > 90 || sep < 1 || sep + 2 + 6 > addrLen || (upper && lower)) return 0;
-    for (i = 0; i < sep; i++) chk = polymod(chk) ^ (tolower(addr[i]) >> 5);
-    chk = polymod(chk);
-    for (i = 0; i < sep; i++) chk = polymod(chk) ^ (addr[i] & 0x1f);
-    memset(buf, 0, sizeof(buf));
+    return sep;
+}
 
+// decodes the data part of addr following the separator, chk is the checksum state after the hrp has been processed
+// returns the number of bytes written to data42, or 0 if the data part or checksum is invalid
+static size_t _BRBech32DecodeData(uint8_t *data42, const char *addr, size_t addrLen, size_t sep, uint32_t chk)
+{
+    size_t i, j, bufLen;
+    uint32_t x;
+    uint8_t c, ver = 0xff, buf[52];
+    int8_t d;
+    
+    memset(buf, 0, sizeof(buf));
+    
     for (i = sep + 1, j = -1; i < addrLen; i++, j++) {
-        switch (tolower(addr[i])) {
-            case 'q': c = 0;  break; case 'p': c = 1;  break; case 'z': c = 2;  break; case 'r': c = 3;  break;
-            case 'y': c = 4;  break; case '9': c = 5;  break; case 'x': c = 6;  break; case '8': c = 7;  break;
-            case 'g': c = 8;  break; case 'f': c = 9;  break; case '2': c = 10; break; case 't': c = 11; break;
-            case 'v': c = 12; break; case 'd': c = 13; break; case 'w': c = 14; break; case '0': c = 15; break;
-            case 's': c = 16; break; case '3': c = 17; break; case 'j': c = 18; break; case 'n': c = 19; break;
-            case '5': c = 20; break; case '4': c = 21; break; case 'k': c = 22; break; case 'h': c = 23; break;
-            case 'c': c = 24; break; case 'e': c = 25; break; case '6': c = 26; break; case 'm': c = 27; break;
-            case 'u': c = 28; break; case 'a': c = 29; break; case '7': c = 30; break; case 'l': c = 31; break;
-            default: return 0; // invalid bech32 digit
-        }
-        
+        d = _bech32Digits[addr[i] & 0x7f];
+        if (d < 0) return 0; // invalid bech32 digit
+        c = (uint8_t)d;
         chk = polymod(chk) ^ c;
         if (j == -1) ver = c;
         if (j == -1 || i + 6 >= addrLen) continue;
@@ -84,43 +99,49 @@ size_t BRBech32Decode(char *hrp84, uint8_t *data42, const char *addr)
     }
     
     bufLen = (addrLen - (sep + 2 + 6))*5/8;
-    if (hrp84 == NULL || data42 == NULL || chk != 1 || ver > 16 || bufLen < 2 || bufLen > 40) return 0;
-    assert(sep < 84);
-    for (i = 0; i < sep; i++) hrp84[i] = tolower(addr[i]);
-    hrp84[sep] = '\0';
+    if (chk != 1 || ver > 16 || bufLen < 2 || bufLen > 40) return 0;
     data42[0] = (ver == 0) ? OP_0 : ver + OP_1 - 1;
     data42[1] = bufLen;
-    assert(bufLen <= 40);
     memcpy(&data42[2], buf, bufLen);
     return 2 + bufLen;
 }
 
-// data must contain a valid BIP141 witness program
-// returns the number of bytes written to addr91 (maximum of 91)
-size_t BRBech32Encode(char *addr91, const char *hrp, const uint8_t data[])
+// writes hrp and the separator to prefix, and sets chk to the checksum state after the hrp has been processed
+// returns the number of characters written, or 0 if hrp is invalid
+static size_t _BRBech32Prefix(char *prefix, uint32_t *chk, const char *hrp)
 {
-    static const char chars[] = "qpzry9x8gf2tvdw0s3jn54khce6mua7l";
-    char addr[91];
-    uint32_t x, chk = 1;
-    uint8_t ver, a, b = 0, c = 0;
     size_t i, j;
-
-    assert(addr91 != NULL);
-    assert(hrp != NULL);
-    assert(data != NULL);
     
-    for (i = 0; hrp && hrp[i]; i++) {
+    *chk = 1;
+    
+    for (i = 0; hrp[i]; i++) {
         if (i > 83 || hrp[i] < 33 || hrp[i] > 126 || isupper(hrp[i])) return 0;
-        chk = polymod(chk) ^ (hrp[i] >> 5);
-        addr[i] = hrp[i];
+        *chk = polymod(*chk) ^ (hrp[i] >> 5);
+        prefix[i] = hrp[i];
     }
     
-    chk = polymod(chk);
-    for (j = 0; j < i; j++) chk = polymod(chk) ^ (hrp[j] & 0x1f);
-    addr[i++] = '1';
+    *chk = polymod(*chk);
+    for (j = 0; j < i; j++) *chk = polymod(*chk) ^ (hrp[j] & 0x1f);
+    prefix[i++] = '1';
+    return i;
+}
+
+// encodes the witness program in data following a prefix returned by _BRBech32Prefix()
+// returns the number of bytes written to addr91, or 0 if data is not a valid witness program
+static size_t _BRBech32EncodeData(char *addr91, const char *prefix, size_t prefixLen, uint32_t chk,
+                                  const uint8_t data[])
+{
+    static const char chars[] = "qpzry9x8gf2tvdw0s3jn54khce6mua7l";
+    char addr[91];
+    uint32_t x;
+    uint8_t ver, a, b = 0, c = 0;
+    size_t i = prefixLen, j;
+    
     if (i < 1 || data == NULL || (data[0] > OP_0 && data[0] < OP_1)) return 0;
     ver = (data[0] >= OP_1) ? data[0] + 1 - OP_1 : 0;
     if (ver > 16 || data[1] < 2 || data[1] > 40) return 0;
+    if (prefixLen + 1 + (data[1]*8 + 4)/5 + 6 + 1 > sizeof(addr)) return 0; // hrp too long for data
+    memcpy(addr, prefix, prefixLen);
     chk = polymod(chk) ^ ver;
     addr[i++] = chars[ver];
     
@@ -142,3 +163,94 @@ size_t BRBech32Encode(char *addr91, const char *hrp, const uint8_t data[])
     return i;
 }
 
+// returns the number of bytes written to data42 (maximum of 42)
+size_t BRBech32Decode(char *hrp84, uint8_t *data42, const char *addr)
+{
+    size_t i, r, addrLen = (addr) ? strlen(addr) : 0, sep;
+    uint32_t chk = 1;
+
+    assert(hrp84 != NULL);
+    assert(data42 != NULL);
+    assert(addr != NULL);
+    
+    sep = _BRBech32Separator(addr, addrLen);
+    if (sep == 0) return 0;
+    for (i = 0; i < sep; i++) chk = polymod(chk) ^ (tolower(addr[i]) >> 5);
+    chk = polymod(chk);
+    for (i = 0; i < sep; i++) chk = polymod(chk) ^ (addr[i] & 0x1f);
+    if (hrp84 == NULL || data42 == NULL) return 0;
+    r = _BRBech32DecodeData(data42, addr, addrLen, sep, chk);
+    if (r == 0) return 0;
+    assert(sep < 84);
+    for (i = 0; i < sep; i++) hrp84[i] = tolower(addr[i]);
+    hrp84[sep] = '\0';
+    return r;
+}
+
+// data must contain a valid BIP141 witness program
+// returns the number of bytes written to addr91 (maximum of 91)
+size_t BRBech32Encode(char *addr91, const char *hrp, const uint8_t data[])
+{
+    char prefix[85];
+    uint32_t chk;
+    size_t prefixLen;
+
+    assert(addr91 != NULL);
+    assert(hrp != NULL);
+    assert(data != NULL);
+    
+    prefixLen = _BRBech32Prefix(prefix, &chk, hrp);
+    return (prefixLen > 0) ? _BRBech32EncodeData(addr91, prefix, prefixLen, chk, data) : 0;
+}
+
+// decodes count addresses that must all use the given lowercase hrp, the hrp checksum is computed only once
+// writes each witness program to data42s[i] and its length to dataLens[i], or 0 if addrs[i] is invalid or has a
+// different hrp, returns the number of addresses decoded
+size_t BRBech32DecodeList(uint8_t data42s[][42], size_t dataLens[], const char *hrp, const char *addrs[],
+                          size_t count)
+{
+    char prefix[85];
+    uint32_t chk = 1;
+    size_t i, sep, addrLen, prefixLen, r = 0;
+
+    assert(data42s != NULL || count == 0);
+    assert(dataLens != NULL || count == 0);
+    assert(hrp != NULL);
+    assert(addrs != NULL || count == 0);
+    
+    prefixLen = _BRBech32Prefix(prefix, &chk, hrp);
+    
+    for (i = 0; i < count; i++) {
+        addrLen = (addrs[i]) ? strlen(addrs[i]) : 0;
+        sep = (prefixLen > 0) ? _BRBech32Separator(addrs[i], addrLen) : 0;
+        dataLens[i] = 0;
+        if (sep == 0 || sep + 1 != prefixLen || strncasecmp(addrs[i], hrp, sep) != 0) continue;
+        dataLens[i] = _BRBech32DecodeData(data42s[i], addrs[i], addrLen, sep, chk);
+        if (dataLens[i] > 0) r++;
+    }
+    
+    return r;
+}
+
+// encodes count witness programs using the same hrp, the hrp checksum is computed only once
+// writes each address to addrs[i], or an empty string if datas[i] is not a valid witness program
+// returns the number of addresses encoded
+size_t BRBech32EncodeList(char addrs[][91], const char *hrp, const uint8_t *datas[], size_t count)
+{
+    char prefix[85];
+    uint32_t chk = 1;
+    size_t i, prefixLen, r = 0;
+
+    assert(addrs != NULL || count == 0);
+    assert(hrp != NULL);
+    assert(datas != NULL || count == 0);
+    
+    prefixLen = _BRBech32Prefix(prefix, &chk, hrp);
+    
+    for (i = 0; i < count; i++) {
+        if (prefixLen > 0 && _BRBech32EncodeData(addrs[i], prefix, prefixLen, chk, datas[i]) > 0) r++;
+        else addrs[i][0] = '\0';
+    }
+    
+    return r;
+}
@@ -42,6 +42,17 @@ size_t BRBech32Decode(char *hrp84, uint8_t *data42, const char *addr);
 // returns the number of bytes written to addr91 (maximum of 91)
 size_t BRBech32Encode(char *addr91, const char *hrp, const uint8_t data[]);
 
+// decodes count addresses that must all use the given lowercase hrp, the hrp checksum is computed only once
+// writes each witness program to data42s[i] and its length to dataLens[i], or 0 if addrs[i] is invalid or has a
+// different hrp, returns the number of addresses decoded
+size_t BRBech32DecodeList(uint8_t data42s[][42], size_t dataLens[], const char *hrp, const char *addrs[],
+                          size_t count);
+
+// encodes count witness programs using the same hrp, the hrp checksum is computed only once
+// writes each address to addrs[i], or an empty string if datas[i] is not a valid witness program
+// returns the number of addresses encoded
+size_t BRBech32EncodeList(char addrs[][91], const char *hrp, const uint8_t *datas[], size_t count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,353 @@
+//
+//  BRBlockCache.c
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#include "BRBlockCache.h"
+#include "BRSet.h"
+#include "BRAddress.h"
+#include "BRArray.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+typedef struct {
+    BRTransaction *tx;
+    uint32_t height; // height of the block tx was delivered with
+    uint32_t timestamp;
+} _BRCachedTx;
+
+typedef struct {
+    UInt160 hash160;
+    uint32_t height; // hash160 was matched by the bloom filter of every block downloaded after this height
+} _BRWatched;
+
+struct BRBlockCacheStruct {
+    uint32_t startHeight, endHeight; // every block from startHeight through endHeight is cached, empty if start > end
+    _BRCachedTx *txs; // in block order
+    BRSet *watched; // _BRWatched items indexed by hash160
+    pthread_mutex_t lock;
+};
+
+inline static size_t _BRWatchedHash(const void *watched)
+{
+    return (size_t)((const _BRWatched *)watched)->hash160.u32[0];
+}
+
+inline static int _BRWatchedEq(const void *watched, const void *otherWatched)
+{
+    return (watched == otherWatched ||
+            UInt160Eq(((const _BRWatched *)watched)->hash160, ((const _BRWatched *)otherWatched)->hash160));
+}
+
+static void _setApplyFree(void *info, void *item)
+{
+    free(item);
+}
+
+// releases cached transactions of blocks above height
+static void _BRBlockCacheTruncate(BRBlockCache *cache, uint32_t height)
+{
+    size_t i = array_count(cache->txs);
+    
+    while (i > 0 && cache->txs[i - 1].height > height) BRTransactionFree(cache->txs[--i].tx);
+    array_set_count(cache->txs, i);
+    if (cache->endHeight > height) cache->endHeight = height;
+}
+
+// drops the oldest blocks until no more than BLOCK_CACHE_MAX_TX transactions are cached
+static void _BRBlockCacheTrim(BRBlockCache *cache)
+{
+    size_t i = 0;
+    
+    while (array_count(cache->txs) - i > BLOCK_CACHE_MAX_TX) {
+        uint32_t height = cache->txs[i].height;
+        
+        while (i < array_count(cache->txs) && cache->txs[i].height == height) BRTransactionFree(cache->txs[i++].tx);
+        cache->startHeight = height + 1;
+    }
+    
+    if (i > 0) array_rm_range(cache->txs, 0, i);
+}
+
+// returns a newly allocated empty block cache that must be freed by calling BRBlockCacheFree()
+BRBlockCache *BRBlockCacheNew(void)
+{
+    BRBlockCache *cache = calloc(1, sizeof(*cache));
+    
+    assert(cache != NULL);
+    cache->startHeight = 1, cache->endHeight = 0;
+    array_new(cache->txs, 100);
+    cache->watched = BRSetNew(_BRWatchedHash, _BRWatchedEq, 100);
+    pthread_mutex_init(&cache->lock, NULL);
+    return cache;
+}
+
+// buf must contain a cache serialized with BRBlockCacheSerialize()
+// returns a block cache that must be freed by calling BRBlockCacheFree(), or NULL if buf is malformed
+BRBlockCache *BRBlockCacheParse(const uint8_t *buf, size_t bufLen)
+{
+    BRBlockCache *cache = (buf && 2*sizeof(uint32_t) < bufLen) ? BRBlockCacheNew() : NULL;
+    size_t off = 0, len = 0, txLen, count = 0, i;
+    _BRWatched *w;
+    _BRCachedTx c;
+    
+    assert(buf != NULL || bufLen == 0);
+    
+    if (cache) {
+        cache->startHeight = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        cache->endHeight = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        
+        for (i = 0; len > 0 && i < count && off + sizeof(UInt160) + sizeof(uint32_t) <= bufLen; i++) {
+            w = calloc(1, sizeof(*w));
+            assert(w != NULL);
+            w->hash160 = UInt160Get(&buf[off]);
+            off += sizeof(UInt160);
+            w->height = UInt32GetLE(&buf[off]);
+            off += sizeof(uint32_t);
+            w = BRSetAdd(cache->watched, w);
+            if (w) free(w);
+        }
+        
+        if (len > 0 && i == count) count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        else len = 0;
+        off += len;
+        
+        for (i = 0; len > 0 && i < count && off + 2*sizeof(uint32_t) <= bufLen; i++) {
+            c.height = UInt32GetLE(&buf[off]);
+            off += sizeof(uint32_t);
+            c.timestamp = UInt32GetLE(&buf[off]);
+            off += sizeof(uint32_t);
+            txLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+            off += len;
+            c.tx = (len > 0 && off + txLen <= bufLen) ? BRTransactionParse(&buf[off], txLen) : NULL;
+            off += txLen;
+            if (! c.tx) break;
+            c.tx->blockHeight = c.height;
+            c.tx->timestamp = c.timestamp;
+            array_add(cache->txs, c);
+        }
+        
+        if (len == 0 || i != count) {
+            BRBlockCacheFree(cache);
+            cache = NULL;
+        }
+    }
+    
+    return cache;
+}
+
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRBlockCacheSerialize(BRBlockCache *cache, uint8_t *buf, size_t bufLen)
+{
+    size_t off = 0, len, count, txLen, i;
+    _BRWatched **watched;
+    
+    assert(cache != NULL);
+    assert(buf != NULL || bufLen == 0);
+    pthread_mutex_lock(&cache->lock);
+    count = BRSetCount(cache->watched);
+    len = 2*sizeof(uint32_t) + BRVarIntSize(count) + count*(sizeof(UInt160) + sizeof(uint32_t)) +
+          BRVarIntSize(array_count(cache->txs));
+    
+    for (i = 0; i < array_count(cache->txs); i++) {
+        txLen = BRTransactionSerialize(cache->txs[i].tx, NULL, 0);
+        len += 2*sizeof(uint32_t) + BRVarIntSize(txLen) + txLen;
+    }
+    
+    if (buf && len <= bufLen) {
+        watched = malloc(count*sizeof(*watched));
+        assert(watched != NULL || count == 0);
+        count = BRSetAll(cache->watched, (void **)watched, count);
+        UInt32SetLE(&buf[off], cache->startHeight);
+        off += sizeof(uint32_t);
+        UInt32SetLE(&buf[off], cache->endHeight);
+        off += sizeof(uint32_t);
+        off += BRVarIntSet(&buf[off], (off <= bufLen ? bufLen - off : 0), count);
+        
+        for (i = 0; i < count; i++) {
+            UInt160Set(&buf[off], watched[i]->hash160);
+            off += sizeof(UInt160);
+            UInt32SetLE(&buf[off], watched[i]->height);
+            off += sizeof(uint32_t);
+        }
+        
+        if (watched) free(watched);
+        off += BRVarIntSet(&buf[off], (off <= bufLen ? bufLen - off : 0), array_count(cache->txs));
+        
+        for (i = 0; i < array_count(cache->txs); i++) {
+            UInt32SetLE(&buf[off], cache->txs[i].height);
+            off += sizeof(uint32_t);
+            UInt32SetLE(&buf[off], cache->txs[i].timestamp);
+            off += sizeof(uint32_t);
+            txLen = BRTransactionSerialize(cache->txs[i].tx, NULL, 0);
+            off += BRVarIntSet(&buf[off], (off <= bufLen ? bufLen - off : 0), txLen);
+            off += BRTransactionSerialize(cache->txs[i].tx, &buf[off], (off <= bufLen ? bufLen - off : 0));
+        }
+    }
+    
+    pthread_mutex_unlock(&cache->lock);
+    return (! buf || len <= bufLen) ? len : 0;
+}
+
+// records that hashes are matched by the bloom filter used to download the blocks after height
+// cached blocks after height are discarded if any of hashes was not matched when they were downloaded
+void BRBlockCacheAddWatched(BRBlockCache *cache, const UInt160 hashes[], size_t hashesCount, uint32_t height)
+{
+    _BRWatched *w;
+    int changed = 0;
+    
+    assert(cache != NULL);
+    assert(hashes != NULL || hashesCount == 0);
+    pthread_mutex_lock(&cache->lock);
+    
+    for (size_t i = 0; i < hashesCount; i++) {
+        w = BRSetGet(cache->watched, &hashes[i]);
+        
+        if (! w) {
+            w = calloc(1, sizeof(*w));
+            assert(w != NULL);
+            w->hash160 = hashes[i];
+            w->height = height;
+            BRSetAdd(cache->watched, w);
+            changed = 1;
+        }
+        else if (w->height > height) w->height = height, changed = 1;
+    }
+    
+    if (changed) _BRBlockCacheTruncate(cache, height);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// adds the block at height along with all transactions it was delivered with, replacing any cached block at or above
+// height, the cache restarts from height if it doesn't already hold the block before it
+void BRBlockCacheAddBlock(BRBlockCache *cache, uint32_t height, uint32_t timestamp, BRTransaction *transactions[],
+                          size_t txCount)
+{
+    assert(cache != NULL);
+    assert(transactions != NULL || txCount == 0);
+    pthread_mutex_lock(&cache->lock);
+    if (cache->startHeight <= cache->endHeight && height <= cache->endHeight) _BRBlockCacheTruncate(cache, height - 1);
+    
+    if (cache->startHeight > cache->endHeight || height != cache->endHeight + 1) { // restart after a gap
+        for (size_t i = array_count(cache->txs); i > 0; i--) BRTransactionFree(cache->txs[i - 1].tx);
+        array_clear(cache->txs);
+        cache->startHeight = height;
+    }
+    
+    cache->endHeight = height;
+    
+    for (size_t i = 0; i < txCount; i++) {
+        array_add(cache->txs, ((_BRCachedTx) { BRTransactionRetain(transactions[i]), height, timestamp }));
+    }
+    
+    _BRBlockCacheTrim(cache);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// discards cached blocks above height, such as after a chain reorganization
+void BRBlockCacheTruncate(BRBlockCache *cache, uint32_t height)
+{
+    assert(cache != NULL);
+    pthread_mutex_lock(&cache->lock);
+    _BRBlockCacheTruncate(cache, height);
+    pthread_mutex_unlock(&cache->lock);
+}
+
+// height of the most recent cached block, the cache holds every block from its start height through this one
+uint32_t BRBlockCacheEndHeight(BRBlockCache *cache)
+{
+    uint32_t height;
+    
+    assert(cache != NULL);
+    pthread_mutex_lock(&cache->lock);
+    height = cache->endHeight;
+    pthread_mutex_unlock(&cache->lock);
+    return height;
+}
+
+// returns the first height from which the cache holds every transaction matching any of hashes through the end height,
+// or UINT32_MAX if the cache is empty or any of hashes has never been watched
+uint32_t BRBlockCacheStartHeight(BRBlockCache *cache, const UInt160 hashes[], size_t hashesCount)
+{
+    uint32_t height;
+    _BRWatched *w;
+    
+    assert(cache != NULL);
+    assert(hashes != NULL || hashesCount == 0);
+    pthread_mutex_lock(&cache->lock);
+    height = (cache->startHeight <= cache->endHeight) ? cache->startHeight : UINT32_MAX;
+    
+    for (size_t i = 0; height != UINT32_MAX && i < hashesCount; i++) {
+        w = BRSetGet(cache->watched, &hashes[i]);
+        if (! w) height = UINT32_MAX;
+        else if (w->height + 1 > height) height = w->height + 1;
+    }
+    
+    pthread_mutex_unlock(&cache->lock);
+    return height;
+}
+
+// writes the transactions of cached blocks at or above startHeight to transactions, and the height and timestamp of
+// their blocks to heights and timestamps if not NULL
+// returns number of transactions written, or total available if transactions is NULL
+// each transaction written is retained and must be released by calling BRTransactionFree()
+size_t BRBlockCacheTransactions(BRBlockCache *cache, uint32_t startHeight, BRTransaction *transactions[],
+                                uint32_t heights[], uint32_t timestamps[], size_t txCount)
+{
+    size_t i, j;
+    
+    assert(cache != NULL);
+    pthread_mutex_lock(&cache->lock);
+    i = array_count(cache->txs);
+    while (i > 0 && cache->txs[i - 1].height >= startHeight) i--;
+    if (! transactions || array_count(cache->txs) - i < txCount) txCount = array_count(cache->txs) - i;
+    
+    for (j = 0; transactions && j < txCount; i++, j++) {
+        transactions[j] = BRTransactionRetain(cache->txs[i].tx);
+        if (heights) heights[j] = cache->txs[i].height;
+        if (timestamps) timestamps[j] = cache->txs[i].timestamp;
+    }
+    
+    pthread_mutex_unlock(&cache->lock);
+    return txCount;
+}
+
+// frees memory allocated for cache, and releases the cached transactions
+void BRBlockCacheFree(BRBlockCache *cache)
+{
+    assert(cache != NULL);
+    pthread_mutex_lock(&cache->lock);
+    for (size_t i = array_count(cache->txs); i > 0; i--) BRTransactionFree(cache->txs[i - 1].tx);
+    array_free(cache->txs);
+    BRSetApply(cache->watched, NULL, _setApplyFree);
+    BRSetFree(cache->watched);
+    pthread_mutex_unlock(&cache->lock);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
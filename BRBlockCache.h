@@ -0,0 +1,90 @@
+//
+//  BRBlockCache.h
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#ifndef BRBlockCache_h
+#define BRBlockCache_h
+
+#include "BRTransaction.h"
+#include "BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a cache of the transactions delivered with recent filtered blocks, along with the heights from which each address
+// hash160 has been matched by the bloom filters they were downloaded with, so a rescan for addresses that were already
+// being filtered for can be done locally instead of downloading the blocks again
+// the cache can be serialized to be kept on disk between launches
+
+#define BLOCK_CACHE_MAX_TX 10000 // oldest blocks are dropped from the cache when it holds more transactions than this
+
+typedef struct BRBlockCacheStruct BRBlockCache;
+
+// returns a newly allocated empty block cache that must be freed by calling BRBlockCacheFree()
+BRBlockCache *BRBlockCacheNew(void);
+
+// buf must contain a cache serialized with BRBlockCacheSerialize()
+// returns a block cache that must be freed by calling BRBlockCacheFree(), or NULL if buf is malformed
+BRBlockCache *BRBlockCacheParse(const uint8_t *buf, size_t bufLen);
+
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRBlockCacheSerialize(BRBlockCache *cache, uint8_t *buf, size_t bufLen);
+
+// records that hashes are matched by the bloom filter used to download the blocks after height
+// cached blocks after height are discarded if any of hashes was not matched when they were downloaded
+void BRBlockCacheAddWatched(BRBlockCache *cache, const UInt160 hashes[], size_t hashesCount, uint32_t height);
+
+// adds the block at height along with all transactions it was delivered with, replacing any cached block at or above
+// height, the cache restarts from height if it doesn't already hold the block before it
+void BRBlockCacheAddBlock(BRBlockCache *cache, uint32_t height, uint32_t timestamp, BRTransaction *transactions[],
+                          size_t txCount);
+
+// discards cached blocks above height, such as after a chain reorganization
+void BRBlockCacheTruncate(BRBlockCache *cache, uint32_t height);
+
+// height of the most recent cached block, the cache holds every block from its start height through this one
+uint32_t BRBlockCacheEndHeight(BRBlockCache *cache);
+
+// returns the first height from which the cache holds every transaction matching any of hashes through the end height,
+// or UINT32_MAX if the cache is empty or any of hashes has never been watched
+uint32_t BRBlockCacheStartHeight(BRBlockCache *cache, const UInt160 hashes[], size_t hashesCount);
+
+// writes the transactions of cached blocks at or above startHeight to transactions, and the height and timestamp of
+// their blocks to heights and timestamps if not NULL
+// returns number of transactions written, or total available if transactions is NULL
+// each transaction written is retained and must be released by calling BRTransactionFree()
+size_t BRBlockCacheTransactions(BRBlockCache *cache, uint32_t startHeight, BRTransaction *transactions[],
+                                uint32_t heights[], uint32_t timestamps[], size_t txCount);
+
+// frees memory allocated for cache, and releases the cached transactions
+void BRBlockCacheFree(BRBlockCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRBlockCache_h
@@ -45,6 +45,51 @@ typedef struct {
     size_t checkpointsCount;
 } BRChainParams;
 
+// returns the last checkpoint at or below height, or NULL if height is below the first checkpoint
+// checkpoints must be sorted by height, so each lookup is a binary search of the params->checkpoints array
+inline static const BRCheckPoint *BRChainParamsCheckpointBeforeHeight(const BRChainParams *params, uint32_t height)
+{
+    size_t lo = 0, hi, mid;
+    
+    assert(params != NULL);
+    hi = params->checkpointsCount;
+    
+    while (lo < hi) { // find the first checkpoint above height
+        mid = lo + (hi - lo)/2;
+        if (params->checkpoints[mid].height <= height) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    return (lo > 0) ? &params->checkpoints[lo - 1] : NULL;
+}
+
+// returns the checkpoint at exactly height, or NULL if there isn't one
+inline static const BRCheckPoint *BRChainParamsCheckpointAtHeight(const BRChainParams *params, uint32_t height)
+{
+    const BRCheckPoint *checkpoint = BRChainParamsCheckpointBeforeHeight(params, height);
+    
+    return (checkpoint && checkpoint->height == height) ? checkpoint : NULL;
+}
+
+// returns the last checkpoint timestamped at or before timestamp, or NULL if timestamp is before the first checkpoint
+// checkpoint timestamps must not decrease with height, the checkpoint height is then a lower bound on the height of
+// the chain at timestamp, and a safe starting point to sync a wallet created at timestamp
+inline static const BRCheckPoint *BRChainParamsCheckpointBeforeTime(const BRChainParams *params, uint32_t timestamp)
+{
+    size_t lo = 0, hi, mid;
+    
+    assert(params != NULL);
+    hi = params->checkpointsCount;
+    
+    while (lo < hi) { // find the first checkpoint after timestamp
+        mid = lo + (hi - lo)/2;
+        if (params->checkpoints[mid].timestamp <= timestamp) lo = mid + 1;
+        else hi = mid;
+    }
+    
+    return (lo > 0) ? &params->checkpoints[lo - 1] : NULL;
+}
+
 static const char *BRMainNetDNSSeeds[] = {
         "seed.digibyteservers.io",
         "seed2.hashdragon.com",
@@ -67,6 +112,7 @@ static const char *BRTestNetDNSSeeds[] = {
 
 // blockchain checkpoints - these are also used as starting points for partial chain downloads, so they must be at
 // difficulty transition boundaries in order to verify the block difficulty at the immediately following transition
+// checkpoints must be listed in order of height, see BRChainParamsCheckpointBeforeHeight()
 static const BRCheckPoint BRMainNetCheckpoints[] = {
         {       0, uint256("7497ea1b465eb39f1c8f507bc877078fe016d6fcb6dfad3a64c98dcc6e1e8496"), 1389388394, 0x1e0ffff0 },
         {    5000, uint256("95753d284404118788a799ac754a3fdb5d817f5bd73a78697dfe40985c085596"), 1389701913, 0x1c32a753 },
@@ -0,0 +1,236 @@
+//
+//  BRHeaderSnapshot.c
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#include "BRHeaderSnapshot.h"
+#include "BRCrypto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define SNAPSHOT_MAGIC       "BRHDRS\x00\x01"
+#define SNAPSHOT_MAGIC_LEN   8
+#define SNAPSHOT_SIG_LEN     65 // compact signature
+#define SNAPSHOT_HEADER_LEN  80
+#define SNAPSHOT_LINKED_LEN  (SNAPSHOT_HEADER_LEN - sizeof(UInt256)) // header without prevBlock
+#define SNAPSHOT_WINDOWS_LEN (sizeof(UInt256) + sizeof(uint32_t)*(BLOCK_ALGO_COUNT*2 + 1 + BLOCK_TIMES_COUNT))
+
+// magic, height of the first block and block count, the first block's chainwork and windows, the full first header,
+// the rest of the headers without prevBlock, the last block's chainwork and the signature
+#define SNAPSHOT_LEN(count)\
+    (SNAPSHOT_MAGIC_LEN + sizeof(uint32_t)*2 + SNAPSHOT_WINDOWS_LEN + SNAPSHOT_HEADER_LEN +\
+     ((count) - 1)*SNAPSHOT_LINKED_LEN + sizeof(UInt256) + SNAPSHOT_SIG_LEN)
+
+// writes chainwork as 32bit little endian words least significant first
+static void _BRHeaderSnapshotSetWork(uint8_t *buf, UInt256 work)
+{
+    for (size_t i = 0; i < 8; i++) UInt32SetLE(&buf[i*sizeof(uint32_t)], work.u32[i]);
+}
+
+static UInt256 _BRHeaderSnapshotGetWork(const uint8_t *buf)
+{
+    UInt256 work;
+    
+    for (size_t i = 0; i < 8; i++) work.u32[i] = UInt32GetLE(&buf[i*sizeof(uint32_t)]);
+    return work;
+}
+
+// writes the header fields of block that follow prevBlock, returns number of bytes written
+static size_t _BRHeaderSnapshotSetLinked(uint8_t *buf, const BRMerkleBlock *block)
+{
+    size_t off = 0;
+    
+    UInt256Set(&buf[off], block->merkleRoot);
+    off += sizeof(UInt256);
+    UInt32SetLE(&buf[off], block->timestamp);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&buf[off], block->target);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&buf[off], block->nonce);
+    off += sizeof(uint32_t);
+    return off;
+}
+
+// serializes blocks, which must be consecutive blocks in order of height each linked to the one before it, signed with
+// key using a compact signature, see BRKeyCompactSign()
+// returns number of bytes written to buf, total bufLen needed if buf is NULL, or 0 if blocks aren't linked or bufLen is
+// too small
+size_t BRHeaderSnapshotSerialize(BRMerkleBlock *blocks[], size_t blocksCount, BRKey *key, uint8_t *buf, size_t bufLen)
+{
+    size_t i, off = 0;
+    UInt256 md;
+    
+    assert(blocks != NULL || blocksCount == 0);
+    assert(key != NULL);
+    if (blocksCount == 0) return 0;
+    
+    for (i = 1; i < blocksCount; i++) {
+        if (! UInt256Eq(blocks[i]->prevBlock, blocks[i - 1]->blockHash) ||
+            blocks[i]->height != blocks[i - 1]->height + 1) return 0;
+    }
+    
+    if (! buf) return SNAPSHOT_LEN(blocksCount);
+    if (SNAPSHOT_LEN(blocksCount) > bufLen) return 0;
+    memcpy(&buf[off], SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN);
+    off += SNAPSHOT_MAGIC_LEN;
+    UInt32SetLE(&buf[off], blocks[0]->height);
+    off += sizeof(uint32_t);
+    UInt32SetLE(&buf[off], (uint32_t)blocksCount);
+    off += sizeof(uint32_t);
+    _BRHeaderSnapshotSetWork(&buf[off], blocks[0]->chainWork);
+    off += sizeof(UInt256);
+    
+    for (i = 0; i < BLOCK_ALGO_COUNT; i++) {
+        UInt32SetLE(&buf[off], blocks[0]->algoHeights[i]);
+        UInt32SetLE(&buf[off + BLOCK_ALGO_COUNT*sizeof(uint32_t)], blocks[0]->algoTargets[i]);
+        off += sizeof(uint32_t);
+    }
+    
+    off += BLOCK_ALGO_COUNT*sizeof(uint32_t);
+    UInt32SetLE(&buf[off], blocks[0]->timesCount);
+    off += sizeof(uint32_t);
+    
+    for (i = 0; i < BLOCK_TIMES_COUNT; i++) {
+        UInt32SetLE(&buf[off], blocks[0]->times[i]);
+        off += sizeof(uint32_t);
+    }
+    
+    UInt32SetLE(&buf[off], blocks[0]->version);
+    off += sizeof(uint32_t);
+    UInt256Set(&buf[off], blocks[0]->prevBlock);
+    off += sizeof(UInt256);
+    off += _BRHeaderSnapshotSetLinked(&buf[off], blocks[0]);
+    
+    for (i = 1; i < blocksCount; i++) {
+        UInt32SetLE(&buf[off], blocks[i]->version);
+        off += sizeof(uint32_t);
+        off += _BRHeaderSnapshotSetLinked(&buf[off], blocks[i]);
+    }
+    
+    _BRHeaderSnapshotSetWork(&buf[off], blocks[blocksCount - 1]->chainWork);
+    off += sizeof(UInt256);
+    BRSHA256_2(&md, buf, off);
+    if (BRKeyCompactSign(key, &buf[off], SNAPSHOT_SIG_LEN, md) != SNAPSHOT_SIG_LEN) return 0;
+    return off + SNAPSHOT_SIG_LEN;
+}
+
+// verifies that buf contains a snapshot signed by the key with the given pubKey, that any header at a checkpoint height
+// of params matches the checkpoint, and that the recomputed chainwork of the last header matches the snapshot, then
+// writes newly allocated blocks along with their heights, chainwork and difficulty windows to blocks, suitable for
+// passing to BRPeerManagerNewEx()
+// proof-of-work isn't checked, since headers are only hashed to link them, so buf must come from a trusted signer
+// returns number of blocks written, or total blocksCount needed if blocks is NULL, or 0 if the snapshot doesn't verify
+// or blocksCount is too small
+size_t BRHeaderSnapshotParse(const uint8_t *buf, size_t bufLen, const BRChainParams *params, const uint8_t *pubKey,
+                             size_t pkLen, BRMerkleBlock *blocks[], size_t blocksCount)
+{
+    const BRCheckPoint *checkpoint;
+    BRMerkleBlock *block, *prev = NULL;
+    uint8_t header[SNAPSHOT_HEADER_LEN], pk[65];
+    size_t i, count, off = SNAPSHOT_MAGIC_LEN;
+    uint32_t height;
+    UInt256 md, hash;
+    BRKey key;
+    int r = 1;
+    
+    assert(buf != NULL || bufLen == 0);
+    assert(params != NULL);
+    assert(pubKey != NULL);
+    if (bufLen < SNAPSHOT_LEN(1) || memcmp(buf, SNAPSHOT_MAGIC, SNAPSHOT_MAGIC_LEN) != 0) return 0;
+    height = UInt32GetLE(&buf[off]);
+    off += sizeof(uint32_t);
+    count = UInt32GetLE(&buf[off]);
+    off += sizeof(uint32_t);
+    if (count == 0 || count > (bufLen - SNAPSHOT_LEN(1))/SNAPSHOT_LINKED_LEN + 1 || bufLen != SNAPSHOT_LEN(count) ||
+        height > BLOCK_UNKNOWN_HEIGHT - count) return 0;
+    BRSHA256_2(&md, buf, bufLen - SNAPSHOT_SIG_LEN);
+    if (! BRKeyRecoverPubKey(&key, md, &buf[bufLen - SNAPSHOT_SIG_LEN], SNAPSHOT_SIG_LEN)) return 0;
+    if (BRKeyPubKey(&key, pk, sizeof(pk)) != pkLen || memcmp(pk, pubKey, pkLen) != 0) return 0;
+    if (! blocks) return count;
+    if (blocksCount < count) return 0;
+    
+    for (i = 0; r && i < count; i++) {
+        block = blocks[i] = BRMerkleBlockNew();
+        block->height = height + (uint32_t)i;
+        block->version = UInt32GetLE(&buf[(i == 0) ? off + SNAPSHOT_WINDOWS_LEN : off]);
+        
+        if (i == 0) {
+            block->chainWork = _BRHeaderSnapshotGetWork(&buf[off]);
+            off += sizeof(UInt256);
+            
+            for (size_t j = 0; j < BLOCK_ALGO_COUNT; j++) {
+                block->algoHeights[j] = UInt32GetLE(&buf[off]);
+                block->algoTargets[j] = UInt32GetLE(&buf[off + BLOCK_ALGO_COUNT*sizeof(uint32_t)]);
+                off += sizeof(uint32_t);
+            }
+            
+            off += BLOCK_ALGO_COUNT*sizeof(uint32_t);
+            block->timesCount = UInt32GetLE(&buf[off]);
+            if (block->timesCount > BLOCK_TIMES_COUNT) block->timesCount = BLOCK_TIMES_COUNT;
+            off += sizeof(uint32_t);
+            
+            for (size_t j = 0; j < BLOCK_TIMES_COUNT; j++) {
+                block->times[j] = UInt32GetLE(&buf[off]);
+                off += sizeof(uint32_t);
+            }
+            
+            off += sizeof(uint32_t);
+            block->prevBlock = UInt256Get(&buf[off]);
+            off += sizeof(UInt256);
+        }
+        else {
+            off += sizeof(uint32_t);
+            block->prevBlock = prev->blockHash;
+        }
+        
+        block->merkleRoot = UInt256Get(&buf[off]);
+        off += sizeof(UInt256);
+        block->timestamp = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        block->target = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        block->nonce = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        
+        // the block hash is the hash of the full header, rebuilt with prevBlock in place
+        UInt32SetLE(header, block->version);
+        UInt256Set(&header[sizeof(uint32_t)], block->prevBlock);
+        _BRHeaderSnapshotSetLinked(&header[sizeof(uint32_t) + sizeof(UInt256)], block);
+        BRSHA256_2(&block->blockHash, header, sizeof(header));
+        if (prev) BRMerkleBlockSetAncestry(block, prev);
+        checkpoint = BRChainParamsCheckpointAtHeight(params, block->height);
+        if (checkpoint) hash = UInt256Reverse(checkpoint->hash);
+        if (checkpoint && ! UInt256Eq(block->blockHash, hash)) r = 0; // the snapshot is from a different chain
+        prev = block;
+    }
+    
+    if (r && ! UInt256Eq(prev->chainWork, _BRHeaderSnapshotGetWork(&buf[off]))) r = 0;
+    
+    if (! r) {
+        while (i > 0) BRMerkleBlockFree(blocks[--i]);
+        count = 0;
+    }
+    
+    return count;
+}
@@ -0,0 +1,65 @@
+//
+//  BRHeaderSnapshot.h
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#ifndef BRHeaderSnapshot_h
+#define BRHeaderSnapshot_h
+
+#include "BRMerkleBlock.h"
+#include "BRChainParams.h"
+#include "BRKey.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a signed snapshot of a range of the header chain, so a new install can start syncing from the end of the range
+// instead of downloading and verifying every header after the last checkpoint
+// the first header is stored in full along with its chainwork and per-algo difficulty windows, each following header
+// is stored without its prevBlock, which is the hash of the header before it, and the windows and chainwork of each
+// following block are recomputed from the one before it when the snapshot is parsed
+
+// serializes blocks, which must be consecutive blocks in order of height each linked to the one before it, signed with
+// key using a compact signature, see BRKeyCompactSign()
+// returns number of bytes written to buf, total bufLen needed if buf is NULL, or 0 if blocks aren't linked or bufLen is
+// too small
+size_t BRHeaderSnapshotSerialize(BRMerkleBlock *blocks[], size_t blocksCount, BRKey *key, uint8_t *buf, size_t bufLen);
+
+// verifies that buf contains a snapshot signed by the key with the given pubKey, that any header at a checkpoint height
+// of params matches the checkpoint, and that the recomputed chainwork of the last header matches the snapshot, then
+// writes newly allocated blocks along with their heights, chainwork and difficulty windows to blocks, suitable for
+// passing to BRPeerManagerNewEx()
+// proof-of-work isn't checked, since headers are only hashed to link them, so buf must come from a trusted signer
+// returns number of blocks written, or total blocksCount needed if blocks is NULL, or 0 if the snapshot doesn't verify
+// or blocksCount is too small
+size_t BRHeaderSnapshotParse(const uint8_t *buf, size_t bufLen, const BRChainParams *params, const uint8_t *pubKey,
+                             size_t pkLen, BRMerkleBlock *blocks[], size_t blocksCount);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRHeaderSnapshot_h
@@ -102,6 +102,17 @@ inline static int UInt512IsZero(UInt512 u)
     return ((u.u64[0] | u.u64[1] | u.u64[2] | u.u64[3] | u.u64[4] | u.u64[5] | u.u64[6] | u.u64[7]) == 0);
 }
 
+// compares a and b as 256bit unsigned integers stored as 32bit words, least significant first, such as chainwork
+// returns a negative value, zero, or a positive value if a is less than, equal to, or greater than b
+inline static int UInt256Compare(UInt256 a, UInt256 b)
+{
+    for (int i = 7; i >= 0; i--) {
+        if (a.u32[i] != b.u32[i]) return (a.u32[i] < b.u32[i]) ? -1 : 1;
+    }
+    
+    return 0;
+}
+
 inline static UInt256 UInt256Reverse(UInt256 u)
 {
     return ((UInt256) { .u8 = { u.u8[31], u.u8[30], u.u8[29], u.u8[28], u.u8[27], u.u8[26], u.u8[25], u.u8[24],
@@ -25,6 +25,7 @@
 #include "BRMerkleBlock.h"
 #include "BRCrypto.h"
 #include "BRAddress.h"
+#include "BRSet.h"
 #include <stdlib.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -32,9 +33,167 @@
 #include <assert.h>
 
 #define MAX_PROOF_OF_WORK 0x1e0fffff    // highest value for difficulty target (higher values are less difficult)
-#define TARGET_TIMESPAN (0.10*24*60*60) // the targeted timespan between difficulty target adjustments
 #define BLOCK_VERSION_ALGO (7 << 9)
 
+#define MULTISHIELD_HEIGHT        400000 // first block using the MultiShield difficulty adjustment
+#define MULTISHIELD_ALGOS         5      // number of algos mining at the same time
+#define MULTISHIELD_TIMESPAN      (BLOCK_AVERAGING_WINDOW/MULTISHIELD_ALGOS*75) // 75s target spacing per algo
+#define MULTISHIELD_MAX_ADJUST_UP 8      // percent
+#define MULTISHIELD_MAX_ADJUST_DN 16     // percent
+#define MULTISHIELD_LOCAL_ADJUST  4      // percent per block the algo is ahead or behind its share of the chain
+
+#define GEOMETRIC_WORK_HEIGHT     1430000 // first block whose work is computed from the geometric mean algo target
+#define GEOMETRIC_WORK_ALGO_SPAN  40320   // algos without a block in this many blocks (about a week) are inactive
+
+// target is in "compact" format, where the most significant byte is the size of resulting value in bytes, the next
+// bit is the sign, and the remaining 23bits is the value after having been right shifted by (size - 3)*8 bits
+// n is a 256bit number stored as 32bit words, least significant first
+static void _BRTargetSetCompact(uint32_t n[8], uint32_t compact)
+{
+    uint32_t size = compact >> 24, word = compact & 0x007fffff, shift;
+    
+    memset(n, 0, 8*sizeof(*n));
+    
+    if (size <= 3) n[0] = word >> (3 - size)*8;
+    else if ((shift = (size - 3)*8) < 256) {
+        n[shift/32] = word << (shift % 32);
+        if (shift % 32 && shift/32 + 1 < 8) n[shift/32 + 1] = word >> (32 - shift % 32);
+    }
+}
+
+static uint32_t _BRTargetGetCompact(const uint32_t n[8])
+{
+    uint32_t bits = 256, size, compact, shift;
+    
+    while (bits > 0 && ! (n[(bits - 1)/32] & (1u << ((bits - 1) % 32)))) bits--;
+    size = (bits + 7)/8;
+    
+    if (size <= 3) compact = n[0] << (3 - size)*8;
+    else {
+        shift = (size - 3)*8;
+        compact = n[shift/32] >> (shift % 32);
+        if (shift % 32 && shift/32 + 1 < 8) compact |= n[shift/32 + 1] << (32 - shift % 32);
+        compact &= 0x00ffffff;
+    }
+    
+    if (compact & 0x00800000) compact >>= 8, size++;
+    return compact | size << 24;
+}
+
+static void _BRTargetMul(uint32_t n[8], uint32_t m)
+{
+    uint64_t carry = 0;
+    
+    for (int i = 0; i < 8; i++) {
+        carry += (uint64_t)n[i]*m;
+        n[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+static void _BRTargetDiv(uint32_t n[8], uint32_t d)
+{
+    uint64_t rem = 0;
+    
+    for (int i = 7; i >= 0; i--) {
+        rem = rem << 32 | n[i];
+        n[i] = (uint32_t)(rem/d);
+        rem %= d;
+    }
+}
+
+static int _BRTargetCompare(const uint32_t a[8], const uint32_t b[8])
+{
+    for (int i = 7; i >= 0; i--) {
+        if (a[i] != b[i]) return (a[i] < b[i]) ? -1 : 1;
+    }
+    
+    return 0;
+}
+
+static void _BRTargetAdd(uint32_t n[8], const uint32_t a[8])
+{
+    uint64_t carry = 0;
+    
+    for (int i = 0; i < 8; i++) {
+        carry += (uint64_t)n[i] + a[i];
+        n[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+static uint64_t _BRSqrt64(uint64_t x)
+{
+    uint64_t r = 0, b = (uint64_t)1 << 62;
+    
+    while (b > x) b >>= 2;
+    
+    for (; b > 0; b >>= 2) {
+        if (x >= r + b) x -= r + b, r = (r >> 1) + b;
+        else r >>= 1;
+    }
+    
+    return r;
+}
+
+// base 2 logarithm of a compact target in fixed point with 30 fractional bits, using only integer math so block work
+// is the same on every platform
+static int64_t _BRTargetLog2(uint32_t compact)
+{
+    uint32_t size = compact >> 24, word = compact & 0x007fffff, msb = 0;
+    int64_t r;
+    uint64_t x;
+    
+    if (word == 0) return 0;
+    while (word >> (msb + 1)) msb++;
+    r = ((int64_t)msb + 8*((int64_t)size - 3))*((int64_t)1 << 30);
+    x = (uint64_t)word << (30 - msb); // 1 <= x < 2
+    
+    for (int i = 29; i >= 0; i--) { // each squaring of x yields the next fractional bit
+        x = (x*x) >> 30;
+        if (x >= ((uint64_t)2 << 30)) x >>= 1, r += (int64_t)1 << i;
+    }
+    
+    return r;
+}
+
+// sets n to 2^256/target, for a target given by its base 2 logarithm in fixed point with 30 fractional bits
+static void _BRWorkSetLog2Target(uint32_t n[8], int64_t log2Target)
+{
+    int64_t e = ((int64_t)256 << 30) - log2Target;
+    uint64_t m = (uint64_t)1 << 30, c = (uint64_t)1 << 31;
+    int shift;
+    
+    memset(n, 0, 8*sizeof(*n));
+    if (e < 0 || e >= ((int64_t)256 << 30)) return;
+    
+    for (int i = 29; i >= 0; i--) { // m = 2^fraction, c = 2^(2^(i - 30)) is the factor for fractional bit i
+        c = _BRSqrt64(c << 30);
+        if (e & ((int64_t)1 << i)) m = (m*c) >> 30;
+    }
+    
+    shift = (int)(e >> 30) - 30;
+    if (shift < 0) m >>= -shift, shift = 0;
+    n[0] = (uint32_t)m, n[1] = (uint32_t)(m >> 32);
+    for (; shift >= 31; shift -= 31) _BRTargetMul(n, 1u << 31);
+    _BRTargetMul(n, 1u << shift);
+}
+
+// median of BLOCK_MEDIAN_TIME_SPAN timestamps
+static uint32_t _BRMedianTime(const uint32_t times[])
+{
+    uint32_t t[BLOCK_MEDIAN_TIME_SPAN], x;
+    
+    for (int i = 0; i < BLOCK_MEDIAN_TIME_SPAN; i++) { // insertion sort
+        int j = i;
+        
+        for (x = times[i]; j > 0 && t[j - 1] > x; j--) t[j] = t[j - 1];
+        t[j] = x;
+    }
+    
+    return t[BLOCK_MEDIAN_TIME_SPAN/2];
+}
+
 inline static int _ceil_log2(int x)
 {
     int r = (x & (x - 1)) ? 1 : 0;
@@ -93,6 +252,8 @@ BRMerkleBlock *BRMerkleBlockCopy(const BRMerkleBlock *block)
     *cpy = *block;
     cpy->hashes = NULL;
     cpy->flags = NULL;
+    cpy->raw = NULL;
+    cpy->rawLen = 0;
     BRMerkleBlockSetTxHashes(cpy, block->hashes, block->hashesCount, block->flags, block->flagsLen);
     return cpy;
 }
@@ -134,6 +295,16 @@ BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
             len = block->flagsLen;
             block->flags = (off + len <= bufLen) ? malloc(len) : NULL;
             if (block->flags) memcpy(block->flags, &buf[off], len);
+            off += len;
+        }
+        
+        // keep the wire bytes when they're complete and match what BRMerkleBlockSerialize() would write, so saving the
+        // block doesn't need to re-serialize it, the peer manager releases them for blocks it won't save
+        if (off <= bufLen && (block->totalTx > 0 || off == 80)) {
+            block->raw = malloc(off);
+            assert(block->raw != NULL);
+            memcpy(block->raw, buf, off);
+            block->rawLen = off;
         }
         
         BRSHA256_2(&block->blockHash, buf, 80);
@@ -165,12 +336,18 @@ BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen)
 }
 
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL (block->height is not serialized)
+// if block was parsed and hasn't been modified since, the bytes it was parsed from are copied without re-serializing
 size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t bufLen)
 {
     size_t off = 0, len = 80;
     
     assert(block != NULL);
     
+    if (block->raw) {
+        if (buf && block->rawLen <= bufLen) memcpy(buf, block->raw, block->rawLen);
+        return (! buf || block->rawLen <= bufLen) ? block->rawLen : 0;
+    }
+    
     if (block->totalTx > 0) {
         len += sizeof(uint32_t) + BRVarIntSize(block->hashesCount) + block->hashesCount*sizeof(UInt256) +
                BRVarIntSize(block->flagsLen) + block->flagsLen;
@@ -205,6 +382,18 @@ size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t b
     return (! buf || len <= bufLen) ? len : 0;
 }
 
+// releases the serialized bytes kept from parsing, must be called after modifying fields of block directly
+void BRMerkleBlockClearRaw(BRMerkleBlock *block)
+{
+    assert(block != NULL);
+    
+    if (block && block->raw) {
+        free(block->raw);
+        block->raw = NULL;
+        block->rawLen = 0;
+    }
+}
+
 static size_t _BRMerkleBlockTxHashesR(const BRMerkleBlock *block, UInt256 *txHashes, size_t hashesCount, size_t *idx,
                                       size_t *hashIdx, size_t *flagIdx, int depth)
 {
@@ -250,6 +439,7 @@ void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size
     assert(hashes != NULL || hashesCount == 0);
     assert(flags != NULL || flagsLen == 0);
     
+    BRMerkleBlockClearRaw(block);
     if (block->hashes) free(block->hashes);
     block->hashes = (hashesCount > 0) ? malloc(hashesCount*sizeof(UInt256)) : NULL;
     if (block->hashes) memcpy(block->hashes, hashes, hashesCount*sizeof(UInt256));
@@ -352,14 +542,93 @@ int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash)
     return r;
 }
 
+// fills in the per-algo and timestamp windows of block from those of previous, so each connected block carries what
+// MultiShield difficulty verification needs without walking back through its ancestors
+// previous may be NULL if the ancestors of block are not known
+void BRMerkleBlockSetAncestry(BRMerkleBlock *block, const BRMerkleBlock *previous)
+{
+    uint32_t algo;
+    
+    assert(block != NULL);
+    algo = (block->version & BLOCK_VERSION_ALGO) >> 9;
+    
+    if (previous) {
+        memcpy(block->algoHeights, previous->algoHeights, sizeof(block->algoHeights));
+        memcpy(block->algoTargets, previous->algoTargets, sizeof(block->algoTargets));
+        memcpy(&block->times[1], previous->times, (BLOCK_TIMES_COUNT - 1)*sizeof(*block->times));
+        block->timesCount = (previous->timesCount < BLOCK_TIMES_COUNT) ? previous->timesCount + 1 : BLOCK_TIMES_COUNT;
+    }
+    else {
+        memset(block->algoHeights, 0, sizeof(block->algoHeights));
+        memset(block->algoTargets, 0, sizeof(block->algoTargets));
+        block->timesCount = 1;
+    }
+    
+    block->algoHeights[algo] = block->height;
+    block->algoTargets[algo] = block->target;
+    block->times[0] = block->timestamp;
+    block->chainWork = BRMerkleBlockWork(block);
+    if (previous) _BRTargetAdd(block->chainWork.u32, previous->chainWork.u32);
+}
+
+// returns the expected number of hashes needed to find a block meeting the block's difficulty target, 2^256/target,
+// as 32bit words least significant first
+// from GEOMETRIC_WORK_HEIGHT on, target is the geometric mean of the latest target of each active algo, taken from the
+// windows set by BRMerkleBlockSetAncestry(), an approximation of DigiByte's GetGeometricMeanPrevWork(), which
+// differs in that:
+// - it decays the work of each other algo by how far back its latest block is, and drops it past 32 blocks, while here
+//   an algo's latest target counts in full until the algo has had no block in GEOMETRIC_WORK_ALGO_SPAN blocks
+// - it takes the NUM_ALGOS root of the product even when fewer algos are active, then shifts the result left 8 bits,
+//   while here the mean is over the active algos only, unscaled, and computed in fixed point log2
+// the result is only comparable with other chainwork computed here, not with the chainwork reported by nodes
+UInt256 BRMerkleBlockWork(const BRMerkleBlock *block)
+{
+    UInt256 work = UINT256_ZERO;
+    uint32_t size, word, shift, count = 0;
+    int64_t log2Target = 0;
+    
+    assert(block != NULL);
+    
+    if (block->height >= GEOMETRIC_WORK_HEIGHT && block->height != BLOCK_UNKNOWN_HEIGHT) {
+        for (uint32_t algo = 0; algo < BLOCK_ALGO_COUNT; algo++) {
+            if (block->algoTargets[algo] == 0 ||
+                block->algoHeights[algo] + GEOMETRIC_WORK_ALGO_SPAN <= block->height) continue;
+            log2Target += _BRTargetLog2(block->algoTargets[algo]);
+            count++;
+        }
+        
+        if (count > 0) {
+            _BRWorkSetLog2Target(work.u32, log2Target/count);
+            return work;
+        }
+    }
+    
+    size = block->target >> 24, word = block->target & 0x007fffff;
+    if (size <= 3) word >>= (3 - size)*8, shift = 0;
+    else shift = (size - 3)*8;
+    
+    if (word != 0 && shift < 256) {
+        // (2^256 - 1)/target, computed as ((2^256 - 1) >> shift)/word, since target is word << shift
+        for (int i = 0; i < 8; i++) {
+            if (i < 8 - (int)shift/32) work.u32[i] = UINT32_MAX;
+        }
+        
+        if (shift % 32) work.u32[7 - shift/32] >>= shift % 32;
+        _BRTargetDiv(work.u32, word);
+    }
+    
+    return work;
+}
+
 // verifies the block difficulty target is correct for the block's position in the chain
-// transitionTime is the timestamp of the block at the previous difficulty transition
-// transitionTime may be 0 if block->height is not a multiple of BLOCK_DIFFICULTY_INTERVAL
-//
-// The difficulty target algorithm is called Multishield.
+// the MultiShield target is computed from the windows set on previous by BRMerkleBlockSetAncestry(), and blocks are
+// accepted unchecked until previous has a full window, transitionTime is not used
 int BRMerkleBlockVerifyDifficulty(const BRMerkleBlock *block, const BRMerkleBlock *previous, uint32_t transitionTime)
 {
-    int r = 1;
+    uint32_t algo, target[8], limit[8];
+    int64_t timespan;
+    int r = 1, adjustments;
+    
     assert(block != NULL);
     
     if (!previous || !UInt256Eq(block->prevBlock, previous->blockHash) || block->height != previous->height + 1)
@@ -370,34 +639,262 @@ int BRMerkleBlockVerifyDifficulty(const BRMerkleBlock *block, const BRMerkleBloc
     return r; // don't worry about difficulty on testnet for now
 #endif
 
-    // TODO: fix difficulty target check for Digibyte (Multishield)
-    /*if (r && (block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) {
-        // target is in "compact" format, where the most significant byte is the size of resulting value in bytes, next
-        // bit is the sign, and the remaining 23bits is the value after having been right shifted by (size - 3)*8 bits
-        static const uint32_t maxsize = MAX_PROOF_OF_WORK >> 24, maxtarget = MAX_PROOF_OF_WORK & 0x00ffffff;
-        int timespan = (int)((int64_t)previous->timestamp - (int64_t)transitionTime), size = previous->target >> 24;
-        uint64_t target = previous->target & 0x00ffffff;
+    algo = (block->version & BLOCK_VERSION_ALGO) >> 9;
     
-        // limit difficulty transition to -75% or +400%
-        if (timespan < TARGET_TIMESPAN/4) timespan = TARGET_TIMESPAN/4;
-        if (timespan > TARGET_TIMESPAN*4) timespan = TARGET_TIMESPAN*4;
-    
-        // TARGET_TIMESPAN happens to be a multiple of 256, and since timespan is at least TARGET_TIMESPAN/4, we don't
-        // lose precision when target is multiplied by timespan and then divided by TARGET_TIMESPAN/256
-        target *= timespan;
-        target /= TARGET_TIMESPAN >> 8;
-        size--; // decrement size since we only divided by TARGET_TIMESPAN/256
+    // the previous block of the same algo and the median times at both ends of the averaging window are kept on
+    // previous, so this is constant time, blocks connected before a full window is known can't be checked
+    if (r && block->height >= MULTISHIELD_HEIGHT && previous->timesCount == BLOCK_TIMES_COUNT &&
+        previous->algoHeights[algo] != 0) {
+        timespan = (int64_t)_BRMedianTime(previous->times) -
+                   (int64_t)_BRMedianTime(&previous->times[BLOCK_AVERAGING_WINDOW]);
+        timespan = MULTISHIELD_TIMESPAN + (timespan - MULTISHIELD_TIMESPAN)/4; // dampen the global adjustment
+        
+        if (timespan < MULTISHIELD_TIMESPAN*(100 - MULTISHIELD_MAX_ADJUST_UP)/100) {
+            timespan = MULTISHIELD_TIMESPAN*(100 - MULTISHIELD_MAX_ADJUST_UP)/100;
+        }
+        
+        if (timespan > MULTISHIELD_TIMESPAN*(100 + MULTISHIELD_MAX_ADJUST_DN)/100) {
+            timespan = MULTISHIELD_TIMESPAN*(100 + MULTISHIELD_MAX_ADJUST_DN)/100;
+        }
+        
+        _BRTargetSetCompact(target, previous->algoTargets[algo]);
+        _BRTargetMul(target, (uint32_t)timespan);
+        _BRTargetDiv(target, MULTISHIELD_TIMESPAN);
+        
+        // per-algo adjustment, the target gets harder for each block this algo is ahead of its share of recent blocks,
+        // and easier for each block it's behind
+        adjustments = (int)previous->algoHeights[algo] + MULTISHIELD_ALGOS - 1 - (int)previous->height;
+        
+        for (; adjustments > 0; adjustments--) {
+            _BRTargetMul(target, 100);
+            _BRTargetDiv(target, 100 + MULTISHIELD_LOCAL_ADJUST);
+        }
+        
+        for (; adjustments < 0; adjustments++) {
+            _BRTargetMul(target, 100 + MULTISHIELD_LOCAL_ADJUST);
+            _BRTargetDiv(target, 100);
+        }
+        
+        _BRTargetSetCompact(limit, MAX_PROOF_OF_WORK);
+        if (_BRTargetCompare(target, limit) > 0) memcpy(target, limit, sizeof(target));
+        if (block->target != _BRTargetGetCompact(target)) r = 0;
+    }
     
-        while (size < 1 || target > 0x007fffff) target >>= 8, size++; // normalize target for "compact" format
+    return r;
+}
+
+// recursively walks the merkle tree like _BRMerkleBlockRootR, collecting the sibling hashes on the path to txHash
+static UInt256 _BRMerkleBlockProofR(const BRMerkleBlock *block, BRMerkleProof *proof, size_t *hashIdx, size_t *flagIdx,
+                                    int depth, uint32_t pos, int *found)
+{
+    uint8_t flag;
+    UInt256 hashes[2], md = UINT256_ZERO;
+    int inLeft, inRight;
+
+    if (*flagIdx/8 < block->flagsLen && *hashIdx < block->hashesCount) {
+        flag = (block->flags[*flagIdx/8] & (1 << (*flagIdx % 8)));
+        (*flagIdx)++;
+
+        if (flag && depth != _ceil_log2(block->totalTx)) {
+            inLeft = ! *found;
+            hashes[0] = _BRMerkleBlockProofR(block, proof, hashIdx, flagIdx, depth + 1, pos*2, found); // left branch
+            inLeft = inLeft && *found;
+            inRight = ! *found;
+            hashes[1] = _BRMerkleBlockProofR(block, proof, hashIdx, flagIdx, depth + 1, pos*2 + 1, found); // right
+            inRight = inRight && *found;
+
+            if (! UInt256IsZero(hashes[0]) && ! UInt256Eq(hashes[0], hashes[1])) {
+                if (UInt256IsZero(hashes[1])) hashes[1] = hashes[0]; // if right branch is missing, dup left branch
+                if (inLeft) proof->branch[proof->branchCount++] = hashes[1];
+                if (inRight) proof->branch[proof->branchCount++] = hashes[0];
+                BRSHA256_2(&md, hashes, sizeof(hashes));
+            }
+            else *hashIdx = SIZE_MAX; // defend against (CVE-2012-2459)
+        }
+        else {
+            md = block->hashes[(*hashIdx)++]; // leaf
+            
+            if (flag && ! *found && UInt256Eq(md, proof->txHash)) {
+                proof->index = pos;
+                *found = 1;
+            }
+        }
+    }
+
+    return md;
+}
+
+// returns a merkle proof for the given matched tx hash that must be freed by calling BRMerkleProofFree(), or NULL if
+// the tx is not matched in the block's partial merkle tree
+BRMerkleProof *BRMerkleBlockProofForTx(const BRMerkleBlock *block, UInt256 txHash)
+{
+    BRMerkleProof *proof;
+    size_t hashIdx = 0, flagIdx = 0;
+    int found = 0;
+    UInt256 merkleRoot;
+
+    assert(block != NULL);
+    if (block->totalTx == 0 || ! BRMerkleBlockContainsTxHash(block, txHash)) return NULL;
+    proof = calloc(1, sizeof(*proof));
+    assert(proof != NULL);
+    proof->blockHash = block->blockHash;
+    proof->txHash = txHash;
+    proof->totalTx = block->totalTx;
+    proof->branch = calloc(_ceil_log2(block->totalTx) + 1, sizeof(UInt256));
+    assert(proof->branch != NULL);
+    merkleRoot = _BRMerkleBlockProofR(block, proof, &hashIdx, &flagIdx, 0, 0, &found);
+
+    if (! found || ! UInt256Eq(merkleRoot, block->merkleRoot) ||
+        ! UInt256Eq(BRMerkleProofRoot(proof), block->merkleRoot)) {
+        BRMerkleProofFree(proof);
+        proof = NULL;
+    }
+
+    return proof;
+}
+
+// returns the merkle root committed to by proof, or UINT256_ZERO if the branch is malformed
+UInt256 BRMerkleProofRoot(const BRMerkleProof *proof)
+{
+    UInt256 hashes[2], md = UINT256_ZERO;
+    uint32_t pos, width;
+
+    assert(proof != NULL);
     
-        // limit to MAX_PROOF_OF_WORK
-        if (size > maxsize || (size == maxsize && target > maxtarget)) target = maxtarget, size = maxsize;
+    if (proof->index < proof->totalTx && proof->branchCount == _ceil_log2(proof->totalTx) &&
+        (proof->branch || proof->branchCount == 0)) {
+        md = proof->txHash;
+        
+        for (size_t i = 0; ! UInt256IsZero(md) && i < proof->branchCount; i++) {
+            pos = proof->index >> i;
+            width = ((proof->totalTx - 1) >> i) + 1; // number of nodes in this row of the tree
+            hashes[pos & 1] = md;
+            hashes[(pos & 1) ^ 1] = proof->branch[i];
+
+            // a node can only equal its sibling when it's the duplicated last node of an odd length row
+            if (UInt256Eq(hashes[0], hashes[1]) != (! (pos & 1) && pos + 1 == width)) md = UINT256_ZERO;
+            else BRSHA256_2(&md, hashes, sizeof(hashes));
+        }
+    }
+
+    return md;
+}
+
+// true if proof is well formed and links its tx hash to the merkle root of the given block header
+int BRMerkleProofVerify(const BRMerkleProof *proof, const BRMerkleBlock *block)
+{
+    assert(proof != NULL);
+    assert(block != NULL);
     
-        if (block->target != ((uint32_t)target | size << 24)) r = 0;
+    return (UInt256Eq(proof->blockHash, block->blockHash) &&
+            (block->totalTx == 0 || block->totalTx == proof->totalTx) &&
+            UInt256Eq(BRMerkleProofRoot(proof), block->merkleRoot));
+}
+
+// verifies proofsCount proofs against a set of block headers, looking up each distinct header only once
+// writes true or false to results for each proof, and returns the number of proofs that verified
+size_t BRMerkleProofVerifyBatch(const BRMerkleProof *proofs[], size_t proofsCount, const BRMerkleBlock *blocks[],
+                                size_t blocksCount, int results[])
+{
+    BRSet *headers = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, blocksCount);
+    const BRMerkleBlock *block = NULL;
+    size_t i, count = 0;
+
+    assert(proofs != NULL || proofsCount == 0);
+    assert(blocks != NULL || blocksCount == 0);
+    assert(results != NULL || proofsCount == 0);
+    for (i = 0; i < blocksCount; i++) BRSetAdd(headers, (void *)blocks[i]);
+
+    for (i = 0; i < proofsCount; i++) {
+        // proofs are usually grouped by block, so only do a new lookup when the block hash changes
+        if (! block || ! UInt256Eq(block->blockHash, proofs[i]->blockHash)) {
+            block = BRSetGet(headers, &proofs[i]->blockHash);
+        }
+        
+        results[i] = (block && BRMerkleProofVerify(proofs[i], block));
+        if (results[i]) count++;
     }
-    else if (r && block->target != previous->target) r = 0;*/
+
+    BRSetFree(headers);
+    return count;
+}
+
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRMerkleProofSerialize(const BRMerkleProof *proof, uint8_t *buf, size_t bufLen)
+{
+    size_t off = 0, len;
+
+    assert(proof != NULL);
+    len = sizeof(UInt256) + sizeof(UInt256) + sizeof(uint32_t) + sizeof(uint32_t) +
+          BRVarIntSize(proof->branchCount) + proof->branchCount*sizeof(UInt256);
+
+    if (buf && len <= bufLen) {
+        UInt256Set(&buf[off], proof->blockHash);
+        off += sizeof(UInt256);
+        UInt256Set(&buf[off], proof->txHash);
+        off += sizeof(UInt256);
+        UInt32SetLE(&buf[off], proof->index);
+        off += sizeof(uint32_t);
+        UInt32SetLE(&buf[off], proof->totalTx);
+        off += sizeof(uint32_t);
+        off += BRVarIntSet(&buf[off], (off <= bufLen ? bufLen - off : 0), proof->branchCount);
+        if (proof->branch) memcpy(&buf[off], proof->branch, proof->branchCount*sizeof(UInt256));
+        off += proof->branchCount*sizeof(UInt256);
+    }
+
+    return (! buf || len <= bufLen) ? len : 0;
+}
+
+// buf must contain a proof serialized with BRMerkleProofSerialize()
+// returns a merkle proof that must be freed by calling BRMerkleProofFree(), or NULL if buf is malformed
+BRMerkleProof *BRMerkleProofParse(const uint8_t *buf, size_t bufLen)
+{
+    BRMerkleProof *proof = (buf && 72 < bufLen) ? calloc(1, sizeof(*proof)) : NULL;
+    size_t off = 0, len = 0;
+
+    assert(buf != NULL || bufLen == 0);
+
+    if (proof) {
+        proof->blockHash = UInt256Get(&buf[off]);
+        off += sizeof(UInt256);
+        proof->txHash = UInt256Get(&buf[off]);
+        off += sizeof(UInt256);
+        proof->index = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        proof->totalTx = UInt32GetLE(&buf[off]);
+        off += sizeof(uint32_t);
+        proof->branchCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+
+        if (len == 0 || proof->branchCount > 32 || off + proof->branchCount*sizeof(UInt256) > bufLen) {
+            BRMerkleProofFree(proof);
+            proof = NULL;
+        }
+        else if (proof->branchCount > 0) {
+            proof->branch = malloc(proof->branchCount*sizeof(UInt256));
+            assert(proof->branch != NULL);
+            memcpy(proof->branch, &buf[off], proof->branchCount*sizeof(UInt256));
+        }
+    }
+
+    return proof;
+}
+
+// frees memory allocated for proof
+void BRMerkleProofFree(BRMerkleProof *proof)
+{
+    assert(proof != NULL);
     
-    return r;
+    if (proof->branch) free(proof->branch);
+    free(proof);
+}
+
+// returns the number of bytes of heap memory used by block, including its matched tx hashes and flags
+size_t BRMerkleBlockMemoryUsage(const BRMerkleBlock *block)
+{
+    assert(block != NULL);
+    return sizeof(*block) + ((block->hashes) ? block->hashesCount*sizeof(*block->hashes) : 0) +
+           ((block->flags) ? block->flagsLen : 0) + ((block->raw) ? block->rawLen : 0);
 }
 
 // frees memory allocated by BRMerkleBlockParse
@@ -407,5 +904,6 @@ void BRMerkleBlockFree(BRMerkleBlock *block)
     
     if (block->hashes) free(block->hashes);
     if (block->flags) free(block->flags);
+    if (block->raw) free(block->raw);
     free(block);
 }
@@ -47,6 +47,10 @@ extern "C" {
 #define BLOCK_DIFFICULTY_INTERVAL 1 // number of blocks between difficulty target adjustments
 #define BLOCK_UNKNOWN_HEIGHT      INT32_MAX
 #define BLOCK_MAX_TIME_DRIFT      (2*60*60) // the furthest in the future a block is allowed to be timestamped
+#define BLOCK_ALGO_COUNT          8  // number of distinct algo values in the block version
+#define BLOCK_MEDIAN_TIME_SPAN    11 // number of blocks used to compute the median time past
+#define BLOCK_AVERAGING_WINDOW    50 // MultiShield averaging window, number of algos times the averaging interval
+#define BLOCK_TIMES_COUNT         (BLOCK_AVERAGING_WINDOW + BLOCK_MEDIAN_TIME_SPAN)
 
 typedef struct {
     UInt256 blockHash;
@@ -63,10 +67,29 @@ typedef struct {
     uint8_t *flags;
     size_t flagsLen;
     uint32_t height;
+    uint8_t *raw; // serialized bytes block was parsed from, released when block is modified or no longer needed
+    size_t rawLen;
+    uint32_t algoHeights[BLOCK_ALGO_COUNT]; // height of the latest block of each algo up to this one, 0 if not known
+    uint32_t algoTargets[BLOCK_ALGO_COUNT]; // difficulty target of the latest block of each algo up to this one
+    uint32_t times[BLOCK_TIMES_COUNT]; // timestamps of this block and its ancestors, most recent first
+    uint32_t timesCount; // number of known entries in times
+    UInt256 chainWork; // proof-of-work of this block and its known ancestors, as 32bit words least significant first
 } BRMerkleBlock;
 
 #define BR_MERKLE_BLOCK_NONE\
-    ((BRMerkleBlock) { UINT256_ZERO, 0, UINT256_ZERO, UINT256_ZERO, 0, 0, 0, 0, NULL, 0, NULL, 0, 0 })
+    ((BRMerkleBlock) { UINT256_ZERO, UINT256_ZERO, 0, UINT256_ZERO, UINT256_ZERO, 0, 0, 0, 0, NULL, 0, NULL, 0, 0,\
+                       NULL, 0, { 0 }, { 0 }, { 0 }, 0, UINT256_ZERO })
+
+// a merkle branch proving a single transaction is included in a block, suitable for serving SPV proofs without the
+// partial merkle tree of the block it was extracted from
+typedef struct {
+    UInt256 blockHash;
+    UInt256 txHash;
+    uint32_t index; // position of the transaction in the block, bit n is set if branch[n] is the left sibling
+    uint32_t totalTx;
+    UInt256 *branch; // sibling hashes from the transaction up to the merkle root
+    size_t branchCount;
+} BRMerkleProof;
 
 // returns a newly allocated merkle block struct that must be freed by calling BRMerkleBlockFree()
 BRMerkleBlock *BRMerkleBlockNew(void);
@@ -79,8 +102,12 @@ BRMerkleBlock *BRMerkleBlockCopy(const BRMerkleBlock *block);
 BRMerkleBlock *BRMerkleBlockParse(const uint8_t *buf, size_t bufLen);
 
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL (block->height is not serialized)
+// if block was parsed and hasn't been modified since, the bytes it was parsed from are copied without re-serializing
 size_t BRMerkleBlockSerialize(const BRMerkleBlock *block, uint8_t *buf, size_t bufLen);
 
+// releases the serialized bytes kept from parsing, must be called after modifying fields of block directly
+void BRMerkleBlockClearRaw(BRMerkleBlock *block);
+
 // populates txHashes with the matched tx hashes in the block
 // returns number of tx hashes written, or the total hashesCount needed if txHashes is NULL
 size_t BRMerkleBlockTxHashes(const BRMerkleBlock *block, UInt256 *txHashes, size_t hashesCount);
@@ -97,11 +124,53 @@ int BRMerkleBlockIsValid(const BRMerkleBlock *block, uint32_t currentTime);
 // true if the given tx hash is known to be included in the block
 int BRMerkleBlockContainsTxHash(const BRMerkleBlock *block, UInt256 txHash);
 
+// fills in the per-algo and timestamp windows of block from those of previous, so each connected block carries what
+// MultiShield difficulty verification needs without walking back through its ancestors, and sets block->chainWork to
+// the chainwork of previous plus the work of block
+// previous may be NULL if the ancestors of block are not known
+void BRMerkleBlockSetAncestry(BRMerkleBlock *block, const BRMerkleBlock *previous);
+
+// returns the expected number of hashes needed to find a block meeting the block's difficulty target, 2^256/target,
+// as 32bit words least significant first
+// from height 1430000 on, target is the geometric mean of the latest target of each active algo, taken from the windows
+// set by BRMerkleBlockSetAncestry(), an approximation of DigiByte's GetGeometricMeanPrevWork(), which differs in that:
+// - it decays the work of each other algo by how far back its latest block is, and drops it past 32 blocks, while here
+//   an algo's latest target counts in full until the algo has had no block in about a week of blocks
+// - it takes the NUM_ALGOS root of the product even when fewer algos are active, then shifts the result left 8 bits,
+//   while here the mean is over the active algos only, unscaled, and computed in fixed point log2
+// the result is only comparable with other chainwork computed here, not with the chainwork reported by nodes
+UInt256 BRMerkleBlockWork(const BRMerkleBlock *block);
+
 // verifies the block difficulty target is correct for the block's position in the chain
-// transitionTime is the timestamp of the block at the previous difficulty transition
-// transitionTime may be 0 if block->height is not a multiple of BLOCK_DIFFICULTY_INTERVAL
+// the MultiShield target is computed from the windows set on previous by BRMerkleBlockSetAncestry(), and blocks are
+// accepted unchecked until previous has a full window, transitionTime is not used
 int BRMerkleBlockVerifyDifficulty(const BRMerkleBlock *block, const BRMerkleBlock *previous, uint32_t transitionTime);
 
+// returns a merkle proof for the given matched tx hash that must be freed by calling BRMerkleProofFree(), or NULL if
+// the tx is not matched in the block's partial merkle tree
+BRMerkleProof *BRMerkleBlockProofForTx(const BRMerkleBlock *block, UInt256 txHash);
+
+// returns the merkle root committed to by proof, or UINT256_ZERO if the branch is malformed
+UInt256 BRMerkleProofRoot(const BRMerkleProof *proof);
+
+// true if proof is well formed and links its tx hash to the merkle root of the given block header
+int BRMerkleProofVerify(const BRMerkleProof *proof, const BRMerkleBlock *block);
+
+// verifies proofsCount proofs against a set of block headers, looking up each distinct header only once
+// writes true or false to results for each proof, and returns the number of proofs that verified
+size_t BRMerkleProofVerifyBatch(const BRMerkleProof *proofs[], size_t proofsCount, const BRMerkleBlock *blocks[],
+                                size_t blocksCount, int results[]);
+
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRMerkleProofSerialize(const BRMerkleProof *proof, uint8_t *buf, size_t bufLen);
+
+// buf must contain a proof serialized with BRMerkleProofSerialize()
+// returns a merkle proof that must be freed by calling BRMerkleProofFree(), or NULL if buf is malformed
+BRMerkleProof *BRMerkleProofParse(const uint8_t *buf, size_t bufLen);
+
+// frees memory allocated for proof
+void BRMerkleProofFree(BRMerkleProof *proof);
+
 // returns a hash value for block suitable for use in a hashtable
 inline static size_t BRMerkleBlockHash(const void *block)
 {
@@ -115,6 +184,9 @@ inline static int BRMerkleBlockEq(const void *block, const void *otherBlock)
             UInt256Eq(((const BRMerkleBlock *)block)->blockHash, ((const BRMerkleBlock *)otherBlock)->blockHash));
 }
 
+// returns the number of bytes of heap memory used by block, including its matched tx hashes and flags
+size_t BRMerkleBlockMemoryUsage(const BRMerkleBlock *block);
+
 // frees memory allocated for block
 void BRMerkleBlockFree(BRMerkleBlock *block);
 
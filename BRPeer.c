@@ -40,6 +40,7 @@
 #include <netdb.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <netinet/in.h> 
 #include <arpa/inet.h>
 
@@ -52,6 +53,7 @@
 #define LOCAL_HOST         ((UInt128) { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 0x7f, 0x00, 0x00, 0x01 })
 #define CONNECT_TIMEOUT    10.0
 #define MESSAGE_TIMEOUT    10.0
+#define CONNECT_FALLBACK_DELAY 0.25 // seconds an IPv6 connection attempt runs before an IPv4 attempt is raced with it
 
 // the standard blockchain download protocol works as follows (for SPV mode):
 // - local peer sends getblocks
@@ -94,6 +96,10 @@ typedef struct {
     char host[INET6_ADDRSTRLEN];
     BRPeerStatus status;
     int waitingForNetwork;
+    volatile int canceled; // set when the peer is disconnected before it finished connecting
+    double connectDelay; // seconds to wait before connecting
+    pthread_mutex_t cancelLock;
+    pthread_cond_t cancelCond; // signaled when canceled is set, to cut the connect delay short
     volatile int needsFilterUpdate;
     uint64_t nonce, feePerKb;
     char *useragent;
@@ -102,10 +108,13 @@ typedef struct {
     volatile double disconnectTime, mempoolTime;
     int sentVerack, gotVerack, sentGetaddr, sentFilter, sentGetdata, sentMempool, sentGetblocks;
     UInt256 lastBlockHash;
+    UInt256 getblocksStop; // hashStop of the last getblocks message, kept when requesting the next 500 block hashes
     BRMerkleBlock *currentBlock;
-    UInt256 *currentBlockTxHashes, *knownBlockHashes, *knownTxHashes;
+    UInt256 *currentBlockTxHashes, *knownBlockHashes; // queues
+    UInt256 *knownTxHashes;
     BRSet *knownTxHashSet;
     volatile int socket;
+    volatile size_t memUsage; // heap memory used by the peer, published by the peer thread after each message
     void *info;
     void (*connected)(void *info);
     void (*disconnected)(void *info, int error);
@@ -120,8 +129,8 @@ typedef struct {
     BRTransaction *(*requestedTx)(void *info, UInt256 txHash);
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
-    void **volatile pongInfo;
-    void (**volatile pongCallback)(void *info, int success);
+    void **volatile pongInfo; // queue
+    void (**volatile pongCallback)(void *info, int success); // queue
     void *volatile mempoolInfo;
     void (*volatile mempoolCallback)(void *info, int success);
     pthread_t thread;
@@ -274,6 +283,7 @@ static int _BRPeerAcceptAddrMessage(BRPeer *peer, const uint8_t *msg, size_t msg
         peer_log(peer, "got addr with %zu address(es)", count);
 
         for (size_t i = 0; i < count; i++) {
+            p = BR_PEER_NONE;
             p.timestamp = UInt32GetLE(&msg[off]);
             off += sizeof(uint32_t);
             p.services = UInt64GetLE(&msg[off]);
@@ -340,7 +350,7 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
             r = 0;
         }
         else if (ctx->currentBlockHeight > 0 && blockCount > 2 && blockCount < 500 &&
-                 ctx->currentBlockHeight + array_count(ctx->knownBlockHashes) + blockCount < ctx->lastblock) {
+                 ctx->currentBlockHeight + queue_count(ctx->knownBlockHashes) + blockCount < ctx->lastblock) {
             peer_log(peer, "non-standard inv, %zu is fewer block hash(es) than expected", blockCount);
             r = 0;
         }
@@ -354,11 +364,11 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
             for (i = 0; i < blockCount; i++) {
                 blockHashes[i] = UInt256Get(blocks[i]);
                 // remember blockHashes in case we need to re-request them with an updated bloom filter
-                array_add(ctx->knownBlockHashes, blockHashes[i]);
+                queue_add(ctx->knownBlockHashes, blockHashes[i]);
             }
         
-            while (array_count(ctx->knownBlockHashes) > MAX_GETDATA_HASHES) {
-                array_rm_range(ctx->knownBlockHashes, 0, array_count(ctx->knownBlockHashes)/3);
+            while (queue_count(ctx->knownBlockHashes) > MAX_GETDATA_HASHES) {
+                queue_rm_range_first(ctx->knownBlockHashes, queue_count(ctx->knownBlockHashes)/3);
             }
         
             if (ctx->needsFilterUpdate) blockCount = 0;
@@ -376,10 +386,11 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
             if (j > 0 || blockCount > 0) BRPeerSendGetdata(peer, txHashes, j, blockHashes, blockCount);
     
             // to improve chain download performance, if we received 500 block hashes, request the next 500 block hashes
-            if (blockCount >= 500) {
+            // unless the last one is where the getblocks request was asked to stop
+            if (blockCount >= 500 && ! UInt256Eq(blockHashes[blockCount - 1], ctx->getblocksStop)) {
                 UInt256 locators[] = { blockHashes[blockCount - 1], blockHashes[0] };
             
-                BRPeerSendGetblocks(peer, locators, 2, UINT256_ZERO);
+                BRPeerSendGetblocks(peer, locators, 2, ctx->getblocksStop);
             }
             
             if (txCount > 0 && ctx->mempoolCallback) {
@@ -414,19 +425,19 @@ static int _BRPeerAcceptTxMessage(BRPeer *peer, const uint8_t *msg, size_t msgLe
         txHash = tx->txHash;
         peer_log(peer, "got tx: %s", log_u256_hex_encode(txHash));
 
-        if (ctx->relayedTx) {
+        if (ctx->relayedTx) { // the callback takes over our reference to tx
             ctx->relayedTx(ctx->info, tx);
         }
         else BRTransactionFree(tx);
 
         if (ctx->currentBlock) { // we're collecting tx messages for a merkleblock
-            for (size_t i = array_count(ctx->currentBlockTxHashes); i > 0; i--) {
-                if (! UInt256Eq(txHash, ctx->currentBlockTxHashes[i - 1])) continue;
-                array_rm(ctx->currentBlockTxHashes, i - 1);
+            for (size_t i = 0; i < queue_count(ctx->currentBlockTxHashes); i++) { // tx usually arrive in block order
+                if (! UInt256Eq(txHash, queue_at(ctx->currentBlockTxHashes, i))) continue;
+                queue_rm(ctx->currentBlockTxHashes, i);
                 break;
             }
         
-            if (array_count(ctx->currentBlockTxHashes) == 0) { // we received the entire block including all matched tx
+            if (queue_count(ctx->currentBlockTxHashes) == 0) { // we received the entire block including all matched tx
                 BRMerkleBlock *block = ctx->currentBlock;
             
                 ctx->currentBlock = NULL;
@@ -533,7 +544,7 @@ static int _BRPeerAcceptGetdataMessage(BRPeer *peer, const uint8_t *msg, size_t
             
             switch (type) {
                 case inv_tx:
-                    if (ctx->requestedTx) tx = ctx->requestedTx(ctx->info, hash);
+                    tx = (ctx->requestedTx) ? ctx->requestedTx(ctx->info, hash) : NULL;
 
                     if (tx && BRTransactionSize(tx) < TX_MAX_SIZE) {
                         uint8_t buf[BRTransactionSerialize(tx, NULL, 0)];
@@ -546,9 +557,11 @@ static int _BRPeerAcceptGetdataMessage(BRPeer *peer, const uint8_t *msg, size_t
                         
                         peer_log(peer, "publishing tx: %s", txHex);
                         BRPeerSendMessage(peer, buf, bufLen, MSG_TX);
+                        BRTransactionFree(tx);
                         break;
                     }
                     
+                    if (tx) BRTransactionFree(tx);
                     // fall through
                 default:
                     if (! notfound) array_new(notfound, 1);
@@ -654,7 +667,7 @@ static int _BRPeerAcceptPongMessage(BRPeer *peer, const uint8_t *msg, size_t msg
         peer_log(peer, "pong message has wrong nonce: %"PRIu64", expected: %"PRIu64, UInt64GetLE(msg), ctx->nonce);
         r = 0;
     }
-    else if (array_count(ctx->pongCallback) == 0) {
+    else if (queue_count(ctx->pongCallback) == 0) {
         peer_log(peer, "got unexpected pong");
         r = 0;
     }
@@ -670,12 +683,12 @@ static int _BRPeerAcceptPongMessage(BRPeer *peer, const uint8_t *msg, size_t msg
         }
         else peer_log(peer, "got pong");
 
-        if (array_count(ctx->pongCallback) > 0) {
-            void (*pongCallback)(void *, int) = ctx->pongCallback[0];
-            void *pongInfo = ctx->pongInfo[0];
+        if (queue_count(ctx->pongCallback) > 0) {
+            void (*pongCallback)(void *, int) = queue_first(ctx->pongCallback);
+            void *pongInfo = queue_first(ctx->pongInfo);
 
-            array_rm(ctx->pongCallback, 0);
-            array_rm(ctx->pongInfo, 0);
+            queue_rm_first(ctx->pongCallback);
+            queue_rm_first(ctx->pongInfo);
             if (pongCallback) pongCallback(pongInfo, 1);
         }
     }
@@ -716,16 +729,16 @@ static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, siz
         assert(hashes != NULL);
         count = BRMerkleBlockTxHashes(block, hashes, count);
 
-        for (size_t i = count; i > 0; i--) { // reverse order for more efficient removal as tx arrive
-            if (BRSetContains(ctx->knownTxHashSet, &hashes[i - 1])) continue;
-            array_add(ctx->currentBlockTxHashes, hashes[i - 1]);
+        for (size_t i = 0; i < count; i++) {
+            if (BRSetContains(ctx->knownTxHashSet, &hashes[i])) continue;
+            queue_add(ctx->currentBlockTxHashes, hashes[i]);
         }
 
         if (hashes != _hashes) free(hashes);
     }
 
     if (block) {
-        if (array_count(ctx->currentBlockTxHashes) > 0) { // wait til we get all tx messages before processing the block
+        if (queue_count(ctx->currentBlockTxHashes) > 0) { // wait til we get all tx messages before processing the block
             ctx->currentBlock = block;
         }
         else if (ctx->relayedBlock) {
@@ -814,8 +827,8 @@ static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen,
     
     if (ctx->currentBlock && strncmp(MSG_TX, type, 12) != 0) { // if we receive a non-tx message, merkleblock is done
         peer_log(peer, "incomplete merkleblock %s, expected %zu more tx, got %s",
-                 log_u256_hex_encode(ctx->currentBlock->blockHash), array_count(ctx->currentBlockTxHashes), type);
-        array_clear(ctx->currentBlockTxHashes);
+                 log_u256_hex_encode(ctx->currentBlock->blockHash), queue_count(ctx->currentBlockTxHashes), type);
+        queue_clear(ctx->currentBlockTxHashes);
         ctx->currentBlock = NULL;
         r = 0;
     }
@@ -838,36 +851,33 @@ static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen,
     return r;
 }
 
-static int _BRPeerOpenSocket(BRPeer *peer, int domain, double timeout, int *error)
+// creates a non-blocking socket in the given domain and starts connecting it to peer, returns the socket and sets
+// *error to 0 if it connected immediately or EINPROGRESS if the connection is pending, or returns -1 and sets *error
+static int _BRPeerStartConnect(BRPeer *peer, int domain, int *error)
 {
-    BRPeerContext *ctx = (BRPeerContext *)peer;
     struct sockaddr_storage addr;
     struct timeval tv;
-    fd_set fds;
-    socklen_t addrLen, optLen;
-    int count, arg = 0, err = 0, on = 1, r = 1;
+    socklen_t addrLen;
+    int fd, arg, on = 1;
 
-    ctx->socket = socket(domain, SOCK_STREAM, 0);
+    *error = 0;
+    fd = socket(domain, SOCK_STREAM, 0);
+    if (fd < 0) *error = errno;
     
-    if (ctx->socket < 0) {
-        err = errno;
-        r = 0;
-    }
-    else {
+    if (fd >= 0) {
         tv.tv_sec = 1; // one second timeout for send/receive, so thread doesn't block for too long
         tv.tv_usec = 0;
-        setsockopt(ctx->socket, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-        setsockopt(ctx->socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
-        setsockopt(ctx->socket, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
 #ifdef SO_NOSIGPIPE // BSD based systems have a SO_NOSIGPIPE socket option to supress SIGPIPE signals
-        setsockopt(ctx->socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
 #endif
-        arg = fcntl(ctx->socket, F_GETFL, NULL);
-        if (arg < 0 || fcntl(ctx->socket, F_SETFL, arg | O_NONBLOCK) < 0) r = 0; // temporarily set socket non-blocking
-        if (! r) err = errno;
+        arg = fcntl(fd, F_GETFL, NULL);
+        if (arg < 0 || fcntl(fd, F_SETFL, arg | O_NONBLOCK) < 0) *error = errno; // non-blocking until connected
     }
-
-    if (r) {
+    
+    if (fd >= 0 && ! *error) {
         memset(&addr, 0, sizeof(addr));
         
         if (domain == PF_INET6) {
@@ -883,35 +893,105 @@ static int _BRPeerOpenSocket(BRPeer *peer, int domain, double timeout, int *erro
             addrLen = sizeof(struct sockaddr_in);
         }
         
-        if (connect(ctx->socket, (struct sockaddr *)&addr, addrLen) < 0) err = errno;
+        if (connect(fd, (struct sockaddr *)&addr, addrLen) < 0) *error = errno;
+    }
+    
+    if (fd >= 0 && *error && *error != EINPROGRESS) close(fd), fd = -1;
+    return fd;
+}
+
+// connects ctx->socket to peer, starting with IPv6, and for IPv4 peers racing an IPv4 attempt against it if IPv6
+// fails or hasn't connected after CONNECT_FALLBACK_DELAY, the first attempt to connect wins and the other is closed
+static int _BRPeerOpenSocket(BRPeer *peer, double timeout, int *error)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    int fds[2] = { -1, -1 }, errs[2] = { 0, 0 }, started = 1, fd = -1, err = 0, maxFd, optErr;
+    int fallback = _BRPeerIsIPv4(peer);
+    double start, now, wait;
+    struct timeval tv;
+    socklen_t optLen;
+    fd_set set;
+
+    gettimeofday(&tv, NULL);
+    start = now = tv.tv_sec + (double)tv.tv_usec/1000000;
+    fds[0] = _BRPeerStartConnect(peer, PF_INET6, &errs[0]);
+    if (fds[0] >= 0 && ! errs[0]) fd = fds[0], fds[0] = -1;
+    
+    while (fd < 0 && ! ctx->canceled && now < start + timeout) {
+        if (fallback && started < 2 && (fds[0] < 0 || now >= start + CONNECT_FALLBACK_DELAY)) {
+            started = 2; // start the IPv4 attempt
+            fds[1] = _BRPeerStartConnect(peer, PF_INET, &errs[1]);
+            if (fds[1] >= 0 && ! errs[1]) fd = fds[1], fds[1] = -1;
+            continue;
+        }
         
-        if (err == EINPROGRESS) {
-            err = 0;
-            optLen = sizeof(err);
-            tv.tv_sec = timeout;
-            tv.tv_usec = (long)(timeout*1000000) % 1000000;
-            FD_ZERO(&fds);
-            FD_SET(ctx->socket, &fds);
-            count = select(ctx->socket + 1, NULL, &fds, NULL, &tv);
-
-            if (count <= 0 || getsockopt(ctx->socket, SOL_SOCKET, SO_ERROR, &err, &optLen) < 0 || err) {
-                if (count == 0) err = ETIMEDOUT;
-                if (count < 0 || ! err) err = errno;
-                r = 0;
-            }
+        if (fds[0] < 0 && fds[1] < 0) break; // all attempts failed
+        wait = start + timeout - now;
+        if (wait > 0.1) wait = 0.1; // wake up regularly to check if the attempt was canceled
+        if (fallback && started < 2 && start + CONNECT_FALLBACK_DELAY - now < wait) {
+            wait = start + CONNECT_FALLBACK_DELAY - now;
         }
-        else if (err && domain == PF_INET6 && _BRPeerIsIPv4(peer)) {
-            return _BRPeerOpenSocket(peer, PF_INET, timeout, error); // fallback to IPv4
+        
+        FD_ZERO(&set);
+        maxFd = -1;
+        
+        for (int i = 0; i < 2; i++) {
+            if (fds[i] < 0) continue;
+            FD_SET(fds[i], &set);
+            if (fds[i] > maxFd) maxFd = fds[i];
         }
-        else if (err) r = 0;
-
-        if (r) peer_log(peer, "socket connected");
-        fcntl(ctx->socket, F_SETFL, arg); // restore socket non-blocking status
+        
+        tv.tv_sec = (wait > 0) ? (long)wait : 0;
+        tv.tv_usec = (wait > 0) ? (long)(wait*1000000) % 1000000 : 0;
+        
+        if (select(maxFd + 1, NULL, &set, NULL, &tv) < 0 && errno != EINTR) {
+            err = errno;
+            break;
+        }
+        
+        for (int i = 0; i < 2 && fd < 0; i++) {
+            if (fds[i] < 0 || ! FD_ISSET(fds[i], &set)) continue;
+            optErr = 0;
+            optLen = sizeof(optErr);
+            if (getsockopt(fds[i], SOL_SOCKET, SO_ERROR, &optErr, &optLen) < 0) optErr = errno;
+            
+            if (! optErr) fd = fds[i], fds[i] = -1;
+            else errs[i] = optErr, close(fds[i]), fds[i] = -1;
+        }
+        
+        gettimeofday(&tv, NULL);
+        now = tv.tv_sec + (double)tv.tv_usec/1000000;
     }
+    
+    for (int i = 0; i < 2; i++) { // cancel the attempt that lost the race
+        if (fds[i] >= 0) close(fds[i]);
+    }
+    
+    if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, NULL) & ~O_NONBLOCK); // restore socket non-blocking status
+        ctx->socket = fd;
+        peer_log(peer, "socket connected");
+        return 1;
+    }
+    
+    if (ctx->canceled) err = ECANCELED;
+    else if (! err && errs[1] && errs[1] != EINPROGRESS) err = errs[1];
+    else if (! err && errs[0] && errs[0] != EINPROGRESS) err = errs[0];
+    else if (! err) err = ETIMEDOUT;
+    peer_log(peer, "connect error: %s", strerror(err));
+    if (error) *error = err;
+    return 0;
+}
 
-    if (! r && err) peer_log(peer, "connect error: %s", strerror(err));
-    if (error && err) *error = err;
-    return r;
+// must only be called from the peer thread, or before it's started
+static size_t _BRPeerMemoryUsage(BRPeerContext *ctx)
+{
+    BRMerkleBlock *block = ctx->currentBlock;
+    
+    return array_mem_size(ctx->useragent) + queue_mem_size(ctx->currentBlockTxHashes) +
+           queue_mem_size(ctx->knownBlockHashes) + array_mem_size(ctx->knownTxHashes) +
+           BRSetMemoryUsage(ctx->knownTxHashSet) + queue_mem_size(ctx->pongInfo) + queue_mem_size(ctx->pongCallback) +
+           ((block) ? BRMerkleBlockMemoryUsage(block) : 0);
 }
 
 static void *_peerThreadRoutine(void *arg)
@@ -922,7 +1002,23 @@ static void *_peerThreadRoutine(void *arg)
 
     pthread_cleanup_push(ctx->threadCleanup, ctx->info);
     
-    if (_BRPeerOpenSocket(peer, PF_INET6, CONNECT_TIMEOUT, &error)) {
+    if (ctx->connectDelay > 0) { // wait out the connect delay unless the attempt is canceled first
+        struct timeval tv;
+        struct timespec ts;
+        double end;
+        
+        gettimeofday(&tv, NULL);
+        end = tv.tv_sec + (double)tv.tv_usec/1000000 + ctx->connectDelay;
+        ts.tv_sec = (time_t)end;
+        ts.tv_nsec = (long)((end - ts.tv_sec)*1000000000);
+        pthread_mutex_lock(&ctx->cancelLock);
+        while (! ctx->canceled && pthread_cond_timedwait(&ctx->cancelCond, &ctx->cancelLock, &ts) != ETIMEDOUT);
+        pthread_mutex_unlock(&ctx->cancelLock);
+        ctx->connectDelay = 0;
+    }
+    
+    if (ctx->canceled) error = ECANCELED;
+    else if (_BRPeerOpenSocket(peer, CONNECT_TIMEOUT, &error)) {
         struct timeval tv;
         double time = 0, msgTimeout;
         uint8_t header[HEADER_LENGTH], *payload = malloc(0x1000);
@@ -1010,6 +1106,8 @@ static void *_peerThreadRoutine(void *arg)
                             error = EPROTO;
                         }
                         else if (! _BRPeerAcceptMessage(peer, payload, msgLen, type)) error = EPROTO;
+                        
+                        ctx->memUsage = _BRPeerMemoryUsage(ctx);
                     }
                 }
             }
@@ -1018,18 +1116,19 @@ static void *_peerThreadRoutine(void *arg)
         free(payload);
     }
     
+    if (ctx->canceled) error = ECANCELED; // disconnected before the handshake finished
     socket = ctx->socket;
     ctx->socket = -1;
     ctx->status = BRPeerStatusDisconnected;
     if (socket >= 0) close(socket);
     peer_log(peer, "disconnected");
     
-    while (array_count(ctx->pongCallback) > 0) {
-        void (*pongCallback)(void *, int) = ctx->pongCallback[0];
-        void *pongInfo = ctx->pongInfo[0];
+    while (queue_count(ctx->pongCallback) > 0) {
+        void (*pongCallback)(void *, int) = queue_first(ctx->pongCallback);
+        void *pongInfo = queue_first(ctx->pongInfo);
         
-        array_rm(ctx->pongCallback, 0);
-        array_rm(ctx->pongInfo, 0);
+        queue_rm_first(ctx->pongCallback);
+        queue_rm_first(ctx->pongInfo);
         if (pongCallback) pongCallback(pongInfo, 0);
     }
 
@@ -1052,17 +1151,20 @@ BRPeer *BRPeerNew(uint32_t magicNumber)
     assert(ctx != NULL);
     ctx->magicNumber = magicNumber;
     array_new(ctx->useragent, 40);
-    array_new(ctx->knownBlockHashes, 10);
-    array_new(ctx->currentBlockTxHashes, 10);
+    queue_new(ctx->knownBlockHashes, 10);
+    queue_new(ctx->currentBlockTxHashes, 10);
     array_new(ctx->knownTxHashes, 10);
     ctx->knownTxHashSet = BRSetNew(BRTransactionHash, BRTransactionEq, 10);
-    array_new(ctx->pongInfo, 10);
-    array_new(ctx->pongCallback, 10);
+    queue_new(ctx->pongInfo, 10);
+    queue_new(ctx->pongCallback, 10);
     ctx->pingTime = DBL_MAX;
     ctx->mempoolTime = DBL_MAX;
     ctx->disconnectTime = DBL_MAX;
     ctx->socket = -1;
     ctx->threadCleanup = _dummyThreadCleanup;
+    ctx->memUsage = _BRPeerMemoryUsage(ctx);
+    pthread_mutex_init(&ctx->cancelLock, NULL);
+    pthread_cond_init(&ctx->cancelCond, NULL);
     return &ctx->peer;
 }
 
@@ -1146,8 +1248,9 @@ void BRPeerConnect(BRPeer *peer)
         else {
             peer_log(peer, "connecting");
             ctx->waitingForNetwork = 0;
+            ctx->canceled = 0;
             gettimeofday(&tv, NULL);
-            ctx->disconnectTime = tv.tv_sec + (double)tv.tv_usec/1000000 + CONNECT_TIMEOUT;
+            ctx->disconnectTime = tv.tv_sec + (double)tv.tv_usec/1000000 + ctx->connectDelay + CONNECT_TIMEOUT;
 
             if (pthread_attr_init(&attr) != 0) {
                 error = ENOMEM;
@@ -1167,12 +1270,30 @@ void BRPeerConnect(BRPeer *peer)
     }
 }
 
-// close connection to peer
+// open connection to peer and perform handshake after waiting delay seconds, so attempts to connect to several peers
+// can be staggered
+void BRPeerConnectAfter(BRPeer *peer, double delay)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    
+    if (ctx->status == BRPeerStatusDisconnected || ctx->waitingForNetwork) ctx->connectDelay = delay;
+    BRPeerConnect(peer);
+}
+
+// close connection to peer, if peer hasn't finished connecting, the attempt is canceled and the disconnected callback
+// is called with ECANCELED
 void BRPeerDisconnect(BRPeer *peer)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
     int socket = ctx->socket;
 
+    if (ctx->status == BRPeerStatusConnecting) {
+        pthread_mutex_lock(&ctx->cancelLock);
+        ctx->canceled = 1;
+        pthread_cond_signal(&ctx->cancelCond); // wakes the peer thread if it's waiting out its connect delay
+        pthread_mutex_unlock(&ctx->cancelLock);
+    }
+    
     if (socket >= 0) {
         ctx->socket = -1;
         if (shutdown(socket, SHUT_RDWR) < 0) peer_log(peer, "%s", strerror(errno));
@@ -1403,6 +1524,7 @@ void BRPeerSendGetheaders(BRPeer *peer, const UInt256 locators[], size_t locator
 
 void BRPeerSendGetblocks(BRPeer *peer, const UInt256 locators[], size_t locatorsCount, UInt256 hashStop)
 {
+    BRPeerContext *ctx = (BRPeerContext *)peer;
     size_t i, off = 0;
     size_t msgLen = sizeof(uint32_t) + BRVarIntSize(locatorsCount) + sizeof(*locators)*locatorsCount + sizeof(hashStop);
     uint8_t msg[msgLen];
@@ -1420,6 +1542,7 @@ void BRPeerSendGetblocks(BRPeer *peer, const UInt256 locators[], size_t locators
     off += sizeof(UInt256);
     
     if (locatorsCount > 0) {
+        ctx->getblocksStop = hashStop;
         peer_log(peer, "calling getblocks with %zu locators: [%s, %s %s]", locatorsCount,
                  log_u256_hex_encode(locators[0]), (locatorsCount > 2 ? " ...," : ""),
                  (locatorsCount > 1 ? log_u256_hex_encode(locators[locatorsCount - 1]) : ""));
@@ -1499,8 +1622,8 @@ void BRPeerSendPing(BRPeer *peer, void *info, void (*pongCallback)(void *info, i
     
     gettimeofday(&tv, NULL);
     ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
-    array_add(ctx->pongInfo, info);
-    array_add(ctx->pongCallback, pongCallback);
+    queue_add(ctx->pongInfo, info);
+    queue_add(ctx->pongCallback, pongCallback);
     UInt64SetLE(msg, ctx->nonce);
     BRPeerSendMessage(peer, msg, sizeof(msg), MSG_PING);
 }
@@ -1509,28 +1632,47 @@ void BRPeerSendPing(BRPeer *peer, void *info, void (*pongCallback)(void *info, i
 void BRPeerRerequestBlocks(BRPeer *peer, UInt256 fromBlock)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    size_t i = array_count(ctx->knownBlockHashes);
+    size_t i = queue_count(ctx->knownBlockHashes);
     
-    while (i > 0 && ! UInt256Eq(ctx->knownBlockHashes[i - 1], fromBlock)) i--;
+    while (i > 0 && ! UInt256Eq(queue_at(ctx->knownBlockHashes, i - 1), fromBlock)) i--;
    
     if (i > 0) {
-        array_rm_range(ctx->knownBlockHashes, 0, i - 1);
-        peer_log(peer, "re-requesting %zu block(s)", array_count(ctx->knownBlockHashes));
-        BRPeerSendGetdata(peer, NULL, 0, ctx->knownBlockHashes, array_count(ctx->knownBlockHashes));
+        queue_rm_range_first(ctx->knownBlockHashes, i - 1);
+        
+        size_t count = queue_count(ctx->knownBlockHashes);
+        UInt256 *blockHashes = malloc(count*sizeof(*blockHashes));
+        
+        assert(blockHashes != NULL);
+        for (i = 0; i < count; i++) blockHashes[i] = queue_at(ctx->knownBlockHashes, i);
+        peer_log(peer, "re-requesting %zu block(s)", count);
+        BRPeerSendGetdata(peer, NULL, 0, blockHashes, count);
+        free(blockHashes);
     }
 }
 
+// returns the number of bytes of heap memory used by peer, including its known tx and block hashes and any merkleblock
+// it's collecting tx for
+// NOTE: the peer thread's collections aren't read, the result is the usage it published after its last message
+size_t BRPeerMemoryUsage(BRPeer *peer)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    
+    return sizeof(*ctx) + ctx->memUsage;
+}
+
 void BRPeerFree(BRPeer *peer)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
     
     if (ctx->useragent) array_free(ctx->useragent);
-    if (ctx->currentBlockTxHashes) array_free(ctx->currentBlockTxHashes);
-    if (ctx->knownBlockHashes) array_free(ctx->knownBlockHashes);
+    if (ctx->currentBlockTxHashes) queue_free(ctx->currentBlockTxHashes);
+    if (ctx->knownBlockHashes) queue_free(ctx->knownBlockHashes);
     if (ctx->knownTxHashes) array_free(ctx->knownTxHashes);
     if (ctx->knownTxHashSet) BRSetFree(ctx->knownTxHashSet);
-    if (ctx->pongInfo) array_free(ctx->pongInfo);
-    if (ctx->pongCallback) array_free(ctx->pongCallback);
+    if (ctx->pongInfo) queue_free(ctx->pongInfo);
+    if (ctx->pongCallback) queue_free(ctx->pongCallback);
+    pthread_cond_destroy(&ctx->cancelCond);
+    pthread_mutex_destroy(&ctx->cancelLock);
     free(ctx);
 }
 
@@ -120,9 +120,10 @@ typedef struct {
     uint64_t services; // bitcoin network services supported by peer
     uint64_t timestamp; // timestamp reported by peer
     uint8_t flags; // scratch variable
+    uint16_t score; // connection quality kept by the peer manager, saved along with the peer, 0 if unknown
 } BRPeer;
 
-#define BR_PEER_NONE ((BRPeer) { UINT128_ZERO, 0, 0, 0, 0 })
+#define BR_PEER_NONE ((BRPeer) { UINT128_ZERO, 0, 0, 0, 0, 0 })
 
 // NOTE: BRPeer functions are not thread-safe
 
@@ -133,12 +134,14 @@ BRPeer *BRPeerNew(uint32_t magicNumber);
 // void connected(void *) - called when peer handshake completes successfully
 // void disconnected(void *, int) - called when peer connection is closed, error is an errno.h code
 // void relayedPeers(void *, const BRPeer[], size_t) - called when an "addr" message is received from peer
-// void relayedTx(void *, BRTransaction *) - called when a "tx" message is received from peer
+// void relayedTx(void *, BRTransaction *) - called when a "tx" message is received from peer, the callback must
+//   call BRTransactionFree() on tx when done with it
 // void hasTx(void *, UInt256 txHash) - called when an "inv" message with an already-known tx hash is received from peer
 // void rejectedTx(void *, UInt256 txHash, uint8_t) - called when a "reject" message is received from peer
 // void relayedBlock(void *, BRMerkleBlock *) - called when a "merkleblock" or "headers" message is received from peer
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
-// BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
+// BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer,
+//   the returned tx is released with BRTransactionFree() after it's sent, so use BRTransactionRetain() on a shared tx
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
 // void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup
 void BRPeerSetCallbacks(BRPeer *peer, void *info,
@@ -168,7 +171,12 @@ BRPeerStatus BRPeerConnectStatus(BRPeer *peer);
 // open connection to peer and perform handshake
 void BRPeerConnect(BRPeer *peer);
 
-// close connection to peer
+// open connection to peer and perform handshake after waiting delay seconds, so attempts to connect to several peers
+// can be staggered
+void BRPeerConnectAfter(BRPeer *peer, double delay);
+
+// close connection to peer, if peer hasn't finished connecting, the attempt is canceled and the disconnected callback
+// is called with ECANCELED
 void BRPeerDisconnect(BRPeer *peer);
 
 // call this to (re)schedule a disconnect in the given number of seconds, or < 0 to cancel (useful for sync timeout)
@@ -228,6 +236,11 @@ inline static int BRPeerEq(const void *peer, const void *otherPeer)
              ((const BRPeer *)peer)->port == ((const BRPeer *)otherPeer)->port));
 }
 
+// returns the number of bytes of heap memory used by peer, including its known tx and block hashes and any merkleblock
+// it's collecting tx for
+// NOTE: the peer thread's collections aren't read, the result is the usage it published after its last message
+size_t BRPeerMemoryUsage(BRPeer *peer);
+
 // frees memory allocated for peer
 void BRPeerFree(BRPeer *peer);
 
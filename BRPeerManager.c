@@ -23,6 +23,8 @@
 //  THE SOFTWARE.
 
 #include "BRPeerManager.h"
+#include "BRPeerStore.h"
+#include "BRHeaderSnapshot.h"
 #include "BRBloomFilter.h"
 #include "BRSet.h"
 #include "BRArray.h"
@@ -43,6 +45,13 @@
 #define MAX_CONNECT_FAILURES  20 // notify user of network problems after this many connect failures in a row
 #define PEER_FLAG_SYNCED      0x01
 #define PEER_FLAG_NEEDSUPDATE 0x02
+#define CHAIN_INDEX_SIZE      1024 // number of recent main chain block hashes indexed by height
+#define PEER_SCORE_MAX        1000 // score of a peer with no latency, unlimited download rate and a long uptime
+#define PEER_SWITCH_BLOCKS    500  // blocks a download peer serves before it's compared with the other peers again
+#define PEER_RACE_FACTOR      2    // connection attempts raced for each peer still needed, the slowest are canceled
+#define PEER_RACE_STAGGER     0.25 // seconds between the starts of raced connection attempts
+#define CACHE_TX_MAX_AGE      (24*60*60) // seconds a non-wallet tx is kept for the block cache if it isn't mined
+#define PEER_SAVE_INTERVAL    60   // minimum seconds between saves of relayed peers
 
 #define genesis_block_hash(params) UInt256Reverse((params)->checkpoints[0].hash)
 
@@ -65,6 +74,13 @@ typedef struct {
     UInt256 hash;
 } BRPeerCallbackInfo;
 
+typedef struct {
+    BRPeer *peer;
+    time_t connectTime; // when the peer finished connecting
+    time_t downloadTime; // when the peer became the download peer, 0 if it isn't
+    uint32_t blockCount; // number of blocks that extended the chain since the peer became the download peer
+} BRPeerStats;
+
 typedef struct {
     BRTransaction *tx;
     void *info;
@@ -76,6 +92,16 @@ typedef struct {
     BRPeer *peers;
 } BRTxPeerList;
 
+typedef struct {
+    UInt256 blockHash;
+    size_t size; // heap memory used by the block when it was added
+} BRRetainedBlock;
+
+typedef struct {
+    UInt256 txHash;
+    time_t time; // when the tx was added to cacheTx
+} BRCachedTx;
+
 // true if peer is contained in the list of peers associated with txHash
 static int _BRTxPeerListHasPeer(const BRTxPeerList *list, UInt256 txHash, const BRPeer *peer)
 {
@@ -140,14 +166,6 @@ static int _BRTxPeerListRemovePeer(BRTxPeerList *list, UInt256 txHash, const BRP
     return 0;
 }
 
-// comparator for sorting peers by timestamp, most recent first
-inline static int _peerTimestampCompare(const void *peer, const void *otherPeer)
-{
-    if (((const BRPeer *)peer)->timestamp < ((const BRPeer *)otherPeer)->timestamp) return 1;
-    if (((const BRPeer *)peer)->timestamp > ((const BRPeer *)otherPeer)->timestamp) return -1;
-    return 0;
-}
-
 // returns a hash value for a block's prevBlock value suitable for use in a hashtable
 inline static size_t _BRPrevBlockHash(const void *block)
 {
@@ -160,31 +178,39 @@ inline static int _BRPrevBlockEq(const void *block, const void *otherBlock)
     return UInt256Eq(((const BRMerkleBlock *)block)->prevBlock, ((const BRMerkleBlock *)otherBlock)->prevBlock);
 }
 
-// returns a hash value for a block's height value suitable for use in a hashtable
-inline static size_t _BRBlockHeightHash(const void *block)
-{
-    // (FNV_OFFSET xor height)*FNV_PRIME
-    return (size_t)((0x811C9dc5 ^ ((const BRMerkleBlock *)block)->height)*0x01000193);
-}
-
-// true if block and otherBlock have equal height values
-inline static int _BRBlockHeightEq(const void *block, const void *otherBlock)
-{
-    return (((const BRMerkleBlock *)block)->height == ((const BRMerkleBlock *)otherBlock)->height);
-}
-
 struct BRPeerManagerStruct {
     const BRChainParams *params;
     BRWallet *wallet;
     int isConnected, connectFailureCount, misbehavinCount, dnsThreadCount, maxConnectCount;
-    BRPeer *peers, *downloadPeer, fixedPeer, **connectedPeers;
+    BRPeerStore *peerStore; // known peers to connect to
+    BRPeer *downloadPeer, fixedPeer, **connectedPeers;
+    BRPeerStats *peerStats; // stats of the connected peers that finished connecting, used to score them
+    time_t peersSaveTime; // when relayed peers were last saved
     char downloadPeerName[INET6_ADDRSTRLEN + 6];
     uint32_t earliestKeyTime, syncStartHeight, filterUpdateHeight, estimatedHeight;
     BRBloomFilter *bloomFilter;
     double fpRate, averageTxPerBlock;
-    BRSet *blocks, *orphans, *checkpoints;
+    BRSet *blocks, *orphans;
+    BRBlockRetention retention;
+    BRRetainedBlock *retainedBlocks; // queue of blocks that may be released, in the order they were added to blocks
+    size_t retainedSize; // heap memory used by the blocks in retainedBlocks
+    size_t keptCount, keptSize; // blocks taken off retainedBlocks that the policy keeps, still counted against it
+    size_t blockSaves; // blocks are being saved while this is non-zero, so their wire bytes aren't released
     BRMerkleBlock *lastBlock, *lastOrphan;
     BRMerkleBlock *startSyncFrom;
+    UInt256 chainIndex[CHAIN_INDEX_SIZE]; // main chain block hashes, indexed by height modulo CHAIN_INDEX_SIZE
+    uint32_t chainIndexHeight; // chainIndex is complete from this height up to lastBlock
+    uint32_t chainWorkHeight; // forks joining the main chain at or above this height are compared by chainwork
+    BRBlockCache *blockCache;
+    BRStore *store;
+    BRWatchWallet *watchWallet;
+    BRSet *cacheTx; // non-wallet tx received while syncing, kept until the block they were filtered into is cached
+    BRCachedTx *cacheTxQueue; // queue of tx added to cacheTx, oldest first, including ones since removed from it
+    BRPeer *rangePeer; // peer downloading the blocks of a range rescan, not used for anything else until it's done
+    BRMerkleBlock *rangeBlock; // most recent verified block of the range rescan
+    uint32_t rangeEndHeight;
+    void *rangeInfo;
+    void (*rangeCallback)(void *info, int error);
     BRTxPeerList *txRelays, *txRequests;
     BRPublishedTx *publishedTx;
     UInt256 *publishedTxHashes;
@@ -197,6 +223,7 @@ struct BRPeerManagerStruct {
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
     pthread_mutex_t lock;
+    pthread_cond_t peersCond; // signaled when a DNS seed lookup finishes or a peer is removed from connectedPeers
 };
 
 void BRPeerManagerSetStartBlock(BRPeerManager* manager, BRMerkleBlock* start) {
@@ -204,15 +231,55 @@ void BRPeerManagerSetStartBlock(BRPeerManager* manager, BRMerkleBlock* start) {
     manager->startSyncFrom = start;
 }
 
-static void _BRPeerManagerPeerMisbehavin(BRPeerManager *manager, BRPeer *peer)
+// returns the most recent checkpoint that's at least a week older than earliestKeyTime, or the genesis checkpoint
+static const BRCheckPoint *_BRPeerManagerStartCheckpoint(BRPeerManager *manager)
+{
+    const BRCheckPoint *checkpoint = NULL;
+    
+    if (manager->earliestKeyTime > 7*24*60*60) {
+        checkpoint = BRChainParamsCheckpointBeforeTime(manager->params, manager->earliestKeyTime - 7*24*60*60 - 1);
+    }
+    
+    return (checkpoint) ? checkpoint : &manager->params->checkpoints[0];
+}
+
+// returns the stats kept for a connected peer, or NULL if the peer hasn't finished connecting
+static BRPeerStats *_BRPeerManagerPeerStats(BRPeerManager *manager, const BRPeer *peer)
+{
+    for (size_t i = array_count(manager->peerStats); i > 0; i--) {
+        if (manager->peerStats[i - 1].peer == peer) return &manager->peerStats[i - 1];
+    }
+    
+    return NULL;
+}
+
+// returns a score from 0 to PEER_SCORE_MAX for a connected peer, weighting its ping time, its block download rate as
+// the download peer and how long it's been connected equally, averaged with the score saved from earlier connections
+static uint16_t _BRPeerManagerPeerScore(BRPeerManager *manager, BRPeer *peer)
 {
-    for (size_t i = array_count(manager->peers); i > 0; i--) {
-        if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
+    BRPeerStats *stats = _BRPeerManagerPeerStats(manager, peer);
+    double now = time(NULL), rate = 0.5, uptime = 0, score;
+    
+    if (stats && stats->downloadTime > 0 && stats->blockCount >= PEER_SWITCH_BLOCKS/10) {
+        rate = stats->blockCount/(now - stats->downloadTime + 1.0); // blocks per second, unknown rates score half
+        rate = rate/(rate + 50.0); // 50 blocks per second scores half
     }
+    
+    if (stats) uptime = now - stats->connectTime;
+    
+    // 100ms ping scores half, as does 10 minutes connected
+    score = PEER_SCORE_MAX/3.0*(1.0/(1.0 + BRPeerPingTime(peer)*10.0) + rate + uptime/(uptime + 10*60.0));
+    if (peer->score > 0) score = (score + peer->score)/2;
+    return (uint16_t)score;
+}
+
+static void _BRPeerManagerPeerMisbehavin(BRPeerManager *manager, BRPeer *peer)
+{
+    BRPeerStoreRemove(manager->peerStore, peer);
 
     if (++manager->misbehavinCount >= 10) { // clear out stored peers so we get a fresh list from DNS for next connect
         manager->misbehavinCount = 0;
-        array_clear(manager->peers);
+        BRPeerStoreClear(manager->peerStore);
     }
 
     BRPeerDisconnect(peer);
@@ -233,6 +300,7 @@ static void _BRPeerManagerSyncStopped(BRPeerManager *manager)
 }
 
 // adds transaction to list of tx to be published, along with any unconfirmed inputs
+// the list retains each tx it holds, and releases it with BRTransactionFree() when the tx is removed
 static void _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransaction *tx, void *info,
                                              void (*callback)(void *, int))
 {
@@ -241,7 +309,7 @@ static void _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransacti
             if (BRTransactionEq(manager->publishedTx[i - 1].tx, tx)) return;
         }
         
-        array_add(manager->publishedTx, ((BRPublishedTx) { tx, info, callback }));
+        array_add(manager->publishedTx, ((BRPublishedTx) { BRTransactionRetain(tx), info, callback }));
         array_add(manager->publishedTxHashes, tx->txHash);
 
         for (size_t i = 0; i < tx->inCount; i++) {
@@ -256,34 +324,211 @@ static size_t _BRPeerManagerBlockLocators(BRPeerManager *manager, UInt256 locato
     // append 10 most recent block hashes, decending, then continue appending, doubling the step back each time,
     // finishing with the genesis block (top, -1, -2, -3, -4, -5, -6, -7, -8, -9, -11, -15, -23, -39, -71, -135, ..., 0)
     BRMerkleBlock *block = manager->lastBlock;
+    const BRCheckPoint *checkpoint = NULL;
+    uint32_t height = 0;
     int32_t step = 1, i = 0, j;
     
     while (block && block->height > 0) {
         if (locators && i < locatorsCount) locators[i] = block->blockHash;
         if (++i >= 10) step *= 2;
+        height = block->height;
         
         for (j = 0; block && j < step; j++) {
             block = BRSetGet(manager->blocks, &block->prevBlock);
         }
     }
     
+    // if older blocks aren't kept, continue with the checkpoints below the last block found, so a peer on a fork that
+    // joins between the last block and the genesis block doesn't have to send the whole chain again
+    if (! block && height > 0) checkpoint = BRChainParamsCheckpointBeforeHeight(manager->params, height - 1);
+    
+    for (size_t k = (checkpoint) ? checkpoint - manager->params->checkpoints + 1 : 0; k > 0; k--) {
+        checkpoint = &manager->params->checkpoints[k - 1];
+        if (checkpoint->height == 0) break;
+        if (locators && i < locatorsCount) locators[i] = UInt256Reverse(checkpoint->hash);
+        i++;
+    }
+    
     if (locators && i < locatorsCount) locators[i] = genesis_block_hash(manager->params);
     return ++i;
 }
 
+// records block as the main chain block at its height
+static void _BRPeerManagerIndexBlock(BRPeerManager *manager, const BRMerkleBlock *block)
+{
+    manager->chainIndex[block->height % CHAIN_INDEX_SIZE] = block->blockHash;
+}
+
+// restarts the main chain index from lastBlock, after lastBlock was set to a block that doesn't extend the chain
+static void _BRPeerManagerResetChainIndex(BRPeerManager *manager)
+{
+    _BRPeerManagerIndexBlock(manager, manager->lastBlock);
+    manager->chainIndexHeight = manager->lastBlock->height;
+}
+
+// true if the main chain block at height is in the chain index, height must not be above lastBlock
+static int _BRPeerManagerIsIndexed(BRPeerManager *manager, uint32_t height)
+{
+    return (height >= manager->chainIndexHeight && height + CHAIN_INDEX_SIZE > manager->lastBlock->height);
+}
+
+// true if block is in the main chain ending with lastBlock, a single index lookup for recent blocks
+static int _BRPeerManagerIsMainChain(BRPeerManager *manager, const BRMerkleBlock *block)
+{
+    const BRMerkleBlock *b = manager->lastBlock;
+    
+    if (block->height > b->height) return 0;
+    
+    if (_BRPeerManagerIsIndexed(manager, block->height)) {
+        return UInt256Eq(manager->chainIndex[block->height % CHAIN_INDEX_SIZE], block->blockHash);
+    }
+    
+    while (b && b->height > block->height) b = BRSetGet(manager->blocks, &b->prevBlock);
+    return (b && BRMerkleBlockEq(b, block));
+}
+
+// returns the main chain block at height, or NULL if it isn't known, such as when it's been released from memory
+static BRMerkleBlock *_BRPeerManagerMainChainBlock(BRPeerManager *manager, uint32_t height)
+{
+    BRMerkleBlock *b = manager->lastBlock;
+    
+    if (height > b->height) return NULL;
+    
+    if (_BRPeerManagerIsIndexed(manager, height)) {
+        return BRSetGet(manager->blocks, &manager->chainIndex[height % CHAIN_INDEX_SIZE]);
+    }
+    
+    while (b && b->height > height) b = BRSetGet(manager->blocks, &b->prevBlock);
+    return b;
+}
+
 static void _setApplyFreeBlock(void *info, void *block)
 {
     BRMerkleBlockFree(block);
 }
 
-static size_t _BRPeerManagerAddPeer(BRPeerManager *manager, BRPeer *peer) {
-	size_t add = 1;
-	for (size_t i = array_count(manager->peers); i > 0; i--) {
-		BRPeer* otherPeer = (BRPeer*) &(manager->peers[i - 1]);
-		if (BRPeerEq(otherPeer, peer)) { i = 1; add = 0;}
-	}
-	if (add == 1) array_add(manager->peers, *peer);
-	return add;
+static void _setApplyFreeTx(void *info, void *tx)
+{
+    BRTransactionFree(tx);
+}
+
+static void _setApplyBlockMemoryUsage(void *info, void *block)
+{
+    *(size_t *)info += BRMerkleBlockMemoryUsage(block);
+}
+
+static void _setApplyTxMemoryUsage(void *info, void *tx)
+{
+    *(size_t *)info += BRTransactionMemoryUsage(tx);
+}
+
+// adds block and the tx matched in it to the block cache, if any of them wasn't received the cache restarts after it
+static void _BRPeerManagerCacheBlock(BRPeerManager *manager, const BRMerkleBlock *block)
+{
+    size_t count = BRMerkleBlockTxHashes(block, NULL, 0), i;
+    UInt256 *txHashes;
+    BRTransaction **transactions, *tx;
+    BRMerkleBlock *prev;
+    uint32_t timestamp = block->timestamp;
+    
+    if (! manager->blockCache) return;
+    txHashes = malloc(count*sizeof(*txHashes) + 1);
+    transactions = malloc(count*sizeof(*transactions) + 1);
+    assert(txHashes != NULL);
+    assert(transactions != NULL);
+    count = BRMerkleBlockTxHashes(block, txHashes, count);
+    prev = BRSetGet(manager->blocks, &block->prevBlock);
+    if (prev) timestamp = timestamp/2 + prev->timestamp/2;
+    
+    for (i = 0; i < count; i++) {
+        tx = BRSetRemove(manager->cacheTx, &txHashes[i]);
+        if (! tx && (tx = BRWalletTransactionForHash(manager->wallet, txHashes[i])) != NULL) BRTransactionRetain(tx);
+        if (! tx) break;
+        transactions[i] = tx;
+    }
+    
+    if (i == count) BRBlockCacheAddBlock(manager->blockCache, block->height, timestamp, transactions, count);
+    else BRBlockCacheTruncate(manager->blockCache, block->height - 1);
+    while (i > 0) BRTransactionFree(transactions[--i]);
+    free(transactions);
+    free(txHashes);
+}
+
+// adds a non-wallet tx to cacheTx, first dropping tx that weren't mined within CACHE_TX_MAX_AGE, such as bloom filter
+// false positives, and the oldest ones if BLOCK_CACHE_MAX_TX are cached
+static void _BRPeerManagerAddCacheTx(BRPeerManager *manager, BRTransaction *tx)
+{
+    time_t now = time(NULL);
+    BRTransaction *t;
+    
+    while (queue_count(manager->cacheTxQueue) > 0 &&
+           (queue_count(manager->cacheTxQueue) >= BLOCK_CACHE_MAX_TX ||
+            queue_first(manager->cacheTxQueue).time + CACHE_TX_MAX_AGE < now)) {
+        t = BRSetRemove(manager->cacheTx, &queue_first(manager->cacheTxQueue).txHash);
+        if (t) BRTransactionFree(t);
+        queue_rm_first(manager->cacheTxQueue);
+    }
+    
+    BRSetAdd(manager->cacheTx, BRTransactionRetain(tx));
+    queue_add(manager->cacheTxQueue, ((BRCachedTx) { tx->txHash, now }));
+}
+
+// replays the tx of cached blocks after height into the wallet, returns false without doing anything if the block
+// cache doesn't hold every block from there to lastBlock filtered for all wallet addresses
+static int _BRPeerManagerRescanCached(BRPeerManager *manager, uint32_t height)
+{
+    size_t addrsCount, hashesCount = 0, txCount;
+    BRAddress *addrs;
+    UInt160 *hashes;
+    int r;
+    
+    if (! manager->blockCache || BRBlockCacheEndHeight(manager->blockCache) != manager->lastBlock->height) return 0;
+    addrsCount = BRWalletAllAddrs(manager->wallet, NULL, 0);
+    addrs = malloc(addrsCount*sizeof(*addrs));
+    hashes = malloc(addrsCount*sizeof(*hashes));
+    assert(addrs != NULL);
+    assert(hashes != NULL);
+    addrsCount = BRWalletAllAddrs(manager->wallet, addrs, addrsCount);
+    
+    for (size_t i = 0; i < addrsCount; i++) {
+        hashes[hashesCount] = UINT160_ZERO;
+        BRAddressHash160(&hashes[hashesCount], addrs[i].s);
+        if (! UInt160IsZero(hashes[hashesCount])) hashesCount++;
+    }
+    
+    r = (BRBlockCacheStartHeight(manager->blockCache, hashes, hashesCount) <= height + 1);
+    free(hashes);
+    free(addrs);
+    
+    if (r) {
+        txCount = BRBlockCacheTransactions(manager->blockCache, height + 1, NULL, NULL, NULL, 0);
+        
+        BRTransaction **transactions = malloc(txCount*sizeof(*transactions));
+        uint32_t *heights = malloc(txCount*sizeof(*heights)), *timestamps = malloc(txCount*sizeof(*timestamps));
+        
+        assert(transactions != NULL);
+        assert(heights != NULL);
+        assert(timestamps != NULL);
+        txCount = BRBlockCacheTransactions(manager->blockCache, height + 1, transactions, heights, timestamps, txCount);
+        peer_log(&BR_PEER_NONE, "rescanning %zu cached transactions after height %"PRIu32, txCount, height);
+        
+        for (size_t i = 0; i < txCount; i++) {
+            if (! BRWalletTransactionForHash(manager->wallet, transactions[i]->txHash) &&
+                BRWalletContainsTransaction(manager->wallet, transactions[i])) {
+                transactions[i]->blockHeight = heights[i];
+                transactions[i]->timestamp = timestamps[i];
+                BRWalletRegisterSharedTransaction(manager->wallet, transactions[i]);
+            }
+            
+            BRTransactionFree(transactions[i]);
+        }
+        
+        free(timestamps);
+        free(heights);
+        free(transactions);
+    }
+    
+    return r;
 }
 
 static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
@@ -302,20 +547,25 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
     
     size_t addrsCount = BRWalletAllAddrs(manager->wallet, NULL, 0);
     BRAddress *addrs = malloc(addrsCount*sizeof(*addrs));
+    UInt160 *hashes = malloc(addrsCount*sizeof(*hashes));
+    size_t hashesCount = 0;
     size_t utxosCount = BRWalletUTXOs(manager->wallet, NULL, 0);
     BRUTXO *utxos = malloc(utxosCount*sizeof(*utxos));
     uint32_t blockHeight = (manager->lastBlock->height > 100) ? manager->lastBlock->height - 100 : 0;
     size_t txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, blockHeight);
     BRTransaction **transactions = malloc(txCount*sizeof(*transactions));
+    size_t watchCount = (manager->watchWallet) ? BRWatchWalletElementCount(manager->watchWallet) : 0;
     BRBloomFilter *filter;
     
     assert(addrs != NULL);
+    assert(hashes != NULL);
     assert(utxos != NULL);
     assert(transactions != NULL);
     addrsCount = BRWalletAllAddrs(manager->wallet, addrs, addrsCount);
     utxosCount = BRWalletUTXOs(manager->wallet, utxos, utxosCount);
     txCount = BRWalletTxUnconfirmedBefore(manager->wallet, transactions, txCount, blockHeight);
-    filter = BRBloomFilterNew(manager->fpRate, addrsCount + utxosCount + txCount + 100, (uint32_t)BRPeerHash(peer),
+    filter = BRBloomFilterNew(manager->fpRate, addrsCount + utxosCount + txCount + watchCount + 100,
+                              (uint32_t)BRPeerHash(peer),
                               BLOOM_UPDATE_ALL); // BUG: XXX txCount not the same as number of spent wallet outputs
     
     for (size_t i = 0; i < addrsCount; i++) { // add addresses to watch for tx receiveing money to the wallet
@@ -326,8 +576,16 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
         if (! UInt160IsZero(hash) && ! BRBloomFilterContainsData(filter, hash.u8, sizeof(hash))) {
             BRBloomFilterInsertData(filter, hash.u8, sizeof(hash));
         }
+        
+        if (! UInt160IsZero(hash)) hashes[hashesCount++] = hash;
     }
 
+    // blocks after lastBlock are downloaded with this filter, so the block cache can vouch for these addresses
+    if (manager->blockCache) {
+        BRBlockCacheAddWatched(manager->blockCache, hashes, hashesCount, manager->lastBlock->height);
+    }
+    
+    free(hashes);
     free(addrs);
         
     for (size_t i = 0; i < utxosCount; i++) { // add UTXOs to watch for tx sending money from the wallet
@@ -356,6 +614,7 @@ static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
     }
     
     free(transactions);
+    if (manager->watchWallet) BRWatchWalletBloomFilterInsert(manager->watchWallet, filter, 0, 1);
     if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
     manager->bloomFilter = filter;
     // TODO: XXX if already synced, recursively add inputs of unconfirmed receives
@@ -438,6 +697,7 @@ static void _updateFilterPingDone(void *info, int success)
             
             for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
                 if (BRPeerConnectStatus(manager->connectedPeers[i - 1]) != BRPeerStatusConnected) continue;
+                if (manager->connectedPeers[i - 1] == manager->rangePeer) continue; // keep its range rescan filter
                 peerInfo = calloc(1, sizeof(*peerInfo));
                 assert(peerInfo != NULL);
                 peerInfo->peer = manager->connectedPeers[i - 1];
@@ -469,6 +729,21 @@ static void _BRPeerManagerUpdateFilter(BRPeerManager *manager)
     }
 }
 
+// registers tx with the watch wallet, and rebuilds the bloom filter if new watch addresses were derived
+// returns true if tx affects the watch wallet
+static int _BRPeerManagerRegisterWatchTx(BRPeerManager *manager, const BRTransaction *tx)
+{
+    if (! manager->watchWallet) return 0;
+    
+    if (BRWatchWalletRegisterTransaction(manager->watchWallet, tx) > 0 && manager->bloomFilter) {
+        BRBloomFilterFree(manager->bloomFilter);
+        manager->bloomFilter = NULL; // reset bloom filter so it's recreated with new watch addresses
+        _BRPeerManagerUpdateFilter(manager);
+    }
+    
+    return BRWatchWalletContainsTransaction(manager->watchWallet, tx->txHash);
+}
+
 static void _BRPeerManagerUpdateTx(BRPeerManager *manager, const UInt256 txHashes[], size_t txCount,
                                    uint32_t blockHeight, uint32_t timestamp)
 {
@@ -480,7 +755,7 @@ static void _BRPeerManagerUpdateTx(BRPeerManager *manager, const UInt256 txHashe
                 if (! UInt256Eq(txHashes[i], tx->txHash)) continue;
                 array_rm(manager->publishedTx, j - 1);
                 array_rm(manager->publishedTxHashes, j - 1);
-                if (! BRWalletTransactionForHash(manager->wallet, tx->txHash)) BRTransactionFree(tx);
+                BRTransactionFree(tx);
             }
             
             for (size_t j = array_count(manager->txRelays); j > 0; j--) {
@@ -492,6 +767,22 @@ static void _BRPeerManagerUpdateTx(BRPeerManager *manager, const UInt256 txHashe
     }
     
     BRWalletUpdateTransactions(manager->wallet, txHashes, txCount, blockHeight, timestamp);
+    if (manager->watchWallet) BRWatchWalletUpdateTransactions(manager->watchWallet, txHashes, txCount, blockHeight);
+}
+
+// saves merkle proofs for the wallet transactions in block to the store, so they can still be served once block is
+// released from memory
+static void _BRPeerManagerSaveProofs(BRPeerManager *manager, const BRMerkleBlock *block, const UInt256 txHashes[],
+                                     size_t txCount)
+{
+    BRMerkleProof *proof;
+    
+    for (size_t i = 0; manager->store && i < txCount; i++) {
+        if (! BRWalletTransactionForHash(manager->wallet, txHashes[i])) continue;
+        proof = BRMerkleBlockProofForTx(block, txHashes[i]);
+        if (proof) BRStoreSaveProof(manager->store, proof);
+        if (proof) BRMerkleProofFree(proof);
+    }
 }
 
 // unconfirmed transactions that aren't in the mempools of any of connected peers have likely dropped off the network
@@ -539,6 +830,22 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
                 _BRPeerManagerUpdateTx(manager, &tx[i]->txHash, 1, TX_UNCONFIRMED, 0);
             }
         }
+        
+        size_t watchCount = (manager->watchWallet) ?
+                            BRWatchWalletTxUnconfirmedBefore(manager->watchWallet, NULL, 0, TX_UNCONFIRMED) : 0;
+        UInt256 watchHashes[(watchCount < 10000) ? watchCount : 10000];
+        
+        if (watchCount > 0) {
+            watchCount = BRWatchWalletTxUnconfirmedBefore(manager->watchWallet, watchHashes,
+                                                          sizeof(watchHashes)/sizeof(*watchHashes), TX_UNCONFIRMED);
+        }
+        
+        for (size_t i = 0; i < watchCount; i++) { // remove watch wallet tx that no connected peer relayed
+            if (_BRTxPeerListCount(manager->txRelays, watchHashes[i]) == 0 &&
+                _BRTxPeerListCount(manager->txRequests, watchHashes[i]) == 0) {
+                BRWatchWalletRemoveTransaction(manager->watchWallet, watchHashes[i]);
+            }
+        }
     }
 
     pthread_mutex_unlock(&manager->lock);
@@ -547,10 +854,15 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
 static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *peer)
 {
     BRPeerCallbackInfo *info;
-    size_t hashCount = 0, txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, TX_UNCONFIRMED);
+    size_t hashCount = 0, txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, TX_UNCONFIRMED),
+           watchCount = (manager->watchWallet) ?
+                        BRWatchWalletTxUnconfirmedBefore(manager->watchWallet, NULL, 0, TX_UNCONFIRMED) : 0;
     BRTransaction *tx[txCount];
-    UInt256 txHashes[txCount];
+    UInt256 *txHashes = malloc((txCount + watchCount)*sizeof(*txHashes)),
+            *watchHashes = malloc(watchCount*sizeof(*watchHashes));
     
+    assert(txHashes != NULL || txCount + watchCount == 0);
+    assert(watchHashes != NULL || watchCount == 0);
     txCount = BRWalletTxUnconfirmedBefore(manager->wallet, tx, txCount, TX_UNCONFIRMED);
     
     for (size_t i = 0; i < txCount; i++) {
@@ -560,10 +872,27 @@ static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *pee
             _BRTxPeerListAddPeer(&manager->txRequests, tx[i]->txHash, peer);
         }
     }
+    
+    if (watchCount > 0) { // also request unconfirmed watch wallet tx, so ones no peer has can be removed
+        watchCount = BRWatchWalletTxUnconfirmedBefore(manager->watchWallet, watchHashes, watchCount, TX_UNCONFIRMED);
+    }
+    
+    for (size_t i = 0; i < watchCount; i++) {
+        if (! _BRTxPeerListHasPeer(manager->txRelays, watchHashes[i], peer) &&
+            ! _BRTxPeerListHasPeer(manager->txRequests, watchHashes[i], peer)) {
+            txHashes[hashCount++] = watchHashes[i];
+            _BRTxPeerListAddPeer(&manager->txRequests, watchHashes[i], peer);
+        }
+    }
+
+    free(watchHashes);
 
     if (hashCount > 0) {
-        BRPeerSendGetdata(peer, txHashes, hashCount, NULL, 0);
-    
+        // page through the hashes with the same 10000 cap _requestUnrelayedTxGetdataDone uses
+        for (size_t i = 0; i < hashCount; i += 10000) {
+            BRPeerSendGetdata(peer, &txHashes[i], (hashCount - i < 10000) ? hashCount - i : 10000, NULL, 0);
+        }
+
         if ((peer->flags & PEER_FLAG_SYNCED) == 0) {
             info = calloc(1, sizeof(*info));
             assert(info != NULL);
@@ -573,6 +902,8 @@ static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *pee
         }
     }
     else peer->flags |= PEER_FLAG_SYNCED;
+
+    free(txHashes);
 }
 
 static void _BRPeerManagerPublishPendingTx(BRPeerManager *manager, BRPeer *peer)
@@ -644,7 +975,7 @@ static void _BRPeerManagerLoadMempools(BRPeerManager *manager)
         BRPeer *peer = manager->connectedPeers[i - 1];
         BRPeerCallbackInfo *info;
 
-        if (BRPeerConnectStatus(peer) != BRPeerStatusConnected) continue;
+        if (BRPeerConnectStatus(peer) != BRPeerStatusConnected || peer == manager->rangePeer) continue;
         info = calloc(1, sizeof(*info));
         assert(info != NULL);
         info->peer = peer;
@@ -693,71 +1024,132 @@ static void *_findPeersThreadRoutine(void *arg)
 {
     BRPeerManager *manager = ((BRFindPeersInfo *)arg)->manager;
     uint64_t services = ((BRFindPeersInfo *)arg)->services;
+    const char *hostname = ((BRFindPeersInfo *)arg)->hostname;
     UInt128 *addrList, *addr;
-    time_t now = time(NULL), age;
+    time_t now, age;
     
     pthread_cleanup_push(manager->threadCleanup, manager->info);
-    addrList = _addressLookup(((BRFindPeersInfo *)arg)->hostname);
+    addrList = _addressLookup(hostname);
+    now = time(NULL);
     free(arg);
     pthread_mutex_lock(&manager->lock);
     
     for (addr = addrList; addr && ! UInt128IsZero(*addr); addr++) {
-        age = 24*60*60 + BRRand(2*24*60*60); // add between 1 and 3 days
+        // peers from the first seed are preferred, others are added between 1 and 3 days old
+        age = (hostname == manager->params->dnsSeeds[0]) ? 0 : 24*60*60 + BRRand(2*24*60*60);
 		BRPeer peer = {*addr, manager->params->standardPort, services, now - age, 0};
-		_BRPeerManagerAddPeer(manager,&peer);
+		BRPeerStoreAdd(manager->peerStore, &peer);
     }
 
     manager->dnsThreadCount--;
+    pthread_cond_broadcast(&manager->peersCond); // wake up _BRPeerManagerFindPeers() to check if it has enough peers
     pthread_mutex_unlock(&manager->lock);
     if (addrList) free(addrList);
     pthread_cleanup_pop(1);
     return NULL;
 }
 
-// DNS peer discovery
+// DNS peer discovery, resolves all seeds in parallel and returns as soon as the first to respond have provided enough
+// peers, the lock is released while waiting and seeds that respond later still add their peers
 static void _BRPeerManagerFindPeers(BRPeerManager *manager)
 {
     uint64_t services = SERVICES_NODE_NETWORK | SERVICES_NODE_BLOOM | manager->params->services;
     time_t now = time(NULL);
-    struct timespec ts;
     pthread_t thread;
     pthread_attr_t attr;
-    UInt128 *addr, *addrList;
     BRFindPeersInfo *info;
     
     if (! UInt128IsZero(manager->fixedPeer.address)) {
-        array_set_count(manager->peers, 1);
-        manager->peers[0] = manager->fixedPeer;
-        manager->peers[0].services = services;
-        manager->peers[0].timestamp = now;
+        BRPeer peer = manager->fixedPeer;
+        
+        peer.services = services;
+        peer.timestamp = now;
+        BRPeerStoreClear(manager->peerStore);
+        BRPeerStoreAdd(manager->peerStore, &peer);
     }
     else {
-        for (size_t i = 1; manager->params->dnsSeeds[i]; i++) {
+        for (size_t i = 0; manager->params->dnsSeeds[i]; i++) {
             info = calloc(1, sizeof(BRFindPeersInfo));
             assert(info != NULL);
             info->manager = manager;
             info->hostname = manager->params->dnsSeeds[i];
             info->services = services;
-            if (pthread_attr_init(&attr) == 0 && pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 &&
+            
+            if (pthread_attr_init(&attr) != 0) {
+                free(info);
+                continue;
+            }
+            
+            if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 &&
                 pthread_create(&thread, &attr, _findPeersThreadRoutine, info) == 0) manager->dnsThreadCount++;
+            else free(info);
+            pthread_attr_destroy(&attr);
         }
 
-        for (addr = addrList = _addressLookup(manager->params->dnsSeeds[0]); addr && ! UInt128IsZero(*addr); addr++) {
-			BRPeer peer = {*addr, manager->params->standardPort, services, now, 0};
-			_BRPeerManagerAddPeer(manager,&peer);
+        while (manager->dnsThreadCount > 0 && BRPeerStoreCount(manager->peerStore) < PEER_MAX_CONNECTIONS) {
+            pthread_cond_wait(&manager->peersCond, &manager->lock); // releases the lock until a seed responds
         }
+    }
+}
 
-        if (addrList) free(addrList);
-        ts.tv_sec = 0;
-        ts.tv_nsec = 1;
+// makes peer the download peer, disconnecting the previous one, and starts the chain download if we're behind
+static void _BRPeerManagerStartDownload(BRPeerManager *manager, BRPeer *peer)
+{
+    BRPeerStats *stats = _BRPeerManagerPeerStats(manager, peer);
+    
+    if (manager->downloadPeer) BRPeerDisconnect(manager->downloadPeer);
+    manager->downloadPeer = peer;
+    manager->isConnected = 1;
+    manager->estimatedHeight = BRPeerLastBlock(peer);
+    if (stats) stats->downloadTime = time(NULL), stats->blockCount = 0;
+    _BRPeerManagerLoadBloomFilter(manager, peer);
+    BRPeerSetCurrentBlockHeight(peer, manager->lastBlock->height);
+    _BRPeerManagerPublishPendingTx(manager, peer);
+        
+    if (manager->lastBlock->height < BRPeerLastBlock(peer)) { // start blockchain sync
+        UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
+        size_t count = _BRPeerManagerBlockLocators(manager, locators, sizeof(locators)/sizeof(*locators));
+        
+        BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule sync timeout
 
-        do {
-            pthread_mutex_unlock(&manager->lock);
-            nanosleep(&ts, NULL); // pthread_yield() isn't POSIX standard :(
-            pthread_mutex_lock(&manager->lock);
-        } while (manager->dnsThreadCount > 0 && array_count(manager->peers) < PEER_MAX_CONNECTIONS);
+        // request just block headers up to a week before earliestKeyTime, and then merkleblocks after that
+        // we do not reset connect failure count yet incase this request times out
+        if (manager->lastBlock->timestamp + 7*24*60*60 >= manager->earliestKeyTime) {
+            BRPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
+        }
+        else BRPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+    }
+    else { // we're already synced
+        manager->connectFailureCount = 0; // reset connect failure count
+        _BRPeerManagerLoadMempools(manager);
+    }
+}
+
+// called each time the download peer extends the chain while syncing, every PEER_SWITCH_BLOCKS blocks the download
+// peer is replaced if another connected peer that has the blocks we're missing scores at least a quarter higher
+static void _BRPeerManagerDownloadProgress(BRPeerManager *manager, BRPeer *peer)
+{
+    BRPeerStats *stats = _BRPeerManagerPeerStats(manager, peer);
+    BRPeer *best = NULL;
+    uint16_t score, bestScore;
+    
+    if (! stats || (++stats->blockCount % PEER_SWITCH_BLOCKS) != 0) return;
+    bestScore = score = _BRPeerManagerPeerScore(manager, peer);
+    
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        BRPeer *p = manager->connectedPeers[i - 1];
+        uint16_t s;
+        
+        if (p == peer || p == manager->rangePeer || BRPeerConnectStatus(p) != BRPeerStatusConnected ||
+            BRPeerLastBlock(p) < BRPeerLastBlock(peer)) continue;
+        s = _BRPeerManagerPeerScore(manager, p);
+        if (s > bestScore) best = p, bestScore = s;
+    }
     
-        qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
+    if (best && bestScore > score + score/4) {
+        peer_log(best, "switching download peer at block #%"PRIu32", score %"PRIu16" vs %"PRIu16,
+                 manager->lastBlock->height, bestScore, score);
+        _BRPeerManagerStartDownload(manager, best);
     }
 }
 
@@ -767,12 +1159,24 @@ static void _peerConnected(void *info)
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRPeerCallbackInfo *peerInfo;
     time_t now = time(NULL);
+    size_t readyCount = 0;
     
     pthread_mutex_lock(&manager->lock);
     if (peer->timestamp > now + 2*60*60 || peer->timestamp < now - 2*60*60) peer->timestamp = now; // sanity check
+    array_add(manager->peerStats, ((BRPeerStats) { peer, now, 0, 0 }));
+    
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        BRPeer *p = manager->connectedPeers[i - 1];
+        
+        if (p != peer && BRPeerConnectStatus(p) == BRPeerStatusConnected) readyCount++;
+    }
     
+    if (readyCount >= manager->maxConnectCount) { // other raced connection attempts already won
+        peer_log(peer, "enough peers connected");
+        BRPeerDisconnect(peer);
+    }
     // TODO: XXX does this work with 0.11 pruned nodes?
-    if ((peer->services & manager->params->services) != manager->params->services) {
+    else if ((peer->services & manager->params->services) != manager->params->services) {
         peer_log(peer, "unsupported node type");
         BRPeerDisconnect(peer);
     }
@@ -802,41 +1206,27 @@ static void _peerConnected(void *info)
             BRPeerSendPing(peer, peerInfo, _loadBloomFilterDone);
         }
     }
-    else { // select the peer with the lowest ping time to download the chain from if we're behind
+    else { // select the best scoring peer to download the chain from if we're behind
         // BUG: XXX a malicious peer can report a higher lastblock to make us select them as the download peer, if
         // two peers agree on lastblock, use one of those two instead
         for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
             BRPeer *p = manager->connectedPeers[i - 1];
             
-            if (BRPeerConnectStatus(p) != BRPeerStatusConnected) continue;
-            if ((BRPeerPingTime(p) < BRPeerPingTime(peer) && BRPeerLastBlock(p) >= BRPeerLastBlock(peer)) ||
+            if (BRPeerConnectStatus(p) != BRPeerStatusConnected || p == manager->rangePeer) continue;
+            if ((BRPeerLastBlock(p) >= BRPeerLastBlock(peer) &&
+                 _BRPeerManagerPeerScore(manager, p) > _BRPeerManagerPeerScore(manager, peer)) ||
                 BRPeerLastBlock(p) > BRPeerLastBlock(peer)) peer = p;
         }
         
-        if (manager->downloadPeer) BRPeerDisconnect(manager->downloadPeer);
-        manager->downloadPeer = peer;
-        manager->isConnected = 1;
-        manager->estimatedHeight = BRPeerLastBlock(peer);
-        _BRPeerManagerLoadBloomFilter(manager, peer);
-        BRPeerSetCurrentBlockHeight(peer, manager->lastBlock->height);
-        _BRPeerManagerPublishPendingTx(manager, peer);
-            
-        if (manager->lastBlock->height < BRPeerLastBlock(peer)) { // start blockchain sync
-            UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
-            size_t count = _BRPeerManagerBlockLocators(manager, locators, sizeof(locators)/sizeof(*locators));
+        _BRPeerManagerStartDownload(manager, peer);
+    }
+    
+    // once the first peers to finish connecting are kept, cancel the connection attempts that were raced against them
+    if (readyCount + 1 >= manager->maxConnectCount) {
+        for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+            BRPeer *p = manager->connectedPeers[i - 1];
             
-            BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule sync timeout
-
-            // request just block headers up to a week before earliestKeyTime, and then merkleblocks after that
-            // we do not reset connect failure count yet incase this request times out
-            if (manager->lastBlock->timestamp + 7*24*60*60 >= manager->earliestKeyTime) {
-                BRPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
-            }
-            else BRPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
-        }
-        else { // we're already synced
-            manager->connectFailureCount = 0; // reset connect failure count
-            _BRPeerManagerLoadMempools(manager);
+            if (BRPeerConnectStatus(p) == BRPeerStatusConnecting) BRPeerDisconnect(p);
         }
     }
 
@@ -854,16 +1244,14 @@ static void _peerDisconnected(void *info, int error)
     //free(info);
     pthread_mutex_lock(&manager->lock);
 
-    void *txInfo[array_count(manager->publishedTx)];
-    void (*txCallback[array_count(manager->publishedTx)])(void *, int);
+    void *txInfo[array_count(manager->publishedTx)], *rangeInfo = NULL;
+    void (*txCallback[array_count(manager->publishedTx)])(void *, int), (*rangeCallback)(void *, int) = NULL;
     
     if (error == EPROTO) { // if it's protocol error, the peer isn't following standard policy
         _BRPeerManagerPeerMisbehavin(manager, peer);
     }
-    else if (error) { // timeout or some non-protocol related network error
-        for (size_t i = array_count(manager->peers); i > 0; i--) {
-            if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
-        }
+    else if (error && error != ECANCELED) { // timeout or other network error, not an attempt that lost a connect race
+        BRPeerStoreRemove(manager->peerStore, peer);
         
         manager->connectFailureCount++;
         
@@ -881,6 +1269,15 @@ static void _peerDisconnected(void *info, int error)
         }
     }
 
+    if (peer == manager->rangePeer) { // range rescan peer disconnected before the rescan was done
+        peer_log(peer, "range rescan abandoned at height %"PRIu32, manager->rangeBlock->height);
+        rangeInfo = manager->rangeInfo;
+        rangeCallback = manager->rangeCallback;
+        BRMerkleBlockFree(manager->rangeBlock);
+        manager->rangeBlock = NULL;
+        manager->rangePeer = NULL;
+    }
+
     if (peer == manager->downloadPeer) { // download peer disconnected
         manager->isConnected = 0;
         manager->downloadPeer = NULL;
@@ -891,12 +1288,12 @@ static void _peerDisconnected(void *info, int error)
         _BRPeerManagerSyncStopped(manager);
         
         // clear out stored peers so we get a fresh list from DNS on next connect attempt
-        array_clear(manager->peers);
+        BRPeerStoreClear(manager->peerStore);
         txError = ENOTCONN; // trigger any pending tx publish callbacks
         willSave = 1;
         peer_log(peer, "sync failed");
     }
-    else if (manager->connectFailureCount < MAX_CONNECT_FAILURES) willReconnect = 1;
+    else if (manager->connectFailureCount < MAX_CONNECT_FAILURES && error != ECANCELED) willReconnect = 1;
     
     if (txError) {
         for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
@@ -905,7 +1302,7 @@ static void _peerDisconnected(void *info, int error)
             txInfo[txCount] = manager->publishedTx[i - 1].info;
             txCallback[txCount] = manager->publishedTx[i - 1].callback;
             txCount++;
-            BRTransactionFree(manager->publishedTx[i - 1].tx);
+            BRTransactionFree(manager->publishedTx[i - 1].tx); // wallet keeps its own reference to wallet tx
             array_rm(manager->publishedTxHashes, i - 1);
             array_rm(manager->publishedTx, i - 1);
         }
@@ -914,6 +1311,15 @@ static void _peerDisconnected(void *info, int error)
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
         if (manager->connectedPeers[i - 1] != peer) continue;
         array_rm(manager->connectedPeers, i - 1);
+        pthread_cond_broadcast(&manager->peersCond); // wake up BRPeerManagerDisconnect() if it's waiting
+        break;
+    }
+    
+    for (size_t i = array_count(manager->peerStats); i > 0; i--) { // save the peer's score for the next connection
+        if (manager->peerStats[i - 1].peer != peer) continue;
+        peer->score = _BRPeerManagerPeerScore(manager, peer);
+        array_rm(manager->peerStats, i - 1);
+        if (! error) BRPeerStoreMarkGood(manager->peerStore, peer); // moves the peer to the tried table
         break;
     }
 
@@ -924,6 +1330,8 @@ static void _peerDisconnected(void *info, int error)
         txCallback[i](txInfo[i], txError);
     }
     
+    if (rangeCallback) rangeCallback(rangeInfo, (error) ? error : ENOTCONN);
+    if (willSave && manager->store) BRStoreSavePeers(manager->store, 1, NULL, 0);
     if (willSave && manager->savePeers) manager->savePeers(manager->info, 1, NULL, 0);
     if (willSave && manager->syncStopped) manager->syncStopped(manager->info, error);
     if (willReconnect) BRPeerManagerConnect(manager); // try connecting to another peer
@@ -935,35 +1343,37 @@ static void _peerRelayedPeers(void *info, const BRPeer peers[], size_t peersCoun
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     time_t now = time(NULL);
+    BRPeer *save = NULL;
+    size_t saveCount = 0;
 
     pthread_mutex_lock(&manager->lock);
     peer_log(peer, "relayed %zu peer(s)", peersCount);
 
-    array_add_array(manager->peers, peers, peersCount);
-    qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
-
-    // limit total to 2500 peers
-    if (array_count(manager->peers) > 2500) array_set_count(manager->peers, 2500);
-    peersCount = array_count(manager->peers);
+    // the store's buckets limit how many peers are kept, and how many can come from the same network
+    for (size_t i = 0; i < peersCount; i++) BRPeerStoreAdd(manager->peerStore, &peers[i]);
     
-    // remove peers more than 3 hours old, or until there are only 1000 left
-    while (peersCount > 1000 && manager->peers[peersCount - 1].timestamp + 3*60*60 < now) peersCount--;
-    array_set_count(manager->peers, peersCount);
+    // peer relaying is complete when we receive <1000, but peers also announce a few new addresses at a time, so the
+    // store is saved at most once per PEER_SAVE_INTERVAL
+    if (peersCount < 1000 && now >= manager->peersSaveTime + PEER_SAVE_INTERVAL &&
+        (manager->store || manager->savePeers)) {
+        saveCount = BRPeerStorePeers(manager->peerStore, NULL, 0);
+        save = malloc(saveCount*sizeof(*save));
+        assert(save != NULL || saveCount == 0);
+        saveCount = BRPeerStorePeers(manager->peerStore, save, saveCount);
+        if (saveCount > 1) manager->peersSaveTime = now;
+    }
     
-    BRPeer save[peersCount];
-
-    for (size_t i = 0; i < peersCount; i++) save[i] = manager->peers[i];
     pthread_mutex_unlock(&manager->lock);
-    
-    // peer relaying is complete when we receive <1000
-    if (peersCount > 1 && peersCount < 1000 &&
-        manager->savePeers) manager->savePeers(manager->info, 1, save, peersCount);
+    if (saveCount > 1 && manager->store) BRStoreSavePeers(manager->store, 1, save, saveCount);
+    if (saveCount > 1 && manager->savePeers) manager->savePeers(manager->info, 1, save, saveCount);
+    if (save) free(save);
 }
 
 static void _peerRelayedTx(void *info, BRTransaction *tx)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRTransaction *relayedTx = tx; // reference handed over by peer, released once the wallet has retained what it keeps
     void *txInfo = NULL;
     void (*txCallback)(void *, int) = NULL;
     int isWalletTx = 0, hasPendingCallbacks = 0;
@@ -972,6 +1382,14 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
     pthread_mutex_lock(&manager->lock);
     peer_log(peer, "relayed tx: %s", u256hex(tx->txHash));
     
+    if (peer == manager->rangePeer) { // tx matched by the range rescan filter, its block sets the height
+        if (BRWalletContainsTransaction(manager->wallet, tx)) BRWalletRegisterSharedTransaction(manager->wallet, tx);
+        _BRPeerManagerRegisterWatchTx(manager, tx);
+        pthread_mutex_unlock(&manager->lock);
+        BRTransactionFree(relayedTx);
+        return;
+    }
+    
     for (size_t i = array_count(manager->publishedTx); i > 0; i--) { // see if tx is in list of published tx
         if (UInt256Eq(manager->publishedTxHashes[i - 1], tx->txHash)) {
             txInfo = manager->publishedTx[i - 1].info;
@@ -989,14 +1407,23 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
     }
 
     if (manager->syncStartHeight == 0 || BRWalletContainsTransaction(manager->wallet, tx)) {
-        isWalletTx = BRWalletRegisterTransaction(manager->wallet, tx);
+        isWalletTx = BRWalletRegisterSharedTransaction(manager->wallet, tx);
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
     }
     else {
-        BRTransactionFree(tx);
+        if (manager->blockCache && ! BRSetContains(manager->cacheTx, tx)) _BRPeerManagerAddCacheTx(manager, tx);
         tx = NULL;
     }
     
+    if (_BRPeerManagerRegisterWatchTx(manager, relayedTx)) {
+        // track relays of watch tx like wallet tx, so ones that drop out of the mempools can be removed
+        if (manager->syncStartHeight == 0 && ! isWalletTx) {
+            _BRTxPeerListAddPeer(&manager->txRelays, relayedTx->txHash, peer);
+        }
+        
+        _BRTxPeerListRemovePeer(manager->txRequests, relayedTx->txHash, peer);
+    }
+    
     if (tx && isWalletTx) {
         // reschedule sync timeout
         if (manager->syncStartHeight > 0 && peer == manager->downloadPeer) {
@@ -1039,6 +1466,7 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
     }
     
     pthread_mutex_unlock(&manager->lock);
+    BRTransactionFree(relayedTx);
     if (txCallback) txCallback(txInfo, 0);
 }
 
@@ -1074,7 +1502,7 @@ static void _peerHasTx(void *info, UInt256 txHash)
     }
 
     if (tx) {
-        isWalletTx = BRWalletRegisterTransaction(manager->wallet, tx);
+        isWalletTx = BRWalletRegisterSharedTransaction(manager->wallet, tx);
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
 
         // reschedule sync timeout
@@ -1132,45 +1560,62 @@ static void _peerRejectedTx(void *info, UInt256 txHash, uint8_t code)
     if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
 }
 
-// reduce memory usage
-// clear the tail that comes after 500 blocks.
-// checkpoints will remain in the blocks-Set, until we are ahead of them.
-static void _BRPeerManagerClearMemory(BRPeerManager* manager) {
-    BRMerkleBlock* blockPtr = manager->lastBlock;
-    UInt256 prevHash;
-    size_t count = BRSetCount(manager->blocks);
-    size_t i = 0;
+// true if block must stay in memory regardless of the retention policy
+static int _BRPeerManagerKeepsBlock(BRPeerManager *manager, const BRMerkleBlock *block)
+{
+    const BRCheckPoint *checkpoint;
+    UInt256 hash;
     
-    if (count >= CLEAR_MEM_BLOCKS_COUNT_TRIGGER) {
-        // find the tail
-        while (blockPtr && i++ <= (CLEAR_MEM_BLOCKS_COUNT_TRIGGER - CLEAR_MEM_BLOCKS_COUNT_TAIL_LEN))
-            blockPtr = BRSetGet(manager->blocks, &blockPtr->prevBlock);
+    if (block == manager->lastBlock || block == manager->startSyncFrom) return 1;
+    if (manager->retention.keepTransitions && (block->height % SAVE_BLOCK_INTERVAL) == 0) return 1;
+    if (! manager->retention.keepCheckpoints) return 0;
+    checkpoint = BRChainParamsCheckpointAtHeight(manager->params, block->height);
+    if (checkpoint) hash = UInt256Reverse(checkpoint->hash);
+    return (checkpoint && UInt256Eq(block->blockHash, hash));
+}
+
+// adds block to manager->blocks and queues it for release by the retention policy, returns any block replaced
+static BRMerkleBlock *_BRPeerManagerAddBlock(BRPeerManager *manager, BRMerkleBlock *block)
+{
+    BRMerkleBlock *b = BRSetAdd(manager->blocks, block);
+    
+    if (! b) {
+        queue_add(manager->retainedBlocks, ((BRRetainedBlock) { block->blockHash, BRMerkleBlockMemoryUsage(block) }));
+        manager->retainedSize += queue_last(manager->retainedBlocks).size;
+    }
+    
+    return b;
+}
+
+// releases the oldest blocks beyond the limits of manager->retention
+// blocks are released in the order they were added, so this is amortized O(1) per block added, and blocks the policy
+// keeps still count against its limits, so fewer recent blocks are kept in their place
+static void _BRPeerManagerPruneBlocks(BRPeerManager *manager)
+{
+    const BRBlockRetention *retention = &manager->retention;
+    uint32_t height = manager->lastBlock->height;
+    BRRetainedBlock *retained;
+    BRMerkleBlock *block;
+    
+    while (queue_count(manager->retainedBlocks) > 0 &&
+           ((retention->maxBlocks > 0 &&
+             queue_count(manager->retainedBlocks) + manager->keptCount > retention->maxBlocks) ||
+            (retention->maxBytes > 0 && manager->retainedSize + manager->keptSize > retention->maxBytes))) {
+        retained = &queue_first(manager->retainedBlocks);
+        block = BRSetGet(manager->blocks, &retained->blockHash);
+        if (block && (block->height > height || height - block->height < retention->reorgDepth)) break;
+        manager->retainedSize -= (retained->size < manager->retainedSize) ? retained->size : manager->retainedSize;
         
-        if (blockPtr) {
-            prevHash = blockPtr->prevBlock;
-            
-            // clear the tail
-            while (blockPtr && !UInt256IsZero(prevHash)) {
-                
-                // get the block
-                blockPtr = BRSetGet(manager->blocks, &prevHash);
-                if (!blockPtr) break;
-                
-                // get previous hash
-                prevHash = blockPtr->prevBlock;
-                
-                // remove the current block
-                if (BRSetRemove(manager->blocks, blockPtr)) {
-                    // free the actual memory
-                    BRMerkleBlockFree(blockPtr);
-                } else {
-                    // nothing to remove
-                    break;
-                }
-            }
-            
-            debug_log("[MEMORY]: Blocks reduced from %ld to %ld blocks\n", count, BRSetCount(manager->blocks));
+        if (block && _BRPeerManagerKeepsBlock(manager, block)) {
+            manager->keptCount++;
+            manager->keptSize += retained->size;
         }
+        else if (block) {
+            BRSetRemove(manager->blocks, block);
+            BRMerkleBlockFree(block);
+        }
+        
+        queue_rm_first(manager->retainedBlocks);
     }
 }
 
@@ -1201,12 +1646,17 @@ static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *bloc
     }
     
     if (r) {
-        BRMerkleBlock *checkpoint = BRSetGet(manager->checkpoints, block);
+        const BRCheckPoint *checkpoint = BRChainParamsCheckpointAtHeight(manager->params, block->height);
+        UInt256 hash = (checkpoint) ? UInt256Reverse(checkpoint->hash) : block->blockHash;
+        
+        if (! checkpoint && manager->startSyncFrom && manager->startSyncFrom->height == block->height) {
+            hash = manager->startSyncFrom->blockHash;
+        }
 
         // verify blockchain checkpoints
-        if (checkpoint && ! BRMerkleBlockEq(block, checkpoint)) {
+        if (! UInt256Eq(block->blockHash, hash)) {
             peer_log(peer, "relayed a block that differs from the checkpoint at height %"PRIu32", blockHash: %s, "
-                     "expected: %s", block->height, u256hex(block->blockHash), u256hex(checkpoint->blockHash));
+                     "expected: %s", block->height, u256hex(block->blockHash), u256hex(hash));
             r = 0;
         }
     }
@@ -1214,6 +1664,85 @@ static int _BRPeerManagerVerifyBlock(BRPeerManager *manager, BRMerkleBlock *bloc
     return r;
 }
 
+// handles a block relayed by the range rescan peer, returns false without doing anything if peer is some other peer
+static int _BRPeerManagerRangeRelayedBlock(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block)
+{
+    BRMerkleBlock *prev;
+    void *info = NULL;
+    void (*callback)(void *, int) = NULL;
+    int error = 0, done = 0;
+    
+    pthread_mutex_lock(&manager->lock);
+    prev = manager->rangeBlock;
+    
+    if (peer != manager->rangePeer) {
+        pthread_mutex_unlock(&manager->lock);
+        return 0;
+    }
+    
+    if (! UInt256Eq(block->prevBlock, prev->blockHash)) { // not the next block of the range, such as a new tip block
+        BRMerkleBlockFree(block);
+    }
+    else {
+        block->height = prev->height + 1;
+        BRMerkleBlockSetAncestry(block, prev);
+        BRMerkleBlockClearRaw(block); // range rescan blocks aren't saved
+        
+        if (! manager->params->verifyDifficulty(block, prev, 0)) {
+            peer_log(peer, "relayed block with invalid difficulty target during range rescan");
+            BRMerkleBlockFree(block);
+            error = EPROTO, done = 1;
+        }
+        else {
+            size_t txCount = BRMerkleBlockTxHashes(block, NULL, 0);
+            UInt256 *txHashes = malloc(txCount*sizeof(*txHashes) + 1);
+            
+            assert(txHashes != NULL);
+            txCount = BRMerkleBlockTxHashes(block, txHashes, txCount);
+            
+            if (txCount > 0) {
+                BRWalletUpdateTransactions(manager->wallet, txHashes, txCount, block->height,
+                                           block->timestamp/2 + prev->timestamp/2);
+                
+                if (manager->watchWallet) {
+                    BRWatchWalletUpdateTransactions(manager->watchWallet, txHashes, txCount, block->height);
+                }
+                
+                _BRPeerManagerSaveProofs(manager, block, txHashes, txCount);
+            }
+            
+            free(txHashes);
+            BRMerkleBlockFree(prev);
+            manager->rangeBlock = block;
+            if (block->height >= manager->rangeEndHeight) done = 1;
+        }
+    }
+    
+    if (done) {
+        peer_log(peer, "range rescan %s at height %"PRIu32, (error) ? "failed" : "done", manager->rangeBlock->height);
+        info = manager->rangeInfo;
+        callback = manager->rangeCallback;
+        BRMerkleBlockFree(manager->rangeBlock);
+        manager->rangeBlock = NULL;
+        manager->rangePeer = NULL;
+        
+        // stop the block download, the peer is replaced like any other disconnected peer
+        if (error) _BRPeerManagerPeerMisbehavin(manager, peer);
+        else BRPeerDisconnect(peer);
+        
+        if (! error) { // wallet may have new unspent outputs, so filters are rebuilt to follow them
+            if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
+            manager->bloomFilter = NULL;
+            _BRPeerManagerUpdateFilter(manager);
+        }
+    }
+    
+    pthread_mutex_unlock(&manager->lock);
+    if (callback) callback(info, error);
+    if (done && manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+    return 1;
+}
+
 static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
@@ -1223,17 +1752,31 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             *txHashes = (sizeof(UInt256)*txCount <= 0x1000) ? _txHashes : malloc(txCount*sizeof(*txHashes));
     size_t i, fpCount = 0, saveCount = 0;
     BRMerkleBlock orphan, *b, *b2, *prev, *next = NULL;
+    UInt256 savedHash = UINT256_ZERO;
     uint32_t txTime = 0;
     
     assert(txHashes != NULL);
     txCount = BRMerkleBlockTxHashes(block, txHashes, txCount);
     
+    if (_BRPeerManagerRangeRelayedBlock(manager, peer, block)) { // block was downloaded for a range rescan
+        if (txHashes != _txHashes) free(txHashes);
+        return;
+    }
+    
     pthread_mutex_lock(&manager->lock);
     prev = BRSetGet(manager->blocks, &block->prevBlock);
 
     if (prev) {
         txTime = block->timestamp/2 + prev->timestamp/2;
         block->height = prev->height + 1;
+        BRMerkleBlockSetAncestry(block, prev); // carries forward what difficulty verification needs from prev
+    }
+    
+    // the bytes block was parsed from are only reused if it's saved, which happens when it extends the main chain at a
+    // save interval or completes the chain download
+    if (! prev || ! UInt256Eq(block->prevBlock, manager->lastBlock->blockHash) ||
+        ((block->height % SAVE_BLOCK_INTERVAL) != 0 && block->height != manager->estimatedHeight)) {
+        BRMerkleBlockClearRaw(block);
     }
     
     // track the observed bloom filter false positive rate using a low pass filter to smooth out variance
@@ -1312,18 +1855,20 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             peer_log(peer, "adding block #%"PRIu32", false positive rate: %f", block->height, manager->fpRate);
         }
         
-        BRSetAdd(manager->blocks, block);
+        _BRPeerManagerAddBlock(manager, block);
         manager->lastBlock = block;
-        
-        // clear some memory
-        _BRPeerManagerClearMemory(manager);
+        _BRPeerManagerIndexBlock(manager, block);
+        _BRPeerManagerCacheBlock(manager, block);
+        _BRPeerManagerPruneBlocks(manager);
         
         if (txCount > 0) _BRPeerManagerUpdateTx(manager, txHashes, txCount, block->height, txTime);
+        if (txCount > 0) _BRPeerManagerSaveProofs(manager, block, txHashes, txCount);
         if (manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, block->height);
             
         if (block->height < manager->estimatedHeight && peer == manager->downloadPeer) {
             BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule sync timeout
             manager->connectFailureCount = 0; // reset failure count once we know our initial request didn't timeout
+            _BRPeerManagerDownloadProgress(manager, peer);
         }
         
         if ((block->height % SAVE_BLOCK_INTERVAL) == 0)
@@ -1339,16 +1884,14 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             peer_log(peer, "relayed existing block #%"PRIu32, block->height);
         }
         
-        b = manager->lastBlock;
-        while (b && b->height > block->height)
-            b = BRSetGet(manager->blocks, &b->prevBlock); // is block in main chain?
-        
-        if (BRMerkleBlockEq(b, block)) { // if it's not on a fork, set block heights for its transactions
+        if (_BRPeerManagerIsMainChain(manager, block)) { // if it's not on a fork, set block heights for its transactions
             if (txCount > 0) _BRPeerManagerUpdateTx(manager, txHashes, txCount, block->height, txTime);
+            if (txCount > 0) _BRPeerManagerSaveProofs(manager, block, txHashes, txCount);
+            _BRPeerManagerCacheBlock(manager, block);
             if (block->height == manager->lastBlock->height) manager->lastBlock = block;
         }
         
-        b = BRSetAdd(manager->blocks, block);
+        b = _BRPeerManagerAddBlock(manager, block);
         
         // check if another block with equal hash existed
         if (b != block) {
@@ -1372,20 +1915,32 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     }
     else { // new block is on a fork
         peer_log(peer, "chain fork reached height %"PRIu32, block->height);
-        BRSetAdd(manager->blocks, block);
-
-        if (block->height > manager->lastBlock->height) { // check if fork is now longer than main chain
-            b = block;
-            b2 = manager->lastBlock;
-            
-            while (b && b2 && ! BRMerkleBlockEq(b, b2)) { // walk back to where the fork joins the main chain
-                b = BRSetGet(manager->blocks, &b->prevBlock);
-                if (b && b->height < b2->height) b2 = BRSetGet(manager->blocks, &b2->prevBlock);
-            }
-            
+        _BRPeerManagerAddBlock(manager, block);
+        b = block;
+        while (b && b->height > manager->lastBlock->height) b = BRSetGet(manager->blocks, &b->prevBlock);
+        b2 = (b) ? _BRPeerManagerMainChainBlock(manager, b->height) : NULL;
+        
+        // walk back the fork to where it joins the main chain, the main chain block at each height is found with a
+        // height index lookup, and the main chain is only walked back along with the fork below the indexed heights
+        while (b && b2 && ! BRMerkleBlockEq(b, b2)) {
+            b = BRSetGet(manager->blocks, &b->prevBlock);
+            b2 = (b && _BRPeerManagerIsIndexed(manager, b->height)) ? _BRPeerManagerMainChainBlock(manager, b->height) :
+                 BRSetGet(manager->blocks, &b2->prevBlock);
+        }
+        
+        if (! b2) b = NULL;
+        
+        // check if fork now has more work than main chain, chainwork of both branches is only comparable if they were
+        // connected from the join point since the chain was last loaded or rescanned, otherwise fall back to height
+        if (b && ((b->height >= manager->chainWorkHeight) ?
+                  UInt256Compare(block->chainWork, manager->lastBlock->chainWork) > 0 :
+                  block->height > manager->lastBlock->height)) {
+            b2 = b;
             peer_log(peer, "reorganizing chain from height %"PRIu32", new height is %"PRIu32, b->height, block->height);
         
             BRWalletSetTxUnconfirmedAfter(manager->wallet, b->height); // mark tx after the join point as unconfirmed
+            if (manager->watchWallet) BRWatchWalletSetTxUnconfirmedAfter(manager->watchWallet, b->height);
+            if (manager->blockCache) BRBlockCacheTruncate(manager->blockCache, b->height);
 
             b = block;
         
@@ -1401,14 +1956,32 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
                 }
                 
                 count = BRMerkleBlockTxHashes(b, txHashes, count);
+                _BRPeerManagerIndexBlock(manager, b);
+                if (count > 0) _BRPeerManagerSaveProofs(manager, b, txHashes, count);
                 b = BRSetGet(manager->blocks, &b->prevBlock);
                 if (b) timestamp = timestamp/2 + b->timestamp/2;
                 if (count > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, count, height, timestamp);
+                
+                if (count > 0 && manager->watchWallet) {
+                    BRWatchWalletUpdateTransactions(manager->watchWallet, txHashes, count, height);
+                }
             }
         
             if (block)
             manager->lastBlock = block;
             
+            if (manager->blockCache) { // cache the new main chain in block order
+                BRMerkleBlock **branch;
+                
+                array_new(branch, block->height - b2->height);
+                for (b = block; b && b->height > b2->height; b = BRSetGet(manager->blocks, &b->prevBlock)) {
+                    array_add(branch, b);
+                }
+                
+                for (i = array_count(branch); i > 0; i--) _BRPeerManagerCacheBlock(manager, branch[i - 1]);
+                array_free(branch);
+            }
+            
             if (block->height == manager->estimatedHeight) { // chain download is complete
                 saveCount = SAVE_BLOCK_COUNT;
                 _BRPeerManagerLoadMempools(manager);
@@ -1439,13 +2012,22 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
 
     
     /* save the blocks */
+    if (i > 0) savedHash = block->blockHash, manager->blockSaves++;
     pthread_mutex_unlock(&manager->lock);
+    if (i > 0 && manager->store) BRStoreSaveBlocks(manager->store, REPLACE_SAVED_BLOCKS, saveBlocks, i);
     
     if (i > 0 && manager->saveBlocks) {
         debug_log("[STATS]: orphan_count = %ld, block_count = %ld\n", BRSetCount(manager->orphans), BRSetCount(manager->blocks));
         manager->saveBlocks(manager->info, REPLACE_SAVED_BLOCKS, saveBlocks, i, (uint64_t*) &stackIntegrityCheck);
     }
     
+    if (i > 0) { // release the wire bytes of the saved block, unless another save may still be reading them
+        pthread_mutex_lock(&manager->lock);
+        b = BRSetGet(manager->blocks, &savedHash);
+        if (--manager->blockSaves == 0 && b) BRMerkleBlockClearRaw(b);
+        pthread_mutex_unlock(&manager->lock);
+    }
+    
     if (block && block->height != BLOCK_UNKNOWN_HEIGHT && block->height >= BRPeerLastBlock(peer) &&
         manager->txStatusUpdate) {
         manager->txStatusUpdate(manager->info); // notify that transaction confirmations may have changed
@@ -1534,11 +2116,8 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
                 error = EINVAL;
                 array_rm(manager->publishedTx, i - 1);
                 array_rm(manager->publishedTxHashes, i - 1);
-                
-                if (! BRWalletTransactionForHash(manager->wallet, txHash)) {
-                    BRTransactionFree(tx);
-                    tx = NULL;
-                }
+                BRTransactionFree(tx);
+                tx = BRWalletTransactionForHash(manager->wallet, txHash);
             }
         }
         else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
@@ -1551,7 +2130,7 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
 
     if (tx && ! error) {
         _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
-        BRWalletRegisterTransaction(manager->wallet, tx);
+        BRWalletRegisterSharedTransaction(manager->wallet, tx);
     }
     
 //    pingInfo = calloc(1, sizeof(*pingInfo));
@@ -1560,6 +2139,7 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
 //    pingInfo->manager = manager;
 //    pingInfo->hash = txHash;
 //    BRPeerSendPing(peer, pingInfo, _peerRequestedTxPingDone);
+    if (tx) BRTransactionRetain(tx); // retained while locked so the peer thread can serialize tx after it's unlocked
     pthread_mutex_unlock(&manager->lock);
     if (txCallback) txCallback(txInfo, error);
     return tx;
@@ -1592,11 +2172,16 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
 }
 
 // returns a newly allocated BRPeerManager struct that must be freed by calling BRPeerManagerFree()
+// headers in blocks newer than one week before earliestKeyTime, such as the end of a header snapshot made after the
+// wallet was created, are freed and synced again as merkleblocks, so they can't hide wallet transactions
 BRPeerManager *BRPeerManagerNewEx(const BRChainParams *params, BRWallet *wallet, uint32_t earliestKeyTime,
                                 BRMerkleBlock *blocks[], size_t blocksCount, const BRPeer peers[], size_t peersCount, BRMerkleBlock* startSyncFrom)
 {
     BRPeerManager *manager = calloc(1, sizeof(*manager));
-    BRMerkleBlock orphan, *block = NULL;
+    BRMerkleBlock *block = NULL, **chain;
+    const BRCheckPoint *checkpoint;
+    BRSet *saved;
+    size_t i;
     
     assert(manager != NULL);
     assert(params != NULL);
@@ -1608,67 +2193,92 @@ BRPeerManager *BRPeerManagerNewEx(const BRChainParams *params, BRWallet *wallet,
     manager->earliestKeyTime = earliestKeyTime;
     manager->averageTxPerBlock = 1400;
     manager->maxConnectCount = PEER_MAX_CONNECTIONS;
-    array_new(manager->peers, peersCount);
-    if (peers)
-        array_add_array(manager->peers, peers, peersCount);
-    qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
+    manager->peerStore = BRPeerStoreNew();
+    
+    for (size_t i = 0; peers && i < peersCount; i++) { // peers that scored before were connected to successfully
+        if (peers[i].score > 0) BRPeerStoreMarkGood(manager->peerStore, &peers[i]);
+        else BRPeerStoreAdd(manager->peerStore, &peers[i]);
+    }
+    
     array_new(manager->connectedPeers, PEER_MAX_CONNECTIONS);
+    array_new(manager->peerStats, PEER_MAX_CONNECTIONS);
     
     manager->blocks = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, blocksCount);
     manager->orphans = BRSetNew(_BRPrevBlockHash, _BRPrevBlockEq, blocksCount); // orphans are indexed by prevBlock
-    manager->checkpoints = BRSetNew(_BRBlockHeightHash, _BRBlockHeightEq, 100); // checkpoints are indexed by height
     manager->startSyncFrom = NULL;
+    manager->cacheTx = BRSetNew(BRTransactionHash, BRTransactionEq, 10);
+    queue_new(manager->cacheTxQueue, 10);
+    manager->retention = BR_BLOCK_RETENTION_DEFAULT;
+    queue_new(manager->retainedBlocks, blocksCount + 100);
     
     if (startSyncFrom) {
         manager->startSyncFrom = startSyncFrom;
         manager->earliestKeyTime = startSyncFrom->timestamp;
-        BRSetAdd(manager->checkpoints, startSyncFrom);
         BRSetAdd(manager->blocks, startSyncFrom);
         manager->lastBlock = startSyncFrom;
     }
     
+    checkpoint = _BRPeerManagerStartCheckpoint(manager);
+    
     for (size_t i = 0; i < manager->params->checkpointsCount; i++) {
         block = BRMerkleBlockNew();
         block->height = manager->params->checkpoints[i].height;
         block->blockHash = UInt256Reverse(manager->params->checkpoints[i].hash);
         block->timestamp = manager->params->checkpoints[i].timestamp;
         block->target = manager->params->checkpoints[i].target;
-        
-        BRSetAdd(manager->checkpoints, block);
         BRSetAdd(manager->blocks, block);
-        
-        if ((i == 0 && !startSyncFrom) || block->timestamp + 7*24*60*60 < manager->earliestKeyTime)
-            manager->lastBlock = block;
+        if (&manager->params->checkpoints[i] == checkpoint) manager->lastBlock = block;
     }
     
     block = NULL;
+    saved = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, blocksCount);
     
     for (size_t i = 0; blocks && i < blocksCount; i++) {
         
         // height must be saved/restored along with serialized block
         assert(blocks[i]->height != BLOCK_UNKNOWN_HEIGHT);
-        
-        // add to orphans
-        BRSetAdd(manager->orphans, blocks[i]);
+        BRMerkleBlockClearRaw(blocks[i]); // already saved, the bytes they were parsed from aren't needed
+        BRSetAdd(saved, blocks[i]);
 
-        // find last transition block
+        // find the last block
         if (!block || blocks[i]->height > block->height)
             block = blocks[i];
     }
     
+    // the last block and the blocks it links back to join the chain lowest first, such as a header snapshot loaded
+    // with BRHeaderSnapshotParse(), any others are kept as orphans
+    array_new(chain, BRSetCount(saved));
+    
     while (block) {
-        BRSetAdd(manager->blocks, block);
-        manager->lastBlock = block;
-        orphan.prevBlock = block->prevBlock;
-        BRSetRemove(manager->orphans, &orphan);
-        orphan.prevBlock = block->blockHash;
-        block = BRSetGet(manager->orphans, &orphan);
+        array_add(chain, block);
+        BRSetRemove(saved, block);
+        block = BRSetGet(saved, &block->prevBlock);
+    }
+    
+    // like the start checkpoint, headers stop a week before earliestKeyTime, since a header's transactions aren't known
+    // (it's a header if it has 0 totalTx), so a snapshot newer than the wallet doesn't skip any wallet transactions
+    for (i = array_count(chain); i > 0; i--) {
+        if (chain[i - 1]->totalTx == 0 &&
+            chain[i - 1]->timestamp + 7*24*60*60 > manager->earliestKeyTime + 2*60*60) break;
+        block = _BRPeerManagerAddBlock(manager, chain[i - 1]); // replaces a checkpoint with the full block
+        if (block && block != chain[i - 1] && block != manager->startSyncFrom) BRMerkleBlockFree(block);
+        manager->lastBlock = chain[i - 1];
+    }
+    
+    for (size_t j = 0; blocks && j < blocksCount; j++) {
+        if (BRSetGet(saved, blocks[j]) == blocks[j]) BRSetAdd(manager->orphans, blocks[j]);
     }
     
+    for (; i > 0; i--) BRMerkleBlockFree(chain[i - 1]); // synced again as merkleblocks
+    array_free(chain);
+    BRSetFree(saved);
+    
     if (startSyncFrom) {
         manager->lastBlock = startSyncFrom;
     }
     
+    _BRPeerManagerResetChainIndex(manager);
+    manager->chainWorkHeight = manager->lastBlock->height;
     printf("Starting sync from height: %d\n", manager->lastBlock->height);
     printf("Starting sync from timestamp: %d\n", manager->lastBlock->timestamp);
     
@@ -1677,6 +2287,7 @@ BRPeerManager *BRPeerManagerNewEx(const BRChainParams *params, BRWallet *wallet,
     array_new(manager->publishedTx, 10);
     array_new(manager->publishedTxHashes, 10);
     pthread_mutex_init(&manager->lock, NULL);
+    pthread_cond_init(&manager->peersCond, NULL);
     manager->threadCleanup = _dummyThreadCleanup;
     return manager;
 }
@@ -1720,8 +2331,62 @@ void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t
     BRPeerManagerDisconnect(manager);
     pthread_mutex_lock(&manager->lock);
     manager->maxConnectCount = UInt128IsZero(address) ? PEER_MAX_CONNECTIONS : 1;
-    manager->fixedPeer = ((BRPeer) { address, port, 0, 0, 0 });
-    array_clear(manager->peers);
+    manager->fixedPeer = ((BRPeer) { address, port, 0, 0, 0, 0 });
+    BRPeerStoreClear(manager->peerStore);
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// sets the policy for releasing old blocks from memory, BR_BLOCK_RETENTION_DEFAULT is used until this is called
+// reorgDepth is raised to SAVE_BLOCK_COUNT if it's lower, since that many blocks are passed to saveBlocks()
+void BRPeerManagerSetBlockRetention(BRPeerManager *manager, BRBlockRetention retention)
+{
+    assert(manager != NULL);
+    if (retention.reorgDepth < SAVE_BLOCK_COUNT) retention.reorgDepth = SAVE_BLOCK_COUNT;
+    pthread_mutex_lock(&manager->lock);
+    manager->retention = retention;
+    _BRPeerManagerPruneBlocks(manager);
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// sets a cache of downloaded filtered blocks that rescans use instead of the network when it covers them, or NULL
+// the cache is filled as blocks are downloaded, and must not be freed while set, it can be saved to disk with
+// BRBlockCacheSerialize() whenever the saveBlocks() callback fires
+void BRPeerManagerSetBlockCache(BRPeerManager *manager, BRBlockCache *cache)
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    manager->blockCache = cache;
+    BRSetApply(manager->cacheTx, NULL, _setApplyFreeTx);
+    BRSetClear(manager->cacheTx);
+    queue_clear(manager->cacheTxQueue);
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// sets a store that blocks and peers are saved to whenever the saveBlocks() and savePeers() callbacks fire, or NULL to
+// stop saving to a store, store must not be freed while it's set on the manager
+void BRPeerManagerSetStore(BRPeerManager *manager, BRStore *store)
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    manager->store = store;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// sets a watch-only wallet to keep in sync alongside the wallet, or NULL to stop, its addresses and unspent outputs
+// are added to the bloom filter, and relayed, confirmed, reorged and dropped transactions are passed on to it
+// watch must not be freed while it's set on the manager
+void BRPeerManagerSetWatchWallet(BRPeerManager *manager, BRWatchWallet *watch)
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    manager->watchWallet = watch;
+    
+    if (manager->bloomFilter) { // reset bloom filter so it's recreated with the watch wallet addresses
+        BRBloomFilterFree(manager->bloomFilter);
+        manager->bloomFilter = NULL;
+        _BRPeerManagerUpdateFilter(manager);
+    }
+    
     pthread_mutex_unlock(&manager->lock);
 }
 
@@ -1746,6 +2411,8 @@ BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager)
 // connect to bitcoin peer-to-peer network (also call this whenever networkIsReachable() status changes)
 void BRPeerManagerConnect(BRPeerManager *manager)
 {
+    size_t readyCount = 0, pendingCount = 0;
+    
     assert(manager != NULL);
     pthread_mutex_lock(&manager->lock);
     if (manager->connectFailureCount >= MAX_CONNECT_FAILURES) manager->connectFailureCount = 0; //this is a manual retry
@@ -1761,51 +2428,45 @@ void BRPeerManagerConnect(BRPeerManager *manager)
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
         BRPeer *p = manager->connectedPeers[i - 1];
 
-        if (BRPeerConnectStatus(p) == BRPeerStatusConnecting) BRPeerConnect(p);
+        if (BRPeerConnectStatus(p) == BRPeerStatusConnecting) BRPeerConnect(p), pendingCount++;
+        else if (BRPeerConnectStatus(p) == BRPeerStatusConnected) readyCount++;
     }
     
-    if (array_count(manager->connectedPeers) < manager->maxConnectCount) {
+    // race PEER_RACE_FACTOR staggered connection attempts for each peer still needed, and keep the first to connect
+    if (readyCount < manager->maxConnectCount) {
         time_t now = time(NULL);
-        BRPeer *peers;
+        size_t raceCount = (manager->maxConnectCount - readyCount)*PEER_RACE_FACTOR, startCount = 0, peersCount;
+        BRPeer peers[100];
 
-		if ((array_count(manager->peers) < (4 * manager->maxConnectCount)) ||
-			((manager->peers[manager->maxConnectCount - 1].timestamp + 3*24*60*60) < now)) {
+        if (BRPeerStoreCount(manager->peerStore) < 4*manager->maxConnectCount ||
+            BRPeerStoreCountSince(manager->peerStore, now - 3*24*60*60) < manager->maxConnectCount) {
             _BRPeerManagerFindPeers(manager);
         }
         
-        array_new(peers, 100);
-        array_add_array(peers, manager->peers,
-                        (array_count(manager->peers) < 100) ? array_count(manager->peers) : 100);
+        // random peers, weighted toward peers with more recent timestamps and peers that scored better before
+        peersCount = BRPeerStoreSelect(manager->peerStore, peers, sizeof(peers)/sizeof(*peers), now);
 
-        while ((array_count(peers) > 0) && (array_count(manager->connectedPeers) < manager->maxConnectCount)) {
-            size_t i = BRRand((uint32_t)array_count(peers)); // index of random peer
+        for (size_t i = 0; i < peersCount && pendingCount < raceCount; i++) {
             BRPeerCallbackInfo *info;
-            
-            i = i*i/array_count(peers); // bias random peer selection toward peers with more recent timestamp
+            size_t j = array_count(manager->connectedPeers);
         
-            for (size_t j = array_count(manager->connectedPeers); i != SIZE_MAX && j > 0; j--) {
-                if (! BRPeerEq(&peers[i], manager->connectedPeers[j - 1])) continue;
-                array_rm(peers, i); // already in connectedPeers
-                i = SIZE_MAX;
-            }
+            while (j > 0 && ! BRPeerEq(&peers[i], manager->connectedPeers[j - 1])) j--;
             
-            if (i != SIZE_MAX) {
+            if (j == 0) { // not already in connectedPeers
                 info = calloc(1, sizeof(*info));
                 assert(info != NULL);
                 info->manager = manager;
                 info->peer = BRPeerNew(manager->params->magicNumber);
                 *info->peer = peers[i];
-                array_rm(peers, i);
                 array_add(manager->connectedPeers, info->peer);
                 BRPeerSetCallbacks(info->peer, info, _peerConnected, _peerDisconnected, _peerRelayedPeers,
                                    _peerRelayedTx, _peerHasTx, _peerRejectedTx, _peerRelayedBlock, _peerDataNotfound,
                                    _peerSetFeePerKb, _peerRequestedTx, _peerNetworkIsReachable, _peerThreadCleanup);
                 BRPeerSetEarliestKeyTime(info->peer, manager->earliestKeyTime);
-                BRPeerConnect(info->peer);
+                BRPeerConnectAfter(info->peer, PEER_RACE_STAGGER*startCount++);
+                pendingCount++;
             }
         }
-
-        array_free(peers);
     }
     
     if (array_count(manager->connectedPeers) == 0) {
@@ -1819,41 +2480,41 @@ void BRPeerManagerConnect(BRPeerManager *manager)
 
 void BRPeerManagerDisconnect(BRPeerManager *manager)
 {
-    struct timespec ts;
-    size_t peerCount, dnsThreadCount;
-    
     assert(manager != NULL);
     pthread_mutex_lock(&manager->lock);
-    peerCount = array_count(manager->connectedPeers);
-    dnsThreadCount = manager->dnsThreadCount;
     
-    for (size_t i = peerCount; i > 0; i--) {
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
         manager->connectFailureCount = MAX_CONNECT_FAILURES; // prevent futher automatic reconnect attempts
         BRPeerDisconnect(manager->connectedPeers[i - 1]);
     }
     
-    pthread_mutex_unlock(&manager->lock);
-    ts.tv_sec = 0;
-    ts.tv_nsec = 1;
-    
-    while (peerCount > 0 || dnsThreadCount > 0) {
-        nanosleep(&ts, NULL); // pthread_yield() isn't POSIX standard :(
-        pthread_mutex_lock(&manager->lock);
-        peerCount = array_count(manager->connectedPeers);
-        dnsThreadCount = manager->dnsThreadCount;
-        pthread_mutex_unlock(&manager->lock);
+    while (array_count(manager->connectedPeers) > 0 || manager->dnsThreadCount > 0) {
+        pthread_cond_wait(&manager->peersCond, &manager->lock); // releases the lock until a peer or seed finishes
     }
+    
+    pthread_mutex_unlock(&manager->lock);
 }
 
 // rescans blocks and transactions after earliestKeyTime (a new random download peer is also selected due to the
 // possibility that a malicious node might lie by omitting transactions that match the bloom filter)
 void BRPeerManagerRescan(BRPeerManager *manager)
 {
+    uint32_t height = 0;
+    
     assert(manager != NULL);
     pthread_mutex_lock(&manager->lock);
     
-    if (manager->isConnected) {
+    if (manager->startSyncFrom != NULL) height = manager->startSyncFrom->height;
+    else height = _BRPeerManagerStartCheckpoint(manager)->height;
+    
+    if (_BRPeerManagerRescanCached(manager, height)) { // the block cache holds everything the rescan would download
+        pthread_mutex_unlock(&manager->lock);
+        if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
+    }
+    else if (manager->isConnected) {
         // start the chain download from the most recent checkpoint that's at least a week older than earliestKeyTime
+        // blocks up to the current tip are downloaded again, so until they are, forks below it are compared by height
+        if (manager->lastBlock->height > manager->chainWorkHeight) manager->chainWorkHeight = manager->lastBlock->height;
         
         if (manager->startSyncFrom != NULL) {
             // There is a block, from which we want to start the sync
@@ -1861,23 +2522,17 @@ void BRPeerManagerRescan(BRPeerManager *manager)
             manager->lastBlock = manager->startSyncFrom;
             BRSetAdd(manager->blocks, manager->lastBlock);
         } else {
-            for (size_t i = manager->params->checkpointsCount; i > 0; i--) {
-                if (i - 1 == 0 || manager->params->checkpoints[i - 1].timestamp + 7*24*60*60 < manager->earliestKeyTime) {
-                    UInt256 hash = UInt256Reverse(manager->params->checkpoints[i - 1].hash);
-
-                    BRMerkleBlock* temp = BRSetGet(manager->blocks, &hash);
-                    if (temp != NULL)
-                        manager->lastBlock = temp;
-                    break;
-                }
-            }
+            UInt256 hash = UInt256Reverse(_BRPeerManagerStartCheckpoint(manager)->hash);
+            BRMerkleBlock* temp = BRSetGet(manager->blocks, &hash);
+            
+            if (temp != NULL)
+                manager->lastBlock = temp;
         }
         
+        _BRPeerManagerResetChainIndex(manager);
+        
         if (manager->downloadPeer) { // disconnect the current download peer so a new random one will be selected
-            for (size_t i = array_count(manager->peers); i > 0; i--) {
-                if (BRPeerEq(&manager->peers[i - 1], manager->downloadPeer)) array_rm(manager->peers, i - 1);
-            }
-            
+            BRPeerStoreRemove(manager->peerStore, manager->downloadPeer);
             BRPeerDisconnect(manager->downloadPeer);
         }
 
@@ -1888,6 +2543,85 @@ void BRPeerManagerRescan(BRPeerManager *manager)
     else pthread_mutex_unlock(&manager->lock);
 }
 
+// rescans only the blocks from startHeight through endHeight for tx matching addrs, downloading them from a connected
+// peer other than the download peer with a filter that contains only addrs, while normal syncing continues
+// the download starts after the main chain block before startHeight, or after the last checkpoint before it if that
+// block is no longer in memory, and stops at the main chain block at endHeight if it's known
+// addrs must already be wallet addresses, such as addresses past the gap limit generated by BRWalletUnusedAddrs()
+// callback is called with error 0 once endHeight is reached, or an errno.h code if the rescan was abandoned
+// returns true if the rescan was started, or false if one is already running or no peer has the blocks
+int BRPeerManagerRescanRange(BRPeerManager *manager, uint32_t startHeight, uint32_t endHeight, const BRAddress addrs[],
+                             size_t addrsCount, void *info, void (*callback)(void *info, int error))
+{
+    const BRCheckPoint *checkpoint = NULL;
+    BRMerkleBlock *start = NULL, *stop;
+    BRPeer *peer = NULL;
+    BRBloomFilter *filter;
+    UInt256 locator;
+    int r = 0;
+    
+    assert(manager != NULL);
+    assert(addrs != NULL || addrsCount == 0);
+    assert(startHeight <= endHeight);
+    pthread_mutex_lock(&manager->lock);
+    
+    // start after the main chain block before the range, or the last checkpoint before it if that isn't known
+    if (startHeight > 0) start = _BRPeerManagerMainChainBlock(manager, startHeight - 1);
+    if (! start && startHeight > 0) checkpoint = BRChainParamsCheckpointBeforeHeight(manager->params, startHeight - 1);
+    if (! start && ! checkpoint) checkpoint = &manager->params->checkpoints[0];
+    stop = _BRPeerManagerMainChainBlock(manager, endHeight);
+    
+    for (size_t i = array_count(manager->connectedPeers); ! manager->rangePeer && i > 0; i--) {
+        BRPeer *p = manager->connectedPeers[i - 1];
+        
+        if (p == manager->downloadPeer || BRPeerConnectStatus(p) != BRPeerStatusConnected ||
+            BRPeerLastBlock(p) < endHeight) continue;
+        if (! peer || BRPeerPingTime(p) < BRPeerPingTime(peer)) peer = p;
+    }
+    
+    if (peer) {
+        filter = BRBloomFilterNew(BLOOM_DEFAULT_FALSEPOSITIVE_RATE, addrsCount + 100, (uint32_t)BRPeerHash(peer),
+                                  BLOOM_UPDATE_ALL);
+        
+        for (size_t i = 0; i < addrsCount; i++) {
+            UInt160 hash = UINT160_ZERO;
+            
+            BRAddressHash160(&hash, addrs[i].s);
+            
+            if (! UInt160IsZero(hash) && ! BRBloomFilterContainsData(filter, hash.u8, sizeof(hash))) {
+                BRBloomFilterInsertData(filter, hash.u8, sizeof(hash));
+            }
+        }
+        
+        uint8_t data[BRBloomFilterSerialize(filter, NULL, 0)];
+        size_t len = BRBloomFilterSerialize(filter, data, sizeof(data));
+        
+        BRBloomFilterFree(filter);
+        
+        if (start) manager->rangeBlock = BRMerkleBlockCopy(start); // keeps the windows to verify the next difficulty
+        else {
+            manager->rangeBlock = BRMerkleBlockNew();
+            manager->rangeBlock->height = checkpoint->height;
+            manager->rangeBlock->blockHash = UInt256Reverse(checkpoint->hash);
+            manager->rangeBlock->timestamp = checkpoint->timestamp;
+            manager->rangeBlock->target = checkpoint->target;
+        }
+        
+        locator = manager->rangeBlock->blockHash;
+        manager->rangePeer = peer;
+        manager->rangeEndHeight = endHeight;
+        manager->rangeInfo = info;
+        manager->rangeCallback = callback;
+        peer_log(peer, "range rescan from height %"PRIu32" to %"PRIu32, startHeight, endHeight);
+        BRPeerSendFilterload(peer, data, len);
+        BRPeerSendGetblocks(peer, &locator, 1, (stop) ? stop->blockHash : UINT256_ZERO);
+        r = 1;
+    }
+    
+    pthread_mutex_unlock(&manager->lock);
+    return r;
+}
+
 // the (unverified) best block height reported by connected peers
 uint32_t BRPeerManagerEstimatedBlockHeight(BRPeerManager *manager)
 {
@@ -1992,17 +2726,21 @@ static void _publishTxInvDone(void *info, int success)
     pthread_mutex_unlock(&manager->lock);
 }
 
-// publishes tx to bitcoin network (do not call BRTransactionFree() on tx afterward)
+// publishes tx to bitcoin network (do not call BRTransactionFree() on tx afterward, use BRTransactionRetain() first to
+// keep a reference), a tx already registered with the wallet stays owned by the wallet
 void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *info,
                             void (*callback)(void *info, int error))
 {
+    int isWalletTx = 0;
+    
     assert(manager != NULL);
     assert(tx != NULL && BRTransactionIsSigned(tx));
+    if (tx) isWalletTx = (BRWalletTransactionForHash(manager->wallet, tx->txHash) == tx);
     if (tx) pthread_mutex_lock(&manager->lock);
     
     if (tx && ! BRTransactionIsSigned(tx)) {
         pthread_mutex_unlock(&manager->lock);
-        BRTransactionFree(tx);
+        if (! isWalletTx) BRTransactionFree(tx);
         tx = NULL;
         if (callback) callback(info, EINVAL); // transaction not signed
     }
@@ -2013,7 +2751,7 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
 
         if (connectFailureCount >= MAX_CONNECT_FAILURES ||
             (manager->networkIsReachable && ! manager->networkIsReachable(manager->info))) {
-            BRTransactionFree(tx);
+            if (! isWalletTx) BRTransactionFree(tx);
             tx = NULL;
             if (callback) callback(info, ENOTCONN); // not connected to bitcoin network
         }
@@ -2025,6 +2763,7 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
         
         tx->timestamp = (uint32_t)time(NULL); // set timestamp to publish time
         _BRPeerManagerAddTxToPublishList(manager, tx, info, callback);
+        if (! isWalletTx) BRTransactionFree(tx); // the publish list retains tx, release the caller's reference
 
         for (i = array_count(manager->connectedPeers); i > 0; i--) {
             if (BRPeerConnectStatus(manager->connectedPeers[i - 1]) == BRPeerStatusConnected) count++;
@@ -2071,26 +2810,166 @@ size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash)
     return count;
 }
 
+// returns a merkle proof for the given confirmed wallet transaction built from the locally stored merkleblocks, or the
+// proof saved to the store set with BRPeerManagerSetStore() once the block is no longer in memory, the result must be
+// freed by calling BRMerkleProofFree(), or NULL if no proof is available
+BRMerkleProof *BRPeerManagerProofForTx(BRPeerManager *manager, UInt256 txHash)
+{
+    BRTransaction *tx;
+    BRMerkleBlock *block;
+    BRMerkleProof *proof = NULL;
+
+    assert(manager != NULL);
+    assert(! UInt256IsZero(txHash));
+    tx = BRWalletTransactionForHash(manager->wallet, txHash);
+    pthread_mutex_lock(&manager->lock);
+    block = (tx && tx->blockHeight != TX_UNCONFIRMED) ? manager->lastBlock : NULL;
+    while (block && block->height > tx->blockHeight) block = BRSetGet(manager->blocks, &block->prevBlock);
+    if (block && block->height == tx->blockHeight) proof = BRMerkleBlockProofForTx(block, txHash);
+    if (! proof && tx && tx->blockHeight != TX_UNCONFIRMED && manager->store) {
+        proof = BRStoreProofForTx(manager->store, txHash); // block was released, use the proof saved when it arrived
+    }
+    pthread_mutex_unlock(&manager->lock);
+    return proof;
+}
+
+// verifies proofs against the proof-of-work verified main chain block headers known to manager, taking the lock only
+// once, proofs for blocks on a fork or not in memory don't verify
+// writes true or false to results for each proof, and returns the number of proofs that verified
+size_t BRPeerManagerVerifyProofs(BRPeerManager *manager, const BRMerkleProof *proofs[], size_t proofsCount,
+                                 int results[])
+{
+    const BRMerkleBlock *block = NULL;
+    size_t count = 0;
+
+    assert(manager != NULL);
+    assert(proofs != NULL || proofsCount == 0);
+    assert(results != NULL || proofsCount == 0);
+    pthread_mutex_lock(&manager->lock);
+
+    for (size_t i = 0; i < proofsCount; i++) {
+        // proofs are usually grouped by block, so only do a new lookup when the block hash changes
+        if (! block || ! UInt256Eq(block->blockHash, proofs[i]->blockHash)) {
+            block = BRSetGet(manager->blocks, &proofs[i]->blockHash);
+        }
+
+        results[i] = (block && _BRPeerManagerIsMainChain(manager, block) && BRMerkleProofVerify(proofs[i], block));
+        if (results[i]) count++;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
+
+// writes a snapshot of the main chain from startHeight through the last block signed with key, that new installs can
+// load with BRHeaderSnapshotParse() instead of downloading headers, the snapshot starts later than startHeight if the
+// blocks from there aren't all in memory, see BRPeerManagerSetBlockRetention()
+// returns number of bytes written to buf, total bufLen needed if buf is NULL, or 0 if bufLen is too small
+size_t BRPeerManagerExportHeaders(BRPeerManager *manager, uint32_t startHeight, BRKey *key, uint8_t *buf,
+                                  size_t bufLen)
+{
+    BRMerkleBlock *b, **chain;
+    size_t i, count = 0, len = 0;
+    
+    assert(manager != NULL);
+    assert(key != NULL);
+    pthread_mutex_lock(&manager->lock);
+    
+    // checkpoints that haven't been replaced by the full block only hold a header hash, so the snapshot stops there
+    for (b = manager->lastBlock; b && b->height >= startHeight && ! UInt256IsZero(b->merkleRoot);
+         b = BRSetGet(manager->blocks, &b->prevBlock)) count++;
+    
+    chain = (count > 0) ? malloc(count*sizeof(*chain)) : NULL;
+    assert(chain != NULL || count == 0);
+    for (i = count, b = manager->lastBlock; i > 0; i--, b = BRSetGet(manager->blocks, &b->prevBlock)) chain[i - 1] = b;
+    if (count > 0) len = BRHeaderSnapshotSerialize(chain, count, key, buf, bufLen);
+    pthread_mutex_unlock(&manager->lock);
+    if (chain) free(chain);
+    return len;
+}
+
+// writes the heap memory used by the blocks, orphans, connected peers, stored peers, tx relay lists, published tx,
+// cached tx and bloom filter of manager to usage, and returns the number of entries written, or total usageCount
+// needed if usage is NULL
+// tx shared with the wallet are counted by both BRWalletMemoryUsage() and BRPeerManagerMemoryUsage()
+size_t BRPeerManagerMemoryUsage(BRPeerManager *manager, BRMemoryUsage usage[], size_t usageCount)
+{
+    BRMemoryUsage u[8];
+    size_t i = 0;
+    
+    assert(manager != NULL);
+    if (! usage) return sizeof(u)/sizeof(*u);
+    pthread_mutex_lock(&manager->lock);
+    u[i] = (BRMemoryUsage) { "blocks", BRSetCount(manager->blocks),
+                             BRSetMemoryUsage(manager->blocks) + queue_mem_size(manager->retainedBlocks) };
+    BRSetApply(manager->blocks, &u[i].size, _setApplyBlockMemoryUsage);
+    if (manager->rangeBlock) u[i].size += BRMerkleBlockMemoryUsage(manager->rangeBlock);
+    i++;
+    u[i] = (BRMemoryUsage) { "orphans", BRSetCount(manager->orphans), BRSetMemoryUsage(manager->orphans) };
+    BRSetApply(manager->orphans, &u[i++].size, _setApplyBlockMemoryUsage);
+    u[i] = (BRMemoryUsage) { "connected peers", array_count(manager->connectedPeers),
+                             array_mem_size(manager->connectedPeers) + array_mem_size(manager->peerStats) };
+    
+    for (size_t j = 0; j < array_count(manager->connectedPeers); j++) { // includes each peer's known hashes
+        u[i].size += BRPeerMemoryUsage(manager->connectedPeers[j]);
+    }
+    
+    i++;
+    u[i++] = (BRMemoryUsage) { "stored peers", BRPeerStoreCount(manager->peerStore),
+                               BRPeerStoreMemoryUsage(manager->peerStore) };
+    u[i] = (BRMemoryUsage) { "tx relay lists", array_count(manager->txRelays) + array_count(manager->txRequests),
+                             array_mem_size(manager->txRelays) + array_mem_size(manager->txRequests) };
+    for (size_t j = 0; j < array_count(manager->txRelays); j++) u[i].size += array_mem_size(manager->txRelays[j].peers);
+    for (size_t j = 0; j < array_count(manager->txRequests); j++) {
+        u[i].size += array_mem_size(manager->txRequests[j].peers);
+    }
+    
+    i++;
+    u[i] = (BRMemoryUsage) { "published tx", array_count(manager->publishedTx),
+                             array_mem_size(manager->publishedTx) + array_mem_size(manager->publishedTxHashes) };
+    for (size_t j = 0; j < array_count(manager->publishedTx); j++) {
+        u[i].size += BRTransactionMemoryUsage(manager->publishedTx[j].tx);
+    }
+    
+    i++;
+    u[i] = (BRMemoryUsage) { "cached tx", BRSetCount(manager->cacheTx),
+                             BRSetMemoryUsage(manager->cacheTx) + queue_mem_size(manager->cacheTxQueue) };
+    BRSetApply(manager->cacheTx, &u[i++].size, _setApplyTxMemoryUsage);
+    u[i++] = (BRMemoryUsage) { "bloom filter", (manager->bloomFilter) ? manager->bloomFilter->elemCount : 0,
+                               (manager->bloomFilter) ? sizeof(BRBloomFilter) + manager->bloomFilter->length : 0 };
+    pthread_mutex_unlock(&manager->lock);
+    
+    for (i = 0; i < usageCount && i < sizeof(u)/sizeof(*u); i++) usage[i] = u[i];
+    return i;
+}
+
 // frees memory allocated for manager
 void BRPeerManagerFree(BRPeerManager *manager)
 {
     assert(manager != NULL);
     pthread_mutex_lock(&manager->lock);
-    array_free(manager->peers);
+    BRPeerStoreFree(manager->peerStore);
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) BRPeerFree(manager->connectedPeers[i - 1]);
     array_free(manager->connectedPeers);
+    array_free(manager->peerStats);
     BRSetApply(manager->blocks, NULL, _setApplyFreeBlock);
     BRSetFree(manager->blocks);
+    queue_free(manager->retainedBlocks);
     BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
     BRSetFree(manager->orphans);
-    BRSetFree(manager->checkpoints);
     for (size_t i = array_count(manager->txRelays); i > 0; i--) free(manager->txRelays[i - 1].peers);
     array_free(manager->txRelays);
     for (size_t i = array_count(manager->txRequests); i > 0; i--) free(manager->txRequests[i - 1].peers);
     array_free(manager->txRequests);
+    for (size_t i = array_count(manager->publishedTx); i > 0; i--) BRTransactionFree(manager->publishedTx[i - 1].tx);
     array_free(manager->publishedTx);
     array_free(manager->publishedTxHashes);
+    BRSetApply(manager->cacheTx, NULL, _setApplyFreeTx);
+    BRSetFree(manager->cacheTx);
+    queue_free(manager->cacheTxQueue);
+    if (manager->rangeBlock) BRMerkleBlockFree(manager->rangeBlock);
     pthread_mutex_unlock(&manager->lock);
+    pthread_cond_destroy(&manager->peersCond);
     pthread_mutex_destroy(&manager->lock);
     free(manager);
 }
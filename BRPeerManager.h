@@ -29,6 +29,8 @@
 #include "BRMerkleBlock.h"
 #include "BRTransaction.h"
 #include "BRWallet.h"
+#include "BRWatchWallet.h"
+#include "BRBlockCache.h"
 #include "BRChainParams.h"
 #include <stddef.h>
 #include <inttypes.h>
@@ -51,18 +53,23 @@ Remarks:
     Since Digibyte makes use of DigiShield (or more specifically MultiShield), on each and
     every block there occurs a difficulty transition.
     We need to keep some blocks in memory in case of forks, to walk the chain backwards.
-    To clear memory we have introduced a trigger value: CLEAR_MEM_BLOCKS_COUNT_TRIGGER.
-    If the BRPeerManager instance contains more than CLEAR_MEM_BLOCKS_COUNT_TRIGGER blocks in 'blocks',
-    we trigger the memory cleanup. The first CLEAR_MEM_BLOCKS_COUNT_TAIL_LEN blocks will be freed up.
-    Note that we have to remove the tail, that is, we have to walk back the chain, until we reach the tail,
-    then free up the remaining blocks.
- 
-    CLEAR_MEM_BLOCKS_COUNT_TAIL_LEN is at least the SAVE_BLOCK_COUNT
-        plus a reserve of CLEAR_MEM_BLOCKS_RESERVE_COUNT blocks.
+    Blocks are released oldest first as new ones arrive, according to a BRBlockRetention policy.
+    By default at most CLEAR_MEM_BLOCKS_COUNT_TRIGGER blocks are kept, and the most recent SAVE_BLOCK_COUNT
+    plus a reserve of CLEAR_MEM_BLOCKS_RESERVE_COUNT blocks are never released.
 */
 #define CLEAR_MEM_BLOCKS_COUNT_TRIGGER 5000
 #define CLEAR_MEM_BLOCKS_RESERVE_COUNT 500
-#define CLEAR_MEM_BLOCKS_COUNT_TAIL_LEN (CLEAR_MEM_BLOCKS_COUNT_TRIGGER - SAVE_BLOCK_COUNT - CLEAR_MEM_BLOCKS_RESERVE_COUNT)
+
+typedef struct {
+    size_t maxBlocks; // number of blocks kept in memory before the oldest are released, 0 for no limit
+    size_t maxBytes; // heap memory blocks may use before the oldest are released, 0 for no limit
+    uint32_t reorgDepth; // blocks less than this far below the chain tip are never released, so forks can be followed
+    int keepCheckpoints; // true to never release blocks at checkpoint heights, which rescans start from
+    int keepTransitions; // true to never release blocks at multiples of SAVE_BLOCK_INTERVAL, they grow with the chain
+} BRBlockRetention;
+
+#define BR_BLOCK_RETENTION_DEFAULT\
+    ((BRBlockRetention) { CLEAR_MEM_BLOCKS_COUNT_TRIGGER, 0, SAVE_BLOCK_COUNT + CLEAR_MEM_BLOCKS_RESERVE_COUNT, 1, 0 })
     
 /* Readability constants */
 #define ADD_TO_SAVED_BLOCKS 0
@@ -75,6 +82,8 @@ BRPeerManager* BRPeerManagerNew(const BRChainParams* params, BRWallet* wallet, u
                                 BRMerkleBlock* blocks[], size_t blocksCount, const BRPeer peers[], size_t peersCount);
 
 // Extension of the above. Accepts a custom initial block
+// headers in blocks newer than one week before earliestKeyTime, such as the end of a header snapshot made after the
+// wallet was created, are freed and synced again as merkleblocks, so they can't hide wallet transactions
 BRPeerManager* BRPeerManagerNewEx(const BRChainParams* params, BRWallet* wallet, uint32_t earliestKeyTime,
                                   BRMerkleBlock* blocks[], size_t blocksCount, const BRPeer peers[], size_t peersCount, BRMerkleBlock* startSyncFrom);
     
@@ -102,9 +111,27 @@ void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
 // set address to UINT128_ZERO to revert to default behavior
 void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t port);
 
+// sets the policy for releasing old blocks from memory, BR_BLOCK_RETENTION_DEFAULT is used until this is called
+// reorgDepth is raised to SAVE_BLOCK_COUNT if it's lower, since that many blocks are passed to saveBlocks()
+void BRPeerManagerSetBlockRetention(BRPeerManager *manager, BRBlockRetention retention);
+
 // sets a custom start block
 void BRPeerManagerSetStartBlock(BRPeerManager* manager, BRMerkleBlock* start);
     
+// sets a cache of downloaded filtered blocks that rescans use instead of the network when it covers them, or NULL
+// the cache is filled as blocks are downloaded, and must not be freed while set, it can be saved to disk with
+// BRBlockCacheSerialize() whenever the saveBlocks() callback fires
+void BRPeerManagerSetBlockCache(BRPeerManager *manager, BRBlockCache *cache);
+
+// sets a store that blocks and peers are saved to whenever the saveBlocks() and savePeers() callbacks fire, or NULL to
+// stop saving to a store, store must not be freed while it's set on the manager
+void BRPeerManagerSetStore(BRPeerManager *manager, BRStore *store);
+
+// sets a watch-only wallet to keep in sync alongside the wallet, or NULL to stop, its addresses and unspent outputs
+// are added to the bloom filter, and relayed, confirmed, reorged and dropped transactions are passed on to it
+// watch must not be freed while it's set on the manager
+void BRPeerManagerSetWatchWallet(BRPeerManager *manager, BRWatchWallet *watch);
+
 // current connect status
 BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager);
 
@@ -116,8 +143,20 @@ void BRPeerManagerDisconnect(BRPeerManager *manager);
 
 // rescans blocks and transactions after earliestKeyTime (a new random download peer is also selected due to the
 // possibility that a malicious node might lie by omitting transactions that match the bloom filter)
+// if the block cache holds every block since then filtered for all wallet addresses, the rescan is done locally from
+// the cache, even when not connected, and trusts the peers the blocks were downloaded from
 void BRPeerManagerRescan(BRPeerManager *manager);
 
+// rescans only the blocks from startHeight through endHeight for tx matching addrs, downloading them from a connected
+// peer other than the download peer with a filter that contains only addrs, while normal syncing continues
+// the download starts after the main chain block before startHeight, or after the last checkpoint before it if that
+// block is no longer in memory, and stops at the main chain block at endHeight if it's known
+// addrs must already be wallet addresses, such as addresses past the gap limit generated by BRWalletUnusedAddrs()
+// callback is called with error 0 once endHeight is reached, or an errno.h code if the rescan was abandoned
+// returns true if the rescan was started, or false if one is already running or no peer has the blocks
+int BRPeerManagerRescanRange(BRPeerManager *manager, uint32_t startHeight, uint32_t endHeight, const BRAddress addrs[],
+                             size_t addrsCount, void *info, void (*callback)(void *info, int error));
+
 // the (unverified) best block height reported by connected peers
 uint32_t BRPeerManagerEstimatedBlockHeight(BRPeerManager *manager);
 
@@ -137,13 +176,38 @@ size_t BRPeerManagerPeerCount(BRPeerManager *manager);
 // description of the peer most recently used to sync blockchain data
 const char *BRPeerManagerDownloadPeerName(BRPeerManager *manager);
 
-// publishes tx to bitcoin network (do not call BRTransactionFree() on tx afterward)
+// publishes tx to bitcoin network (do not call BRTransactionFree() on tx afterward, use BRTransactionRetain() first to
+// keep a reference), a tx already registered with the wallet stays owned by the wallet
 void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *info,
                             void (*callback)(void *info, int error));
 
 // number of connected peers that have relayed the given unconfirmed transaction
 size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash);
 
+// returns a merkle proof for the given confirmed wallet transaction built from the locally stored merkleblocks, or the
+// proof saved to the store set with BRPeerManagerSetStore() once the block is no longer in memory, the result must be
+// freed by calling BRMerkleProofFree(), or NULL if no proof is available
+BRMerkleProof *BRPeerManagerProofForTx(BRPeerManager *manager, UInt256 txHash);
+
+// verifies proofs against the proof-of-work verified main chain block headers known to manager, taking the lock only
+// once, proofs for blocks on a fork or not in memory don't verify
+// writes true or false to results for each proof, and returns the number of proofs that verified
+size_t BRPeerManagerVerifyProofs(BRPeerManager *manager, const BRMerkleProof *proofs[], size_t proofsCount,
+                                 int results[]);
+
+// writes a snapshot of the main chain from startHeight through the last block signed with key, that new installs can
+// load with BRHeaderSnapshotParse() instead of downloading headers, the snapshot starts later than startHeight if the
+// blocks from there aren't all in memory, see BRPeerManagerSetBlockRetention()
+// returns number of bytes written to buf, total bufLen needed if buf is NULL, or 0 if bufLen is too small
+size_t BRPeerManagerExportHeaders(BRPeerManager *manager, uint32_t startHeight, BRKey *key, uint8_t *buf,
+                                  size_t bufLen);
+
+// writes the heap memory used by the blocks, orphans, connected peers, stored peers, tx relay lists, published tx,
+// cached tx and bloom filter of manager to usage, and returns the number of entries written, or total usageCount
+// needed if usage is NULL
+// tx shared with the wallet are counted by both BRWalletMemoryUsage() and BRPeerManagerMemoryUsage()
+size_t BRPeerManagerMemoryUsage(BRPeerManager *manager, BRMemoryUsage usage[], size_t usageCount);
+
 // frees memory allocated for manager (call BRPeerManagerDisconnect() first if connected)
 void BRPeerManagerFree(BRPeerManager *manager);
 	
@@ -0,0 +1,320 @@
+//
+//  BRPeerStore.c
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRPeerStore.h"
+#include "BRSet.h"
+#include "BRArray.h"
+#include <stdlib.h>
+#include <assert.h>
+
+typedef struct {
+    BRPeer peer; // must be first, so entries can be looked up in the index by peer
+    uint8_t tried; // true if the entry is in the tried table
+    uint16_t bucket; // index of the bucket holding the entry in its table
+    uint16_t pos; // position of the entry in its bucket
+    uint32_t mark; // selection round in which the entry was last chosen
+} _BRPeerEntry;
+
+struct BRPeerStoreStruct {
+    BRSet *index; // _BRPeerEntry items indexed by address and port
+    _BRPeerEntry **newTable[PEER_STORE_NEW_BUCKETS];
+    _BRPeerEntry **triedTable[PEER_STORE_TRIED_BUCKETS];
+    size_t newCount, triedCount;
+    uint32_t key; // random key mixed into bucket hashes, so bucket placement can't be predicted by remote peers
+    uint32_t mark;
+};
+
+// returns the network group of peer, the /16 of an IPv4 address or the /32 of an IPv6 address
+static uint32_t _BRPeerStoreGroup(const BRPeer *peer)
+{
+    const uint8_t *a = peer->address.u8;
+    
+    if (peer->address.u64[0] == 0 && peer->address.u16[4] == 0 && peer->address.u16[5] == 0xffff) { // IPv4 mapped
+        return ((uint32_t)a[12] << 8) | a[13];
+    }
+    
+    return ((((uint32_t)a[0] << 24) | ((uint32_t)a[1] << 16) | ((uint32_t)a[2] << 8) | a[3]) ^ 0x80000000);
+}
+
+// returns the bucket for peer in a table of bucketCount buckets
+static size_t _BRPeerStoreBucket(const BRPeerStore *store, const BRPeer *peer, size_t bucketCount)
+{
+    // (((FNV_OFFSET xor key)*FNV_PRIME) xor group)*FNV_PRIME
+    return (((((0x811C9dc5 ^ store->key)*0x01000193) ^ _BRPeerStoreGroup(peer))*0x01000193) >> 8) % bucketCount;
+}
+
+// removes entry from the bucket holding it, without freeing it or removing it from the index
+static void _BRPeerStoreUnlink(BRPeerStore *store, _BRPeerEntry *entry)
+{
+    _BRPeerEntry **bucket = (entry->tried) ? store->triedTable[entry->bucket] : store->newTable[entry->bucket];
+    size_t last = array_count(bucket) - 1;
+    
+    bucket[entry->pos] = bucket[last]; // move the last entry of the bucket into the gap
+    bucket[entry->pos]->pos = entry->pos;
+    array_set_count(bucket, last);
+    if (entry->tried) store->triedCount--;
+    else store->newCount--;
+}
+
+static void _BRPeerStoreDiscard(BRPeerStore *store, _BRPeerEntry *entry)
+{
+    _BRPeerStoreUnlink(store, entry);
+    BRSetRemove(store->index, entry);
+    free(entry);
+}
+
+// adds entry to a bucket of the tried or new table, if the bucket is full the oldest new entry is discarded to make
+// room, or the lowest scoring tried entry is moved back to the new table
+static void _BRPeerStoreLink(BRPeerStore *store, _BRPeerEntry *entry, int tried)
+{
+    size_t b = _BRPeerStoreBucket(store, &entry->peer, (tried) ? PEER_STORE_TRIED_BUCKETS : PEER_STORE_NEW_BUCKETS);
+    _BRPeerEntry **bucket = (tried) ? store->triedTable[b] : store->newTable[b], *worst = NULL;
+    
+    if (array_count(bucket) >= PEER_STORE_BUCKET_SIZE) {
+        for (size_t i = 0; i < array_count(bucket); i++) {
+            if (! worst || (tried && bucket[i]->peer.score < worst->peer.score) ||
+                ((! tried || bucket[i]->peer.score == worst->peer.score) &&
+                 bucket[i]->peer.timestamp < worst->peer.timestamp)) worst = bucket[i];
+        }
+        
+        if (tried) {
+            _BRPeerStoreUnlink(store, worst);
+            _BRPeerStoreLink(store, worst, 0);
+        }
+        else _BRPeerStoreDiscard(store, worst);
+    }
+    
+    entry->tried = (tried) ? 1 : 0;
+    entry->bucket = (uint16_t)b;
+    entry->pos = (uint16_t)array_count(bucket);
+    array_add(bucket, entry);
+    if (tried) store->triedTable[b] = bucket, store->triedCount++;
+    else store->newTable[b] = bucket, store->newCount++;
+}
+
+// returns a chance from 1 to 1000 of choosing entry when it's picked at random, halving after a day since its
+// timestamp, and ranging from a third for peers without a score up to all of it for the highest scoring peers
+static uint32_t _BRPeerStoreChance(const _BRPeerEntry *entry, uint64_t now)
+{
+    uint64_t age = (now > entry->peer.timestamp) ? now - entry->peer.timestamp : 0;
+    uint32_t chance = (uint32_t)(1000*(500 + (uint64_t)entry->peer.score)/1500/(1 + age/(24*60*60)));
+    
+    return (chance > 0) ? chance : 1;
+}
+
+// returns a newly allocated empty peer store that must be freed by calling BRPeerStoreFree()
+BRPeerStore *BRPeerStoreNew(void)
+{
+    BRPeerStore *store = calloc(1, sizeof(*store));
+    
+    assert(store != NULL);
+    store->index = BRSetNew(BRPeerHash, BRPeerEq, 100);
+    store->key = BRRand(0);
+    for (size_t i = 0; i < PEER_STORE_NEW_BUCKETS; i++) array_new(store->newTable[i], 8);
+    for (size_t i = 0; i < PEER_STORE_TRIED_BUCKETS; i++) array_new(store->triedTable[i], 8);
+    return store;
+}
+
+// adds peer to the new table, or updates the timestamp and services of an already known peer if peer is more recent
+// returns true if peer was not already known
+int BRPeerStoreAdd(BRPeerStore *store, const BRPeer *peer)
+{
+    _BRPeerEntry *entry;
+    int r = 0;
+    
+    assert(store != NULL);
+    assert(peer != NULL);
+    entry = BRSetGet(store->index, peer);
+    
+    if (entry) {
+        if (peer->timestamp > entry->peer.timestamp) {
+            entry->peer.timestamp = peer->timestamp;
+            entry->peer.services = peer->services;
+        }
+    }
+    else {
+        entry = calloc(1, sizeof(*entry));
+        assert(entry != NULL);
+        entry->peer = *peer;
+        entry->peer.flags = 0;
+        _BRPeerStoreLink(store, entry, 0);
+        BRSetAdd(store->index, entry);
+        r = 1;
+    }
+    
+    return r;
+}
+
+// records a successful connection to peer, moving it to the tried table and saving its score and timestamp
+void BRPeerStoreMarkGood(BRPeerStore *store, const BRPeer *peer)
+{
+    _BRPeerEntry *entry;
+    
+    assert(store != NULL);
+    assert(peer != NULL);
+    BRPeerStoreAdd(store, peer);
+    entry = BRSetGet(store->index, peer);
+    entry->peer.score = peer->score;
+    
+    if (! entry->tried) {
+        _BRPeerStoreUnlink(store, entry);
+        _BRPeerStoreLink(store, entry, 1);
+    }
+}
+
+// removes peer from the store, returns true if it was known
+int BRPeerStoreRemove(BRPeerStore *store, const BRPeer *peer)
+{
+    _BRPeerEntry *entry;
+    
+    assert(store != NULL);
+    assert(peer != NULL);
+    entry = BRSetGet(store->index, peer);
+    if (entry) _BRPeerStoreDiscard(store, entry);
+    return (entry != NULL);
+}
+
+// removes all peers from the store
+void BRPeerStoreClear(BRPeerStore *store)
+{
+    assert(store != NULL);
+    
+    for (size_t i = 0; i < PEER_STORE_NEW_BUCKETS; i++) {
+        for (size_t j = 0; j < array_count(store->newTable[i]); j++) free(store->newTable[i][j]);
+        array_clear(store->newTable[i]);
+    }
+    
+    for (size_t i = 0; i < PEER_STORE_TRIED_BUCKETS; i++) {
+        for (size_t j = 0; j < array_count(store->triedTable[i]); j++) free(store->triedTable[i][j]);
+        array_clear(store->triedTable[i]);
+    }
+    
+    BRSetClear(store->index);
+    store->newCount = store->triedCount = 0;
+}
+
+// number of peers in the store
+size_t BRPeerStoreCount(const BRPeerStore *store)
+{
+    assert(store != NULL);
+    return store->newCount + store->triedCount;
+}
+
+// number of peers with a timestamp at or after the given timestamp
+size_t BRPeerStoreCountSince(const BRPeerStore *store, uint64_t timestamp)
+{
+    const _BRPeerEntry *entry = NULL;
+    size_t count = 0;
+    
+    assert(store != NULL);
+    
+    while ((entry = BRSetIterate(store->index, entry)) != NULL) {
+        if (entry->peer.timestamp >= timestamp) count++;
+    }
+    
+    return count;
+}
+
+// writes the stored peers to peers, tried peers first
+// returns number of peers written, or total available if peers is NULL
+size_t BRPeerStorePeers(const BRPeerStore *store, BRPeer peers[], size_t peersCount)
+{
+    size_t n = 0;
+    
+    assert(store != NULL);
+    if (! peers) return store->newCount + store->triedCount;
+    
+    for (size_t i = 0; i < PEER_STORE_TRIED_BUCKETS; i++) {
+        for (size_t j = 0; j < array_count(store->triedTable[i]) && n < peersCount; j++) {
+            peers[n++] = store->triedTable[i][j]->peer;
+        }
+    }
+    
+    for (size_t i = 0; i < PEER_STORE_NEW_BUCKETS; i++) {
+        for (size_t j = 0; j < array_count(store->newTable[i]) && n < peersCount; j++) {
+            peers[n++] = store->newTable[i][j]->peer;
+        }
+    }
+    
+    return n;
+}
+
+// writes up to peersCount distinct peers chosen at random to peers, tried and new peers are chosen equally often,
+// and within a table, peers with recent timestamps and higher scores are more likely to be chosen
+// returns number of peers written
+size_t BRPeerStoreSelect(BRPeerStore *store, BRPeer peers[], size_t peersCount, uint64_t now)
+{
+    size_t n = 0, total, tries, b, bucketCount;
+    _BRPeerEntry ***table, **bucket, *entry;
+    
+    assert(store != NULL);
+    assert(peers != NULL || peersCount == 0);
+    total = store->newCount + store->triedCount;
+    store->mark++;
+    
+    for (tries = 0; n < peersCount && n < total && tries < 100 + 50*peersCount; tries++) {
+        int tried = (store->triedCount > 0 && (store->newCount == 0 || BRRand(2) == 0));
+        
+        table = (tried) ? store->triedTable : store->newTable;
+        bucketCount = (tried) ? PEER_STORE_TRIED_BUCKETS : PEER_STORE_NEW_BUCKETS;
+        b = BRRand((uint32_t)bucketCount);
+        while (array_count(table[b]) == 0) b = (b + 1) % bucketCount; // the table has at least one entry
+        bucket = table[b];
+        entry = bucket[BRRand((uint32_t)array_count(bucket))];
+        if (entry->mark == store->mark || BRRand(1000) >= _BRPeerStoreChance(entry, now)) continue;
+        entry->mark = store->mark;
+        peers[n++] = entry->peer;
+    }
+    
+    for (entry = NULL; n < peersCount && n < total && (entry = BRSetIterate(store->index, entry)) != NULL;) {
+        if (entry->mark == store->mark) continue; // out of tries, fill in with any peers not already chosen
+        entry->mark = store->mark;
+        peers[n++] = entry->peer;
+    }
+    
+    return n;
+}
+
+// returns the number of bytes of heap memory used by store
+size_t BRPeerStoreMemoryUsage(const BRPeerStore *store)
+{
+    size_t size;
+    
+    assert(store != NULL);
+    size = sizeof(*store) + BRSetMemoryUsage(store->index) + BRSetCount(store->index)*sizeof(_BRPeerEntry);
+    for (size_t i = 0; i < PEER_STORE_NEW_BUCKETS; i++) size += array_mem_size(store->newTable[i]);
+    for (size_t i = 0; i < PEER_STORE_TRIED_BUCKETS; i++) size += array_mem_size(store->triedTable[i]);
+    return size;
+}
+
+// frees memory allocated for store
+void BRPeerStoreFree(BRPeerStore *store)
+{
+    assert(store != NULL);
+    BRPeerStoreClear(store);
+    for (size_t i = 0; i < PEER_STORE_NEW_BUCKETS; i++) array_free(store->newTable[i]);
+    for (size_t i = 0; i < PEER_STORE_TRIED_BUCKETS; i++) array_free(store->triedTable[i]);
+    BRSetFree(store->index);
+    free(store);
+}
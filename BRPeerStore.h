@@ -0,0 +1,90 @@
+//
+//  BRPeerStore.h
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRPeerStore_h
+#define BRPeerStore_h
+
+#include "BRPeer.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// an address book of known peers, indexed by address and port so adding or updating a peer takes constant time
+// peers are kept in a "new" table until a connection to them succeeds, and then in a "tried" table, each table is split
+// into buckets by network group (the /16 of an IPv4 address) so that a single network can only fill one bucket of each
+// table, and when a bucket is full the least useful peer in it makes room
+
+#define PEER_STORE_NEW_BUCKETS   64
+#define PEER_STORE_TRIED_BUCKETS 16
+#define PEER_STORE_BUCKET_SIZE   64
+
+typedef struct BRPeerStoreStruct BRPeerStore;
+
+// NOTE: BRPeerStore functions are not thread-safe
+
+// returns a newly allocated empty peer store that must be freed by calling BRPeerStoreFree()
+BRPeerStore *BRPeerStoreNew(void);
+
+// adds peer to the new table, or updates the timestamp and services of an already known peer if peer is more recent
+// returns true if peer was not already known
+int BRPeerStoreAdd(BRPeerStore *store, const BRPeer *peer);
+
+// records a successful connection to peer, moving it to the tried table and saving its score and timestamp
+void BRPeerStoreMarkGood(BRPeerStore *store, const BRPeer *peer);
+
+// removes peer from the store, returns true if it was known
+int BRPeerStoreRemove(BRPeerStore *store, const BRPeer *peer);
+
+// removes all peers from the store
+void BRPeerStoreClear(BRPeerStore *store);
+
+// number of peers in the store
+size_t BRPeerStoreCount(const BRPeerStore *store);
+
+// number of peers with a timestamp at or after the given timestamp
+size_t BRPeerStoreCountSince(const BRPeerStore *store, uint64_t timestamp);
+
+// writes the stored peers to peers, tried peers first
+// returns number of peers written, or total available if peers is NULL
+size_t BRPeerStorePeers(const BRPeerStore *store, BRPeer peers[], size_t peersCount);
+
+// writes up to peersCount distinct peers chosen at random to peers, tried and new peers are chosen equally often,
+// and within a table, peers with recent timestamps and higher scores are more likely to be chosen
+// returns number of peers written
+size_t BRPeerStoreSelect(BRPeerStore *store, BRPeer peers[], size_t peersCount, uint64_t now);
+
+// returns the number of bytes of heap memory used by store
+size_t BRPeerStoreMemoryUsage(const BRPeerStore *store);
+
+// frees memory allocated for store
+void BRPeerStoreFree(BRPeerStore *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRPeerStore_h
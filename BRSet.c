@@ -314,6 +314,13 @@ void BRSetIntersect(BRSet *set, const BRSet *otherSet)
     }
 }
 
+// returns the number of bytes of heap memory used by set and its hashtable, not counting the items it contains
+size_t BRSetMemoryUsage(const BRSet *set)
+{
+    assert(set != NULL);
+    return sizeof(*set) + set->size*sizeof(*set->table);
+}
+
 // frees memory allocated for set
 void BRSetFree(BRSet *set)
 {
@@ -81,6 +81,9 @@ void BRSetMinus(BRSet *set, const BRSet *otherSet);
 // removes items not contained in otherSet from set
 void BRSetIntersect(BRSet *set, const BRSet *otherSet);
 
+// returns the number of bytes of heap memory used by set and its hashtable, not counting the items it contains
+size_t BRSetMemoryUsage(const BRSet *set);
+
 // frees memory allocated for set
 void BRSetFree(BRSet *set);
 
@@ -0,0 +1,691 @@
+//
+//  BRStore.c
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRStore.h"
+#include "BRSet.h"
+#include "BRArray.h"
+#include "BRCrypto.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define STORE_MAGIC        "BRSTORE\x01"
+#define STORE_MAGIC_LEN    8
+#define STORE_HEADER_LEN   (1 + sizeof(UInt256) + sizeof(uint32_t)) // record type, key and data length
+#define STORE_CHECKSUM_LEN sizeof(uint32_t)
+#define STORE_RETRY_MIN    60      // seconds before a failed compaction is tried again, doubled after each failure
+#define STORE_RETRY_MAX    (60*60) // longest wait between compaction attempts
+
+#define STORE_BLOCK     0x01 // block height followed by the serialized block
+#define STORE_PEER      0x02 // address, port, services, timestamp and score
+#define STORE_TX        0x03 // serialized tx followed by its block height and timestamp
+#define STORE_TX_STATUS 0x04 // replaces the block height and timestamp at the end of a STORE_TX record
+#define STORE_PROOF     0x05 // serialized merkle proof of a confirmed tx
+#define STORE_CLEAR     0x40 // or'd with a record type, removes all records of that type
+#define STORE_DELETE    0x80 // or'd with a record type, removes the record with the same key
+
+#define STORE_PEER_LEN (sizeof(UInt128) + sizeof(uint16_t) + sizeof(uint64_t)*2 + sizeof(uint16_t))
+
+typedef struct {
+    UInt256 key; // blockHash, txHash, or peer address followed by port
+    uint8_t type;
+    uint8_t *data;
+    size_t len;
+} _BRStoreRecord;
+
+struct BRStoreStruct {
+    char *path;
+    int fd; // only used by the writer thread once the store is opened
+    int dirty; // set by the writer thread when a batch couldn't be written, nothing is appended until it's compacted
+    time_t compactTime; // a compaction isn't tried before this time after one failed
+    time_t compactDelay;
+    BRSet *records; // live _BRStoreRecord items indexed by type and key
+    size_t liveSize; // bytes the live records take up in the file
+    size_t fileSize;
+    uint8_t *pending; // serialized records waiting to be written
+    uint64_t pendingSeq, committedSeq; // number of records queued, and number written and synced
+    int error, closing;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t pendingCond, committedCond;
+};
+
+inline static size_t _BRStoreRecordHash(const void *record)
+{
+    const _BRStoreRecord *r = record;
+    
+    // (((FNV_OFFSET xor key)*FNV_PRIME) xor type)*FNV_PRIME, key words 3 and 4 hold an IPv4 address and port
+    return (size_t)((((0x811C9dc5 ^ r->key.u32[0] ^ r->key.u32[3] ^ r->key.u32[4])*0x01000193) ^ r->type)*0x01000193);
+}
+
+inline static int _BRStoreRecordEq(const void *record, const void *otherRecord)
+{
+    const _BRStoreRecord *r = record, *o = otherRecord;
+    
+    return (r == o || (r->type == o->type && UInt256Eq(r->key, o->key)));
+}
+
+inline static size_t _BRStoreRecordSize(size_t len)
+{
+    return STORE_HEADER_LEN + len + STORE_CHECKSUM_LEN;
+}
+
+static void _BRStoreRecordFree(_BRStoreRecord *record)
+{
+    if (record->data) free(record->data);
+    free(record);
+}
+
+static void _setApplyFreeRecord(void *info, void *record)
+{
+    _BRStoreRecordFree(record);
+}
+
+// appends a serialized record to buf
+static void _BRStoreSerialize(uint8_t **buf, uint8_t type, UInt256 key, const uint8_t *data, size_t len)
+{
+    size_t off = array_count(*buf), size = _BRStoreRecordSize(len);
+    uint8_t *b;
+    
+    if (off + size > array_capacity(*buf)) array_set_capacity(*buf, (off + size)*3/2);
+    array_set_count(*buf, off + size);
+    b = *buf + off;
+    b[0] = type;
+    UInt256Set(&b[1], key);
+    UInt32SetLE(&b[1 + sizeof(UInt256)], (uint32_t)len);
+    if (len > 0) memcpy(&b[STORE_HEADER_LEN], data, len);
+    UInt32SetLE(&b[STORE_HEADER_LEN + len], BRMurmur3_32(b, STORE_HEADER_LEN + len, 0));
+}
+
+// applies a record to the live records
+static void _BRStoreApply(BRStore *store, uint8_t type, UInt256 key, const uint8_t *data, size_t len)
+{
+    _BRStoreRecord *r = NULL, q = { key, type, NULL, 0 };
+    
+    if (type & STORE_CLEAR) {
+        _BRStoreRecord **all;
+        
+        array_new(all, BRSetCount(store->records));
+        
+        while ((r = BRSetIterate(store->records, r)) != NULL) {
+            if (r->type == (type & ~STORE_CLEAR)) array_add(all, r);
+        }
+        
+        for (size_t i = 0; i < array_count(all); i++) {
+            BRSetRemove(store->records, all[i]);
+            store->liveSize -= _BRStoreRecordSize(all[i]->len);
+            _BRStoreRecordFree(all[i]);
+        }
+        
+        array_free(all);
+    }
+    else if (type & STORE_DELETE) {
+        q.type = type & ~STORE_DELETE;
+        r = BRSetRemove(store->records, &q);
+        if (r) store->liveSize -= _BRStoreRecordSize(r->len);
+        if (r) _BRStoreRecordFree(r);
+    }
+    else if (type == STORE_TX_STATUS) {
+        q.type = STORE_TX;
+        r = BRSetGet(store->records, &q);
+        if (r && r->len >= len && len == sizeof(uint32_t)*2) memcpy(&r->data[r->len - len], data, len);
+    }
+    else {
+        r = calloc(1, sizeof(*r));
+        assert(r != NULL);
+        r->key = key;
+        r->type = type;
+        r->data = (len > 0) ? malloc(len) : NULL;
+        assert(r->data != NULL || len == 0);
+        if (len > 0) memcpy(r->data, data, len);
+        r->len = len;
+        store->liveSize += _BRStoreRecordSize(len);
+        r = BRSetAdd(store->records, r);
+        if (r) store->liveSize -= _BRStoreRecordSize(r->len);
+        if (r) _BRStoreRecordFree(r);
+    }
+}
+
+// applies a record and queues it for the writer thread, must be called with the lock held
+static void _BRStoreSubmit(BRStore *store, uint8_t type, UInt256 key, const uint8_t *data, size_t len)
+{
+    _BRStoreApply(store, type, key, data, len);
+    _BRStoreSerialize(&store->pending, type, key, data, len);
+    store->pendingSeq++;
+}
+
+// returns 0 once len bytes of buf are written to fd, or an errno value
+static int _BRStoreWrite(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+    
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return errno;
+        buf += n;
+        len -= n;
+    }
+    
+    return 0;
+}
+
+// syncs the directory containing path, so a file renamed into it is still there after a crash
+// returns 0 on success, or an errno value
+static int _BRStoreSyncDir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    size_t len = (! slash) ? 1 : (slash == path) ? 1 : (size_t)(slash - path);
+    char dir[len + 1];
+    int fd, error = 0;
+    
+    if (slash) memcpy(dir, path, len);
+    else dir[0] = '.';
+    dir[len] = '\0';
+    fd = open(dir, O_RDONLY);
+    if (fd < 0) return errno;
+    if (fsync(fd) != 0) error = errno;
+    close(fd);
+    return error;
+}
+
+// rewrites the file with only the live records, called by the writer thread with the lock held
+// records queued after the snapshot is taken are appended to the new file, replaying any that the snapshot already
+// includes leaves the live records unchanged
+// returns 0 on success, or an errno value, after which the next attempt waits an exponentially increasing time
+static int _BRStoreCompact(BRStore *store)
+{
+    size_t pathLen = strlen(store->path);
+    char tmp[pathLen + 5];
+    _BRStoreRecord *r = NULL;
+    uint8_t *buf;
+    int fd, renamed = 0, error = 0;
+    
+    strcpy(tmp, store->path);
+    strcpy(&tmp[pathLen], ".tmp");
+    array_new(buf, STORE_MAGIC_LEN + store->liveSize);
+    array_add_array(buf, (const uint8_t *)STORE_MAGIC, STORE_MAGIC_LEN);
+    while ((r = BRSetIterate(store->records, r)) != NULL) _BRStoreSerialize(&buf, r->type, r->key, r->data, r->len);
+    pthread_mutex_unlock(&store->lock);
+    
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (fd < 0) error = errno;
+    if (! error) error = _BRStoreWrite(fd, buf, array_count(buf));
+    if (! error && fsync(fd) != 0) error = errno;
+    if (! error && rename(tmp, store->path) != 0) error = errno;
+    
+    if (! error) {
+        close(store->fd);
+        store->fd = fd;
+        renamed = 1;
+        error = _BRStoreSyncDir(store->path);
+    }
+    else if (fd >= 0) { // the original file is left in place, so a failed compaction loses nothing
+        close(fd);
+        unlink(tmp);
+    }
+    
+    pthread_mutex_lock(&store->lock);
+    if (renamed) store->fileSize = array_count(buf);
+    if (! error) store->dirty = 0;
+    if (! error) store->compactDelay = 0;
+    
+    if (error) {
+        store->compactDelay = (store->compactDelay == 0) ? STORE_RETRY_MIN : store->compactDelay*2;
+        if (store->compactDelay > STORE_RETRY_MAX) store->compactDelay = STORE_RETRY_MAX;
+        store->compactTime = time(NULL) + store->compactDelay;
+    }
+    
+    array_free(buf);
+    return error;
+}
+
+static void *_BRStoreThreadRoutine(void *info)
+{
+    BRStore *store = info;
+    uint8_t *buf, *batch;
+    uint64_t seq;
+    int dirty, error;
+    
+    array_new(buf, 0x1000);
+    pthread_mutex_lock(&store->lock);
+    
+    while (! store->closing || array_count(store->pending) > 0) {
+        if (array_count(store->pending) == 0) {
+            pthread_cond_wait(&store->pendingCond, &store->lock);
+            continue;
+        }
+        
+        // group commit: records queued while this batch is written and synced go out together in the next one
+        batch = store->pending;
+        store->pending = buf;
+        buf = batch;
+        seq = store->pendingSeq;
+        dirty = store->dirty;
+        error = 0;
+        pthread_mutex_unlock(&store->lock);
+        
+        if (! dirty) { // once a batch is missing from the file, the next one is written by rewriting the whole file
+            error = _BRStoreWrite(store->fd, buf, array_count(buf));
+            if (! error && fsync(store->fd) != 0) error = errno;
+            
+            // cut off whatever part of the batch was written, records appended after a torn one would be lost on replay
+            if (error && ftruncate(store->fd, store->fileSize) == 0) fsync(store->fd);
+        }
+        
+        pthread_mutex_lock(&store->lock);
+        if (error && ! store->error) store->error = error;
+        if (error) store->dirty = 1;
+        if (! dirty && ! error) store->fileSize += array_count(buf);
+        
+        if ((dirty || (store->fileSize >= STORE_COMPACT_MIN_SIZE &&
+                       store->fileSize > store->liveSize*STORE_COMPACT_RATIO)) && time(NULL) >= store->compactTime) {
+            if (_BRStoreCompact(store) == 0 && dirty) store->error = 0; // every live record is in the file again
+        }
+        
+        store->committedSeq = seq;
+        pthread_cond_broadcast(&store->committedCond);
+        array_set_count(buf, 0);
+        
+        if (array_capacity(buf) > STORE_COMPACT_MIN_SIZE) { // don't hold on to the memory of an unusually large batch
+            array_free(buf);
+            array_new(buf, 0x1000);
+        }
+    }
+    
+    if (store->dirty) _BRStoreCompact(store); // last chance to get the lost batches into the file before closing
+    pthread_mutex_unlock(&store->lock);
+    array_free(buf);
+    return NULL;
+}
+
+// opens the store at path, creating it if needed, and replays its log, discarding any partially written record at the
+// end left by a crash
+// returns NULL and sets errno if the file can't be opened or isn't a store, otherwise a store that must be freed by
+// calling BRStoreFree()
+BRStore *BRStoreNew(const char *path)
+{
+    BRStore *store = NULL;
+    struct stat st;
+    uint8_t *buf = NULL;
+    size_t size = 0, off = STORE_MAGIC_LEN, len;
+    ssize_t n = 0;
+    int fd, error = 0;
+    
+    assert(path != NULL);
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0) error = errno;
+    if (! error) size = (size_t)st.st_size;
+    
+    if (! error && size < STORE_MAGIC_LEN) { // new file, or one whose creation didn't complete
+        if (ftruncate(fd, 0) != 0) error = errno;
+        if (! error) error = _BRStoreWrite(fd, (const uint8_t *)STORE_MAGIC, STORE_MAGIC_LEN);
+        if (! error && fsync(fd) != 0) error = errno;
+        size = STORE_MAGIC_LEN;
+    }
+    else if (! error) {
+        buf = malloc(size);
+        assert(buf != NULL);
+        
+        for (len = 0; len < size; len += n) {
+            n = pread(fd, &buf[len], size - len, len);
+            if (n < 0 && errno == EINTR) n = 0;
+            else if (n <= 0) break;
+        }
+        
+        if (len < size) error = (n < 0) ? errno : EIO;
+        else if (memcmp(buf, STORE_MAGIC, STORE_MAGIC_LEN) != 0) error = EINVAL;
+    }
+    
+    if (! error) {
+        store = calloc(1, sizeof(*store));
+        assert(store != NULL);
+        store->path = strdup(path);
+        assert(store->path != NULL);
+        store->fd = fd;
+        store->records = BRSetNew(_BRStoreRecordHash, _BRStoreRecordEq, 100);
+        array_new(store->pending, 0x1000);
+        pthread_mutex_init(&store->lock, NULL);
+        pthread_cond_init(&store->pendingCond, NULL);
+        pthread_cond_init(&store->committedCond, NULL);
+        
+        while (buf && off + STORE_HEADER_LEN + STORE_CHECKSUM_LEN <= size) {
+            len = UInt32GetLE(&buf[off + 1 + sizeof(UInt256)]);
+            if (len > size - off - STORE_HEADER_LEN - STORE_CHECKSUM_LEN) break; // truncated record
+            if (BRMurmur3_32(&buf[off], STORE_HEADER_LEN + len, 0) !=
+                UInt32GetLE(&buf[off + STORE_HEADER_LEN + len])) break; // torn write
+            _BRStoreApply(store, buf[off], UInt256Get(&buf[off + 1]), &buf[off + STORE_HEADER_LEN], len);
+            off += _BRStoreRecordSize(len);
+        }
+        
+        if (off < size && ftruncate(fd, off) != 0) error = errno; // discard the partially written record
+        store->fileSize = (off < size) ? off : size;
+        if (! error && pthread_create(&store->thread, NULL, _BRStoreThreadRoutine, store) != 0) error = EAGAIN;
+        
+        if (error) {
+            BRSetApply(store->records, NULL, _setApplyFreeRecord);
+            BRSetFree(store->records);
+            array_free(store->pending);
+            pthread_cond_destroy(&store->committedCond);
+            pthread_cond_destroy(&store->pendingCond);
+            pthread_mutex_destroy(&store->lock);
+            free(store->path);
+            free(store);
+            store = NULL;
+        }
+    }
+    
+    if (buf) free(buf);
+    if (error) close(fd);
+    if (error) errno = error;
+    return store;
+}
+
+// saves blocks along with their heights, if replace is true all previously saved blocks are removed first
+void BRStoreSaveBlocks(BRStore *store, int replace, BRMerkleBlock *blocks[], size_t blocksCount)
+{
+    uint8_t *buf;
+    size_t len;
+    
+    assert(store != NULL);
+    assert(blocks != NULL || blocksCount == 0);
+    array_new(buf, 0x100);
+    pthread_mutex_lock(&store->lock);
+    if (replace) _BRStoreSubmit(store, STORE_CLEAR | STORE_BLOCK, UINT256_ZERO, NULL, 0);
+    
+    for (size_t i = 0; i < blocksCount; i++) {
+        len = BRMerkleBlockSerialize(blocks[i], NULL, 0);
+        if (sizeof(uint32_t) + len > array_capacity(buf)) array_set_capacity(buf, sizeof(uint32_t) + len);
+        array_set_count(buf, sizeof(uint32_t) + len);
+        UInt32SetLE(buf, blocks[i]->height);
+        BRMerkleBlockSerialize(blocks[i], &buf[sizeof(uint32_t)], len);
+        _BRStoreSubmit(store, STORE_BLOCK, blocks[i]->blockHash, buf, array_count(buf));
+    }
+    
+    pthread_cond_signal(&store->pendingCond);
+    pthread_mutex_unlock(&store->lock);
+    array_free(buf);
+}
+
+// saves peers, if replace is true all previously saved peers are removed first
+void BRStoreSavePeers(BRStore *store, int replace, const BRPeer peers[], size_t peersCount)
+{
+    uint8_t buf[STORE_PEER_LEN];
+    UInt256 key;
+    size_t off;
+    
+    assert(store != NULL);
+    assert(peers != NULL || peersCount == 0);
+    pthread_mutex_lock(&store->lock);
+    if (replace) _BRStoreSubmit(store, STORE_CLEAR | STORE_PEER, UINT256_ZERO, NULL, 0);
+    
+    for (size_t i = 0; i < peersCount; i++) {
+        off = 0;
+        UInt128Set(&buf[off], peers[i].address);
+        off += sizeof(UInt128);
+        UInt16SetLE(&buf[off], peers[i].port);
+        off += sizeof(uint16_t);
+        UInt64SetLE(&buf[off], peers[i].services);
+        off += sizeof(uint64_t);
+        UInt64SetLE(&buf[off], peers[i].timestamp);
+        off += sizeof(uint64_t);
+        UInt16SetLE(&buf[off], peers[i].score);
+        key = UINT256_ZERO;
+        memcpy(key.u8, buf, sizeof(UInt128) + sizeof(uint16_t)); // address and port
+        _BRStoreSubmit(store, STORE_PEER, key, buf, sizeof(buf));
+    }
+    
+    pthread_cond_signal(&store->pendingCond);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// saves tx along with its block height and timestamp
+void BRStoreSaveTx(BRStore *store, const BRTransaction *tx)
+{
+    size_t len;
+    
+    assert(store != NULL);
+    assert(tx != NULL);
+    len = BRTransactionSerialize(tx, NULL, 0);
+    
+    uint8_t _buf[0x1000], *buf = (len + sizeof(uint32_t)*2 <= sizeof(_buf)) ? _buf : malloc(len + sizeof(uint32_t)*2);
+    
+    assert(buf != NULL);
+    len = BRTransactionSerialize(tx, buf, len);
+    UInt32SetLE(&buf[len], tx->blockHeight);
+    UInt32SetLE(&buf[len + sizeof(uint32_t)], tx->timestamp);
+    pthread_mutex_lock(&store->lock);
+    _BRStoreSubmit(store, STORE_TX, tx->txHash, buf, len + sizeof(uint32_t)*2);
+    pthread_cond_signal(&store->pendingCond);
+    pthread_mutex_unlock(&store->lock);
+    if (buf != _buf) free(buf);
+}
+
+// removes the saved proof for txHash if there is one, must be called with the lock held
+static void _BRStoreDeleteProof(BRStore *store, UInt256 txHash)
+{
+    _BRStoreRecord q = { txHash, STORE_PROOF, NULL, 0 };
+    
+    if (BRSetContains(store->records, &q)) _BRStoreSubmit(store, STORE_DELETE | STORE_PROOF, txHash, NULL, 0);
+}
+
+// updates the block height and timestamp of saved transactions, saved proofs are removed if blockHeight is
+// TX_UNCONFIRMED
+void BRStoreUpdateTx(BRStore *store, const UInt256 txHashes[], size_t txCount, uint32_t blockHeight,
+                     uint32_t timestamp)
+{
+    uint8_t buf[sizeof(uint32_t)*2];
+    
+    assert(store != NULL);
+    assert(txHashes != NULL || txCount == 0);
+    UInt32SetLE(buf, blockHeight);
+    UInt32SetLE(&buf[sizeof(uint32_t)], timestamp);
+    pthread_mutex_lock(&store->lock);
+    
+    for (size_t i = 0; i < txCount; i++) {
+        _BRStoreSubmit(store, STORE_TX_STATUS, txHashes[i], buf, sizeof(buf));
+        if (blockHeight == TX_UNCONFIRMED) _BRStoreDeleteProof(store, txHashes[i]);
+    }
+    
+    pthread_cond_signal(&store->pendingCond);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// removes a saved transaction along with its saved proof
+void BRStoreDeleteTx(BRStore *store, UInt256 txHash)
+{
+    assert(store != NULL);
+    pthread_mutex_lock(&store->lock);
+    _BRStoreSubmit(store, STORE_DELETE | STORE_TX, txHash, NULL, 0);
+    _BRStoreDeleteProof(store, txHash);
+    pthread_cond_signal(&store->pendingCond);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// saves a merkle proof for a confirmed tx, replacing any proof previously saved for the same tx
+void BRStoreSaveProof(BRStore *store, const BRMerkleProof *proof)
+{
+    size_t len;
+    
+    assert(store != NULL);
+    assert(proof != NULL);
+    len = BRMerkleProofSerialize(proof, NULL, 0);
+    
+    uint8_t buf[len];
+    
+    len = BRMerkleProofSerialize(proof, buf, len);
+    pthread_mutex_lock(&store->lock);
+    _BRStoreSubmit(store, STORE_PROOF, proof->txHash, buf, len);
+    pthread_cond_signal(&store->pendingCond);
+    pthread_mutex_unlock(&store->lock);
+}
+
+// returns the saved merkle proof for txHash that must be freed by calling BRMerkleProofFree(), or NULL if none is saved
+BRMerkleProof *BRStoreProofForTx(BRStore *store, UInt256 txHash)
+{
+    _BRStoreRecord *r, q = { txHash, STORE_PROOF, NULL, 0 };
+    BRMerkleProof *proof = NULL;
+    
+    assert(store != NULL);
+    pthread_mutex_lock(&store->lock);
+    r = BRSetGet(store->records, &q);
+    if (r) proof = BRMerkleProofParse(r->data, r->len);
+    pthread_mutex_unlock(&store->lock);
+    return proof;
+}
+
+// writes newly allocated copies of the saved blocks to blocks, suitable for passing to BRPeerManagerNew()
+// returns number of blocks written, or total blocksCount needed if blocks is NULL
+size_t BRStoreBlocks(BRStore *store, BRMerkleBlock *blocks[], size_t blocksCount)
+{
+    _BRStoreRecord *r = NULL;
+    BRMerkleBlock *block;
+    size_t i = 0;
+    
+    assert(store != NULL);
+    pthread_mutex_lock(&store->lock);
+    
+    while ((! blocks || i < blocksCount) && (r = BRSetIterate(store->records, r)) != NULL) {
+        if (r->type != STORE_BLOCK || r->len < sizeof(uint32_t)) continue;
+        
+        if (blocks) {
+            block = BRMerkleBlockParse(&r->data[sizeof(uint32_t)], r->len - sizeof(uint32_t));
+            if (! block) continue;
+            block->height = UInt32GetLE(r->data);
+            blocks[i] = block;
+        }
+        
+        i++;
+    }
+    
+    pthread_mutex_unlock(&store->lock);
+    return i;
+}
+
+// writes the saved peers to peers
+// returns number of peers written, or total peersCount needed if peers is NULL
+size_t BRStorePeers(BRStore *store, BRPeer peers[], size_t peersCount)
+{
+    _BRStoreRecord *r = NULL;
+    size_t i = 0, off;
+    
+    assert(store != NULL);
+    pthread_mutex_lock(&store->lock);
+    
+    while ((! peers || i < peersCount) && (r = BRSetIterate(store->records, r)) != NULL) {
+        if (r->type != STORE_PEER || r->len < STORE_PEER_LEN) continue;
+        
+        if (peers) {
+            off = 0;
+            peers[i] = BR_PEER_NONE;
+            peers[i].address = UInt128Get(&r->data[off]);
+            off += sizeof(UInt128);
+            peers[i].port = UInt16GetLE(&r->data[off]);
+            off += sizeof(uint16_t);
+            peers[i].services = UInt64GetLE(&r->data[off]);
+            off += sizeof(uint64_t);
+            peers[i].timestamp = UInt64GetLE(&r->data[off]);
+            off += sizeof(uint64_t);
+            peers[i].score = UInt16GetLE(&r->data[off]);
+        }
+        
+        i++;
+    }
+    
+    pthread_mutex_unlock(&store->lock);
+    return i;
+}
+
+// writes newly allocated copies of the saved transactions to transactions, suitable for passing to BRWalletNew()
+// returns number of transactions written, or total txCount needed if transactions is NULL
+size_t BRStoreTransactions(BRStore *store, BRTransaction *transactions[], size_t txCount)
+{
+    _BRStoreRecord *r = NULL;
+    BRTransaction *tx;
+    size_t i = 0, len;
+    
+    assert(store != NULL);
+    pthread_mutex_lock(&store->lock);
+    
+    while ((! transactions || i < txCount) && (r = BRSetIterate(store->records, r)) != NULL) {
+        if (r->type != STORE_TX || r->len < sizeof(uint32_t)*2) continue;
+        
+        if (transactions) {
+            len = r->len - sizeof(uint32_t)*2;
+            tx = BRTransactionParse(r->data, len);
+            if (! tx) continue;
+            tx->blockHeight = UInt32GetLE(&r->data[len]);
+            tx->timestamp = UInt32GetLE(&r->data[len + sizeof(uint32_t)]);
+            transactions[i] = tx;
+        }
+        
+        i++;
+    }
+    
+    pthread_mutex_unlock(&store->lock);
+    return i;
+}
+
+// waits until every change saved before the call is written to the file and synced
+// returns 0 on success, or the errno value of a failed write if the file is still missing changes because of it
+int BRStoreFlush(BRStore *store)
+{
+    uint64_t seq;
+    int error;
+    
+    assert(store != NULL);
+    pthread_mutex_lock(&store->lock);
+    seq = store->pendingSeq;
+    while (store->committedSeq < seq) pthread_cond_wait(&store->committedCond, &store->lock);
+    error = store->error;
+    pthread_mutex_unlock(&store->lock);
+    return error;
+}
+
+// flushes and closes the store, and frees memory allocated for it
+void BRStoreFree(BRStore *store)
+{
+    assert(store != NULL);
+    pthread_mutex_lock(&store->lock);
+    store->closing = 1;
+    pthread_cond_signal(&store->pendingCond);
+    pthread_mutex_unlock(&store->lock);
+    pthread_join(store->thread, NULL); // the writer thread writes out everything still queued before it exits
+    close(store->fd);
+    BRSetApply(store->records, NULL, _setApplyFreeRecord);
+    BRSetFree(store->records);
+    array_free(store->pending);
+    pthread_cond_destroy(&store->committedCond);
+    pthread_cond_destroy(&store->pendingCond);
+    pthread_mutex_destroy(&store->lock);
+    free(store->path);
+    free(store);
+}
@@ -0,0 +1,101 @@
+//
+//  BRStore.h
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRStore_h
+#define BRStore_h
+
+#include "BRPeer.h"
+#include "BRMerkleBlock.h"
+#include "BRTransaction.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// an optional built-in store for blocks, peers, transactions and merkle proofs, kept in a single append-only file
+// changes are applied in memory and queued, and a background thread appends them to the file, so saving never waits on
+// storage, changes queued while the file is being synced are written and synced together with a single fsync(), and
+// once the file grows to several times the size of its live records, it's rewritten with only the live records
+// if a write fails, the file is cut back to its last complete record and the next batch rewrites the whole file instead
+
+#define STORE_COMPACT_MIN_SIZE (1024*1024) // the file isn't compacted until it's at least this many bytes
+#define STORE_COMPACT_RATIO    3 // the file is compacted when it's this many times larger than its live records
+
+typedef struct BRStoreStruct BRStore;
+
+// opens the store at path, creating it if needed, and replays its log, discarding any partially written record at the
+// end left by a crash
+// returns NULL and sets errno if the file can't be opened or isn't a store, otherwise a store that must be freed by
+// calling BRStoreFree()
+BRStore *BRStoreNew(const char *path);
+
+// saves blocks along with their heights, if replace is true all previously saved blocks are removed first
+void BRStoreSaveBlocks(BRStore *store, int replace, BRMerkleBlock *blocks[], size_t blocksCount);
+
+// saves peers, if replace is true all previously saved peers are removed first
+void BRStoreSavePeers(BRStore *store, int replace, const BRPeer peers[], size_t peersCount);
+
+// saves tx along with its block height and timestamp
+void BRStoreSaveTx(BRStore *store, const BRTransaction *tx);
+
+// updates the block height and timestamp of saved transactions, saved proofs are removed if blockHeight is
+// TX_UNCONFIRMED
+void BRStoreUpdateTx(BRStore *store, const UInt256 txHashes[], size_t txCount, uint32_t blockHeight,
+                     uint32_t timestamp);
+
+// removes a saved transaction along with its saved proof
+void BRStoreDeleteTx(BRStore *store, UInt256 txHash);
+
+// saves a merkle proof for a confirmed tx, replacing any proof previously saved for the same tx
+void BRStoreSaveProof(BRStore *store, const BRMerkleProof *proof);
+
+// returns the saved merkle proof for txHash that must be freed by calling BRMerkleProofFree(), or NULL if none is saved
+BRMerkleProof *BRStoreProofForTx(BRStore *store, UInt256 txHash);
+
+// writes newly allocated copies of the saved blocks to blocks, suitable for passing to BRPeerManagerNew()
+// returns number of blocks written, or total blocksCount needed if blocks is NULL
+size_t BRStoreBlocks(BRStore *store, BRMerkleBlock *blocks[], size_t blocksCount);
+
+// writes the saved peers to peers
+// returns number of peers written, or total peersCount needed if peers is NULL
+size_t BRStorePeers(BRStore *store, BRPeer peers[], size_t peersCount);
+
+// writes newly allocated copies of the saved transactions to transactions, suitable for passing to BRWalletNew()
+// returns number of transactions written, or total txCount needed if transactions is NULL
+size_t BRStoreTransactions(BRStore *store, BRTransaction *transactions[], size_t txCount);
+
+// waits until every change saved before the call is written to the file and synced
+// returns 0 on success, or the errno value of a failed write if the file is still missing changes because of it
+int BRStoreFlush(BRStore *store);
+
+// flushes and closes the store, and frees memory allocated for it
+void BRStoreFree(BRStore *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRStore_h
@@ -65,6 +65,7 @@ void BRTxInputSetAddress(BRTxInput *input, const char *address)
     if (input->script) array_free(input->script);
     input->script = NULL;
     input->scriptLen = 0;
+    input->scriptTemplate = BR_SCRIPT_TEMPLATE_NONE;
     memset(input->address, 0, sizeof(input->address));
 
     if (address) {
@@ -73,6 +74,7 @@ void BRTxInputSetAddress(BRTxInput *input, const char *address)
         array_new(input->script, input->scriptLen);
         array_set_count(input->script, input->scriptLen);
         BRAddressScriptPubKey(input->script, input->scriptLen, address);
+        input->scriptTemplate = BRScriptClassify(input->script, input->scriptLen);
     }
 }
 
@@ -83,12 +85,14 @@ void BRTxInputSetScript(BRTxInput *input, const uint8_t *script, size_t scriptLe
     if (input->script) array_free(input->script);
     input->script = NULL;
     input->scriptLen = 0;
+    input->scriptTemplate = BR_SCRIPT_TEMPLATE_NONE;
     memset(input->address, 0, sizeof(input->address));
     
     if (script) {
         input->scriptLen = scriptLen;
         array_new(input->script, scriptLen);
         array_add_array(input->script, script, scriptLen);
+        input->scriptTemplate = BRScriptClassify(script, scriptLen);
         BRAddressFromScriptPubKey(input->address, sizeof(input->address), script, scriptLen);
     }
 }
@@ -156,6 +160,7 @@ void BRTxOutputSetAddress(BRTxOutput *output, const char *address)
     if (output->script) array_free(output->script);
     output->script = NULL;
     output->scriptLen = 0;
+    output->scriptTemplate = BR_SCRIPT_TEMPLATE_NONE;
     memset(output->address, 0, sizeof(output->address));
 
     if (address) {
@@ -164,6 +169,7 @@ void BRTxOutputSetAddress(BRTxOutput *output, const char *address)
         array_new(output->script, output->scriptLen);
         array_set_count(output->script, output->scriptLen);
         BRAddressScriptPubKey(output->script, output->scriptLen, address);
+        output->scriptTemplate = BRScriptClassify(output->script, output->scriptLen);
     }
 }
 
@@ -173,12 +179,14 @@ void BRTxOutputSetScript(BRTxOutput *output, const uint8_t *script, size_t scrip
     if (output->script) array_free(output->script);
     output->script = NULL;
     output->scriptLen = 0;
+    output->scriptTemplate = BR_SCRIPT_TEMPLATE_NONE;
     memset(output->address, 0, sizeof(output->address));
 
     if (script) {
         output->scriptLen = scriptLen;
         array_new(output->script, scriptLen);
         array_add_array(output->script, script, scriptLen);
+        output->scriptTemplate = BRScriptClassify(script, scriptLen);
         BRAddressFromScriptPubKey(output->address, sizeof(output->address), script, scriptLen);
     }
 }
@@ -244,7 +252,7 @@ static size_t _BRTransactionWitnessData(const BRTransaction *tx, uint8_t *data,
     input.signature = input.script; // TODO: handle OP_CODESEPARATOR
     input.sigLen = input.scriptLen;
 
-    if (input.scriptLen == 22 && input.script[0] == OP_0 && input.script[1] == 20) { // P2WPKH scriptCode
+    if (input.scriptTemplate.type == BRScriptTypeP2WPKH) { // P2WPKH scriptCode
         memcpy(&scriptCode[3], &input.script[2], 20);
         input.signature = scriptCode;
         input.sigLen = sizeof(scriptCode);
@@ -379,6 +387,7 @@ BRTransaction *BRTransactionNew(void)
     array_new(tx->outputs, 2);
     tx->lockTime = TX_LOCKTIME;
     tx->blockHeight = TX_UNCONFIRMED;
+    tx->refCount = 1;
     return tx;
 }
 
@@ -394,6 +403,9 @@ BRTransaction *BRTransactionCopy(const BRTransaction *tx)
     cpy->inputs = inputs;
     cpy->outputs = outputs;
     cpy->inCount = cpy->outCount = 0;
+    cpy->refCount = 1;
+    cpy->raw = NULL;
+    cpy->rawLen = 0;
 
     for (size_t i = 0; i < tx->inCount; i++) {
         BRTransactionAddInput(cpy, tx->inputs[i].txHash, tx->inputs[i].index, tx->inputs[i].amount,
@@ -409,6 +421,15 @@ BRTransaction *BRTransactionCopy(const BRTransaction *tx)
     return cpy;
 }
 
+// adds an owner to tx, returns tx which must be released by an additional call to BRTransactionFree()
+// use this instead of BRTransactionCopy() to share a transaction that will not be modified
+BRTransaction *BRTransactionRetain(BRTransaction *tx)
+{
+    assert(tx != NULL);
+    if (tx) __sync_add_and_fetch(&tx->refCount, 1);
+    return tx;
+}
+
 // buf must contain a serialized tx
 // retruns a transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
@@ -512,10 +533,26 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
 
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
 // (tx->blockHeight and tx->timestamp are not serialized)
+// if tx was signed by BRTransactionSign() and hasn't been modified since, its signed bytes are copied as is
 size_t BRTransactionSerialize(const BRTransaction *tx, uint8_t *buf, size_t bufLen)
 {
     assert(tx != NULL);
-    return (tx) ? _BRTransactionData(tx, buf, bufLen, SIZE_MAX, SIGHASH_ALL) : 0;
+    if (! tx) return 0;
+    if (! tx->raw) return _BRTransactionData(tx, buf, bufLen, SIZE_MAX, SIGHASH_ALL);
+    if (buf && tx->rawLen <= bufLen) memcpy(buf, tx->raw, tx->rawLen);
+    return (! buf || tx->rawLen <= bufLen) ? tx->rawLen : 0;
+}
+
+// releases the serialized bytes kept by BRTransactionSign(), must be called after modifying fields of tx directly
+void BRTransactionClearRaw(BRTransaction *tx)
+{
+    assert(tx != NULL);
+    
+    if (tx && tx->raw) {
+        free(tx->raw);
+        tx->raw = NULL;
+        tx->rawLen = 0;
+    }
 }
 
 // adds an input to tx
@@ -523,7 +560,7 @@ void BRTransactionAddInput(BRTransaction *tx, UInt256 txHash, uint32_t index, ui
                            const uint8_t *script, size_t scriptLen, const uint8_t *signature, size_t sigLen,
                            const uint8_t *witness, size_t witLen, uint32_t sequence)
 {
-    BRTxInput input = { txHash, index, "", amount, NULL, 0, NULL, 0, NULL, 0, sequence };
+    BRTxInput input = { txHash, index, "", amount, NULL, 0, NULL, 0, NULL, 0, sequence, BR_SCRIPT_TEMPLATE_NONE };
 
     assert(tx != NULL);
     assert(! UInt256IsZero(txHash));
@@ -532,6 +569,7 @@ void BRTransactionAddInput(BRTransaction *tx, UInt256 txHash, uint32_t index, ui
     assert(witness != NULL || witLen == 0);
     
     if (tx) {
+        BRTransactionClearRaw(tx);
         if (script) BRTxInputSetScript(&input, script, scriptLen);
         if (signature) BRTxInputSetSignature(&input, signature, sigLen);
         if (witness) BRTxInputSetWitness(&input, witness, witLen);
@@ -543,12 +581,13 @@ void BRTransactionAddInput(BRTransaction *tx, UInt256 txHash, uint32_t index, ui
 // adds an output to tx
 void BRTransactionAddOutput(BRTransaction *tx, uint64_t amount, const uint8_t *script, size_t scriptLen)
 {
-    BRTxOutput output = { "", amount, NULL, 0 };
+    BRTxOutput output = { "", amount, NULL, 0, BR_SCRIPT_TEMPLATE_NONE };
     
     assert(tx != NULL);
     assert(script != NULL || scriptLen == 0);
     
     if (tx) {
+        BRTransactionClearRaw(tx);
         BRTxOutputSetScript(&output, script, scriptLen);
         array_add(tx->outputs, output);
         tx->outCount = array_count(tx->outputs);
@@ -559,6 +598,7 @@ void BRTransactionAddOutput(BRTransaction *tx, uint64_t amount, const uint8_t *s
 void BRTransactionShuffleOutputs(BRTransaction *tx)
 {
     assert(tx != NULL);
+    if (tx) BRTransactionClearRaw(tx);
     
     for (uint32_t i = 0; tx && i + 1 < tx->outCount; i++) { // fischer-yates shuffle
         uint32_t j = i + BRRand((uint32_t)tx->outCount - i);
@@ -670,20 +710,26 @@ int BRTransactionSign(BRTransaction *tx, int forkId, BRKey keys[], size_t keysCo
     for (i = 0; tx && i < tx->inCount; i++) {
         BRTxInput *input = &tx->inputs[i];
 
-        const uint8_t *hash = BRScriptPKH(input->script, input->scriptLen);
+        BRScriptType type = input->scriptTemplate.type;
+        const uint8_t *hash = NULL;
+
+        if (type == BRScriptTypeP2PKH || type == BRScriptTypeP2SH || type == BRScriptTypeP2WPKH) {
+            hash = &input->script[input->scriptTemplate.dataOff];
+        }
+        else if (type == BRScriptTypeNonStandard) hash = BRScriptPKH(input->script, input->scriptLen);
+
         j = 0;
         while (j < keysCount && (! hash || ! UInt160Eq(pkh[j], UInt160Get(hash)))) j++;
         if (j >= keysCount) continue;
+        BRTransactionClearRaw(tx);
 
-        const uint8_t *elems[BRScriptElements(NULL, 0, input->script, input->scriptLen)];
-        size_t elemsCount = BRScriptElements(elems, sizeof(elems)/sizeof(*elems), input->script, input->scriptLen);
         uint8_t pubKey[BRKeyPubKey(&keys[j], NULL, 0)];
         size_t pkLen = BRKeyPubKey(&keys[j], pubKey, sizeof(pubKey));
         uint8_t sig[73], script[1 + sizeof(sig) + 1 + sizeof(pubKey)];
         size_t sigLen, scriptLen;
         UInt256 md = UINT256_ZERO;        
 
-        if (elemsCount == 2 && *elems[0] == OP_0 && *elems[1] == 20) { // pay-to-witness-pubkey-hash
+        if (type == BRScriptTypeP2WPKH) { // pay-to-witness-pubkey-hash
             uint8_t data[_BRTransactionWitnessData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
             size_t dataLen = _BRTransactionWitnessData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
             
@@ -695,7 +741,7 @@ int BRTransactionSign(BRTransaction *tx, int forkId, BRKey keys[], size_t keysCo
             BRTxInputSetSignature(input, script, 0);
             BRTxInputSetWitness(input, script, scriptLen);
         }
-        else if (elemsCount >= 2 && *elems[elemsCount - 2] == OP_EQUALVERIFY) { // pay-to-pubkey-hash
+        else if (type == BRScriptTypeP2PKH) { // pay-to-pubkey-hash
             uint8_t data[_BRTransactionData(tx, NULL, 0, i, forkId | SIGHASH_ALL)];
             size_t dataLen = _BRTransactionData(tx, data, sizeof(data), i, forkId | SIGHASH_ALL);
             
@@ -727,6 +773,14 @@ int BRTransactionSign(BRTransaction *tx, int forkId, BRKey keys[], size_t keysCo
         
         if (t) tx->txHash = t->txHash, tx->wtxHash = t->wtxHash;
         if (t) BRTransactionFree(t);
+        
+        if (! tx->raw) { // keep the signed bytes, a signed tx is serialized again to be published, relayed and saved
+            tx->raw = malloc(len);
+            assert(tx->raw != NULL);
+            memcpy(tx->raw, data, len);
+            tx->rawLen = len;
+        }
+        
         return 1;
     }
     else return 0;
@@ -742,12 +796,36 @@ int BRTransactionIsStandard(const BRTransaction *tx)
     return r;
 }
 
-// frees memory allocated for tx
+// returns the number of bytes of heap memory used by tx, including inputs, outputs, scripts, signatures and witnesses
+size_t BRTransactionMemoryUsage(const BRTransaction *tx)
+{
+    size_t size;
+    
+    assert(tx != NULL);
+    size = sizeof(*tx) + ((tx->raw) ? tx->rawLen : 0);
+    if (tx->inputs) size += array_mem_size(tx->inputs);
+    if (tx->outputs) size += array_mem_size(tx->outputs);
+
+    for (size_t i = 0; i < tx->inCount; i++) {
+        if (tx->inputs[i].script) size += array_mem_size(tx->inputs[i].script);
+        if (tx->inputs[i].signature) size += array_mem_size(tx->inputs[i].signature);
+        if (tx->inputs[i].witness) size += array_mem_size(tx->inputs[i].witness);
+    }
+
+    for (size_t i = 0; i < tx->outCount; i++) {
+        if (tx->outputs[i].script) size += array_mem_size(tx->outputs[i].script);
+    }
+
+    return size;
+}
+
+// releases an owner of tx, and frees memory allocated for tx if it was the last one
 void BRTransactionFree(BRTransaction *tx)
 {
     assert(tx != NULL);
     
-    if (tx) {
+    if (tx && __sync_sub_and_fetch(&tx->refCount, 1) == 0) {
+        BRTransactionClearRaw(tx);
         for (size_t i = 0; i < tx->inCount; i++) {
             BRTxInputSetScript(&tx->inputs[i], NULL, 0);
             BRTxInputSetSignature(&tx->inputs[i], NULL, 0);
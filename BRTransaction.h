@@ -26,6 +26,7 @@
 #define BRTransaction_h
 
 #include "BRKey.h"
+#include "BRAddress.h"
 #include "BRInt.h"
 #include <stddef.h>
 #include <inttypes.h>
@@ -66,8 +67,11 @@ typedef struct {
     uint8_t *witness;
     size_t witLen;
     uint32_t sequence;
+    BRScriptTemplate scriptTemplate; // standard template matched by script, cached when script is set
 } BRTxInput;
 
+// these don't clear the serialized bytes a signed BRTransaction keeps in tx->raw, after changing an input of a signed
+// tx, call BRTransactionClearRaw() so the tx is serialized from its fields again
 void BRTxInputSetAddress(BRTxInput *input, const char *address);
 void BRTxInputSetScript(BRTxInput *input, const uint8_t *script, size_t scriptLen);
 void BRTxInputSetSignature(BRTxInput *input, const uint8_t *signature, size_t sigLen);
@@ -78,11 +82,14 @@ typedef struct {
     uint64_t amount;
     uint8_t *script;
     size_t scriptLen;
+    BRScriptTemplate scriptTemplate; // standard template matched by script, cached when script is set
 } BRTxOutput;
 
-#define BR_TX_OUTPUT_NONE ((BRTxOutput) { "", 0, NULL, 0 })
+#define BR_TX_OUTPUT_NONE ((BRTxOutput) { "", 0, NULL, 0, BR_SCRIPT_TEMPLATE_NONE })
 
 // when creating a BRTxOutput struct outside of a BRTransaction, set address or script to NULL when done to free memory
+// like the BRTxInput setters, these don't clear tx->raw, call BRTransactionClearRaw() after changing an output of a
+// signed tx
 void BRTxOutputSetAddress(BRTxOutput *output, const char *address);
 void BRTxOutputSetScript(BRTxOutput *output, const uint8_t *script, size_t scriptLen);
 
@@ -97,6 +104,11 @@ typedef struct {
     uint32_t lockTime;
     uint32_t blockHeight;
     uint32_t timestamp; // time interval since unix epoch
+    uint32_t refCount; // number of owners, tx is freed when the last one calls BRTransactionFree()
+    // serialized bytes kept by BRTransactionSign() for relaying and saving, released by the BRTransaction functions
+    // that modify tx, callers changing fields or inputs and outputs directly must call BRTransactionClearRaw()
+    uint8_t *raw;
+    size_t rawLen;
 } BRTransaction;
 
 // returns a newly allocated empty transaction that must be freed by calling BRTransactionFree()
@@ -105,14 +117,22 @@ BRTransaction *BRTransactionNew(void);
 // returns a deep copy of tx and that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionCopy(const BRTransaction *tx);
 
+// adds an owner to tx, returns tx which must be released by an additional call to BRTransactionFree()
+// use this instead of BRTransactionCopy() to share a transaction that will not be modified
+BRTransaction *BRTransactionRetain(BRTransaction *tx);
+
 // buf must contain a serialized tx
 // retruns a transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen);
 
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
 // (tx->blockHeight and tx->timestamp are not serialized)
+// if tx was signed by BRTransactionSign() and hasn't been modified since, its signed bytes are copied as is
 size_t BRTransactionSerialize(const BRTransaction *tx, uint8_t *buf, size_t bufLen);
 
+// releases the serialized bytes kept by BRTransactionSign(), must be called after modifying fields of tx directly
+void BRTransactionClearRaw(BRTransaction *tx);
+
 // adds an input to tx
 void BRTransactionAddInput(BRTransaction *tx, UInt256 txHash, uint32_t index, uint64_t amount,
                            const uint8_t *script, size_t scriptLen, const uint8_t *signature, size_t sigLen,
@@ -156,7 +176,10 @@ inline static int BRTransactionEq(const void *tx, const void *otherTx)
     return (tx == otherTx || UInt256Eq(((const BRTransaction *)tx)->txHash, ((const BRTransaction *)otherTx)->txHash));
 }
 
-// frees memory allocated for tx
+// returns the number of bytes of heap memory used by tx, including inputs, outputs, scripts, signatures and witnesses
+size_t BRTransactionMemoryUsage(const BRTransaction *tx);
+
+// releases an owner of tx, and frees memory allocated for tx if it was the last one
 void BRTransactionFree(BRTransaction *tx);
 
 #ifdef __cplusplus
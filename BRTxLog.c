@@ -0,0 +1,816 @@
+//
+//  BRTxLog.c
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "BRTxLog.h"
+#include "BRSet.h"
+#include "BRArray.h"
+#include "BRCrypto.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define TXLOG_MAGIC      "BRTXLOG\x02"
+#define TXLOG_MAGIC_LEN  8
+#define TXLOG_BUF_LEN    0x10000 // compaction writes are batched into chunks of this many bytes
+#define TXLOG_RETRY      60 // seconds before a failed compaction is tried again
+
+// index record: txHash, block height, timestamp, offset and length of the serialized tx, length of the wallet data
+// stored just before the serialized tx, number of bytes following the record, and a checksum of the preceding fields
+// and the bytes following the record
+#define TXLOG_RECORD_LEN (sizeof(UInt256) + sizeof(uint32_t)*2 + sizeof(uint64_t) + sizeof(uint32_t)*4)
+#define TXLOG_HEIGHT_OFF (sizeof(UInt256))
+#define TXLOG_TIME_OFF   (TXLOG_HEIGHT_OFF + sizeof(uint32_t))
+#define TXLOG_OFFSET_OFF (TXLOG_TIME_OFF + sizeof(uint32_t))
+#define TXLOG_LENGTH_OFF (TXLOG_OFFSET_OFF + sizeof(uint64_t))
+#define TXLOG_WALLET_OFF (TXLOG_LENGTH_OFF + sizeof(uint32_t))
+#define TXLOG_DATA_OFF   (TXLOG_WALLET_OFF + sizeof(uint32_t))
+#define TXLOG_CHECK_OFF  (TXLOG_DATA_OFF + sizeof(uint32_t))
+
+#define TXLOG_INPUT_LEN  (sizeof(UInt256) + sizeof(uint32_t)*2) // previous txHash, output index and sequence
+
+typedef struct {
+    UInt256 txHash; // must be first, entries are looked up with BRTransactionHash() and BRTransactionEq()
+    uint32_t blockHeight;
+    uint32_t timestamp;
+    uint64_t offset; // file offset of the serialized tx
+    uint32_t length; // length of the serialized tx, 0 if removed
+    uint32_t walletLen; // length of the wallet data stored just before the serialized tx
+    BRTransaction *tx; // NULL until first accessed
+    int loaded; // true once tx is parsed, rather than only built from the wallet data
+} _BRTxLogEntry;
+
+typedef struct {
+    UInt256 txHash; // must be first, moves are looked up with BRTransactionHash() and BRTransactionEq()
+    uint64_t offset, newOffset; // where the serialized tx is in the log, and where it's copied to by compaction
+    uint32_t blockHeight, timestamp, length, walletLen;
+} _BRTxLogMove;
+
+struct BRTxLogStruct {
+    char *path;
+    int fd; // only replaced by the compaction thread, with the lock held
+    const uint8_t *map;
+    size_t mapLen, fileSize, liveSize; // liveSize is what the live entries would take up in a compacted file
+    BRSet *entries;
+    int error; // set when a failed append couldn't be rolled back, after which appends fail with the same error
+    int compactPending, closing;
+    time_t compactTime; // a compaction isn't tried before this time after one failed
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t compactCond;
+};
+
+static void _BRTxLogEntryFree(_BRTxLogEntry *entry)
+{
+    if (entry->tx) BRTransactionFree(entry->tx);
+    free(entry);
+}
+
+static void _setApplyFreeEntry(void *info, void *entry)
+{
+    _BRTxLogEntryFree(entry);
+}
+
+// writes the data the wallet needs to compute balances and UTXOs to buf: version, lockTime, input count, each input's
+// previous txHash, output index, sequence and address, output count, and each output's amount, script and address
+// returns number of bytes written, or total bufLen needed if buf is NULL
+static size_t _BRTxLogWalletData(const BRTransaction *tx, uint8_t *buf, size_t bufLen)
+{
+    size_t off = 0, len;
+    
+    if (buf && off + sizeof(uint32_t)*2 <= bufLen) {
+        UInt32SetLE(&buf[off], tx->version);
+        UInt32SetLE(&buf[off + sizeof(uint32_t)], tx->lockTime);
+    }
+    
+    off += sizeof(uint32_t)*2;
+    off += BRVarIntSet((buf ? &buf[off] : NULL), (off <= bufLen ? bufLen - off : 0), tx->inCount);
+    
+    for (size_t i = 0; i < tx->inCount; i++) {
+        len = strlen(tx->inputs[i].address);
+        
+        if (buf && off + TXLOG_INPUT_LEN + 1 + len <= bufLen) {
+            UInt256Set(&buf[off], tx->inputs[i].txHash);
+            UInt32SetLE(&buf[off + sizeof(UInt256)], tx->inputs[i].index);
+            UInt32SetLE(&buf[off + sizeof(UInt256) + sizeof(uint32_t)], tx->inputs[i].sequence);
+            buf[off + TXLOG_INPUT_LEN] = (uint8_t)len;
+            memcpy(&buf[off + TXLOG_INPUT_LEN + 1], tx->inputs[i].address, len);
+        }
+        
+        off += TXLOG_INPUT_LEN + 1 + len;
+    }
+    
+    off += BRVarIntSet((buf ? &buf[off] : NULL), (off <= bufLen ? bufLen - off : 0), tx->outCount);
+    
+    for (size_t i = 0; i < tx->outCount; i++) {
+        len = strlen(tx->outputs[i].address);
+        if (buf && off + sizeof(uint64_t) <= bufLen) UInt64SetLE(&buf[off], tx->outputs[i].amount);
+        off += sizeof(uint64_t);
+        off += BRVarIntSet((buf ? &buf[off] : NULL), (off <= bufLen ? bufLen - off : 0), tx->outputs[i].scriptLen);
+        
+        if (buf && off + tx->outputs[i].scriptLen + 1 + len <= bufLen) {
+            if (tx->outputs[i].scriptLen > 0) memcpy(&buf[off], tx->outputs[i].script, tx->outputs[i].scriptLen);
+            buf[off + tx->outputs[i].scriptLen] = (uint8_t)len;
+            memcpy(&buf[off + tx->outputs[i].scriptLen + 1], tx->outputs[i].address, len);
+        }
+        
+        off += tx->outputs[i].scriptLen + 1 + len;
+    }
+    
+    return (! buf || off <= bufLen) ? off : 0;
+}
+
+// reads an address written by _BRTxLogWalletData(), returns the number of bytes read, or 0 if it's malformed
+static size_t _BRTxLogGetAddress(char address[36], const uint8_t *buf, size_t bufLen)
+{
+    size_t len = (bufLen > 0) ? buf[0] : 0;
+    
+    if (bufLen == 0 || len > 35 || 1 + len > bufLen) return 0;
+    memcpy(address, &buf[1], len);
+    address[len] = '\0';
+    return 1 + len;
+}
+
+// builds a tx from the wallet data written by _BRTxLogWalletData() without deriving any addresses or hashes, its input
+// scripts, signatures and witnesses are NULL until they're parsed from the serialized tx
+// returns NULL if the wallet data is malformed
+static BRTransaction *_BRTxLogWalletTx(const uint8_t *buf, size_t bufLen, UInt256 txHash)
+{
+    BRTransaction *tx = BRTransactionNew();
+    size_t i, off = sizeof(uint32_t)*2, len = 0, n;
+    uint64_t count = 0;
+    int ok = (off <= bufLen);
+    
+    if (ok) {
+        tx->version = UInt32GetLE(buf);
+        tx->lockTime = UInt32GetLE(&buf[sizeof(uint32_t)]);
+        count = BRVarInt(&buf[off], bufLen - off, &len);
+        off += len;
+        ok = (off <= bufLen && count > 0 && count <= (bufLen - off)/(TXLOG_INPUT_LEN + 1));
+    }
+    
+    if (ok) tx->inCount = (size_t)count;
+    if (ok) array_set_count(tx->inputs, tx->inCount);
+    
+    for (i = 0; ok && i < tx->inCount; i++) {
+        ok = (off + TXLOG_INPUT_LEN <= bufLen);
+        if (! ok) break;
+        tx->inputs[i].txHash = UInt256Get(&buf[off]);
+        tx->inputs[i].index = UInt32GetLE(&buf[off + sizeof(UInt256)]);
+        tx->inputs[i].sequence = UInt32GetLE(&buf[off + sizeof(UInt256) + sizeof(uint32_t)]);
+        off += TXLOG_INPUT_LEN;
+        n = _BRTxLogGetAddress(tx->inputs[i].address, &buf[off], bufLen - off);
+        ok = (n > 0);
+        off += n;
+    }
+    
+    if (ok) {
+        count = BRVarInt(&buf[off], bufLen - off, &len);
+        off += len;
+        ok = (off <= bufLen && count <= (bufLen - off)/(sizeof(uint64_t) + 2));
+    }
+    
+    if (ok) tx->outCount = (size_t)count;
+    if (ok) array_set_count(tx->outputs, tx->outCount);
+    
+    for (i = 0; ok && i < tx->outCount; i++) {
+        ok = (off + sizeof(uint64_t) <= bufLen);
+        if (! ok) break;
+        tx->outputs[i].amount = UInt64GetLE(&buf[off]);
+        off += sizeof(uint64_t);
+        count = BRVarInt(&buf[off], bufLen - off, &len);
+        off += len;
+        ok = (off <= bufLen && count < bufLen - off);
+        if (! ok) break;
+        tx->outputs[i].scriptLen = (size_t)count;
+        array_new(tx->outputs[i].script, tx->outputs[i].scriptLen);
+        array_add_array(tx->outputs[i].script, &buf[off], tx->outputs[i].scriptLen);
+        tx->outputs[i].scriptTemplate = BRScriptClassify(tx->outputs[i].script, tx->outputs[i].scriptLen);
+        off += tx->outputs[i].scriptLen;
+        n = _BRTxLogGetAddress(tx->outputs[i].address, &buf[off], bufLen - off);
+        ok = (n > 0);
+        off += n;
+    }
+    
+    if (ok && off == bufLen) {
+        tx->txHash = txHash;
+        tx->wtxHash = txHash;
+    }
+    else {
+        BRTransactionFree(tx);
+        tx = NULL;
+    }
+    
+    return tx;
+}
+
+// writes an index record for entry, with a checksum of the record and the dataLen bytes of data that follow it
+static void _BRTxLogRecord(uint8_t buf[TXLOG_RECORD_LEN], const _BRTxLogEntry *entry, const uint8_t *data,
+                           uint32_t dataLen)
+{
+    UInt256Set(buf, entry->txHash);
+    UInt32SetLE(&buf[TXLOG_HEIGHT_OFF], entry->blockHeight);
+    UInt32SetLE(&buf[TXLOG_TIME_OFF], entry->timestamp);
+    UInt64SetLE(&buf[TXLOG_OFFSET_OFF], entry->offset);
+    UInt32SetLE(&buf[TXLOG_LENGTH_OFF], entry->length);
+    UInt32SetLE(&buf[TXLOG_WALLET_OFF], entry->walletLen);
+    UInt32SetLE(&buf[TXLOG_DATA_OFF], dataLen);
+    UInt32SetLE(&buf[TXLOG_CHECK_OFF], BRMurmur3_32(data, dataLen, BRMurmur3_32(buf, TXLOG_CHECK_OFF, 0)));
+}
+
+// appends an index record for entry followed by dataLen bytes of data to buf
+static void _BRTxLogBufAdd(uint8_t **buf, const _BRTxLogEntry *entry, const uint8_t *data, uint32_t dataLen)
+{
+    size_t off = array_count(*buf);
+    
+    if (off + TXLOG_RECORD_LEN + dataLen > array_capacity(*buf)) {
+        array_set_capacity(*buf, off + TXLOG_RECORD_LEN + dataLen);
+    }
+    
+    array_set_count(*buf, off + TXLOG_RECORD_LEN + dataLen);
+    if (dataLen > 0) memcpy(&(*buf)[off + TXLOG_RECORD_LEN], data, dataLen);
+    _BRTxLogRecord(&(*buf)[off], entry, data, dataLen);
+}
+
+// returns 0 once len bytes of buf are written to fd, or an errno value
+static int _BRTxLogWrite(int fd, const uint8_t *buf, size_t len)
+{
+    ssize_t n;
+    
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return errno;
+        buf += n;
+        len -= n;
+    }
+    
+    return 0;
+}
+
+// syncs the directory containing path, so a file renamed into it is still there after a crash
+// returns 0 on success, or an errno value
+static int _BRTxLogSyncDir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    size_t len = (! slash) ? 1 : (slash == path) ? 1 : (size_t)(slash - path);
+    char dir[len + 1];
+    int fd, error = 0;
+    
+    if (slash) memcpy(dir, path, len);
+    else dir[0] = '.';
+    dir[len] = '\0';
+    fd = open(dir, O_RDONLY);
+    if (fd < 0) return errno;
+    if (fsync(fd) != 0) error = errno;
+    close(fd);
+    return error;
+}
+
+// extends the mapping to cover the whole file, returns 0 on success, or an errno value
+static int _BRTxLogMap(BRTxLog *log)
+{
+    void *map;
+    
+    if (log->map && log->mapLen >= log->fileSize) return 0;
+    map = mmap(NULL, log->fileSize, PROT_READ, MAP_SHARED, log->fd, 0);
+    if (map == MAP_FAILED) return errno;
+    if (log->map) munmap((void *)log->map, log->mapLen);
+    log->map = map;
+    log->mapLen = log->fileSize;
+    return 0;
+}
+
+// applies an index record to the live entries, a record with a different offset than the live entry replaces it
+static void _BRTxLogApply(BRTxLog *log, const _BRTxLogEntry *entry)
+{
+    _BRTxLogEntry *e = BRSetGet(log->entries, &entry->txHash);
+    
+    if (e && (entry->length == 0 || e->offset != entry->offset)) {
+        BRSetRemove(log->entries, e);
+        log->liveSize -= TXLOG_RECORD_LEN + e->walletLen + e->length;
+        _BRTxLogEntryFree(e);
+        e = NULL;
+    }
+    
+    if (! e && entry->length > 0) {
+        e = calloc(1, sizeof(*e));
+        assert(e != NULL);
+        e->txHash = entry->txHash;
+        e->offset = entry->offset;
+        e->length = entry->length;
+        e->walletLen = entry->walletLen;
+        BRSetAdd(log->entries, e);
+        log->liveSize += TXLOG_RECORD_LEN + e->walletLen + e->length;
+    }
+    
+    if (e) {
+        e->blockHeight = entry->blockHeight;
+        e->timestamp = entry->timestamp;
+        if (e->tx) e->tx->blockHeight = entry->blockHeight, e->tx->timestamp = entry->timestamp;
+    }
+}
+
+// true if the file is large enough compared to its live entries to be compacted, must be called with the lock held
+static int _BRTxLogNeedsCompact(BRTxLog *log)
+{
+    return (log->fileSize >= TXLOG_COMPACT_MIN_SIZE && log->fileSize > log->liveSize*TXLOG_COMPACT_RATIO &&
+            time(NULL) >= log->compactTime);
+}
+
+// rewrites the file with only the live entries, called by the compaction thread with the lock held
+// the live entries are copied without the lock, through a separate mapping of the part of the file written before they
+// were listed, which appends never modify, then the changes appended since are written with the lock held
+// a failed compaction leaves the original file in place, so nothing is lost
+// returns 0 on success, or an errno value
+static int _BRTxLogCompact(BRTxLog *log)
+{
+    size_t pathLen = strlen(log->path), count = BRSetCount(log->entries), snapSize = log->fileSize, i, n = 0;
+    char tmp[pathLen + 5];
+    _BRTxLogMove *moves = malloc(count*sizeof(*moves)), *adds = NULL, *m;
+    BRSet *moved = BRSetNew(BRTransactionHash, BRTransactionEq, count);
+    _BRTxLogEntry *e = NULL, q;
+    void *map = MAP_FAILED;
+    const uint8_t *snap;
+    uint64_t off = TXLOG_MAGIC_LEN;
+    uint8_t *buf;
+    int fd = -1, error = 0;
+    
+    assert(moves != NULL || count == 0);
+    strcpy(tmp, log->path);
+    strcpy(&tmp[pathLen], ".tmp");
+    
+    for (i = 0; (e = BRSetIterate(log->entries, e)) != NULL; i++) {
+        moves[i] = (_BRTxLogMove) { e->txHash, e->offset, 0, e->blockHeight, e->timestamp, e->length, e->walletLen };
+        BRSetAdd(moved, &moves[i]);
+    }
+    
+    pthread_mutex_unlock(&log->lock);
+    array_new(buf, TXLOG_BUF_LEN);
+    array_add_array(buf, (const uint8_t *)TXLOG_MAGIC, TXLOG_MAGIC_LEN);
+    map = mmap(NULL, snapSize, PROT_READ, MAP_SHARED, log->fd, 0);
+    if (map == MAP_FAILED) error = errno;
+    snap = map;
+    if (! error) fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (! error && fd < 0) error = errno;
+    
+    for (i = 0; ! error && i < count; i++) {
+        m = &moves[i];
+        q = (_BRTxLogEntry) { m->txHash, m->blockHeight, m->timestamp, off + TXLOG_RECORD_LEN + m->walletLen,
+                              m->length, m->walletLen, NULL, 0 };
+        _BRTxLogBufAdd(&buf, &q, &snap[m->offset - m->walletLen], m->walletLen + m->length);
+        m->newOffset = q.offset;
+        off += TXLOG_RECORD_LEN + m->walletLen + m->length;
+        if (array_count(buf) < TXLOG_BUF_LEN) continue;
+        error = _BRTxLogWrite(fd, buf, array_count(buf));
+        array_set_count(buf, 0);
+    }
+    
+    if (! error) error = _BRTxLogWrite(fd, buf, array_count(buf));
+    if (! error && fsync(fd) != 0) error = errno; // the bulk of the file is synced before taking the lock again
+    array_set_count(buf, 0);
+    pthread_mutex_lock(&log->lock);
+    adds = malloc(BRSetCount(log->entries)*sizeof(*adds));
+    assert(adds != NULL || BRSetCount(log->entries) == 0);
+    
+    while (! error && (e = BRSetIterate(log->entries, e)) != NULL) {
+        m = BRSetGet(moved, &e->txHash);
+        q = *e;
+        
+        if (m && m->offset == e->offset) { // copied already, only the block height and timestamp may have changed
+            if (m->blockHeight == e->blockHeight && m->timestamp == e->timestamp) continue;
+            q.offset = m->newOffset;
+            _BRTxLogBufAdd(&buf, &q, NULL, 0);
+            off += TXLOG_RECORD_LEN;
+            continue;
+        }
+        
+        // added or replaced since the entries were listed
+        if (e->offset + e->length > log->mapLen && (error = _BRTxLogMap(log)) != 0) break;
+        q.offset = off + TXLOG_RECORD_LEN + e->walletLen;
+        _BRTxLogBufAdd(&buf, &q, &log->map[e->offset - e->walletLen], e->walletLen + e->length);
+        adds[n] = (_BRTxLogMove) { e->txHash, e->offset, q.offset, 0, 0, 0, 0 };
+        BRSetAdd(moved, &adds[n++]);
+        off += TXLOG_RECORD_LEN + e->walletLen + e->length;
+    }
+    
+    for (i = 0; ! error && i < count; i++) { // removed since the entries were listed
+        if (BRSetContains(log->entries, &moves[i])) continue;
+        q = (_BRTxLogEntry) { moves[i].txHash, 0, 0, 0, 0, 0, NULL, 0 };
+        _BRTxLogBufAdd(&buf, &q, NULL, 0);
+        off += TXLOG_RECORD_LEN;
+    }
+    
+    if (! error) error = _BRTxLogWrite(fd, buf, array_count(buf));
+    if (! error && fsync(fd) != 0) error = errno;
+    if (! error && rename(tmp, log->path) != 0) error = errno;
+    
+    if (! error) {
+        if (log->map) munmap((void *)log->map, log->mapLen);
+        log->map = NULL;
+        log->mapLen = 0;
+        close(log->fd);
+        log->fd = fd;
+        log->fileSize = (size_t)off;
+        log->error = 0; // whatever a failed append left behind isn't in the new file
+        
+        while ((e = BRSetIterate(log->entries, e)) != NULL) {
+            m = BRSetGet(moved, &e->txHash);
+            if (m && m->offset == e->offset) e->offset = m->newOffset;
+        }
+        
+        error = _BRTxLogSyncDir(log->path);
+    }
+    else if (fd >= 0) {
+        close(fd);
+        unlink(tmp);
+    }
+    
+    if (map != MAP_FAILED) munmap(map, snapSize);
+    array_free(buf);
+    BRSetFree(moved);
+    if (adds) free(adds);
+    if (moves) free(moves);
+    return error;
+}
+
+static void *_BRTxLogThreadRoutine(void *info)
+{
+    BRTxLog *log = info;
+    
+    pthread_mutex_lock(&log->lock);
+    
+    // a compaction that's already been requested is finished before closing
+    while (! log->closing || log->compactPending) {
+        if (! log->compactPending) {
+            pthread_cond_wait(&log->compactCond, &log->lock);
+            continue;
+        }
+        
+        if (_BRTxLogCompact(log) != 0) log->compactTime = time(NULL) + TXLOG_RETRY;
+        log->compactPending = _BRTxLogNeedsCompact(log); // changes appended while compacting may call for another
+    }
+    
+    pthread_mutex_unlock(&log->lock);
+    return NULL;
+}
+
+// appends an index record for entry followed by dataLen bytes of data, then applies it, must be called with the lock
+// held, returns 0 on success, or an errno value
+static int _BRTxLogAppend(BRTxLog *log, const _BRTxLogEntry *entry, const uint8_t *data, uint32_t dataLen)
+{
+    uint8_t rec[TXLOG_RECORD_LEN];
+    int error = log->error;
+    
+    _BRTxLogRecord(rec, entry, data, dataLen);
+    if (! error) error = _BRTxLogWrite(log->fd, rec, sizeof(rec));
+    if (! error && dataLen > 0) error = _BRTxLogWrite(log->fd, data, dataLen);
+    
+    if (error) { // don't leave a partial record for the next append to follow
+        if (! log->error && ftruncate(log->fd, log->fileSize) != 0) log->error = error;
+        return error;
+    }
+    
+    log->fileSize += TXLOG_RECORD_LEN + dataLen;
+    _BRTxLogApply(log, entry);
+    
+    if (! log->compactPending && _BRTxLogNeedsCompact(log)) { // compacted on the log's own thread
+        log->compactPending = 1;
+        pthread_cond_signal(&log->compactCond);
+    }
+    
+    return 0;
+}
+
+// opens the log at path, creating it if needed, and maps it into memory, discarding any partially written record at
+// the end left by a crash
+// returns NULL and sets errno if the file can't be opened or isn't a transaction log, otherwise a log that must be
+// freed by calling BRTxLogFree()
+BRTxLog *BRTxLogNew(const char *path)
+{
+    BRTxLog *log = NULL;
+    struct stat st;
+    const uint8_t *r;
+    _BRTxLogEntry entry;
+    size_t size = 0, off = TXLOG_MAGIC_LEN;
+    uint32_t dataLen;
+    int fd, error = 0;
+    
+    assert(path != NULL);
+    fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0) error = errno;
+    if (! error) size = (size_t)st.st_size;
+    
+    if (! error && size < TXLOG_MAGIC_LEN) { // new file, or one whose creation didn't complete
+        if (ftruncate(fd, 0) != 0) error = errno;
+        if (! error) error = _BRTxLogWrite(fd, (const uint8_t *)TXLOG_MAGIC, TXLOG_MAGIC_LEN);
+        if (! error && fsync(fd) != 0) error = errno;
+        size = TXLOG_MAGIC_LEN;
+    }
+    
+    if (! error) {
+        log = calloc(1, sizeof(*log));
+        assert(log != NULL);
+        log->path = strdup(path);
+        assert(log->path != NULL);
+        log->fd = fd;
+        log->fileSize = size;
+        log->entries = BRSetNew(BRTransactionHash, BRTransactionEq, 100);
+        pthread_mutex_init(&log->lock, NULL);
+        pthread_cond_init(&log->compactCond, NULL);
+        error = _BRTxLogMap(log);
+        if (! error && memcmp(log->map, TXLOG_MAGIC, TXLOG_MAGIC_LEN) != 0) error = EINVAL;
+        
+        // only the index records and wallet data are used here, transactions are parsed on first access
+        while (! error && off + TXLOG_RECORD_LEN <= size) {
+            r = &log->map[off];
+            dataLen = UInt32GetLE(&r[TXLOG_DATA_OFF]);
+            if (dataLen > size - off - TXLOG_RECORD_LEN) break; // truncated record
+            if (BRMurmur3_32(&r[TXLOG_RECORD_LEN], dataLen, BRMurmur3_32(r, TXLOG_CHECK_OFF, 0)) !=
+                UInt32GetLE(&r[TXLOG_CHECK_OFF])) break; // torn write
+            entry = (_BRTxLogEntry) { UInt256Get(r), UInt32GetLE(&r[TXLOG_HEIGHT_OFF]), UInt32GetLE(&r[TXLOG_TIME_OFF]),
+                                      UInt64GetLE(&r[TXLOG_OFFSET_OFF]), UInt32GetLE(&r[TXLOG_LENGTH_OFF]),
+                                      UInt32GetLE(&r[TXLOG_WALLET_OFF]), NULL, 0 };
+            if (entry.length > 0 && (entry.offset < TXLOG_MAGIC_LEN + TXLOG_RECORD_LEN + entry.walletLen ||
+                                     entry.offset + entry.length > off + TXLOG_RECORD_LEN + dataLen)) break; // corrupt
+            _BRTxLogApply(log, &entry);
+            off += TXLOG_RECORD_LEN + dataLen;
+        }
+        
+        if (! error && off < size && ftruncate(fd, off) != 0) error = errno; // discard the partially written record
+        if (! error) log->fileSize = off;
+        if (! error && pthread_create(&log->thread, NULL, _BRTxLogThreadRoutine, log) != 0) error = EAGAIN;
+        
+        if (error) {
+            BRSetApply(log->entries, NULL, _setApplyFreeEntry);
+            BRSetFree(log->entries);
+            if (log->map) munmap((void *)log->map, log->mapLen);
+            pthread_cond_destroy(&log->compactCond);
+            pthread_mutex_destroy(&log->lock);
+            free(log->path);
+            free(log);
+            log = NULL;
+        }
+    }
+    
+    if (error) close(fd);
+    if (error) errno = error;
+    return log;
+}
+
+// appends tx along with its block height and timestamp, replacing any tx with the same txHash, tx is retained by the
+// log, so it must not be modified afterwards other than by the wallet updating its block height and timestamp
+// returns 0 once the change is synced to the file, or an errno value
+int BRTxLogAdd(BRTxLog *log, BRTransaction *tx)
+{
+    _BRTxLogEntry entry, *e;
+    size_t walletLen, len;
+    int error;
+    
+    assert(log != NULL);
+    assert(tx != NULL);
+    walletLen = _BRTxLogWalletData(tx, NULL, 0);
+    len = BRTransactionSerialize(tx, NULL, 0);
+    if (len == 0 || walletLen + len > UINT32_MAX) return EINVAL;
+    
+    uint8_t _buf[0x1000], *buf = (walletLen + len <= sizeof(_buf)) ? _buf : malloc(walletLen + len);
+    
+    assert(buf != NULL);
+    walletLen = _BRTxLogWalletData(tx, buf, walletLen);
+    len = BRTransactionSerialize(tx, &buf[walletLen], len);
+    pthread_mutex_lock(&log->lock);
+    entry = (_BRTxLogEntry) { tx->txHash, tx->blockHeight, tx->timestamp, log->fileSize + TXLOG_RECORD_LEN + walletLen,
+                              (uint32_t)len, (uint32_t)walletLen, NULL, 0 };
+    error = _BRTxLogAppend(log, &entry, buf, (uint32_t)(walletLen + len));
+    e = (! error) ? BRSetGet(log->entries, &tx->txHash) : NULL;
+    if (e && ! e->tx) e->tx = BRTransactionRetain(tx), e->loaded = 1; // already parsed, so it's never read back
+    if (! error && fsync(log->fd) != 0) error = errno;
+    pthread_mutex_unlock(&log->lock);
+    if (buf != _buf) free(buf);
+    return error;
+}
+
+// appends new block heights and timestamps for logged transactions, hashes that aren't in the log are ignored
+// returns 0 once the changes are synced to the file, or an errno value
+int BRTxLogUpdate(BRTxLog *log, const UInt256 txHashes[], size_t txCount, uint32_t blockHeight, uint32_t timestamp)
+{
+    _BRTxLogEntry entry, *e;
+    size_t count = 0;
+    int error = 0;
+    
+    assert(log != NULL);
+    assert(txHashes != NULL || txCount == 0);
+    pthread_mutex_lock(&log->lock);
+    
+    for (size_t i = 0; ! error && i < txCount; i++) {
+        e = BRSetGet(log->entries, &txHashes[i]);
+        if (! e || (e->blockHeight == blockHeight && e->timestamp == timestamp)) continue;
+        entry = *e;
+        entry.blockHeight = blockHeight;
+        entry.timestamp = timestamp;
+        error = _BRTxLogAppend(log, &entry, NULL, 0);
+        count++;
+    }
+    
+    if (! error && count > 0 && fsync(log->fd) != 0) error = errno; // one sync for the whole batch
+    pthread_mutex_unlock(&log->lock);
+    return error;
+}
+
+// appends the removal of a logged transaction
+// returns 0 once the change is synced to the file, or an errno value
+int BRTxLogRemove(BRTxLog *log, UInt256 txHash)
+{
+    _BRTxLogEntry entry = { txHash, 0, 0, 0, 0, 0, NULL, 0 };
+    int error = 0;
+    
+    assert(log != NULL);
+    pthread_mutex_lock(&log->lock);
+    
+    if (BRSetContains(log->entries, &txHash)) {
+        error = _BRTxLogAppend(log, &entry, NULL, 0);
+        if (! error && fsync(log->fd) != 0) error = errno;
+    }
+    
+    pthread_mutex_unlock(&log->lock);
+    return error;
+}
+
+// writes the hashes of the logged transactions to txHashes without parsing any of them
+// returns number of hashes written, or total txCount needed if txHashes is NULL
+size_t BRTxLogHashes(BRTxLog *log, UInt256 txHashes[], size_t txCount)
+{
+    _BRTxLogEntry *e = NULL;
+    size_t i = 0;
+    
+    assert(log != NULL);
+    pthread_mutex_lock(&log->lock);
+    if (! txHashes) i = BRSetCount(log->entries);
+    
+    while (txHashes && i < txCount && (e = BRSetIterate(log->entries, e)) != NULL) {
+        txHashes[i++] = e->txHash;
+    }
+    
+    pthread_mutex_unlock(&log->lock);
+    return i;
+}
+
+// parses entry from the mapping if it hasn't been yet, a tx already built from the wallet data gets the parsed input
+// scripts, signatures and witnesses, so it stays the same object, must be called with the lock held
+// returns NULL if the serialized tx can't be parsed, or isn't the one the record is for
+static BRTransaction *_BRTxLogEntryTx(BRTxLog *log, _BRTxLogEntry *entry)
+{
+    BRTransaction *tx, *t = entry->tx;
+    BRTxInput *in, *p;
+    
+    if (entry->loaded) return t;
+    if (entry->offset + entry->length > log->mapLen && _BRTxLogMap(log) != 0) return NULL;
+    tx = BRTransactionParse(&log->map[entry->offset], entry->length);
+    
+    if (tx && (! UInt256Eq(tx->txHash, entry->txHash) || (t && t->inCount != tx->inCount))) {
+        BRTransactionFree(tx);
+        tx = NULL;
+    }
+    
+    if (tx && t) {
+        for (size_t i = 0; i < tx->inCount; i++) {
+            in = &t->inputs[i];
+            p = &tx->inputs[i];
+            in->script = p->script, in->scriptLen = p->scriptLen, in->scriptTemplate = p->scriptTemplate;
+            in->signature = p->signature, in->sigLen = p->sigLen;
+            in->witness = p->witness, in->witLen = p->witLen;
+            p->script = p->signature = p->witness = NULL;
+            p->scriptLen = p->sigLen = p->witLen = 0;
+        }
+        
+        t->wtxHash = tx->wtxHash;
+        BRTransactionClearRaw(t);
+        BRTransactionFree(tx);
+        entry->loaded = 1;
+    }
+    else if (tx) {
+        tx->blockHeight = entry->blockHeight;
+        tx->timestamp = entry->timestamp;
+        entry->tx = t = tx;
+        entry->loaded = 1;
+    }
+    
+    return (entry->loaded) ? t : NULL;
+}
+
+// returns the logged transaction with the given hash, parsing it on first access, or NULL if it isn't logged
+// a tx returned by BRTxLogIndexTransactions() is returned as the same object, with its inputs filled in
+// the result must be released by calling BRTransactionFree()
+BRTransaction *BRTxLogTransaction(BRTxLog *log, UInt256 txHash)
+{
+    _BRTxLogEntry *e;
+    BRTransaction *tx = NULL;
+    
+    assert(log != NULL);
+    pthread_mutex_lock(&log->lock);
+    e = BRSetGet(log->entries, &txHash);
+    if (e) tx = _BRTxLogEntryTx(log, e);
+    if (tx) BRTransactionRetain(tx);
+    pthread_mutex_unlock(&log->lock);
+    return tx;
+}
+
+// writes the logged transactions to transactions, building any not yet accessed from the wallet data stored with
+// them without parsing them, so their input scripts, signatures and witnesses are NULL until they're passed to
+// BRTxLogTransaction(), each one written must be released by calling BRTransactionFree()
+// returns number of transactions written, or total txCount needed if transactions is NULL
+size_t BRTxLogIndexTransactions(BRTxLog *log, BRTransaction *transactions[], size_t txCount)
+{
+    _BRTxLogEntry *e = NULL;
+    BRTransaction *tx;
+    size_t i = 0;
+    
+    assert(log != NULL);
+    pthread_mutex_lock(&log->lock);
+    if (! transactions) i = BRSetCount(log->entries);
+    
+    while (transactions && i < txCount && (e = BRSetIterate(log->entries, e)) != NULL) {
+        if (! e->tx && e->offset + e->length > log->mapLen) _BRTxLogMap(log);
+        
+        if (! e->tx && e->offset + e->length <= log->mapLen) {
+            e->tx = _BRTxLogWalletTx(&log->map[e->offset - e->walletLen], e->walletLen, e->txHash);
+            if (e->tx) e->tx->blockHeight = e->blockHeight, e->tx->timestamp = e->timestamp;
+        }
+        
+        tx = (e->tx) ? e->tx : _BRTxLogEntryTx(log, e); // entries with unusable wallet data are parsed
+        if (tx) transactions[i++] = BRTransactionRetain(tx);
+    }
+    
+    pthread_mutex_unlock(&log->lock);
+    return i;
+}
+
+// writes the logged transactions to transactions, parsing any not yet accessed, suitable for passing to BRWalletNew()
+// each one written must be released by calling BRTransactionFree()
+// returns number of transactions written, or total txCount needed if transactions is NULL
+size_t BRTxLogTransactions(BRTxLog *log, BRTransaction *transactions[], size_t txCount)
+{
+    _BRTxLogEntry *e = NULL;
+    BRTransaction *tx;
+    size_t i = 0;
+    
+    assert(log != NULL);
+    pthread_mutex_lock(&log->lock);
+    if (! transactions) i = BRSetCount(log->entries);
+    
+    while (transactions && i < txCount && (e = BRSetIterate(log->entries, e)) != NULL) {
+        tx = _BRTxLogEntryTx(log, e);
+        if (tx) transactions[i++] = BRTransactionRetain(tx); // entries that fail to parse are skipped
+    }
+    
+    pthread_mutex_unlock(&log->lock);
+    return i;
+}
+
+// finishes any compaction in progress, unmaps and closes the log, and frees memory allocated for it
+void BRTxLogFree(BRTxLog *log)
+{
+    assert(log != NULL);
+    pthread_mutex_lock(&log->lock);
+    log->closing = 1;
+    pthread_cond_signal(&log->compactCond);
+    pthread_mutex_unlock(&log->lock);
+    pthread_join(log->thread, NULL);
+    BRSetApply(log->entries, NULL, _setApplyFreeEntry);
+    BRSetFree(log->entries);
+    if (log->map) munmap((void *)log->map, log->mapLen);
+    close(log->fd);
+    pthread_cond_destroy(&log->compactCond);
+    pthread_mutex_destroy(&log->lock);
+    free(log->path);
+    free(log);
+}
@@ -0,0 +1,96 @@
+//
+//  BRTxLog.h
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#ifndef BRTxLog_h
+#define BRTxLog_h
+
+#include "BRTransaction.h"
+#include "BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a compact append-only log of serialized transactions, with a fixed-size index record for each change holding the
+// txHash, block height, timestamp and the offset of the serialized bytes in the file, which are preceded by the inputs
+// and outputs the wallet needs to compute balances and UTXOs
+// opening a log only reads its index records through a read-only memory mapping, each transaction is parsed from the
+// mapping the first time it's accessed, and the parsed transaction is kept until it's removed or the log is freed
+// every change is synced to the file before it returns, and the file is compacted on the log's own thread
+
+#define TXLOG_COMPACT_MIN_SIZE (1024*1024) // the file isn't compacted until it's at least this many bytes
+#define TXLOG_COMPACT_RATIO    2 // the file is compacted when it's this many times larger than its live records
+
+typedef struct BRTxLogStruct BRTxLog;
+
+// opens the log at path, creating it if needed, and maps it into memory, discarding any partially written record at
+// the end left by a crash
+// returns NULL and sets errno if the file can't be opened or isn't a transaction log, otherwise a log that must be
+// freed by calling BRTxLogFree()
+BRTxLog *BRTxLogNew(const char *path);
+
+// appends tx along with its block height and timestamp, replacing any tx with the same txHash, tx is retained by the
+// log, so it must not be modified afterwards other than by the wallet updating its block height and timestamp
+// returns 0 once the change is synced to the file, or an errno value
+int BRTxLogAdd(BRTxLog *log, BRTransaction *tx);
+
+// appends new block heights and timestamps for logged transactions, hashes that aren't in the log are ignored
+// returns 0 once the changes are synced to the file, or an errno value
+int BRTxLogUpdate(BRTxLog *log, const UInt256 txHashes[], size_t txCount, uint32_t blockHeight, uint32_t timestamp);
+
+// appends the removal of a logged transaction
+// returns 0 once the change is synced to the file, or an errno value
+int BRTxLogRemove(BRTxLog *log, UInt256 txHash);
+
+// writes the hashes of the logged transactions to txHashes without parsing any of them
+// returns number of hashes written, or total txCount needed if txHashes is NULL
+size_t BRTxLogHashes(BRTxLog *log, UInt256 txHashes[], size_t txCount);
+
+// returns the logged transaction with the given hash, parsing it on first access, or NULL if it isn't logged
+// a tx returned by BRTxLogIndexTransactions() is returned as the same object, with its inputs filled in
+// the result must be released by calling BRTransactionFree()
+BRTransaction *BRTxLogTransaction(BRTxLog *log, UInt256 txHash);
+
+// writes the logged transactions to transactions, building any not yet accessed from the wallet data stored with
+// them without parsing them, so their input scripts, signatures and witnesses are NULL until they're passed to
+// BRTxLogTransaction(), each one written must be released by calling BRTransactionFree()
+// returns number of transactions written, or total txCount needed if transactions is NULL
+size_t BRTxLogIndexTransactions(BRTxLog *log, BRTransaction *transactions[], size_t txCount);
+
+// writes the logged transactions to transactions, parsing any not yet accessed, suitable for passing to BRWalletNew()
+// each one written must be released by calling BRTransactionFree()
+// returns number of transactions written, or total txCount needed if transactions is NULL
+size_t BRTxLogTransactions(BRTxLog *log, BRTransaction *transactions[], size_t txCount);
+
+// finishes any compaction in progress, unmaps and closes the log, and frees memory allocated for it
+void BRTxLogFree(BRTxLog *log);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRTxLog_h
@@ -33,19 +33,55 @@
 #include <pthread.h>
 #include <assert.h>
 
+#define TX_METRICS_AMOUNTS  0x01 // received, sent and fee are set
+#define TX_METRICS_BALANCE  0x02 // balanceAfter is set
+#define TX_METRICS_VALID    0x04 // isValid is set
+#define TX_METRICS_PENDING  0x08 // isPending is set
+#define TX_METRICS_VERIFIED 0x10 // isVerified is set
+#define TX_METRICS_STATUS   (TX_METRICS_VALID | TX_METRICS_PENDING | TX_METRICS_VERIFIED)
+
+// memoized per-transaction values, so history views don't repeat set lookups and ancestor walks for every query
+// entries are only kept while enabled with BRWalletSetTxMetrics(), and are created the first time a tx is queried
+// when a tx is added, removed, updated or changes validity, only its own entry and those of the transactions spending
+// its outputs are invalidated, and balanceAfter is rewritten by each balance recalculation
+typedef struct {
+    UInt256 txHash;
+    uint64_t received, sent, fee, balanceAfter;
+    uint8_t flags, isValid, isPending, isVerified;
+} _BRTxMetrics;
+
+// hashes of the transactions with memoized metrics that spend outputs of txHash, so invalidating the metrics of a tx
+// can look up its spenders instead of scanning every entry
+typedef struct {
+    UInt256 txHash;
+    UInt256 *spenders;
+} _BRTxSpenders;
+
+// per-address index of wallet transactions and unspent outputs, updated as transactions are added, removed or reordered
+typedef struct {
+    BRAddress address;
+    BRTransaction **transactions; // wallet transactions with an input or output for address, sorted oldest first
+    BRUTXO *utxos; // unspent outputs paying to address
+    uint64_t balance;
+} _BRAddrIndex;
+
 struct BRWalletStruct {
-    uint64_t balance, totalSent, totalReceived, feePerKb, *balanceHist;
+    uint64_t balance, totalSent, totalReceived, feePerKb, *balanceHist, assetBalance;
     uint32_t blockHeight;
-    BRUTXO *utxos;
+    BRUTXO *utxos, *assetUtxos;
     BRTransaction **transactions;
     BRMasterPubKey masterPubKey;
     BRAddress *internalChain, *externalChain;
-    BRSet *allTx, *invalidTx, *pendingTx, *spentOutputs, *usedAddrs, *allAddrs;
+    BRSet *allTx, *invalidTx, *pendingTx, *spentOutputs, *usedAddrs, *allAddrs, *txMetrics, *addrIndex, *assetUTXOSet;
+    BRSet *txSpenders; // _BRTxSpenders items indexed by the spent txHash, kept for the transactions in txMetrics
+    BRSet *unloadedTx; // tx built from the wallet data in txLog, whose inputs are filled in when they're first needed
     void *callbackInfo;
     void (*balanceChanged)(void *info, uint64_t balance);
     void (*txAdded)(void *info, BRTransaction *tx);
     void (*txUpdated)(void *info, const UInt256 txHashes[], size_t txCount, uint32_t blockHeight, uint32_t timestamp);
     void (*txDeleted)(void *info, UInt256 txHash, int notifyUser, int recommendRescan);
+    BRStore *store;
+    BRTxLog *txLog;
     pthread_mutex_t lock;
 };
 
@@ -104,7 +140,8 @@ inline static int _BRWalletTxCompare(BRWallet *wallet, const BRTransaction *tx1,
 }
 
 // inserts tx into wallet->transactions, keeping wallet->transactions sorted by date, oldest first (insertion sort)
-inline static void _BRWalletInsertTx(BRWallet *wallet, BRTransaction *tx)
+// returns the index tx was inserted at
+inline static size_t _BRWalletInsertTx(BRWallet *wallet, BRTransaction *tx)
 {
     size_t i = array_count(wallet->transactions);
     
@@ -116,6 +153,7 @@ inline static void _BRWalletInsertTx(BRWallet *wallet, BRTransaction *tx)
     }
     
     wallet->transactions[i] = tx;
+    return i;
 }
 
 // non-threadsafe version of BRWalletContainsTransaction()
@@ -137,6 +175,426 @@ static int _BRWalletContainsTx(BRWallet *wallet, const BRTransaction *tx)
     return r;
 }
 
+// returns the memoized metrics for tx if metrics are enabled and tx is registered in wallet->allTx, creating them if
+// needed, or NULL otherwise
+static _BRTxMetrics *_BRWalletTxMetrics(BRWallet *wallet, const BRTransaction *tx)
+{
+    _BRTxMetrics *m;
+    
+    if (! wallet->txMetrics) return NULL;
+    m = BRSetGet(wallet->txMetrics, &tx->txHash);
+    
+    if (! m && BRSetContains(wallet->allTx, tx)) {
+        m = calloc(1, sizeof(*m));
+        assert(m != NULL);
+        m->txHash = tx->txHash;
+        BRSetAdd(wallet->txMetrics, m);
+        
+        for (size_t i = 0; i < tx->inCount; i++) { // index tx as a spender of each of its inputs' transactions
+            _BRTxSpenders *s = BRSetGet(wallet->txSpenders, &tx->inputs[i].txHash);
+            size_t j;
+            
+            if (! s) {
+                s = calloc(1, sizeof(*s));
+                assert(s != NULL);
+                s->txHash = tx->inputs[i].txHash;
+                array_new(s->spenders, 1);
+                BRSetAdd(wallet->txSpenders, s);
+            }
+            
+            for (j = array_count(s->spenders); j > 0 && ! UInt256Eq(s->spenders[j - 1], tx->txHash); j--);
+            if (j == 0) array_add(s->spenders, tx->txHash);
+        }
+    }
+    
+    return m;
+}
+
+// removes the memoized metrics for tx, call before tx is removed from wallet->allTx
+static void _BRWalletRemoveTxMetrics(BRWallet *wallet, const BRTransaction *tx)
+{
+    _BRTxMetrics *m = (wallet->txMetrics) ? BRSetGet(wallet->txMetrics, &tx->txHash) : NULL;
+    _BRTxSpenders *s;
+    
+    if (! m) return;
+    BRSetRemove(wallet->txMetrics, m);
+    free(m);
+    
+    for (size_t i = 0; i < tx->inCount; i++) {
+        s = BRSetGet(wallet->txSpenders, &tx->inputs[i].txHash);
+        
+        for (size_t j = (s) ? array_count(s->spenders) : 0; j > 0; j--) {
+            if (UInt256Eq(s->spenders[j - 1], tx->txHash)) array_rm(s->spenders, j - 1);
+        }
+        
+        if (! s || array_count(s->spenders) > 0) continue;
+        BRSetRemove(wallet->txSpenders, s);
+        array_free(s->spenders);
+        free(s);
+    }
+}
+
+// clears flags from the memoized metrics for txHash, and spenderFlags from those of each tx spending its outputs
+// status flags are also cleared further down the chain of spenders, since they depend on every unconfirmed ancestor
+static void _BRWalletInvalidateTxMetrics(BRWallet *wallet, UInt256 txHash, uint8_t flags, uint8_t spenderFlags)
+{
+    _BRTxMetrics *m;
+    _BRTxSpenders *s;
+    
+    if (! wallet->txMetrics) return;
+    m = BRSetGet(wallet->txMetrics, &txHash);
+    if (m) m->flags &= ~flags;
+    s = (spenderFlags) ? BRSetGet(wallet->txSpenders, &txHash) : NULL;
+    
+    for (size_t i = 0; s && i < array_count(s->spenders); i++) {
+        m = BRSetGet(wallet->txMetrics, &s->spenders[i]);
+        if (! m || ! (m->flags & spenderFlags)) continue; // spenders of a tx with unset values have them unset as well
+        m->flags &= ~spenderFlags;
+        _BRWalletInvalidateTxMetrics(wallet, m->txHash, 0, spenderFlags & TX_METRICS_STATUS);
+    }
+}
+
+// clears the memoized amounts of each tx paying to or spending from one of the given newly generated addresses
+static void _BRWalletInvalidateAddrMetrics(BRWallet *wallet, const BRAddress addrs[], size_t addrsCount)
+{
+    _BRTxMetrics *m;
+    BRTransaction *tx, *t;
+    size_t i, j;
+    
+    if (! wallet->txMetrics || addrsCount == 0) return;
+    
+    for (m = BRSetIterate(wallet->txMetrics, NULL); m; m = BRSetIterate(wallet->txMetrics, m)) {
+        tx = (m->flags & TX_METRICS_AMOUNTS) ? BRSetGet(wallet->allTx, &m->txHash) : NULL;
+        
+        for (i = 0; tx && i < tx->outCount; i++) {
+            for (j = 0; j < addrsCount && ! BRAddressEq(tx->outputs[i].address, &addrs[j]); j++);
+            if (j < addrsCount) m->flags &= ~TX_METRICS_AMOUNTS, tx = NULL;
+        }
+        
+        for (i = 0; tx && i < tx->inCount; i++) {
+            t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
+            if (! t || tx->inputs[i].index >= t->outCount) continue;
+            for (j = 0; j < addrsCount && ! BRAddressEq(t->outputs[tx->inputs[i].index].address, &addrs[j]); j++);
+            if (j < addrsCount) m->flags &= ~TX_METRICS_AMOUNTS, tx = NULL;
+        }
+    }
+}
+
+// non-threadsafe computation of the amount received, amount sent and fee for tx, memoized if tx is registered
+static _BRTxMetrics _BRWalletTxAmounts(BRWallet *wallet, const BRTransaction *tx)
+{
+    _BRTxMetrics r, *m = _BRWalletTxMetrics(wallet, tx);
+    BRTransaction *t;
+    uint32_t n;
+    size_t i;
+    
+    if (m && (m->flags & TX_METRICS_AMOUNTS)) return *m;
+    memset(&r, 0, sizeof(r));
+    
+    // TODO: don't include outputs below TX_MIN_OUTPUT_AMOUNT
+    for (i = 0; i < tx->outCount; i++) {
+        if (BRSetContains(wallet->allAddrs, tx->outputs[i].address)) r.received += tx->outputs[i].amount;
+    }
+    
+    for (i = 0; i < tx->inCount; i++) {
+        t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
+        n = tx->inputs[i].index;
+        
+        if (t && n < t->outCount) {
+            if (BRSetContains(wallet->allAddrs, t->outputs[n].address)) r.sent += t->outputs[n].amount;
+            if (r.fee != UINT64_MAX) r.fee += t->outputs[n].amount;
+        }
+        else r.fee = UINT64_MAX;
+    }
+    
+    for (i = 0; i < tx->outCount && r.fee != UINT64_MAX; i++) {
+        r.fee -= tx->outputs[i].amount;
+    }
+    
+    if (m) {
+        m->received = r.received, m->sent = r.sent, m->fee = r.fee;
+        m->flags |= TX_METRICS_AMOUNTS;
+    }
+    
+    return r;
+}
+
+// non-threadsafe version of BRWalletTransactionIsValid(), memoized so deep unconfirmed chains are walked only once
+static int _BRWalletTxIsValid(BRWallet *wallet, const BRTransaction *tx)
+{
+    _BRTxMetrics *m;
+    BRTransaction *t;
+    int r = 1;
+    
+    if (tx->blockHeight != TX_UNCONFIRMED) return r; // only unconfirmed transactions can be invalid
+    m = _BRWalletTxMetrics(wallet, tx);
+    if (m && (m->flags & TX_METRICS_VALID)) return m->isValid;
+    
+    if (! BRSetContains(wallet->allTx, tx)) {
+        for (size_t i = 0; r && i < tx->inCount; i++) {
+            if (BRSetContains(wallet->spentOutputs, &tx->inputs[i])) r = 0;
+        }
+    }
+    else if (BRSetContains(wallet->invalidTx, tx)) r = 0;
+    
+    for (size_t i = 0; r && i < tx->inCount; i++) {
+        t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
+        if (t && ! _BRWalletTxIsValid(wallet, t)) r = 0;
+    }
+    
+    if (m) m->isValid = r, m->flags |= TX_METRICS_VALID;
+    return r;
+}
+
+// non-threadsafe version of BRWalletTransactionIsPending()
+// timeLocked is set if the result depends on a lockTime, either a block height or a time still in the future, since
+// the wallet block height can go down again on a reorg, such results aren't memoized
+static int _BRWalletTxIsPending(BRWallet *wallet, const BRTransaction *tx, time_t now, int *timeLocked)
+{
+    _BRTxMetrics *m;
+    BRTransaction *t;
+    int r = 0, locked = 0;
+    
+    if (tx->blockHeight != TX_UNCONFIRMED) return r; // only unconfirmed transactions can be postdated
+    m = _BRWalletTxMetrics(wallet, tx);
+    if (m && (m->flags & TX_METRICS_PENDING)) return m->isPending;
+    if (BRTransactionSize(tx) > TX_MAX_SIZE) r = 1; // check transaction size is under TX_MAX_SIZE
+    
+    for (size_t i = 0; ! r && i < tx->inCount; i++) {
+        if (tx->inputs[i].sequence < UINT32_MAX - 1) r = 1; // check for replace-by-fee
+        if (tx->inputs[i].sequence < UINT32_MAX && tx->lockTime < TX_MAX_LOCK_HEIGHT && tx->lockTime > 0) {
+            locked = 1;
+            if (tx->lockTime > wallet->blockHeight + 1) r = 1; // future lockTime
+        }
+        
+        if (tx->inputs[i].sequence < UINT32_MAX && tx->lockTime > now) r = locked = 1; // future lockTime
+    }
+    
+    for (size_t i = 0; ! r && i < tx->outCount; i++) { // check that no outputs are dust
+        if (tx->outputs[i].amount < TX_MIN_OUTPUT_AMOUNT) r = 1;
+    }
+    
+    for (size_t i = 0; ! r && i < tx->inCount; i++) { // check if any inputs are known to be pending
+        t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
+        if (t && _BRWalletTxIsPending(wallet, t, now, &locked)) r = 1;
+    }
+    
+    if (m && ! locked) m->isPending = r, m->flags |= TX_METRICS_PENDING;
+    if (locked && timeLocked) *timeLocked = 1;
+    return r;
+}
+
+// non-threadsafe version of BRWalletTransactionIsVerified()
+static int _BRWalletTxIsVerified(BRWallet *wallet, const BRTransaction *tx, time_t now, int *timeLocked)
+{
+    _BRTxMetrics *m;
+    BRTransaction *t;
+    int r = 1, locked = 0;
+    
+    if (tx->blockHeight != TX_UNCONFIRMED) return r; // only unconfirmed transactions can be unverified
+    m = _BRWalletTxMetrics(wallet, tx);
+    if (m && (m->flags & TX_METRICS_VERIFIED)) return m->isVerified;
+    
+    if (tx->timestamp == 0 || ! _BRWalletTxIsValid(wallet, tx) ||
+        _BRWalletTxIsPending(wallet, tx, now, &locked)) r = 0;
+    
+    for (size_t i = 0; r && i < tx->inCount; i++) { // check if any inputs are known to be unverified
+        t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
+        if (t && ! _BRWalletTxIsVerified(wallet, t, now, &locked)) r = 0;
+    }
+    
+    if (m && ! locked) m->isVerified = r, m->flags |= TX_METRICS_VERIFIED;
+    if (locked && timeLocked) *timeLocked = 1;
+    return r;
+}
+
+// returns the address index entry for the wallet address addr, creating it if needed
+static _BRAddrIndex *_BRWalletAddrIndex(BRWallet *wallet, const char *addr)
+{
+    _BRAddrIndex *a = BRSetGet(wallet->addrIndex, addr);
+    
+    if (! a) {
+        a = calloc(1, sizeof(*a));
+        assert(a != NULL);
+        strncpy(a->address.s, addr, sizeof(a->address.s) - 1);
+        array_new(a->transactions, 1);
+        array_new(a->utxos, 1);
+        BRSetAdd(wallet->addrIndex, a);
+    }
+    
+    return a;
+}
+
+// adds utxo, an unspent output of tx, to the outpoint index of unspent outputs from transactions carrying a DigiAsset,
+// if tx carries one, asset transactions are classified once when their output scripts are parsed
+static void _BRWalletAddAssetUTXO(BRWallet *wallet, const BRTransaction *tx, BRUTXO utxo)
+{
+    BRUTXO *assetUtxos = wallet->assetUtxos;
+    size_t i;
+    
+    if (! BRContainsAsset(tx->outputs, tx->outCount) || utxo.n >= tx->outCount) return;
+    if (BRSetContains(wallet->assetUTXOSet, &utxo)) return;
+    array_add(wallet->assetUtxos, utxo);
+    wallet->assetBalance += tx->outputs[utxo.n].amount;
+    
+    if (wallet->assetUtxos == assetUtxos) {
+        BRSetAdd(wallet->assetUTXOSet, &wallet->assetUtxos[array_count(wallet->assetUtxos) - 1]);
+    }
+    else { // assetUtxos moved to a new memory location, so re-add the set's pointers into it
+        BRSetClear(wallet->assetUTXOSet);
+        
+        for (i = 0; i < array_count(wallet->assetUtxos); i++) {
+            BRSetAdd(wallet->assetUTXOSet, &wallet->assetUtxos[i]);
+        }
+    }
+}
+
+// removes utxo, an output of tx, from the asset outpoint index, moving the last entry into its place
+static void _BRWalletRemoveAssetUTXO(BRWallet *wallet, const BRTransaction *tx, BRUTXO utxo)
+{
+    BRUTXO *u = BRSetGet(wallet->assetUTXOSet, &utxo), *last;
+    
+    if (! u) return;
+    BRSetRemove(wallet->assetUTXOSet, u);
+    if (utxo.n < tx->outCount) wallet->assetBalance -= tx->outputs[utxo.n].amount;
+    last = &wallet->assetUtxos[array_count(wallet->assetUtxos) - 1];
+    
+    if (u != last) {
+        BRSetRemove(wallet->assetUTXOSet, last);
+        *u = *last;
+        BRSetAdd(wallet->assetUTXOSet, u);
+    }
+    
+    array_rm_last(wallet->assetUtxos);
+}
+
+// inserts tx into the transaction list of the index entry for the wallet address addr, unless it's already there,
+// keeping the list in the same order as wallet->transactions, where tx is at index txIdx
+static void _BRWalletAddrIndexInsertTx(BRWallet *wallet, const char *addr, BRTransaction *tx, size_t txIdx)
+{
+    size_t i, j, txCount = array_count(wallet->transactions);
+    _BRAddrIndex *a;
+    
+    if (! BRSetContains(wallet->allAddrs, addr)) return;
+    a = _BRWalletAddrIndex(wallet, addr);
+    i = array_count(a->transactions);
+    
+    while (i > 0 && a->transactions[i - 1] != tx) { // transactions are mostly added last, so walk back from the end
+        for (j = txIdx + 1; j < txCount && wallet->transactions[j] != a->transactions[i - 1]; j++);
+        if (j == txCount) break; // entry i - 1 comes before tx
+        i--;
+    }
+    
+    if (i == 0 || a->transactions[i - 1] != tx) array_insert(a->transactions, i, tx);
+}
+
+// adds tx, at index txIdx of wallet->transactions, to the index entries of the wallet addresses it pays to or spends
+// from, along with any later wallet transactions that spend its outputs, since those entries needed tx to be known
+static void _BRWalletAddrIndexAddTx(BRWallet *wallet, BRTransaction *tx, size_t txIdx)
+{
+    BRTransaction *t;
+    uint32_t n;
+    size_t i, j;
+    
+    for (i = 0; i < tx->inCount; i++) {
+        t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
+        n = tx->inputs[i].index;
+        if (t && n < t->outCount) _BRWalletAddrIndexInsertTx(wallet, t->outputs[n].address, tx, txIdx);
+    }
+    
+    for (i = 0; i < tx->outCount; i++) {
+        _BRWalletAddrIndexInsertTx(wallet, tx->outputs[i].address, tx, txIdx);
+    }
+    
+    for (i = txIdx + 1; i < array_count(wallet->transactions); i++) {
+        t = wallet->transactions[i];
+        
+        for (j = 0; j < t->inCount; j++) {
+            n = t->inputs[j].index;
+            if (! UInt256Eq(t->inputs[j].txHash, tx->txHash) || n >= tx->outCount) continue;
+            _BRWalletAddrIndexInsertTx(wallet, tx->outputs[n].address, t, i);
+        }
+    }
+}
+
+// removes tx from the transaction lists of the index entries for the wallet addresses it pays to or spends from
+static void _BRWalletAddrIndexRemoveTx(BRWallet *wallet, const BRTransaction *tx)
+{
+    BRTransaction *t;
+    _BRAddrIndex *a;
+    uint32_t n;
+    size_t i, j;
+    
+    for (i = 0; i < tx->inCount + tx->outCount; i++) {
+        if (i < tx->inCount) {
+            t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
+            n = tx->inputs[i].index;
+            a = (t && n < t->outCount) ? BRSetGet(wallet->addrIndex, t->outputs[n].address) : NULL;
+        }
+        else a = BRSetGet(wallet->addrIndex, tx->outputs[i - tx->inCount].address);
+        
+        for (j = (a) ? array_count(a->transactions) : 0; j > 0; j--) {
+            if (a->transactions[j - 1] != tx) continue;
+            array_rm(a->transactions, j - 1);
+            break;
+        }
+    }
+}
+
+// removes the unspent output n of tx from the index entry for the address it pays to
+static void _BRWalletAddrIndexRemoveUTXO(BRWallet *wallet, const BRTransaction *tx, uint32_t n)
+{
+    _BRAddrIndex *a = (n < tx->outCount) ? BRSetGet(wallet->addrIndex, tx->outputs[n].address) : NULL;
+    
+    for (size_t i = (a) ? array_count(a->utxos) : 0; i > 0; i--) {
+        if (a->utxos[i - 1].n != n || ! UInt256Eq(a->utxos[i - 1].hash, tx->txHash)) continue;
+        a->balance -= tx->outputs[n].amount;
+        array_rm(a->utxos, i - 1);
+        break;
+    }
+}
+
+// adds the unspent output n of tx to the index entry for the address it pays to
+static void _BRWalletAddrIndexAddUTXO(BRWallet *wallet, const BRTransaction *tx, uint32_t n)
+{
+    _BRAddrIndex *a = _BRWalletAddrIndex(wallet, tx->outputs[n].address);
+    
+    array_add(a->utxos, ((BRUTXO) { tx->txHash, n }));
+    a->balance += tx->outputs[n].amount;
+}
+
+static void _setApplyClearAddrIndexUTXOs(void *info, void *addrIndex)
+{
+    _BRAddrIndex *a = addrIndex;
+    
+    array_clear(a->utxos);
+    a->balance = 0;
+}
+
+// adds the wallet transactions paying to or spending from the newly generated addresses to the address index
+static void _BRWalletAddrIndexAddAddrs(BRWallet *wallet, const BRAddress addrs[], size_t addrsCount)
+{
+    BRTransaction *tx, *t;
+    uint32_t n;
+    size_t i, j, k;
+    
+    for (i = 0; i < array_count(wallet->transactions) && addrsCount > 0; i++) {
+        tx = wallet->transactions[i];
+        
+        for (j = 0; j < tx->inCount + tx->outCount; j++) {
+            if (j < tx->inCount) {
+                t = BRSetGet(wallet->allTx, &tx->inputs[j].txHash);
+                n = tx->inputs[j].index;
+                if (! t || n >= t->outCount) continue;
+            }
+            else t = tx, n = (uint32_t)(j - tx->inCount);
+            
+            for (k = 0; k < addrsCount && ! BRAddressEq(t->outputs[n].address, &addrs[k]); k++);
+            if (k < addrsCount) _BRWalletAddrIndexInsertTx(wallet, t->outputs[n].address, tx, i);
+        }
+    }
+}
+
 //static int _BRWalletTxIsSend(BRWallet *wallet, BRTransaction *tx)
 //{
 //    int r = 0;
@@ -155,8 +613,20 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
     time_t now = time(NULL);
     size_t i, j;
     BRTransaction *tx, *t;
+    BRSet *prevInvalidTx = NULL;
     BRTxOutput o;
 
+    if (wallet->txMetrics && BRSetCount(wallet->txMetrics) > 0 && BRSetCount(wallet->invalidTx) > 0) {
+        prevInvalidTx = wallet->invalidTx; // keep the previous invalid set to find the tx that changed validity
+        wallet->invalidTx = BRSetNew(BRTransactionHash, BRTransactionEq, BRSetCount(prevInvalidTx) + 10);
+    }
+    
+    // the per-address and asset unspent outputs are rebuilt along with wallet->utxos, as each tx's outputs are added
+    // and spent below
+    BRSetApply(wallet->addrIndex, NULL, _setApplyClearAddrIndexUTXOs);
+    array_clear(wallet->assetUtxos);
+    BRSetClear(wallet->assetUTXOSet);
+    wallet->assetBalance = 0;
     array_clear(wallet->utxos);
     array_clear(wallet->balanceHist);
     BRSetClear(wallet->spentOutputs);
@@ -222,6 +692,8 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
                 if (BRSetContains(wallet->allAddrs, tx->outputs[j].address) && !BROutIsAsset(tx->outputs[j])) {
                     array_add(wallet->utxos, ((BRUTXO) { tx->txHash, (uint32_t)j }));
                     balance += tx->outputs[j].amount;
+                    _BRWalletAddrIndexAddUTXO(wallet, tx, (uint32_t)j);
+                    _BRWalletAddAssetUTXO(wallet, tx, ((BRUTXO) { tx->txHash, (uint32_t)j }));
                 }
             }
         }
@@ -232,6 +704,8 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
             o = t->outputs[wallet->utxos[j - 1].n];
             if (BRSetContains(wallet->spentOutputs, &wallet->utxos[j - 1])) {
                 balance -= o.amount;
+                _BRWalletAddrIndexRemoveUTXO(wallet, t, wallet->utxos[j - 1].n);
+                _BRWalletRemoveAssetUTXO(wallet, t, wallet->utxos[j - 1]);
                 array_rm(wallet->utxos, j - 1);
             }
         }
@@ -245,10 +719,43 @@ static void _BRWalletUpdateBalance(BRWallet *wallet)
     //No longer applicable, balance is not for all transactions considering assets
     //assert(array_count(wallet->balanceHist) == array_count(wallet->transactions));
     wallet->balance = balance;
+    
+    if (wallet->txMetrics && BRSetCount(wallet->txMetrics) > 0) {
+        // only transactions that changed validity, and those spending their outputs, need their status recomputed
+        tx = NULL;
+        
+        while (prevInvalidTx && (tx = BRSetIterate(prevInvalidTx, tx))) {
+            if (BRSetContains(wallet->invalidTx, tx)) continue;
+            _BRWalletInvalidateTxMetrics(wallet, tx->txHash, TX_METRICS_STATUS, TX_METRICS_STATUS);
+        }
+        
+        for (tx = BRSetIterate(wallet->invalidTx, NULL); tx; tx = BRSetIterate(wallet->invalidTx, tx)) {
+            if (prevInvalidTx && BRSetContains(prevInvalidTx, tx)) continue;
+            _BRWalletInvalidateTxMetrics(wallet, tx->txHash, TX_METRICS_STATUS, TX_METRICS_STATUS);
+        }
+
+        for (i = 0; i < array_count(wallet->transactions) && i < array_count(wallet->balanceHist); i++) {
+            _BRTxMetrics *m = BRSetGet(wallet->txMetrics, &wallet->transactions[i]->txHash);
+
+            if (m) m->balanceAfter = wallet->balanceHist[i], m->flags |= TX_METRICS_BALANCE;
+        }
+    }
+    
+    if (prevInvalidTx) BRSetFree(prevInvalidTx);
 }
 
-// allocates and populates a BRWallet struct which must be freed by calling BRWalletFree()
-BRWallet *BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPubKey mpk)
+// fills in the inputs of a tx built from the wallet data in the tx log, the first time it's handed out or becomes
+// unconfirmed, must be called with the lock held
+static void _BRWalletLoadTx(BRWallet *wallet, BRTransaction *tx)
+{
+    BRTransaction *t;
+    
+    if (! wallet->unloadedTx || ! BRSetRemove(wallet->unloadedTx, tx)) return;
+    t = BRTxLogTransaction(wallet->txLog, tx->txHash); // returns tx itself, now with its inputs
+    if (t) BRTransactionFree(t);
+}
+
+static BRWallet *_BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPubKey mpk, BRTxLog *log)
 {
     BRWallet *wallet = NULL;
     BRTransaction *tx;
@@ -257,6 +764,7 @@ BRWallet *BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPub
     wallet = calloc(1, sizeof(*wallet));
     assert(wallet != NULL);
     array_new(wallet->utxos, 100);
+    array_new(wallet->assetUtxos, 10);
     array_new(wallet->transactions, txCount + 100);
     wallet->feePerKb = DEFAULT_FEE_PER_KB;
     wallet->masterPubKey = mpk;
@@ -269,13 +777,19 @@ BRWallet *BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPub
     wallet->spentOutputs = BRSetNew(BRUTXOHash, BRUTXOEq, txCount + 100);
     wallet->usedAddrs = BRSetNew(BRAddressHash, BRAddressEq, txCount + 100);
     wallet->allAddrs = BRSetNew(BRAddressHash, BRAddressEq, txCount + 100);
+    wallet->addrIndex = BRSetNew(BRAddressHash, BRAddressEq, txCount + 100);
+    wallet->assetUTXOSet = BRSetNew(BRUTXOHash, BRUTXOEq, 10);
+    wallet->txLog = log;
+    if (log) wallet->unloadedTx = BRSetNew(BRTransactionHash, BRTransactionEq, txCount);
     pthread_mutex_init(&wallet->lock, NULL);
 
     for (size_t i = 0; transactions && i < txCount; i++) {
         tx = transactions[i];
-        if (! BRTransactionIsSigned(tx) || BRSetContains(wallet->allTx, tx)) continue;
+        if ((! log && ! BRTransactionIsSigned(tx)) || BRSetContains(wallet->allTx, tx)) continue;
         BRSetAdd(wallet->allTx, tx);
         _BRWalletInsertTx(wallet, tx);
+        if (log) BRSetAdd(wallet->unloadedTx, tx);
+        if (log && tx->blockHeight == TX_UNCONFIRMED) _BRWalletLoadTx(wallet, tx); // needed for the pending checks
 
         for (size_t j = 0; j < tx->outCount; j++) {
             if (tx->outputs[j].address[0] != '\0') BRSetAdd(wallet->usedAddrs, tx->outputs[j].address);
@@ -294,6 +808,35 @@ BRWallet *BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPub
     return wallet;
 }
 
+// allocates and populates a BRWallet struct which must be freed by calling BRWalletFree()
+BRWallet *BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPubKey mpk)
+{
+    return _BRWalletNew(transactions, txCount, mpk, NULL);
+}
+
+// like BRWalletNew(), with the transactions in log, which are built from the inputs and outputs stored in its index
+// without parsing them, each tx is parsed from the log's memory mapping the first time the wallet hands it out, or
+// when it becomes unconfirmed
+// transactions added to the wallet afterwards are appended to log, and updates and removals are recorded in it, log
+// must not be freed before the wallet
+// a wallet persists its transactions either to a tx log or to a store set with BRWalletSetStore(), never both, the tx
+// log is preferred for large wallets since it doesn't need every transaction parsed at startup
+BRWallet *BRWalletNewWithTxLog(BRTxLog *log, BRMasterPubKey mpk)
+{
+    BRWallet *wallet;
+    BRTransaction **transactions;
+    size_t txCount;
+    
+    assert(log != NULL);
+    txCount = BRTxLogIndexTransactions(log, NULL, 0);
+    transactions = malloc((txCount > 0 ? txCount : 1)*sizeof(*transactions));
+    assert(transactions != NULL);
+    txCount = BRTxLogIndexTransactions(log, transactions, txCount);
+    wallet = _BRWalletNew(transactions, txCount, mpk, log);
+    free(transactions);
+    return wallet;
+}
+
 // not thread-safe, set callbacks once after BRWalletNew(), before calling other BRWallet functions
 // info is a void pointer that will be passed along with each callback call
 // void balanceChanged(void *, uint64_t) - called when the wallet balance changes
@@ -317,6 +860,59 @@ void BRWalletSetCallbacks(BRWallet *wallet, void *info,
     wallet->txDeleted = txDeleted;
 }
 
+// sets a store that transactions are saved to as they're added, updated and removed, alongside the callbacks, or NULL
+// to stop saving to a store, store must not be freed while it's set on the wallet
+// wallets created with BRWalletNewWithTxLog() record their transactions in the tx log and can't also use a store
+void BRWalletSetStore(BRWallet *wallet, BRStore *store)
+{
+    assert(wallet != NULL);
+    assert(store == NULL || wallet->txLog == NULL);
+    pthread_mutex_lock(&wallet->lock);
+    wallet->store = store;
+    pthread_mutex_unlock(&wallet->lock);
+}
+
+static void _setApplyFreeTxMetrics(void *info, void *metrics)
+{
+    free(metrics);
+}
+
+static void _setApplyFreeTxSpenders(void *info, void *spenders)
+{
+    _BRTxSpenders *s = spenders;
+    
+    array_free(s->spenders);
+    free(s);
+}
+
+static void _setApplyTxSpendersMemoryUsage(void *info, void *spenders)
+{
+    *(size_t *)info += sizeof(_BRTxSpenders) + array_mem_size(((_BRTxSpenders *)spenders)->spenders);
+}
+
+// enables or disables memoizing per-transaction amounts, status and balance for history views, disabled by default
+// while enabled, values are kept for each transaction the first time it's queried, disabling frees them
+void BRWalletSetTxMetrics(BRWallet *wallet, int enabled)
+{
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    
+    if (enabled && ! wallet->txMetrics) {
+        wallet->txMetrics = BRSetNew(BRTransactionHash, BRTransactionEq, array_count(wallet->transactions) + 100);
+        wallet->txSpenders = BRSetNew(BRTransactionHash, BRTransactionEq, array_count(wallet->transactions) + 100);
+    }
+    else if (! enabled && wallet->txMetrics) {
+        BRSetApply(wallet->txMetrics, NULL, _setApplyFreeTxMetrics);
+        BRSetFree(wallet->txMetrics);
+        wallet->txMetrics = NULL;
+        BRSetApply(wallet->txSpenders, NULL, _setApplyFreeTxSpenders);
+        BRSetFree(wallet->txSpenders);
+        wallet->txSpenders = NULL;
+    }
+    
+    pthread_mutex_unlock(&wallet->lock);
+}
+
 // wallets are composed of chains of addresses
 // each chain is traversed until a gap of a number of addresses is found that haven't been used in any transactions
 // this function writes to addrs an array of <gapLimit> unused addresses following the last used address in the chain
@@ -357,6 +953,9 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
         }
     }
     
+    // new addresses may match outputs of registered transactions
+    if (count > startCount) _BRWalletInvalidateAddrMetrics(wallet, &addrChain[startCount], count - startCount);
+
     // was addrChain moved to a new memory location?
     if (addrChain == (internal ? wallet->internalChain : wallet->externalChain)) {
         for (i = startCount; i < count; i++) {
@@ -377,6 +976,7 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
         }
     }
 
+    if (count > startCount) _BRWalletAddrIndexAddAddrs(wallet, &addrChain[startCount], count - startCount);
     pthread_mutex_unlock(&wallet->lock);
     return j;
 }
@@ -418,6 +1018,7 @@ size_t BRWalletTransactions(BRWallet *wallet, BRTransaction *transactions[], siz
 
     for (size_t i = 0; transactions && i < txCount; i++) {
         transactions[i] = wallet->transactions[i];
+        _BRWalletLoadTx(wallet, transactions[i]);
     }
     
     pthread_mutex_unlock(&wallet->lock);
@@ -439,6 +1040,7 @@ size_t BRWalletTxUnconfirmedBefore(BRWallet *wallet, BRTransaction *transactions
 
     for (size_t i = 0; transactions && i < txCount; i++) {
         transactions[i] = wallet->transactions[(total - n) + i];
+        _BRWalletLoadTx(wallet, transactions[i]);
     }
 
     pthread_mutex_unlock(&wallet->lock);
@@ -469,6 +1071,122 @@ uint64_t BRWalletTotalReceived(BRWallet *wallet)
     return totalReceived;
 }
 
+// paginated queries start at position *cursor (0 for the first page, or NULL to always start at 0), and advance *cursor
+// past the items written so the next call returns the following page
+// NOTE: positions shift if transactions are added, removed or reordered between calls
+
+// writes up to txCount transactions registered in the wallet, sorted by date, oldest first, to transactions
+// returns the number of transactions written, or number available from *cursor if transactions is NULL
+size_t BRWalletTransactionsPage(BRWallet *wallet, size_t *cursor, BRTransaction *transactions[], size_t txCount)
+{
+    size_t start = (cursor) ? *cursor : 0, total;
+    
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    total = array_count(wallet->transactions);
+    total = (start < total) ? total - start : 0;
+    if (! transactions || total < txCount) txCount = total;
+    
+    for (size_t i = 0; transactions && i < txCount; i++) {
+        transactions[i] = wallet->transactions[start + i];
+        _BRWalletLoadTx(wallet, transactions[i]);
+    }
+    
+    if (transactions && cursor) *cursor = start + txCount;
+    pthread_mutex_unlock(&wallet->lock);
+    return txCount;
+}
+
+// writes up to txCount wallet transactions with an input or output for the wallet address addr, sorted by date, oldest
+// first, to transactions, returns the number of transactions written, or number available if transactions is NULL
+size_t BRWalletAddressTransactions(BRWallet *wallet, const char *addr, size_t *cursor, BRTransaction *transactions[],
+                                   size_t txCount)
+{
+    size_t start = (cursor) ? *cursor : 0, total = 0;
+    _BRAddrIndex *a;
+    
+    assert(wallet != NULL);
+    assert(addr != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    a = (addr) ? BRSetGet(wallet->addrIndex, addr) : NULL;
+    if (a && start < array_count(a->transactions)) total = array_count(a->transactions) - start;
+    if (! transactions || total < txCount) txCount = total;
+    
+    for (size_t i = 0; transactions && i < txCount; i++) {
+        transactions[i] = a->transactions[start + i];
+        _BRWalletLoadTx(wallet, transactions[i]);
+    }
+    
+    if (transactions && cursor) *cursor = start + txCount;
+    pthread_mutex_unlock(&wallet->lock);
+    return txCount;
+}
+
+// writes up to utxosCount unspent outputs paying to the wallet address addr to utxos
+// returns the number of outputs written, or number available if utxos is NULL
+size_t BRWalletAddressUTXOs(BRWallet *wallet, const char *addr, size_t *cursor, BRUTXO utxos[], size_t utxosCount)
+{
+    size_t start = (cursor) ? *cursor : 0, total = 0;
+    _BRAddrIndex *a;
+    
+    assert(wallet != NULL);
+    assert(addr != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    a = (addr) ? BRSetGet(wallet->addrIndex, addr) : NULL;
+    if (a && start < array_count(a->utxos)) total = array_count(a->utxos) - start;
+    if (! utxos || total < utxosCount) utxosCount = total;
+    
+    for (size_t i = 0; utxos && i < utxosCount; i++) {
+        utxos[i] = a->utxos[start + i];
+    }
+    
+    if (utxos && cursor) *cursor = start + utxosCount;
+    pthread_mutex_unlock(&wallet->lock);
+    return utxosCount;
+}
+
+// balance of unspent outputs paying to the wallet address addr, not including transactions known to be invalid
+uint64_t BRWalletAddressBalance(BRWallet *wallet, const char *addr)
+{
+    uint64_t balance = 0;
+    _BRAddrIndex *a;
+    
+    assert(wallet != NULL);
+    assert(addr != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    a = (addr) ? BRSetGet(wallet->addrIndex, addr) : NULL;
+    if (a) balance = a->balance;
+    pthread_mutex_unlock(&wallet->lock);
+    return balance;
+}
+
+// writes up to count used wallet addresses and their balances to addrs and balances, in chain order, external chain
+// first, returns the number of addresses written, or number available if addrs is NULL
+size_t BRWalletAddressBalances(BRWallet *wallet, size_t *cursor, BRAddress addrs[], uint64_t balances[], size_t count)
+{
+    size_t i, n = 0, externalCount, total;
+    BRAddress *addr;
+    _BRAddrIndex *a;
+    
+    assert(wallet != NULL);
+    assert(balances != NULL || addrs == NULL);
+    pthread_mutex_lock(&wallet->lock);
+    externalCount = array_count(wallet->externalChain);
+    total = externalCount + array_count(wallet->internalChain);
+    
+    for (i = (cursor) ? *cursor : 0; i < total && (! addrs || n < count); i++) {
+        addr = (i < externalCount) ? &wallet->externalChain[i] : &wallet->internalChain[i - externalCount];
+        a = BRSetGet(wallet->addrIndex, addr);
+        if (! a || array_count(a->transactions) == 0) continue;
+        if (addrs) addrs[n] = *addr, balances[n] = a->balance;
+        n++;
+    }
+    
+    if (addrs && cursor) *cursor = i;
+    pthread_mutex_unlock(&wallet->lock);
+    return n;
+}
+
 // fee-per-kb of transaction size to use when creating a transaction
 uint64_t BRWalletFeePerKb(BRWallet *wallet)
 {
@@ -715,8 +1433,8 @@ int BRWalletContainsTransaction(BRWallet *wallet, const BRTransaction *tx)
     return r;
 }
 
-// adds a transaction to the wallet, or returns false if it isn't associated with the wallet
-int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx)
+// adds tx to the wallet, retaining it first if retain is true
+static int _BRWalletRegisterTx(BRWallet *wallet, BRTransaction *tx, int retain)
 {
     int wasAdded = 0, r = 1;
     
@@ -731,16 +1449,21 @@ int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx)
                 // TODO: verify signatures when possible
                 // TODO: handle tx replacement with input sequence numbers
                 //       (for now, replacements appear invalid until confirmation)
-                BRSetAdd(wallet->allTx, tx);
-                _BRWalletInsertTx(wallet, tx);
+                BRSetAdd(wallet->allTx, (retain) ? BRTransactionRetain(tx) : tx);
+                _BRWalletInvalidateTxMetrics(wallet, tx->txHash, 0, TX_METRICS_AMOUNTS | TX_METRICS_STATUS);
+                _BRWalletAddrIndexAddTx(wallet, tx, _BRWalletInsertTx(wallet, tx));
                 _BRWalletUpdateBalance(wallet);
                 wasAdded = 1;
             }
             else { // keep track of unconfirmed non-wallet tx for invalid tx checks and child-pays-for-parent fees
                    // BUG: limit total non-wallet unconfirmed tx to avoid memory exhaustion attack
-                if (tx->blockHeight == TX_UNCONFIRMED) BRSetAdd(wallet->allTx, tx);
+                if (tx->blockHeight == TX_UNCONFIRMED) {
+                    BRSetAdd(wallet->allTx, (retain) ? BRTransactionRetain(tx) : tx);
+                    _BRWalletInvalidateTxMetrics(wallet, tx->txHash, 0, TX_METRICS_AMOUNTS | TX_METRICS_STATUS);
+                }
+                
                 r = 0;
-                // BUG: XXX memory leak if tx is not added to wallet->allTx, and we can't just free it
+                // BUG: XXX memory leak if tx isn't retained or added to wallet->allTx, and we can't just free it
             }
         }
     
@@ -753,12 +1476,27 @@ int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx)
         BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL, 0);
         BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL, 1);
         if (wallet->balanceChanged) wallet->balanceChanged(wallet->callbackInfo, wallet->balance);
+        if (wallet->txLog) BRTxLogAdd(wallet->txLog, tx);
+        else if (wallet->store) BRStoreSaveTx(wallet->store, tx);
         if (wallet->txAdded) wallet->txAdded(wallet->callbackInfo, tx);
     }
 
     return r;
 }
 
+// adds a transaction to the wallet, or returns false if it isn't associated with the wallet
+int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx)
+{
+    return _BRWalletRegisterTx(wallet, tx, 0);
+}
+
+// like BRWalletRegisterTransaction(), but the wallet calls BRTransactionRetain() on tx if it's kept, so the caller
+// must still call BRTransactionFree() to release its own reference
+int BRWalletRegisterSharedTransaction(BRWallet *wallet, BRTransaction *tx)
+{
+    return _BRWalletRegisterTx(wallet, tx, 1);
+}
+
 // removes a tx from the wallet and calls BRTransactionFree() on it, along with any tx that depend on its outputs
 void BRWalletRemoveTransaction(BRWallet *wallet, UInt256 txHash)
 {
@@ -796,6 +1534,10 @@ void BRWalletRemoveTransaction(BRWallet *wallet, UInt256 txHash)
             BRWalletRemoveTransaction(wallet, txHash);
         }
         else {
+            _BRWalletLoadTx(wallet, tx); // still used below, after it's removed
+            _BRWalletRemoveTxMetrics(wallet, tx);
+            _BRWalletInvalidateTxMetrics(wallet, tx->txHash, 0, TX_METRICS_AMOUNTS | TX_METRICS_STATUS);
+            _BRWalletAddrIndexRemoveTx(wallet, tx);
             BRSetRemove(wallet->allTx, tx);
             
             for (size_t i = array_count(wallet->transactions); i > 0; i--) {
@@ -821,6 +1563,8 @@ void BRWalletRemoveTransaction(BRWallet *wallet, UInt256 txHash)
 
             BRTransactionFree(tx);
             if (wallet->balanceChanged) wallet->balanceChanged(wallet->callbackInfo, wallet->balance);
+            if (wallet->txLog) BRTxLogRemove(wallet->txLog, txHash);
+            else if (wallet->store) BRStoreDeleteTx(wallet->store, txHash);
             if (wallet->txDeleted) wallet->txDeleted(wallet->callbackInfo, txHash, notifyUser, recommendRescan);
         }
         
@@ -838,6 +1582,7 @@ BRTransaction *BRWalletTransactionForHash(BRWallet *wallet, UInt256 txHash)
     if (UInt256IsZero(txHash)) { return NULL;}
     pthread_mutex_lock(&wallet->lock);
     tx = BRSetGet(wallet->allTx, &txHash);
+    if (tx) _BRWalletLoadTx(wallet, tx);
     pthread_mutex_unlock(&wallet->lock);
     return tx;
 }
@@ -845,7 +1590,6 @@ BRTransaction *BRWalletTransactionForHash(BRWallet *wallet, UInt256 txHash)
 // true if no previous wallet transaction spends any of the given transaction's inputs, and no inputs are invalid
 int BRWalletTransactionIsValid(BRWallet *wallet, const BRTransaction *tx)
 {
-    BRTransaction *t;
     int r = 1;
 
     assert(wallet != NULL);
@@ -856,20 +1600,8 @@ int BRWalletTransactionIsValid(BRWallet *wallet, const BRTransaction *tx)
 
     if (tx && tx->blockHeight == TX_UNCONFIRMED) { // only unconfirmed transactions can be invalid
         pthread_mutex_lock(&wallet->lock);
-
-        if (! BRSetContains(wallet->allTx, tx)) {
-            for (size_t i = 0; r && i < tx->inCount; i++) {
-                if (BRSetContains(wallet->spentOutputs, &tx->inputs[i])) r = 0;
-            }
-        }
-        else if (BRSetContains(wallet->invalidTx, tx)) r = 0;
-
+        r = _BRWalletTxIsValid(wallet, tx);
         pthread_mutex_unlock(&wallet->lock);
-
-        for (size_t i = 0; r && i < tx->inCount; i++) {
-            t = BRWalletTransactionForHash(wallet, tx->inputs[i].txHash);
-            if (t && ! BRWalletTransactionIsValid(wallet, t)) r = 0;
-        }
     }
     
     return r;
@@ -878,35 +1610,15 @@ int BRWalletTransactionIsValid(BRWallet *wallet, const BRTransaction *tx)
 // true if tx cannot be immediately spent (i.e. if it or an input tx can be replaced-by-fee)
 int BRWalletTransactionIsPending(BRWallet *wallet, const BRTransaction *tx)
 {
-    BRTransaction *t;
-    time_t now = time(NULL);
-    uint32_t blockHeight;
     int r = 0;
     
     assert(wallet != NULL);
     assert(tx != NULL && BRTransactionIsSigned(tx));
-    pthread_mutex_lock(&wallet->lock);
-    blockHeight = wallet->blockHeight;
-    pthread_mutex_unlock(&wallet->lock);
 
     if (tx && tx->blockHeight == TX_UNCONFIRMED) { // only unconfirmed transactions can be postdated
-        if (BRTransactionSize(tx) > TX_MAX_SIZE) r = 1; // check transaction size is under TX_MAX_SIZE
-        
-        for (size_t i = 0; ! r && i < tx->inCount; i++) {
-            if (tx->inputs[i].sequence < UINT32_MAX - 1) r = 1; // check for replace-by-fee
-            if (tx->inputs[i].sequence < UINT32_MAX && tx->lockTime < TX_MAX_LOCK_HEIGHT &&
-                tx->lockTime > blockHeight + 1) r = 1; // future lockTime
-            if (tx->inputs[i].sequence < UINT32_MAX && tx->lockTime > now) r = 1; // future lockTime
-        }
-        
-        for (size_t i = 0; ! r && i < tx->outCount; i++) { // check that no outputs are dust
-            if (tx->outputs[i].amount < TX_MIN_OUTPUT_AMOUNT) r = 1;
-        }
-        
-        for (size_t i = 0; ! r && i < tx->inCount; i++) { // check if any inputs are known to be pending
-            t = BRWalletTransactionForHash(wallet, tx->inputs[i].txHash);
-            if (t && BRWalletTransactionIsPending(wallet, t)) r = 1;
-        }
+        pthread_mutex_lock(&wallet->lock);
+        r = _BRWalletTxIsPending(wallet, tx, time(NULL), NULL);
+        pthread_mutex_unlock(&wallet->lock);
     }
     
     return r;
@@ -915,20 +1627,15 @@ int BRWalletTransactionIsPending(BRWallet *wallet, const BRTransaction *tx)
 // true if tx is considered 0-conf safe (valid and not pending, timestamp is greater than 0, and no unverified inputs)
 int BRWalletTransactionIsVerified(BRWallet *wallet, const BRTransaction *tx)
 {
-    BRTransaction *t;
     int r = 1;
 
     assert(wallet != NULL);
     assert(tx != NULL && BRTransactionIsSigned(tx));
 
     if (tx && tx->blockHeight == TX_UNCONFIRMED) { // only unconfirmed transactions can be unverified
-        if (tx->timestamp == 0 || ! BRWalletTransactionIsValid(wallet, tx) ||
-            BRWalletTransactionIsPending(wallet, tx)) r = 0;
-            
-        for (size_t i = 0; r && i < tx->inCount; i++) { // check if any inputs are known to be unverified
-            t = BRWalletTransactionForHash(wallet, tx->inputs[i].txHash);
-            if (t && ! BRWalletTransactionIsVerified(wallet, t)) r = 0;
-        }
+        pthread_mutex_lock(&wallet->lock);
+        r = _BRWalletTxIsVerified(wallet, tx, time(NULL), NULL);
+        pthread_mutex_unlock(&wallet->lock);
     }
     
     return r;
@@ -954,12 +1661,15 @@ void BRWalletUpdateTransactions(BRWallet *wallet, const UInt256 txHashes[], size
         if (! tx || (tx->blockHeight == blockHeight && tx->timestamp == timestamp)) continue;
         tx->timestamp = timestamp;
         tx->blockHeight = blockHeight;
+        if (blockHeight == TX_UNCONFIRMED) _BRWalletLoadTx(wallet, tx);
+        _BRWalletInvalidateTxMetrics(wallet, tx->txHash, TX_METRICS_STATUS, TX_METRICS_STATUS);
         
         if (_BRWalletContainsTx(wallet, tx)) {
             for (k = array_count(wallet->transactions); k > 0; k--) { // remove and re-insert tx to keep wallet sorted
                 if (! BRTransactionEq(wallet->transactions[k - 1], tx)) continue;
+                _BRWalletAddrIndexRemoveTx(wallet, tx);
                 array_rm(wallet->transactions, k - 1);
-                _BRWalletInsertTx(wallet, tx);
+                _BRWalletAddrIndexAddTx(wallet, tx, _BRWalletInsertTx(wallet, tx));
                 break;
             }
             
@@ -967,13 +1677,18 @@ void BRWalletUpdateTransactions(BRWallet *wallet, const UInt256 txHashes[], size
             if (BRSetContains(wallet->pendingTx, tx) || BRSetContains(wallet->invalidTx, tx)) needsUpdate = 1;
         }
         else if (blockHeight != TX_UNCONFIRMED) { // remove and free confirmed non-wallet tx
+            _BRWalletRemoveTxMetrics(wallet, tx);
+            _BRWalletInvalidateTxMetrics(wallet, tx->txHash, 0, TX_METRICS_AMOUNTS | TX_METRICS_STATUS);
             BRSetRemove(wallet->allTx, tx);
+            if (wallet->unloadedTx) BRSetRemove(wallet->unloadedTx, tx);
             BRTransactionFree(tx);
         }
     }
     
     if (needsUpdate) _BRWalletUpdateBalance(wallet);
     pthread_mutex_unlock(&wallet->lock);
+    if (j > 0 && wallet->txLog) BRTxLogUpdate(wallet->txLog, hashes, j, blockHeight, timestamp);
+    else if (j > 0 && wallet->store) BRStoreUpdateTx(wallet->store, hashes, j, blockHeight, timestamp);
     if (j > 0 && wallet->txUpdated) wallet->txUpdated(wallet->callbackInfo, hashes, j, blockHeight, timestamp);
 }
 
@@ -993,11 +1708,15 @@ void BRWalletSetTxUnconfirmedAfter(BRWallet *wallet, uint32_t blockHeight)
 
     for (j = 0; j < count; j++) {
         wallet->transactions[i + j]->blockHeight = TX_UNCONFIRMED;
+        _BRWalletLoadTx(wallet, wallet->transactions[i + j]);
         hashes[j] = wallet->transactions[i + j]->txHash;
+        _BRWalletInvalidateTxMetrics(wallet, hashes[j], TX_METRICS_STATUS, TX_METRICS_STATUS);
     }
     
     if (count > 0) _BRWalletUpdateBalance(wallet);
     pthread_mutex_unlock(&wallet->lock);
+    if (count > 0 && wallet->txLog) BRTxLogUpdate(wallet->txLog, hashes, count, TX_UNCONFIRMED, 0);
+    else if (count > 0 && wallet->store) BRStoreUpdateTx(wallet->store, hashes, count, TX_UNCONFIRMED, 0);
     if (count > 0 && wallet->txUpdated) wallet->txUpdated(wallet->callbackInfo, hashes, count, TX_UNCONFIRMED, 0);
 }
 
@@ -1009,12 +1728,7 @@ uint64_t BRWalletAmountReceivedFromTx(BRWallet *wallet, const BRTransaction *tx)
     assert(wallet != NULL);
     assert(tx != NULL);
     pthread_mutex_lock(&wallet->lock);
-    
-    // TODO: don't include outputs below TX_MIN_OUTPUT_AMOUNT
-    for (size_t i = 0; tx && i < tx->outCount; i++) {
-        if (BRSetContains(wallet->allAddrs, tx->outputs[i].address)) amount += tx->outputs[i].amount;
-    }
-    
+    if (tx) amount = _BRWalletTxAmounts(wallet, tx).received;
     pthread_mutex_unlock(&wallet->lock);
     return amount;
 }
@@ -1027,16 +1741,7 @@ uint64_t BRWalletAmountSentByTx(BRWallet *wallet, const BRTransaction *tx)
     assert(wallet != NULL);
     assert(tx != NULL);
     pthread_mutex_lock(&wallet->lock);
-    
-    for (size_t i = 0; tx && i < tx->inCount; i++) {
-        BRTransaction *t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
-        uint32_t n = tx->inputs[i].index;
-        
-        if (t && n < t->outCount && BRSetContains(wallet->allAddrs, t->outputs[n].address)) {
-            amount += t->outputs[n].amount;
-        }
-    }
-    
+    if (tx) amount = _BRWalletTxAmounts(wallet, tx).sent;
     pthread_mutex_unlock(&wallet->lock);
     return amount;
 }
@@ -1049,42 +1754,33 @@ uint64_t BRWalletFeeForTx(BRWallet *wallet, const BRTransaction *tx)
     assert(wallet != NULL);
     assert(tx != NULL);
     pthread_mutex_lock(&wallet->lock);
-    
-    for (size_t i = 0; tx && i < tx->inCount && amount != UINT64_MAX; i++) {
-        BRTransaction *t = BRSetGet(wallet->allTx, &tx->inputs[i].txHash);
-        uint32_t n = tx->inputs[i].index;
-        
-        if (t && n < t->outCount) {
-            amount += t->outputs[n].amount;
-        }
-        else amount = UINT64_MAX;
-    }
-    
+    if (tx) amount = _BRWalletTxAmounts(wallet, tx).fee;
     pthread_mutex_unlock(&wallet->lock);
-    
-    for (size_t i = 0; tx && i < tx->outCount && amount != UINT64_MAX; i++) {
-        amount -= tx->outputs[i].amount;
-    }
-    
     return amount;
 }
 
 // historical wallet balance after the given transaction, or current balance if transaction is not registered in wallet
 uint64_t BRWalletBalanceAfterTx(BRWallet *wallet, const BRTransaction *tx)
 {
+    _BRTxMetrics *m;
     uint64_t balance;
     
     assert(wallet != NULL);
     assert(tx != NULL && BRTransactionIsSigned(tx));
     pthread_mutex_lock(&wallet->lock);
     balance = wallet->balance;
+    m = (tx) ? _BRWalletTxMetrics(wallet, tx) : NULL;
     
-    for (size_t i = array_count(wallet->transactions); tx && i > 0; i--) {
-        if (! BRTransactionEq(tx, wallet->transactions[i - 1])) continue;
-        balance = wallet->balanceHist[i - 1];
-        break;
+    if (m && (m->flags & TX_METRICS_BALANCE)) balance = m->balanceAfter;
+    else {
+        for (size_t i = array_count(wallet->transactions); tx && i > 0; i--) {
+            if (! BRTransactionEq(tx, wallet->transactions[i - 1]) || i > array_count(wallet->balanceHist)) continue;
+            balance = wallet->balanceHist[i - 1];
+            if (m) m->balanceAfter = balance, m->flags |= TX_METRICS_BALANCE;
+            break;
+        }
     }
-
+    
     pthread_mutex_unlock(&wallet->lock);
     return balance;
 }
@@ -1168,6 +1864,70 @@ uint64_t BRWalletMaxOutputAmount(BRWallet *wallet)
     return (amount > fee) ? amount - fee : 0;
 }
 
+static void _setApplyFreeTx(void *info, void *tx)
+{
+    BRTransactionFree(tx);
+}
+
+static void _setApplyFreeAddrIndex(void *info, void *addrIndex)
+{
+    _BRAddrIndex *a = addrIndex;
+    
+    array_free(a->transactions);
+    array_free(a->utxos);
+    free(a);
+}
+
+static void _setApplyTxMemoryUsage(void *info, void *tx)
+{
+    *(size_t *)info += BRTransactionMemoryUsage(tx);
+}
+
+static void _setApplyAddrIndexMemoryUsage(void *info, void *addrIndex)
+{
+    _BRAddrIndex *a = addrIndex;
+    
+    *(size_t *)info += sizeof(*a) + array_mem_size(a->transactions) + array_mem_size(a->utxos);
+}
+
+// writes the heap memory used by transactions, transaction metrics, utxos, address chains and the address index of
+// wallet to usage, and returns the number of entries written, or total usageCount needed if usage is NULL
+size_t BRWalletMemoryUsage(BRWallet *wallet, BRMemoryUsage usage[], size_t usageCount)
+{
+    BRMemoryUsage u[5];
+    size_t i = 0;
+    
+    assert(wallet != NULL);
+    if (! usage) return sizeof(u)/sizeof(*u);
+    pthread_mutex_lock(&wallet->lock);
+    // allTx also holds unconfirmed non-wallet tx, invalidTx and pendingTx hold no tx of their own
+    u[i] = (BRMemoryUsage) { "transactions", BRSetCount(wallet->allTx),
+                             array_mem_size(wallet->transactions) + array_mem_size(wallet->balanceHist) +
+                             BRSetMemoryUsage(wallet->allTx) + BRSetMemoryUsage(wallet->invalidTx) +
+                             BRSetMemoryUsage(wallet->pendingTx) +
+                             ((wallet->unloadedTx) ? BRSetMemoryUsage(wallet->unloadedTx) : 0) };
+    BRSetApply(wallet->allTx, &u[i++].size, _setApplyTxMemoryUsage);
+    u[i] = (BRMemoryUsage) { "transaction metrics", (wallet->txMetrics) ? BRSetCount(wallet->txMetrics) : 0,
+                             (wallet->txMetrics) ? BRSetMemoryUsage(wallet->txMetrics) +
+                             BRSetCount(wallet->txMetrics)*sizeof(_BRTxMetrics) +
+                             BRSetMemoryUsage(wallet->txSpenders) : 0 };
+    if (wallet->txSpenders) BRSetApply(wallet->txSpenders, &u[i].size, _setApplyTxSpendersMemoryUsage);
+    i++;
+    u[i++] = (BRMemoryUsage) { "utxos", array_count(wallet->utxos) + array_count(wallet->assetUtxos),
+                               array_mem_size(wallet->utxos) + array_mem_size(wallet->assetUtxos) +
+                               BRSetMemoryUsage(wallet->spentOutputs) + BRSetMemoryUsage(wallet->assetUTXOSet) };
+    u[i++] = (BRMemoryUsage) { "address chains",
+                               array_count(wallet->internalChain) + array_count(wallet->externalChain),
+                               array_mem_size(wallet->internalChain) + array_mem_size(wallet->externalChain) +
+                               BRSetMemoryUsage(wallet->usedAddrs) + BRSetMemoryUsage(wallet->allAddrs) };
+    u[i] = (BRMemoryUsage) { "address index", BRSetCount(wallet->addrIndex), BRSetMemoryUsage(wallet->addrIndex) };
+    BRSetApply(wallet->addrIndex, &u[i++].size, _setApplyAddrIndexMemoryUsage);
+    pthread_mutex_unlock(&wallet->lock);
+    
+    for (i = 0; i < usageCount && i < sizeof(u)/sizeof(*u); i++) usage[i] = u[i];
+    return i;
+}
+
 // frees memory allocated for wallet, and calls BRTransactionFree() for all registered transactions
 void BRWalletFree(BRWallet *wallet)
 {
@@ -1175,20 +1935,29 @@ void BRWalletFree(BRWallet *wallet)
     pthread_mutex_lock(&wallet->lock);
     BRSetFree(wallet->allAddrs);
     BRSetFree(wallet->usedAddrs);
+    BRSetApply(wallet->allTx, NULL, _setApplyFreeTx); // releases wallet tx as well as unconfirmed non-wallet tx
     BRSetFree(wallet->allTx);
     BRSetFree(wallet->invalidTx);
     BRSetFree(wallet->pendingTx);
+    if (wallet->unloadedTx) BRSetFree(wallet->unloadedTx);
     BRSetFree(wallet->spentOutputs);
+    
+    if (wallet->txMetrics) {
+        BRSetApply(wallet->txMetrics, NULL, _setApplyFreeTxMetrics);
+        BRSetFree(wallet->txMetrics);
+        BRSetApply(wallet->txSpenders, NULL, _setApplyFreeTxSpenders);
+        BRSetFree(wallet->txSpenders);
+    }
+    
+    BRSetApply(wallet->addrIndex, NULL, _setApplyFreeAddrIndex);
+    BRSetFree(wallet->addrIndex);
+    BRSetFree(wallet->assetUTXOSet);
     array_free(wallet->internalChain);
     array_free(wallet->externalChain);
     array_free(wallet->balanceHist);
-
-    for (size_t i = array_count(wallet->transactions); i > 0; i--) {
-        BRTransactionFree(wallet->transactions[i - 1]);
-    }
-
     array_free(wallet->transactions);
     array_free(wallet->utxos);
+    array_free(wallet->assetUtxos);
     pthread_mutex_unlock(&wallet->lock);
     pthread_mutex_destroy(&wallet->lock);
     free(wallet);
@@ -1228,22 +1997,75 @@ int64_t BRBitcoinAmount(int64_t localAmount, double price)
     return (localAmount < 0) ? -amount : amount;
 }
 
+// sets each input script of assetTransaction to the scriptPubKey of the wallet transaction output it spends, and
+// removes inputs that don't spend a known transaction output, using one outpoint lookup per input
 void BRFixAssetInputs(BRWallet *wallet, BRTransaction *assetTransaction)
 {
-    BRTxInput *tempInputScripts;
-    array_new(tempInputScripts, assetTransaction->inCount);
-    for (size_t j = 0; j < array_count(wallet->transactions); j++) {
-        BRTransaction *t = wallet->transactions[j];
-        for (size_t i = 0; i < array_count(assetTransaction->inputs); i++) {
-            BRTxInput input = assetTransaction->inputs[i];
-            if(UInt256Eq(input.txHash, t->txHash)){
-                BRTxOutput output = t->outputs[input.index];
-                BRTxInputSetScript(&input, output.script, output.scriptLen);
-                array_add(tempInputScripts, input);
-            }
+    BRTransaction *t;
+    BRTxInput *input;
+    
+    assert(wallet != NULL);
+    assert(assetTransaction != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    
+    for (size_t i = array_count(assetTransaction->inputs); i > 0; i--) {
+        input = &assetTransaction->inputs[i - 1];
+        t = BRSetGet(wallet->allTx, &input->txHash);
+        
+        if (t && input->index < t->outCount) {
+            BRTxInputSetScript(input, t->outputs[input->index].script, t->outputs[input->index].scriptLen);
+        }
+        else {
+            BRTxInputSetScript(input, NULL, 0);
+            BRTxInputSetSignature(input, NULL, 0);
+            BRTxInputSetWitness(input, NULL, 0);
+            array_rm(assetTransaction->inputs, i - 1);
         }
     }
-    assetTransaction->inputs = tempInputScripts;
+    
+    assetTransaction->inCount = array_count(assetTransaction->inputs);
+    BRTransactionClearRaw(assetTransaction);
+    pthread_mutex_unlock(&wallet->lock);
+}
+
+// writes unspent outputs of wallet transactions carrying a DigiAsset to utxos
+// returns the number of outputs written, or number available if utxos is NULL
+size_t BRWalletAssetUTXOs(BRWallet *wallet, BRUTXO utxos[], size_t utxosCount)
+{
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    if (! utxos || array_count(wallet->assetUtxos) < utxosCount) utxosCount = array_count(wallet->assetUtxos);
+    
+    for (size_t i = 0; utxos && i < utxosCount; i++) {
+        utxos[i] = wallet->assetUtxos[i];
+    }
+    
+    pthread_mutex_unlock(&wallet->lock);
+    return utxosCount;
+}
+
+// true if utxo is an unspent wallet output of a transaction carrying a DigiAsset
+int BRWalletUTXOIsAsset(BRWallet *wallet, BRUTXO utxo)
+{
+    int r;
+    
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    r = BRSetContains(wallet->assetUTXOSet, &utxo);
+    pthread_mutex_unlock(&wallet->lock);
+    return r;
+}
+
+// total amount of unspent outputs of wallet transactions carrying a DigiAsset (included in BRWalletBalance())
+uint64_t BRWalletAssetBalance(BRWallet *wallet)
+{
+    uint64_t balance;
+    
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    balance = wallet->assetBalance;
+    pthread_mutex_unlock(&wallet->lock);
+    return balance;
 }
 
 BRUTXO * BRGetUTXO(BRWallet *wallet)
@@ -1257,39 +2079,22 @@ BRTransaction * BRGetTxForUTXO(BRWallet *wallet, BRUTXO utxo)
     return t;
 }
 
+// asset outputs are classified once, when their script is set, see BRScriptClassify()
 uint8_t BRTXContainsAsset(BRTransaction *tx)
 {
-    //Skip utxo that contain assets
-    for (int p = 0; p < tx->outCount; p++) {
-        uint8_t one = tx->outputs[p].script[0];
-        uint8_t three = tx->outputs[p].script[2];
-        uint8_t four = tx->outputs[p].script[3];
-        if (one == 106 && three == 68 && four == 65) {
-            return 1;
-        }
-    }
-    return 0;
+    return (tx) ? BRContainsAsset(tx->outputs, tx->outCount) : 0;
 }
 
-uint8_t BRContainsAsset(const BRTxOutput *outputs, size_t outCount) {
-    //Skip utxo that contain assets
-    for (int p = 0; p < outCount; p++) {
-        uint8_t one = outputs[p].script[0];
-        uint8_t three = outputs[p].script[2];
-        uint8_t four = outputs[p].script[3];
-        if (one == 106 && three == 68 && four == 65) {
-            return 1;
-        }
+uint8_t BRContainsAsset(const BRTxOutput *outputs, size_t outCount)
+{
+    for (size_t i = 0; outputs && i < outCount; i++) {
+        if (outputs[i].scriptTemplate.type == BRScriptTypeDigiAsset) return 1;
     }
+    
     return 0;
 }
 
-uint8_t BROutIsAsset(const BRTxOutput output) {
-    uint8_t one = output.script[0];
-    uint8_t three = output.script[2];
-    uint8_t four = output.script[3];
-    if (one == 106 && three == 68 && four == 65) {
-        return 1;
-    }
-    return 0;
-}
\ No newline at end of file
+uint8_t BROutIsAsset(const BRTxOutput output)
+{
+    return (output.scriptTemplate.type == BRScriptTypeDigiAsset);
+}
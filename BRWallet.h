@@ -29,6 +29,8 @@
 #include "BRAddress.h"
 #include "BRBIP32Sequence.h"
 #include "BRInt.h"
+#include "BRStore.h"
+#include "BRTxLog.h"
 #include <string.h>
 
 #define wallet_log(...) _wallet_log("%s:%"PRIu16" " _va_first(__VA_ARGS__, NULL) "\n", _va_rest(__VA_ARGS__, NULL))
@@ -90,11 +92,27 @@ inline static int BRUTXOEq(const void *utxo, const void *otherUtxo)
                                   ((const BRUTXO *)utxo)->n == ((const BRUTXO *)otherUtxo)->n));
 }
 
+// heap memory used by one part of a wallet or peer manager, see BRWalletMemoryUsage() and BRPeerManagerMemoryUsage()
+typedef struct {
+    const char *name; // static string naming the part
+    size_t count; // number of items held
+    size_t size; // bytes of heap memory used, including hashtables and space reserved for growth
+} BRMemoryUsage;
+
 typedef struct BRWalletStruct BRWallet;
 
 // allocates and populates a BRWallet struct that must be freed by calling BRWalletFree()
 BRWallet *BRWalletNew(BRTransaction *transactions[], size_t txCount, BRMasterPubKey mpk);
 
+// like BRWalletNew(), with the transactions in log, which are built from the inputs and outputs stored in its index
+// without parsing them, each tx is parsed from the log's memory mapping the first time the wallet hands it out, or
+// when it becomes unconfirmed
+// transactions added to the wallet afterwards are appended to log, and updates and removals are recorded in it, log
+// must not be freed before the wallet
+// a wallet persists its transactions either to a tx log or to a store set with BRWalletSetStore(), never both, the tx
+// log is preferred for large wallets since it doesn't need every transaction parsed at startup
+BRWallet *BRWalletNewWithTxLog(BRTxLog *log, BRMasterPubKey mpk);
+
 // not thread-safe, set callbacks once after BRWalletNew(), before calling other BRWallet functions
 // info is a void pointer that will be passed along with each callback call
 // void balanceChanged(void *, uint64_t) - called when the wallet balance changes
@@ -109,6 +127,15 @@ void BRWalletSetCallbacks(BRWallet *wallet, void *info,
                                             uint32_t timestamp),
                           void (*txDeleted)(void *info, UInt256 txHash, int notifyUser, int recommendRescan));
 
+// sets a store that transactions are saved to as they're added, updated and removed, alongside the callbacks, or NULL
+// to stop saving to a store, store must not be freed while it's set on the wallet
+// wallets created with BRWalletNewWithTxLog() record their transactions in the tx log and can't also use a store
+void BRWalletSetStore(BRWallet *wallet, BRStore *store);
+
+// enables or disables memoizing per-transaction amounts, status and balance for history views, disabled by default
+// while enabled, values are kept for each transaction the first time it's queried, disabling frees them
+void BRWalletSetTxMetrics(BRWallet *wallet, int enabled);
+
 // wallets are composed of chains of addresses
 // each chain is traversed until a gap of a number of addresses is found that haven't been used in any transactions
 // this function writes to addrs an array of <gapLimit> unused addresses following the last used address in the chain
@@ -151,6 +178,30 @@ uint64_t BRWalletTotalReceived(BRWallet *wallet);
 // writes unspent outputs to utxos and returns the number of outputs written, or number available if utxos is NULL
 size_t BRWalletUTXOs(BRWallet *wallet, BRUTXO utxos[], size_t utxosCount);
 
+// paginated queries start at position *cursor (0 for the first page, or NULL to always start at 0), and advance *cursor
+// past the items written so the next call returns the following page
+// NOTE: positions shift if transactions are added, removed or reordered between calls
+
+// writes up to txCount transactions registered in the wallet, sorted by date, oldest first, to transactions
+// returns the number of transactions written, or number available from *cursor if transactions is NULL
+size_t BRWalletTransactionsPage(BRWallet *wallet, size_t *cursor, BRTransaction *transactions[], size_t txCount);
+
+// writes up to txCount wallet transactions with an input or output for the wallet address addr, sorted by date, oldest
+// first, to transactions, returns the number of transactions written, or number available if transactions is NULL
+size_t BRWalletAddressTransactions(BRWallet *wallet, const char *addr, size_t *cursor, BRTransaction *transactions[],
+                                   size_t txCount);
+
+// writes up to utxosCount unspent outputs paying to the wallet address addr to utxos
+// returns the number of outputs written, or number available if utxos is NULL
+size_t BRWalletAddressUTXOs(BRWallet *wallet, const char *addr, size_t *cursor, BRUTXO utxos[], size_t utxosCount);
+
+// balance of unspent outputs paying to the wallet address addr, not including transactions known to be invalid
+uint64_t BRWalletAddressBalance(BRWallet *wallet, const char *addr);
+
+// writes up to count used wallet addresses and their balances to addrs and balances, in chain order, external chain
+// first, returns the number of addresses written, or number available if addrs is NULL
+size_t BRWalletAddressBalances(BRWallet *wallet, size_t *cursor, BRAddress addrs[], uint64_t balances[], size_t count);
+
 // fee-per-kb of transaction size to use when creating a transaction
 uint64_t BRWalletFeePerKb(BRWallet *wallet);
 void BRWalletSetFeePerKb(BRWallet *wallet, uint64_t feePerKb);
@@ -175,6 +226,10 @@ int BRWalletContainsTransaction(BRWallet *wallet, const BRTransaction *tx);
 // adds a transaction to the wallet, or returns false if it isn't associated with the wallet
 int BRWalletRegisterTransaction(BRWallet *wallet, BRTransaction *tx);
 
+// like BRWalletRegisterTransaction(), but the wallet calls BRTransactionRetain() on tx if it's kept, so the caller
+// must still call BRTransactionFree() to release its own reference
+int BRWalletRegisterSharedTransaction(BRWallet *wallet, BRTransaction *tx);
+
 // removes a tx from the wallet and calls BRTransactionFree() on it, along with any tx that depend on its outputs
 void BRWalletRemoveTransaction(BRWallet *wallet, UInt256 txHash);
 
@@ -190,8 +245,20 @@ int BRWalletTransactionIsPending(BRWallet *wallet, const BRTransaction *tx);
 // true if tx is considered 0-conf safe (valid and not pending, timestamp is greater than 0, and no unverified inputs)
 int BRWalletTransactionIsVerified(BRWallet *wallet, const BRTransaction *tx);
 
+// sets each input script of assetTransaction to the scriptPubKey of the wallet transaction output it spends, and
+// removes inputs that don't spend a known transaction output, using one outpoint lookup per input
 void BRFixAssetInputs(BRWallet *wallet, BRTransaction *assetTransaction);
 
+// writes unspent outputs of wallet transactions carrying a DigiAsset to utxos
+// returns the number of outputs written, or number available if utxos is NULL
+size_t BRWalletAssetUTXOs(BRWallet *wallet, BRUTXO utxos[], size_t utxosCount);
+
+// true if utxo is an unspent wallet output of a transaction carrying a DigiAsset
+int BRWalletUTXOIsAsset(BRWallet *wallet, BRUTXO utxo);
+
+// total amount of unspent outputs of wallet transactions carrying a DigiAsset (included in BRWalletBalance())
+uint64_t BRWalletAssetBalance(BRWallet *wallet);
+
 // set the block heights and timestamps for the given transactions
 // use height TX_UNCONFIRMED and timestamp 0 to indicate a tx should remain marked as unverified (not 0-conf safe)
 void BRWalletUpdateTransactions(BRWallet *wallet, const UInt256 txHashes[], size_t txCount, uint32_t blockHeight,
@@ -224,6 +291,10 @@ uint64_t BRWalletMinOutputAmount(BRWallet *wallet);
 // maximum amount that can be sent from the wallet to a single address after fees
 uint64_t BRWalletMaxOutputAmount(BRWallet *wallet);
 
+// writes the heap memory used by transactions, transaction metrics, utxos, address chains and the address index of
+// wallet to usage, and returns the number of entries written, or total usageCount needed if usage is NULL
+size_t BRWalletMemoryUsage(BRWallet *wallet, BRMemoryUsage usage[], size_t usageCount);
+
 // frees memory allocated for wallet, and calls BRTransactionFree() for all registered transactions
 void BRWalletFree(BRWallet *wallet);
 
@@ -239,10 +310,13 @@ BRUTXO * BRGetUTXO(BRWallet *wallet);
 
 BRTransaction * BRGetTxForUTXO(BRWallet *wallet, BRUTXO utxo);
 
+// true if any output of tx is a DigiAsset OP_RETURN, uses the script template classified when the output was parsed
 uint8_t BRTXContainsAsset(BRTransaction *tx);
 
+// true if any of the outputs is a DigiAsset OP_RETURN
 uint8_t BRContainsAsset(const BRTxOutput *outputs, size_t outCount);
 
+// true if output is a DigiAsset OP_RETURN
 uint8_t BROutIsAsset(const BRTxOutput output);
 
 #ifdef __cplusplus
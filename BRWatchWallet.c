@@ -0,0 +1,617 @@
+//
+//  BRWatchWallet.c
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+
+#include "BRWatchWallet.h"
+#include "BRSet.h"
+#include "BRAddress.h"
+#include "BRCrypto.h"
+#include "BRArray.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+
+#define WATCH_PAGE_SIZE 4096 // number of address entries per page
+
+typedef struct {
+    UInt160 hash160;
+    UInt160 scriptHash; // hash160 of the pay-to-witness-pubkey-hash redeem script, for P2SH-P2WPKH outputs
+    uint32_t keyIndex;
+    uint32_t path; // chain in the high bit, index within chain in the low 31 bits
+} _BRWatchEntry;
+
+typedef struct {
+    BRMasterPubKey mpk;
+    uint32_t derived[2]; // number of addresses derived on each chain
+    uint32_t used[2]; // one past the highest used address index on each chain
+    uint64_t balance;
+} _BRWatchKey;
+
+typedef struct {
+    UInt256 txHash;
+    uint32_t blockHeight;
+    uint32_t outCount; // number of outputs in the transaction, used to find the unspent outputs it added
+    BRWatchUTXO *spent; // unspent outputs the transaction spent, restored if the transaction is removed
+} _BRWatchTx;
+
+typedef struct {
+    BRUTXO outpoint; // must be first, the spenders set hashes items with BRUTXOHash()
+    _BRWatchTx *wtx; // registered transaction that spent outpoint
+} _BRWatchSpender;
+
+struct BRWatchWalletStruct {
+    uint32_t gapLimit[2];
+    uint64_t balance;
+    _BRWatchKey *keys;
+    _BRWatchEntry **pages; // entries are allocated in fixed size pages that never move, so the index can point to them
+    size_t entryCount;
+    BRSet *entries; // entries indexed by hash160
+    BRSet *scriptHashes; // entries indexed by scriptHash
+    BRSet *utxos; // BRWatchUTXO items indexed by outpoint
+    BRSet *txs; // _BRWatchTx records of registered transactions that affected the wallet, indexed by txHash
+    BRSet *spenders; // _BRWatchSpender items indexed by the outpoint of each spent output in txs
+    pthread_mutex_t lock;
+};
+
+inline static size_t _BRWatchEntryHash(const void *entry)
+{
+    return (size_t)((const _BRWatchEntry *)entry)->hash160.u32[0];
+}
+
+inline static int _BRWatchEntryEq(const void *entry, const void *otherEntry)
+{
+    return (entry == otherEntry ||
+            UInt160Eq(((const _BRWatchEntry *)entry)->hash160, ((const _BRWatchEntry *)otherEntry)->hash160));
+}
+
+inline static size_t _BRWatchEntryScriptHash(const void *entry)
+{
+    return (size_t)((const _BRWatchEntry *)entry)->scriptHash.u32[0];
+}
+
+inline static int _BRWatchEntryScriptEq(const void *entry, const void *otherEntry)
+{
+    return (entry == otherEntry ||
+            UInt160Eq(((const _BRWatchEntry *)entry)->scriptHash, ((const _BRWatchEntry *)otherEntry)->scriptHash));
+}
+
+// derives count addresses on the given chain of the key at keyIndex, starting after the last derived address
+static void _BRWatchWalletDerive(BRWatchWallet *watch, uint32_t keyIndex, uint32_t chain, uint32_t count)
+{
+    _BRWatchKey *key = &watch->keys[keyIndex];
+    BRECPoint pubKeys[WATCH_DERIVE_BATCH_SIZE];
+    _BRWatchEntry *entry;
+    uint8_t redeem[22] = { OP_0, 20 };
+    uint32_t n;
+
+    while (count > 0) {
+        n = (count < WATCH_DERIVE_BATCH_SIZE) ? count : WATCH_DERIVE_BATCH_SIZE;
+        BRBIP32PubKeyList(pubKeys, n, key->mpk, chain, key->derived[chain]);
+
+        for (uint32_t i = 0; i < n; i++) {
+            if (watch->entryCount % WATCH_PAGE_SIZE == 0) {
+                entry = malloc(WATCH_PAGE_SIZE*sizeof(*entry));
+                assert(entry != NULL);
+                array_add(watch->pages, entry);
+            }
+
+            entry = &watch->pages[watch->entryCount/WATCH_PAGE_SIZE][watch->entryCount % WATCH_PAGE_SIZE];
+            BRHash160(&entry->hash160, pubKeys[i].p, sizeof(pubKeys[i].p));
+            UInt160Set(&redeem[2], entry->hash160);
+            BRHash160(&entry->scriptHash, redeem, sizeof(redeem));
+            entry->keyIndex = keyIndex;
+            entry->path = (chain << 31) | (key->derived[chain] + i);
+            watch->entryCount++;
+            BRSetAdd(watch->entries, entry);
+            BRSetAdd(watch->scriptHashes, entry);
+        }
+
+        key->derived[chain] += n;
+        count -= n;
+    }
+}
+
+// derives enough addresses to keep gapLimit unused addresses past the last used address on chain
+// returns the number of addresses derived
+static size_t _BRWatchWalletExtend(BRWatchWallet *watch, uint32_t keyIndex, uint32_t chain)
+{
+    _BRWatchKey *key = &watch->keys[keyIndex];
+    uint32_t count = 0;
+
+    if (key->derived[chain] < key->used[chain] + watch->gapLimit[chain]) {
+        count = key->used[chain] + watch->gapLimit[chain] - key->derived[chain];
+        _BRWatchWalletDerive(watch, keyIndex, chain, count);
+    }
+
+    return count;
+}
+
+// returns the derived address entry the script pays to, for the standard templates derived addresses can appear in,
+// or NULL if none
+static _BRWatchEntry *_BRWatchWalletScriptEntry(BRWatchWallet *watch, const uint8_t *script, size_t scriptLen)
+{
+    _BRWatchEntry e;
+
+    if (scriptLen == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) { // pay-to-pubkey-hash
+        e.hash160 = UInt160Get(&script[3]);
+    }
+    else if (scriptLen == 22 && script[0] == OP_0 && script[1] == 20) { // pay-to-witness-pubkey-hash
+        e.hash160 = UInt160Get(&script[2]);
+    }
+    else if (scriptLen == 35 && script[0] == 33 && script[34] == OP_CHECKSIG) { // pay-to-pubkey (compressed)
+        BRHash160(&e.hash160, &script[1], 33);
+    }
+    else if (scriptLen == 23 && script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL) {
+        e.scriptHash = UInt160Get(&script[2]); // pay-to-script-hash, matched if it wraps a derived P2WPKH script
+        return BRSetGet(watch->scriptHashes, &e);
+    }
+    else return NULL;
+
+    return BRSetGet(watch->entries, &e);
+}
+
+// updates the height of the unspent outputs added by wtx
+static void _BRWatchWalletSetTxHeight(BRWatchWallet *watch, _BRWatchTx *wtx, uint32_t blockHeight)
+{
+    BRWatchUTXO *utxo;
+
+    wtx->blockHeight = blockHeight;
+
+    for (uint32_t n = 0; n < wtx->outCount; n++) {
+        BRUTXO o = { wtx->txHash, n };
+
+        utxo = BRSetGet(watch->utxos, &o);
+        if (utxo) utxo->blockHeight = blockHeight;
+    }
+}
+
+// returns the registered transaction that spent output n of wtx, or NULL if none
+static _BRWatchTx *_BRWatchWalletSpender(BRWatchWallet *watch, const _BRWatchTx *wtx, uint32_t n)
+{
+    BRUTXO o = { wtx->txHash, n };
+    _BRWatchSpender *spender = BRSetGet(watch->spenders, &o);
+
+    return (spender) ? spender->wtx : NULL;
+}
+
+// removes wtx and all registered transactions that depend on it, restoring the unspent outputs they spent
+static void _BRWatchWalletRemoveTx(BRWatchWallet *watch, _BRWatchTx *wtx)
+{
+    BRWatchUTXO *utxo;
+    _BRWatchTx *t;
+
+    for (uint32_t n = 0; n < wtx->outCount; n++) { // remove spenders of the outputs added by wtx
+        if ((t = _BRWatchWalletSpender(watch, wtx, n))) _BRWatchWalletRemoveTx(watch, t);
+    }
+
+    for (uint32_t n = 0; n < wtx->outCount; n++) { // remove outputs added by wtx, spenders are already removed
+        BRUTXO o = { wtx->txHash, n };
+
+        utxo = BRSetRemove(watch->utxos, &o);
+        if (! utxo) continue;
+        watch->keys[utxo->keyIndex].balance -= utxo->amount;
+        watch->balance -= utxo->amount;
+        free(utxo);
+    }
+
+    for (size_t i = 0; wtx->spent && i < array_count(wtx->spent); i++) { // restore outputs spent by wtx
+        utxo = malloc(sizeof(*utxo));
+        assert(utxo != NULL);
+        *utxo = wtx->spent[i];
+        BRSetAdd(watch->utxos, utxo);
+        watch->keys[utxo->keyIndex].balance += utxo->amount;
+        watch->balance += utxo->amount;
+        free(BRSetRemove(watch->spenders, &utxo->outpoint));
+    }
+
+    BRSetRemove(watch->txs, wtx);
+    if (wtx->spent) array_free(wtx->spent);
+    free(wtx);
+}
+
+// returns a newly allocated watch-only wallet that must be freed by calling BRWatchWalletFree()
+// externalGapLimit and internalGapLimit are the number of unused addresses kept derived past the last used address
+BRWatchWallet *BRWatchWalletNew(uint32_t externalGapLimit, uint32_t internalGapLimit)
+{
+    BRWatchWallet *watch = calloc(1, sizeof(*watch));
+
+    assert(watch != NULL);
+    watch->gapLimit[SEQUENCE_EXTERNAL_CHAIN] = externalGapLimit;
+    watch->gapLimit[SEQUENCE_INTERNAL_CHAIN] = internalGapLimit;
+    array_new(watch->keys, 10);
+    array_new(watch->pages, 10);
+    watch->entries = BRSetNew(_BRWatchEntryHash, _BRWatchEntryEq, 1000);
+    watch->scriptHashes = BRSetNew(_BRWatchEntryScriptHash, _BRWatchEntryScriptEq, 1000);
+    watch->utxos = BRSetNew(BRUTXOHash, BRUTXOEq, 100);
+    watch->txs = BRSetNew(BRTransactionHash, BRTransactionEq, 100);
+    watch->spenders = BRSetNew(BRUTXOHash, BRUTXOEq, 100);
+    pthread_mutex_init(&watch->lock, NULL);
+    return watch;
+}
+
+// adds a master public key to monitor and derives the initial gap limit addresses on both of its chains
+// returns the keyIndex used to identify the master public key in other BRWatchWallet functions
+uint32_t BRWatchWalletAddKey(BRWatchWallet *watch, BRMasterPubKey mpk)
+{
+    _BRWatchKey key;
+    uint32_t keyIndex;
+
+    assert(watch != NULL);
+    memset(&key, 0, sizeof(key));
+    key.mpk = mpk;
+    pthread_mutex_lock(&watch->lock);
+    keyIndex = (uint32_t)array_count(watch->keys);
+    array_add(watch->keys, key);
+    _BRWatchWalletExtend(watch, keyIndex, SEQUENCE_EXTERNAL_CHAIN);
+    _BRWatchWalletExtend(watch, keyIndex, SEQUENCE_INTERNAL_CHAIN);
+    pthread_mutex_unlock(&watch->lock);
+    return keyIndex;
+}
+
+// number of master public keys being monitored
+size_t BRWatchWalletKeyCount(BRWatchWallet *watch)
+{
+    size_t count;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    count = array_count(watch->keys);
+    pthread_mutex_unlock(&watch->lock);
+    return count;
+}
+
+// total number of derived addresses being monitored
+size_t BRWatchWalletAddressCount(BRWatchWallet *watch)
+{
+    size_t count;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    count = watch->entryCount;
+    pthread_mutex_unlock(&watch->lock);
+    return count;
+}
+
+// true if the given hash160 belongs to a derived address, either as a pubkey hash or as the script hash of its
+// P2SH-P2WPKH address, and if so writes where it was derived from to the keyIndex, chain and index pointers that are
+// not NULL
+int BRWatchWalletContainsHash160(BRWatchWallet *watch, UInt160 hash160, uint32_t *keyIndex, uint32_t *chain,
+                                 uint32_t *index)
+{
+    _BRWatchEntry *entry, e;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    e.hash160 = e.scriptHash = hash160;
+    entry = BRSetGet(watch->entries, &e);
+    if (! entry) entry = BRSetGet(watch->scriptHashes, &e);
+
+    if (entry) {
+        if (keyIndex) *keyIndex = entry->keyIndex;
+        if (chain) *chain = entry->path >> 31;
+        if (index) *index = entry->path & ~BIP32_HARD;
+    }
+
+    pthread_mutex_unlock(&watch->lock);
+    return (entry) ? 1 : 0;
+}
+
+// true if tx was registered and affected the wallet
+int BRWatchWalletContainsTransaction(BRWatchWallet *watch, UInt256 txHash)
+{
+    int r;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    r = BRSetContains(watch->txs, &txHash);
+    pthread_mutex_unlock(&watch->lock);
+    return r;
+}
+
+// adds outputs paying to monitored addresses to the unspent output set, and removes any unspent outputs spent by tx
+// transactions must be registered in chain order, registering the same transaction more than once has no effect
+// returns the number of new addresses derived to keep the gap limits, if non-zero the bloom filters must be rebuilt
+size_t BRWatchWalletRegisterTransaction(BRWatchWallet *watch, const BRTransaction *tx)
+{
+    BRWatchUTXO *utxo;
+    _BRWatchEntry *entry;
+    _BRWatchKey *key;
+    _BRWatchTx *wtx;
+    _BRWatchSpender *spender;
+    uint32_t chain, index;
+    size_t count = 0;
+    int r = 0;
+
+    assert(watch != NULL);
+    assert(tx != NULL);
+    pthread_mutex_lock(&watch->lock);
+
+    if (! BRSetContains(watch->txs, &tx->txHash)) {
+        wtx = calloc(1, sizeof(*wtx));
+        assert(wtx != NULL);
+        wtx->txHash = tx->txHash;
+        wtx->blockHeight = tx->blockHeight;
+        wtx->outCount = (uint32_t)tx->outCount;
+
+        for (size_t i = 0; i < tx->inCount; i++) {
+            BRUTXO o = { tx->inputs[i].txHash, tx->inputs[i].index };
+
+            utxo = BRSetRemove(watch->utxos, &o);
+            if (! utxo) continue;
+            watch->keys[utxo->keyIndex].balance -= utxo->amount;
+            watch->balance -= utxo->amount;
+            if (! wtx->spent) array_new(wtx->spent, tx->inCount);
+            array_add(wtx->spent, *utxo);
+            free(utxo);
+        }
+
+        for (size_t i = 0; i < tx->outCount; i++) {
+            entry = _BRWatchWalletScriptEntry(watch, tx->outputs[i].script, tx->outputs[i].scriptLen);
+            if (! entry) continue;
+            key = &watch->keys[entry->keyIndex];
+            chain = entry->path >> 31;
+            index = entry->path & ~BIP32_HARD;
+            utxo = calloc(1, sizeof(*utxo));
+            assert(utxo != NULL);
+            utxo->outpoint = (BRUTXO) { tx->txHash, (uint32_t)i };
+            utxo->amount = tx->outputs[i].amount;
+            utxo->keyIndex = entry->keyIndex;
+            utxo->chain = chain;
+            utxo->index = index;
+            utxo->blockHeight = tx->blockHeight;
+            BRSetAdd(watch->utxos, utxo);
+            key->balance += utxo->amount;
+            watch->balance += utxo->amount;
+            if (index + 1 > key->used[chain]) key->used[chain] = index + 1;
+            count += _BRWatchWalletExtend(watch, utxo->keyIndex, chain);
+            r = 1;
+        }
+
+        for (size_t i = 0; wtx->spent && i < array_count(wtx->spent); i++) { // index wtx by the outputs it spent
+            spender = malloc(sizeof(*spender));
+            assert(spender != NULL);
+            spender->outpoint = wtx->spent[i].outpoint;
+            spender->wtx = wtx;
+            BRSetAdd(watch->spenders, spender);
+        }
+
+        if (r || wtx->spent) BRSetAdd(watch->txs, wtx);
+        else free(wtx);
+    }
+
+    pthread_mutex_unlock(&watch->lock);
+    return count;
+}
+
+// removes a registered transaction and all registered transactions that spend its outputs, restoring the unspent
+// outputs they spent, for transactions that dropped out of the mempool or were double spent
+void BRWatchWalletRemoveTransaction(BRWatchWallet *watch, UInt256 txHash)
+{
+    _BRWatchTx *wtx;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    wtx = BRSetGet(watch->txs, &txHash);
+    if (wtx) _BRWatchWalletRemoveTx(watch, wtx);
+    pthread_mutex_unlock(&watch->lock);
+}
+
+// sets the block height of the given registered transactions and the unspent outputs they added, use
+// TX_UNCONFIRMED as blockHeight to mark them as unconfirmed
+void BRWatchWalletUpdateTransactions(BRWatchWallet *watch, const UInt256 txHashes[], size_t txCount,
+                                     uint32_t blockHeight)
+{
+    _BRWatchTx *wtx;
+
+    assert(watch != NULL);
+    assert(txHashes != NULL || txCount == 0);
+    pthread_mutex_lock(&watch->lock);
+
+    for (size_t i = 0; i < txCount; i++) {
+        wtx = BRSetGet(watch->txs, &txHashes[i]);
+        if (wtx) _BRWatchWalletSetTxHeight(watch, wtx, blockHeight);
+    }
+
+    pthread_mutex_unlock(&watch->lock);
+}
+
+// marks all registered transactions confirmed after blockHeight as unconfirmed, used when a chain reorg occurs
+void BRWatchWalletSetTxUnconfirmedAfter(BRWatchWallet *watch, uint32_t blockHeight)
+{
+    _BRWatchTx *wtx = NULL;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+
+    while ((wtx = BRSetIterate(watch->txs, wtx))) {
+        if (wtx->blockHeight > blockHeight && wtx->blockHeight != TX_UNCONFIRMED) {
+            _BRWatchWalletSetTxHeight(watch, wtx, TX_UNCONFIRMED);
+        }
+    }
+
+    pthread_mutex_unlock(&watch->lock);
+}
+
+// writes the hashes of registered transactions unconfirmed before blockHeight to txHashes and returns the number
+// written, or the number available if txHashes is NULL, use TX_UNCONFIRMED as blockHeight for unconfirmed only
+size_t BRWatchWalletTxUnconfirmedBefore(BRWatchWallet *watch, UInt256 txHashes[], size_t txCount,
+                                        uint32_t blockHeight)
+{
+    _BRWatchTx *wtx = NULL;
+    size_t i = 0;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+
+    while ((wtx = BRSetIterate(watch->txs, wtx))) {
+        if (wtx->blockHeight < blockHeight) continue;
+        if (txHashes && i >= txCount) break;
+        if (txHashes) txHashes[i] = wtx->txHash;
+        i++;
+    }
+
+    pthread_mutex_unlock(&watch->lock);
+    return i;
+}
+
+// total balance of unspent outputs for all monitored keys
+uint64_t BRWatchWalletBalance(BRWatchWallet *watch)
+{
+    uint64_t balance;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    balance = watch->balance;
+    pthread_mutex_unlock(&watch->lock);
+    return balance;
+}
+
+// balance of unspent outputs paying to addresses derived from the master public key at keyIndex
+uint64_t BRWatchWalletKeyBalance(BRWatchWallet *watch, uint32_t keyIndex)
+{
+    uint64_t balance = 0;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    if (keyIndex < array_count(watch->keys)) balance = watch->keys[keyIndex].balance;
+    pthread_mutex_unlock(&watch->lock);
+    return balance;
+}
+
+// writes unspent outputs to utxos and returns the number of outputs written, or number available if utxos is NULL
+size_t BRWatchWalletUTXOs(BRWatchWallet *watch, BRWatchUTXO utxos[], size_t utxosCount)
+{
+    BRWatchUTXO *utxo = NULL;
+    size_t i = 0;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+
+    if (! utxos) i = BRSetCount(watch->utxos);
+    else {
+        while (i < utxosCount && (utxo = BRSetIterate(watch->utxos, utxo))) utxos[i++] = *utxo;
+    }
+
+    pthread_mutex_unlock(&watch->lock);
+    return i;
+}
+
+// number of bloom filter elements needed to match all monitored addresses and unspent outputs
+size_t BRWatchWalletElementCount(BRWatchWallet *watch)
+{
+    size_t count;
+
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    count = watch->entryCount*2 + BRSetCount(watch->utxos);
+    pthread_mutex_unlock(&watch->lock);
+    return count;
+}
+
+// returns the number of bloom filter shards needed for each shard to hold at most elemsPerShard elements
+size_t BRWatchWalletShardCount(BRWatchWallet *watch, size_t elemsPerShard)
+{
+    size_t count;
+
+    assert(elemsPerShard > 0);
+    count = (BRWatchWalletElementCount(watch) + elemsPerShard - 1)/elemsPerShard;
+    return (count > 0) ? count : 1;
+}
+
+// inserts the addresses and unspent outputs assigned to shard out of shardCount shards into filter
+void BRWatchWalletBloomFilterInsert(BRWatchWallet *watch, BRBloomFilter *filter, size_t shard, size_t shardCount)
+{
+    BRWatchUTXO *utxo = NULL;
+    _BRWatchEntry *entry;
+    uint8_t o[sizeof(UInt256) + sizeof(uint32_t)];
+
+    assert(watch != NULL);
+    assert(filter != NULL);
+    assert(shard < shardCount);
+    pthread_mutex_lock(&watch->lock);
+
+    for (size_t i = 0; i < watch->entryCount; i++) { // add addresses to watch for tx receiving money
+        entry = &watch->pages[i/WATCH_PAGE_SIZE][i % WATCH_PAGE_SIZE];
+        if (_BRWatchEntryHash(entry) % shardCount != shard) continue;
+        BRBloomFilterInsertData(filter, entry->hash160.u8, sizeof(entry->hash160));
+        BRBloomFilterInsertData(filter, entry->scriptHash.u8, sizeof(entry->scriptHash));
+    }
+
+    while ((utxo = BRSetIterate(watch->utxos, utxo))) { // add UTXOs to watch for tx sending money
+        if (BRUTXOHash(utxo) % shardCount != shard) continue;
+        UInt256Set(o, utxo->outpoint.hash);
+        UInt32SetLE(&o[sizeof(UInt256)], utxo->outpoint.n);
+        BRBloomFilterInsertData(filter, o, sizeof(o));
+    }
+
+    pthread_mutex_unlock(&watch->lock);
+}
+
+// returns a bloom filter matching the addresses and unspent outputs assigned to shard out of shardCount shards
+// each shard can be loaded on a different peer, result must be freed by calling BRBloomFilterFree()
+BRBloomFilter *BRWatchWalletBloomFilter(BRWatchWallet *watch, size_t shard, size_t shardCount, double fpRate,
+                                        uint32_t tweak)
+{
+    BRBloomFilter *filter;
+
+    assert(watch != NULL);
+    assert(shard < shardCount);
+    filter = BRBloomFilterNew(fpRate, BRWatchWalletElementCount(watch)/shardCount + 100, tweak, BLOOM_UPDATE_ALL);
+    BRWatchWalletBloomFilterInsert(watch, filter, shard, shardCount);
+    return filter;
+}
+
+static void _setApplyFree(void *info, void *item)
+{
+    free(item);
+}
+
+static void _setApplyFreeTx(void *info, void *item)
+{
+    if (((_BRWatchTx *)item)->spent) array_free(((_BRWatchTx *)item)->spent);
+    free(item);
+}
+
+// frees memory allocated for watch
+void BRWatchWalletFree(BRWatchWallet *watch)
+{
+    assert(watch != NULL);
+    pthread_mutex_lock(&watch->lock);
+    BRSetApply(watch->utxos, NULL, _setApplyFree);
+    BRSetFree(watch->utxos);
+    BRSetApply(watch->txs, NULL, _setApplyFreeTx);
+    BRSetFree(watch->txs);
+    BRSetApply(watch->spenders, NULL, _setApplyFree);
+    BRSetFree(watch->spenders);
+    BRSetFree(watch->scriptHashes);
+    BRSetFree(watch->entries);
+    for (size_t i = array_count(watch->pages); i > 0; i--) free(watch->pages[i - 1]);
+    array_free(watch->pages);
+    array_free(watch->keys);
+    pthread_mutex_unlock(&watch->lock);
+    pthread_mutex_destroy(&watch->lock);
+    free(watch);
+}
@@ -0,0 +1,134 @@
+//
+//  BRWatchWallet.h
+//
+//  Created by DigiByte developers on 10/18/26.
+//  Copyright (c) 2026 breadwallet LLC
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BRWatchWallet_h
+#define BRWatchWallet_h
+
+#include "BRWallet.h"
+#include "BRBloomFilter.h"
+#include "BRTransaction.h"
+#include "BRBIP32Sequence.h"
+#include "BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a watch-only monitor for large address sets derived from many master public keys
+// addresses are kept as hash160 values only, and only balances and unspent outputs are tracked, so the memory cost is
+// a few dozen bytes per address, which allows monitoring hundreds of thousands of deposit addresses
+// outputs paying to P2PKH, P2WPKH, P2PK and P2SH-P2WPKH scripts of derived keys are matched
+// a BRPeerManager keeps a watch wallet in sync once it is attached with BRPeerManagerSetWatchWallet()
+
+#define WATCH_DERIVE_BATCH_SIZE 256 // number of addresses derived at a time when extending a chain
+
+typedef struct {
+    BRUTXO outpoint;
+    uint64_t amount;
+    uint32_t keyIndex; // index of the master public key the output pays to, as returned by BRWatchWalletAddKey()
+    uint32_t chain;    // SEQUENCE_EXTERNAL_CHAIN or SEQUENCE_INTERNAL_CHAIN
+    uint32_t index;    // index of the receiving address within chain
+    uint32_t blockHeight; // height of the block containing the transaction, or TX_UNCONFIRMED
+} BRWatchUTXO;
+
+typedef struct BRWatchWalletStruct BRWatchWallet;
+
+// returns a newly allocated watch-only wallet that must be freed by calling BRWatchWalletFree()
+// externalGapLimit and internalGapLimit are the number of unused addresses kept derived past the last used address
+BRWatchWallet *BRWatchWalletNew(uint32_t externalGapLimit, uint32_t internalGapLimit);
+
+// adds a master public key to monitor and derives the initial gap limit addresses on both of its chains
+// returns the keyIndex used to identify the master public key in other BRWatchWallet functions
+uint32_t BRWatchWalletAddKey(BRWatchWallet *watch, BRMasterPubKey mpk);
+
+// number of master public keys being monitored
+size_t BRWatchWalletKeyCount(BRWatchWallet *watch);
+
+// total number of derived addresses being monitored
+size_t BRWatchWalletAddressCount(BRWatchWallet *watch);
+
+// true if the given hash160 belongs to a derived address, either as a pubkey hash or as the script hash of its
+// P2SH-P2WPKH address, and if so writes where it was derived from to the keyIndex, chain and index pointers that are
+// not NULL
+int BRWatchWalletContainsHash160(BRWatchWallet *watch, UInt160 hash160, uint32_t *keyIndex, uint32_t *chain,
+                                 uint32_t *index);
+
+// true if tx was registered and affected the wallet
+int BRWatchWalletContainsTransaction(BRWatchWallet *watch, UInt256 txHash);
+
+// adds outputs paying to monitored addresses to the unspent output set, and removes any unspent outputs spent by tx
+// transactions must be registered in chain order, registering the same transaction more than once has no effect
+// returns the number of new addresses derived to keep the gap limits, if non-zero the bloom filters must be rebuilt
+size_t BRWatchWalletRegisterTransaction(BRWatchWallet *watch, const BRTransaction *tx);
+
+// removes a registered transaction and all registered transactions that spend its outputs, restoring the unspent
+// outputs they spent, for transactions that dropped out of the mempool or were double spent
+void BRWatchWalletRemoveTransaction(BRWatchWallet *watch, UInt256 txHash);
+
+// sets the block height of the given registered transactions and the unspent outputs they added, use
+// TX_UNCONFIRMED as blockHeight to mark them as unconfirmed
+void BRWatchWalletUpdateTransactions(BRWatchWallet *watch, const UInt256 txHashes[], size_t txCount,
+                                     uint32_t blockHeight);
+
+// marks all registered transactions confirmed after blockHeight as unconfirmed, used when a chain reorg occurs
+void BRWatchWalletSetTxUnconfirmedAfter(BRWatchWallet *watch, uint32_t blockHeight);
+
+// writes the hashes of registered transactions unconfirmed before blockHeight to txHashes and returns the number
+// written, or the number available if txHashes is NULL, use TX_UNCONFIRMED as blockHeight for unconfirmed only
+size_t BRWatchWalletTxUnconfirmedBefore(BRWatchWallet *watch, UInt256 txHashes[], size_t txCount,
+                                        uint32_t blockHeight);
+
+// total balance of unspent outputs for all monitored keys
+uint64_t BRWatchWalletBalance(BRWatchWallet *watch);
+
+// balance of unspent outputs paying to addresses derived from the master public key at keyIndex
+uint64_t BRWatchWalletKeyBalance(BRWatchWallet *watch, uint32_t keyIndex);
+
+// writes unspent outputs to utxos and returns the number of outputs written, or number available if utxos is NULL
+size_t BRWatchWalletUTXOs(BRWatchWallet *watch, BRWatchUTXO utxos[], size_t utxosCount);
+
+// number of bloom filter elements needed to match all monitored addresses and unspent outputs
+size_t BRWatchWalletElementCount(BRWatchWallet *watch);
+
+// returns the number of bloom filter shards needed for each shard to hold at most elemsPerShard elements
+size_t BRWatchWalletShardCount(BRWatchWallet *watch, size_t elemsPerShard);
+
+// inserts the addresses and unspent outputs assigned to shard out of shardCount shards into filter
+void BRWatchWalletBloomFilterInsert(BRWatchWallet *watch, BRBloomFilter *filter, size_t shard, size_t shardCount);
+
+// returns a bloom filter matching the addresses and unspent outputs assigned to shard out of shardCount shards
+// each shard can be loaded on a different peer, result must be freed by calling BRBloomFilterFree()
+BRBloomFilter *BRWatchWalletBloomFilter(BRWatchWallet *watch, size_t shard, size_t shardCount, double fpRate,
+                                        uint32_t tweak);
+
+// frees memory allocated for watch
+void BRWatchWalletFree(BRWatchWallet *watch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRWatchWallet_h
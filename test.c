@@ -25,7 +25,9 @@
 #include "BRCrypto.h"
 #include "BRBloomFilter.h"
 #include "BRMerkleBlock.h"
+#include "BRBlockCache.h"
 #include "BRWallet.h"
+#include "BRWatchWallet.h"
 #include "BRKey.h"
 #include "BRBIP38Key.h"
 #include "BRAddress.h"
@@ -35,6 +37,10 @@
 #include "BRBIP39WordsEn.h"
 #include "BRPeer.h"
 #include "BRPeerManager.h"
+#include "BRPeerStore.h"
+#include "BRStore.h"
+#include "BRTxLog.h"
+#include "BRHeaderSnapshot.h"
 #include "BRChainParams.h"
 #include "BRPaymentProtocol.h"
 #include "BRInt.h"
@@ -48,6 +54,10 @@
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 
 #define SKIP_BIP38 1
@@ -162,6 +172,52 @@ int BRArrayTests()
 
     array_free(a);
     
+    queue_new(a, 0);                // [ ]
+    if (queue_count(a) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: queue_new() test\n", __func__);
+
+    queue_add(a, 1);                // [ 1 ]
+    queue_add(a, 2);                // [ 1, 2 ]
+    if (queue_count(a) != 2 || queue_first(a) != 1 || queue_last(a) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: queue_add() test\n", __func__);
+
+    queue_add_first(a, 0);          // [ 0, 1, 2 ]
+    if (queue_count(a) != 3 || queue_first(a) != 0 || queue_at(a, 2) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: queue_add_first() test\n", __func__);
+
+    queue_rm_first(a);              // [ 1, 2 ]
+    if (queue_count(a) != 2 || queue_first(a) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: queue_rm_first() test\n", __func__);
+
+    for (int i = 3; i < 10; i++) { // wrap around the end of the buffer while removing from the start
+        queue_add(a, i);
+        queue_rm_first(a);
+    }                               // [ 8, 9 ]
+    
+    if (queue_count(a) != 2 || queue_first(a) != 8 || queue_last(a) != 9)
+        r = 0, fprintf(stderr, "***FAILED*** %s: queue_add() test 2\n", __func__);
+
+    for (int i = 10; i < 15; i++) queue_add(a, i); // [ 8, 9, 10, 11, 12, 13, 14 ] (capacity is increased)
+    if (queue_count(a) != 7 || queue_first(a) != 8 || queue_at(a, 4) != 12 || queue_last(a) != 14)
+        r = 0, fprintf(stderr, "***FAILED*** %s: queue_set_capacity() test\n", __func__);
+
+    queue_rm(a, 1);                 // [ 8, 10, 11, 12, 13, 14 ]
+    queue_rm(a, 4);                 // [ 8, 10, 11, 12, 14 ]
+    if (queue_count(a) != 5 || queue_first(a) != 8 || queue_at(a, 1) != 10 || queue_at(a, 3) != 12 ||
+        queue_last(a) != 14) r = 0, fprintf(stderr, "***FAILED*** %s: queue_rm() test\n", __func__);
+
+    queue_rm_range_first(a, 3);     // [ 12, 14 ]
+    if (queue_count(a) != 2 || queue_first(a) != 12)
+        r = 0, fprintf(stderr, "***FAILED*** %s: queue_rm_range_first() test\n", __func__);
+
+    queue_rm_last(a);               // [ 12 ]
+    if (queue_count(a) != 1 || queue_last(a) != 12)
+        r = 0, fprintf(stderr, "***FAILED*** %s: queue_rm_last() test\n", __func__);
+
+    queue_clear(a);                 // [ ]
+    if (queue_count(a) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: queue_clear() test\n", __func__);
+
+    queue_free(a);
+    
     printf("                                    ");
     return r;
 }
@@ -351,6 +407,22 @@ int BRBech32Tests()
     if (l == 0 || strcmp(addr, "bc1zw508d6qejxtdg4y5r3zarvaryvg6kdaj"))
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRBech32Encode() test 3", __func__);
 
+    const char *addrs[] = { "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4", "BC1ZW508D6QEJXTDG4Y5R3ZARVARYVG6KDAJ",
+                            "tb1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t4", "bc1qw508d6qejxtdg4y5r3zarvary0c5xw7kv8f3t5" };
+    uint8_t datas[4][42];
+    size_t lens[4];
+    char addrs2[2][91];
+
+    l = BRBech32DecodeList(datas, lens, "bc", addrs, 4);
+    if (l != 2 || lens[0] != 22 || lens[1] != 18 || lens[2] != 0 || lens[3] != 0 || memcmp(datas[1], b, 18))
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRBech32DecodeList() test", __func__);
+
+    const uint8_t *datas2[] = { datas[0], datas[1] };
+
+    l = BRBech32EncodeList(addrs2, "bc", datas2, 2);
+    if (l != 2 || strcmp(addrs2[0], addrs[0]) || strcmp(addrs2[1], "bc1zw508d6qejxtdg4y5r3zarvaryvg6kdaj"))
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRBech32EncodeList() test", __func__);
+
     if (! r) fprintf(stderr, "\n                                    ");
     return r;
 }
@@ -1412,7 +1484,58 @@ int BRAddressTests()
     BRAddressFromScriptPubKey(addr2.s, sizeof(addr2), script, scriptLen);
     if (! BRAddressEq(&addr, &addr2))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRAddressFromScriptPubKey()\n", __func__);
-    
+
+    BRScriptTemplate t = BRScriptClassify(script, scriptLen);
+
+    if (t.type != BRScriptTypeP2PKH || t.dataOff != 3 || t.dataLen != 20)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptClassify() test 1\n", __func__);
+
+    t = BRScriptClassify((const uint8_t *)"\x6a\x04\x44\x41\x03\x00", 6);
+    if (t.type != BRScriptTypeDigiAsset || t.dataOff != 2 || t.dataLen != 4)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptClassify() test 2\n", __func__);
+
+    UInt160 md20 = UINT160_ZERO, md20s[2];
+
+    if (! BRScriptPubKeyHash160(&md20, script, scriptLen) || ! UInt160Eq(md20, BRKeyHash160(&k)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptPubKeyHash160()\n", __func__);
+
+    const uint8_t *scripts[] = { script, script };
+    const size_t scriptLens[] = { scriptLen, scriptLen - 1 };
+    BRAddress addrs[2];
+    const char *addrStrs[] = { addr.s, "notanaddress" };
+    int valid[2];
+
+    if (BRAddressFromScriptPubKeyList(addrs, scripts, scriptLens, 2) != 1 || ! BRAddressEq(&addrs[0], &addr) ||
+        addrs[1].s[0] != '\0')
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRAddressFromScriptPubKeyList()\n", __func__);
+
+    if (BRScriptPubKeyHash160List(md20s, scripts, scriptLens, 2) != 1 || ! UInt160Eq(md20s[0], md20))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRScriptPubKeyHash160List()\n", __func__);
+
+    if (BRAddressIsValidList(valid, addrStrs, 2) != 1 || ! valid[0] || valid[1])
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRAddressIsValidList()\n", __func__);
+
+    if (BRAddressHash160List(md20s, addrStrs, 2) != 1 || ! UInt160Eq(md20s[0], md20))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRAddressHash160List()\n", __func__);
+
+    uint8_t wscript[22] = { OP_0, 20 };
+    char waddr[91] = "", upper[91] = ""; // bech32 addresses don't fit in a BRAddress
+    size_t i;
+
+    UInt160Set(&wscript[2], md20);
+    BRAddressFromScriptPubKey(waddr, sizeof(waddr), wscript, sizeof(wscript));
+    for (i = 0; waddr[i]; i++) upper[i] = (waddr[i] >= 'a' && waddr[i] <= 'z') ? waddr[i] - 'a' + 'A' : waddr[i];
+    md20s[0] = UINT160_ZERO;
+
+    if (! BRAddressIsValid(waddr) || ! BRAddressIsValid(upper) || ! BRAddressHash160(&md20s[0], upper) ||
+        ! UInt160Eq(md20s[0], md20))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRAddressIsValid() bech32 test 1\n", __func__);
+
+    for (i = 4; upper[i] && (upper[i] < 'A' || upper[i] > 'Z'); i++);
+    if (upper[i]) upper[i] += 'a' - 'A'; // mixed case bech32 is invalid
+    if (BRAddressIsValid(upper) || BRAddressHash160(&md20s[0], upper))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRAddressIsValid() bech32 test 2\n", __func__);
+
     // TODO: test BRAddressFromScriptSig()
     
     return r;
@@ -1604,6 +1727,16 @@ int BRBIP32SequenceTests()
                     uint256("7b6a7dd645507d775215a9035be06700e1ed8c541da9351b4bd14bd50ab61428")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKey() test\n", __func__);
 
+    BRECPoint pubKeys[3];
+
+    BRBIP32PubKeyList(pubKeys, 3, mpk, SEQUENCE_EXTERNAL_CHAIN, 0);
+    BRBIP32PubKey(pubKey, sizeof(pubKey), mpk, SEQUENCE_EXTERNAL_CHAIN, 2);
+    if (memcmp(pubKeys[0].p, "\x02", 1) != 0 ||
+        ! UInt256Eq(*(UInt256 *)&pubKeys[0].p[1],
+                    uint256("7b6a7dd645507d775215a9035be06700e1ed8c541da9351b4bd14bd50ab61428")) ||
+        memcmp(pubKeys[2].p, pubKey, sizeof(pubKey)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBIP32PubKeyList() test\n", __func__);
+
     UInt512 dk;
     BRAddress addr;
 
@@ -1755,6 +1888,15 @@ int BRTransactionTests()
     uint8_t buf4[BRTransactionSerialize(tx, NULL, 0)];
     size_t len4 = BRTransactionSerialize(tx, buf4, sizeof(buf4));
     
+    if (! tx->raw || tx->rawLen != len4)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTransactionSign() test 3\n", __func__);
+
+    BRTransactionShuffleOutputs(tx); // modifying tx releases its signed bytes, the outputs are all the same here
+    uint8_t buf6[len4];
+    
+    if (tx->raw || BRTransactionSerialize(tx, buf6, sizeof(buf6)) != len4 || memcmp(buf4, buf6, len4) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTransactionSerialize() test 3\n", __func__);
+    
     BRTransactionFree(tx);
     tx = BRTransactionParse(buf4, len4);
     if (! tx || ! BRTransactionIsSigned(tx))
@@ -1791,6 +1933,14 @@ int BRTransactionTests()
     if (!BRTransactionEqual(tgt, src))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRTransactionCopy() test 3\n", __func__);
     BRTransactionFree(tgt);
+
+    if (BRTransactionRetain(src) != src || src->refCount != 2) // shared reference, freed by the last owner
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTransactionRetain() test\n", __func__);
+
+    BRTransactionFree(src);
+    if (src->refCount != 1 || src->outCount != 10)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTransactionFree() test\n", __func__);
+
     BRTransactionFree(src);
     return r;
 }
@@ -1834,6 +1984,7 @@ int BRWalletTests()
     BRKey k;
     BRAddress addr, recvAddr = BRWalletReceiveAddress(w);
     BRTransaction *tx;
+    BRPeerManager *manager;
     
     printf("\n");
     
@@ -1891,6 +2042,44 @@ int BRWalletTests()
     if (BRWalletBalance(w) != SATOSHIS*2)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletUpdateTransactions() test\n", __func__);
 
+    BRTransaction *page[1];
+    size_t cursor = 0;
+
+    if (BRWalletAddressBalance(w, recvAddr.s) != SATOSHIS*2 || BRWalletAddressUTXOs(w, recvAddr.s, NULL, NULL, 0) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletAddressBalance() test\n", __func__);
+
+    if (BRWalletAddressTransactions(w, recvAddr.s, &cursor, page, 1) != 1 || page[0] != tx || // confirmed tx first
+        BRWalletAddressTransactions(w, recvAddr.s, &cursor, page, 1) != 1 || page[0] == tx ||
+        BRWalletAddressTransactions(w, recvAddr.s, &cursor, page, 1) != 0 || cursor != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletAddressTransactions() test\n", __func__);
+
+    tx = BRTransactionNew();
+    BRTransactionAddInput(tx, inHash, 2, 1, inScript, inScriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(tx, SATOSHIS, outScript, outScriptLen);
+    BRTransactionSign(tx, 0, &k, 1);
+    BRWalletRegisterSharedTransaction(w, tx); // the wallet retains tx, so the caller keeps its own reference
+    if (BRWalletBalance(w) != SATOSHIS*3 || tx->refCount != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRegisterSharedTransaction() test 1\n", __func__);
+
+    BRTransactionFree(tx);
+    if (BRWalletTransactionForHash(w, tx->txHash) != tx || tx->refCount != 1 || BRWalletBalance(w) != SATOSHIS*3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRegisterSharedTransaction() test 2\n", __func__);
+
+    tx = BRTransactionNew();
+    BRTransactionAddInput(tx, inHash, 3, 1, inScript, inScriptLen, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(tx, SATOSHIS, outScript, outScriptLen);
+    BRTransactionSign(tx, 0, &k, 1);
+    BRWalletRegisterTransaction(w, tx);
+    manager = BRPeerManagerNew(&BR_CHAIN_PARAMS, w, BIP39_CREATION_TIME, NULL, 0, NULL, 0);
+    BRPeerManagerPublishTx(manager, tx, NULL, NULL); // the wallet's reference isn't released by publishing
+    if (BRWalletTransactionForHash(w, tx->txHash) != tx || tx->refCount != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPublishTx() test 1\n", __func__);
+
+    BRWalletUpdateTransactions(w, &tx->txHash, 1, 1001, 1);
+    BRPeerManagerFree(manager); // releases the publish list's reference
+    if (BRWalletTransactionForHash(w, tx->txHash) != tx || tx->refCount != 1 || BRWalletBalance(w) != SATOSHIS*4)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPublishTx() test 2\n", __func__);
+
     BRWalletFree(w);
     tx = BRTransactionNew();
     BRTransactionAddInput(tx, inHash, 0, 1, inScript, inScriptLen, NULL, 0, TXIN_SEQUENCE);
@@ -1901,6 +2090,8 @@ int BRWalletTests()
     if (BRWalletBalance(w) != SATOSHIS)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNew() test\n", __func__);
 
+    BRWalletSetTxMetrics(w, 1); // memoize tx amounts and status for the queries below
+
     if (BRWalletAllAddrs(w, NULL, 0) != SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL + 1)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletAllAddrs() test\n", __func__);
     
@@ -1937,7 +2128,14 @@ int BRWalletTests()
 
     if (tx && BRWalletTransactionIsPending(w, tx))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletTransactionIsPending() test 2\n", __func__);
-    
+
+    if (tx && (BRWalletBalanceAfterTx(w, BRWalletTransactionForHash(w, hash)) != SATOSHIS ||
+               BRWalletBalanceAfterTx(w, tx) != BRWalletBalance(w)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletBalanceAfterTx() test\n", __func__);
+
+    if (tx && BRWalletAmountSentByTx(w, tx) != SATOSHIS) // second call is answered from the memoized tx metrics
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletAmountSentByTx() test\n", __func__);
+
     BRWalletRemoveTransaction(w, hash); // removing first tx should recursively remove second, leaving none
     if (BRWalletTransactions(w, NULL, 0) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletRemoveTransaction() test\n", __func__);
@@ -1966,8 +2164,23 @@ int BRWalletTests()
     if (BRWalletAmountSentByTx(w, tx) - BRWalletFeeForTx(w, tx) != amt || BRWalletAmountReceivedFromTx(w, tx) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletMaxOutputAmount() test 1\n", __func__);
 
+    BRMemoryUsage usage[BRWalletMemoryUsage(w, NULL, 0)];
+    size_t usageCount = BRWalletMemoryUsage(w, usage, sizeof(usage)/sizeof(*usage));
+
+    if (usageCount != 5 || strcmp(usage[0].name, "transactions") != 0 || usage[0].count != 1 ||
+        usage[0].size < BRTransactionMemoryUsage(tx))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletMemoryUsage() test\n", __func__);
+
     BRTransactionFree(tx);
     BRWalletFree(w);
+
+    BRTxOutput assetOut = BR_TX_OUTPUT_NONE;
+
+    BRTxOutputSetScript(&assetOut, (const uint8_t *)"\x6a\x04\x44\x41\x03\x00", 6);
+    if (! BROutIsAsset(assetOut) || ! BRContainsAsset(&assetOut, 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BROutIsAsset() test\n", __func__);
+
+    BRTxOutputSetScript(&assetOut, NULL, 0);
     
     amt = BRBitcoinAmount(50000, 50000);
     if (amt != SATOSHIS) r = 0, fprintf(stderr, "***FAILED*** %s: BRBitcoinAmount() test 1\n", __func__);
@@ -1984,6 +2197,117 @@ int BRWalletTests()
     return r;
 }
 
+int BRWatchWalletTests()
+{
+    int r = 1;
+    BRMasterPubKey mpk = BRBIP32MasterPubKey("", 1);
+    BRWatchWallet *watch = BRWatchWalletNew(20, 10);
+    UInt256 inHash = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    uint8_t pubKey[33], script[25] = { OP_DUP, OP_HASH160, 20 }, redeem[22] = { OP_0, 20 },
+            p2sh[23] = { OP_HASH160, 20 };
+    uint32_t keyIndex = BRWatchWalletAddKey(watch, mpk), chain = 0, index = 0;
+    UInt160 hash160;
+    BRTransaction *tx, *spendTx, *p2shTx;
+    BRBloomFilter *filter;
+    BRWatchUTXO utxos[2];
+
+    if (BRWatchWalletAddressCount(watch) != 30)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletAddKey() test\n", __func__);
+
+    BRBIP32PubKey(pubKey, sizeof(pubKey), mpk, SEQUENCE_EXTERNAL_CHAIN, 15);
+    BRHash160(&hash160, pubKey, sizeof(pubKey));
+    UInt160Set(&script[3], hash160);
+    script[23] = OP_EQUALVERIFY;
+    script[24] = OP_CHECKSIG;
+    
+    if (! BRWatchWalletContainsHash160(watch, hash160, &keyIndex, &chain, &index) || keyIndex != 0 ||
+        chain != SEQUENCE_EXTERNAL_CHAIN || index != 15)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletContainsHash160() test\n", __func__);
+
+    tx = BRTransactionNew();
+    BRTransactionAddInput(tx, inHash, 0, 1, NULL, 0, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(tx, SATOSHIS, script, sizeof(script));
+    tx->txHash = UInt256Reverse(inHash);
+    
+    if (BRWatchWalletRegisterTransaction(watch, tx) != 16 || BRWatchWalletAddressCount(watch) != 46)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletRegisterTransaction() test 1\n", __func__);
+
+    if (BRWatchWalletBalance(watch) != SATOSHIS || BRWatchWalletKeyBalance(watch, 0) != SATOSHIS ||
+        BRWatchWalletUTXOs(watch, NULL, 0) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletBalance() test 1\n", __func__);
+
+    BRWatchWalletRegisterTransaction(watch, tx); // registering twice should have no effect
+    if (BRWatchWalletBalance(watch) != SATOSHIS)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletRegisterTransaction() test 2\n", __func__);
+
+    uint8_t o[sizeof(UInt256) + sizeof(uint32_t)];
+    size_t shardCount = BRWatchWalletShardCount(watch, 10), matches = 0;
+
+    UInt256Set(o, tx->txHash);
+    UInt32SetLE(&o[sizeof(UInt256)], 0);
+    
+    for (size_t i = 0; i < shardCount; i++) {
+        filter = BRWatchWalletBloomFilter(watch, i, shardCount, BLOOM_DEFAULT_FALSEPOSITIVE_RATE, 0);
+        if (BRBloomFilterContainsData(filter, o, sizeof(o))) matches++;
+        BRBloomFilterFree(filter);
+    }
+
+    if (shardCount != 10 || matches < 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletBloomFilter() test\n", __func__);
+
+    spendTx = BRTransactionNew();
+    BRTransactionAddInput(spendTx, tx->txHash, 0, SATOSHIS, script, sizeof(script), NULL, 0, NULL, 0,
+                          TXIN_SEQUENCE);
+    spendTx->txHash = inHash;
+    BRWatchWalletRegisterTransaction(watch, spendTx);
+
+    if (BRWatchWalletBalance(watch) != 0 || BRWatchWalletUTXOs(watch, NULL, 0) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletBalance() test 2\n", __func__);
+
+    BRWatchWalletRemoveTransaction(watch, spendTx->txHash); // removing the spend restores the output it spent
+    if (BRWatchWalletBalance(watch) != SATOSHIS || BRWatchWalletUTXOs(watch, NULL, 0) != 1 ||
+        BRWatchWalletContainsTransaction(watch, spendTx->txHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletRemoveTransaction() test 1\n", __func__);
+
+    BRBIP32PubKey(pubKey, sizeof(pubKey), mpk, SEQUENCE_EXTERNAL_CHAIN, 3);
+    BRHash160(&hash160, pubKey, sizeof(pubKey));
+    UInt160Set(&redeem[2], hash160);
+    BRHash160(&hash160, redeem, sizeof(redeem));
+    UInt160Set(&p2sh[2], hash160);
+    p2sh[22] = OP_EQUAL;
+    p2shTx = BRTransactionNew();
+    BRTransactionAddInput(p2shTx, inHash, 1, 1, NULL, 0, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(p2shTx, SATOSHIS, p2sh, sizeof(p2sh));
+    p2shTx->txHash = uint256("0000000000000000000000000000000000000000000000000000000000000002");
+    p2shTx->blockHeight = 100;
+    BRWatchWalletRegisterTransaction(watch, p2shTx);
+
+    if (BRWatchWalletBalance(watch) != 2*SATOSHIS ||
+        ! BRWatchWalletContainsHash160(watch, hash160, NULL, NULL, &index) || index != 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletRegisterTransaction() test 3\n", __func__);
+
+    BRWatchWalletUpdateTransactions(watch, &tx->txHash, 1, 90);
+    BRWatchWalletSetTxUnconfirmedAfter(watch, 95); // reorg back to height 95 unconfirms p2shTx only
+    BRWatchWalletUTXOs(watch, utxos, 2);
+
+    if (BRWatchWalletTxUnconfirmedBefore(watch, NULL, 0, TX_UNCONFIRMED) != 1 ||
+        (utxos[0].blockHeight != 90 && utxos[1].blockHeight != 90) ||
+        (utxos[0].blockHeight != TX_UNCONFIRMED && utxos[1].blockHeight != TX_UNCONFIRMED))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletSetTxUnconfirmedAfter() test\n", __func__);
+
+    BRWatchWalletRegisterTransaction(watch, spendTx);
+    BRWatchWalletRemoveTransaction(watch, tx->txHash); // removing tx also removes spendTx, which depends on it
+    if (BRWatchWalletBalance(watch) != SATOSHIS || BRWatchWalletUTXOs(watch, NULL, 0) != 1 ||
+        BRWatchWalletContainsTransaction(watch, spendTx->txHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWatchWalletRemoveTransaction() test 2\n", __func__);
+
+    BRTransactionFree(tx);
+    BRTransactionFree(spendTx);
+    BRTransactionFree(p2shTx);
+    BRWatchWalletFree(watch);
+    return r;
+}
+
 int BRBloomFilterTests()
 {
     int r = 1;
@@ -2109,6 +2433,11 @@ int BRMerkleBlockTests()
         memcmp(block, block2, sizeof(block2)) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSerialize() test\n", __func__);
     
+    BRMerkleBlockClearRaw(b); // re-serializing from fields must match the bytes the block was parsed from
+    if (b->raw || BRMerkleBlockSerialize(b, block2, sizeof(block2)) != sizeof(block2) ||
+        memcmp(block, block2, sizeof(block2)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockClearRaw() test\n", __func__);
+    
     if (! BRMerkleBlockContainsTxHash(b, uint256("4c30b63cfcdc2d35e3329421b9805ef0c6565d35381ca857762ea0b3a5a128bb")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockContainsTxHash() test\n", __func__);
     
@@ -2131,9 +2460,100 @@ int BRMerkleBlockTests()
     if (! UInt256Eq(txHashes[3], uint256("c9ab658448c10b6921b7a4ce3021eb22ed6bb6a7fde1e5bcc4b1db6615c6abc5")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockTxHashes() test 4\n", __func__);
     
+    BRMerkleProof *proof = BRMerkleBlockProofForTx(b, txHashes[3]), *proof2 = NULL;
+    
+    if (! proof || proof->index != 6 || ! BRMerkleProofVerify(proof, b))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockProofForTx() test\n", __func__);
+
+    if (proof) {
+        uint8_t proofBuf[BRMerkleProofSerialize(proof, NULL, 0)];
+        const BRMerkleBlock *headers[] = { b };
+        int results[2];
+        
+        proof2 = BRMerkleProofParse(proofBuf, BRMerkleProofSerialize(proof, proofBuf, sizeof(proofBuf)));
+        
+        if (! proof2 || BRMerkleProofVerifyBatch((const BRMerkleProof *[]) { proof, proof2 }, 2, headers, 1,
+                                                 results) != 2)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleProofParse() test\n", __func__);
+
+        if (proof2) {
+            proof2->branch[0].u8[0] ^= 1;
+            if (BRMerkleProofVerify(proof2, b))
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleProofVerify() test\n", __func__);
+            BRMerkleProofFree(proof2);
+        }
+        
+        BRMerkleProofFree(proof);
+    }
+    
     // TODO: test a block with an odd number of tree rows both at the tx level and merkle node level
 
-    // TODO: XXX test BRMerkleBlockVerifyDifficulty()
+#if ! BITCOIN_TESTNET
+    // MultiShield: five algos taking turns every 10s, so the averaging window is faster than the 750s target and the
+    // next target is the previous one of the same algo, lowered by the maximum 8% step, the last block of the chain is
+    // the first with a full window before it and has the target computed for it
+    static const uint32_t versions[] = { 2, 512 | 2, 1024 | 2, 1536 | 2, 2048 | 2 };
+    BRMerkleBlock chain[BLOCK_TIMES_COUNT + 1], next = BR_MERKLE_BLOCK_NONE, *prev = NULL;
+    
+    for (int i = 0; i < BLOCK_TIMES_COUNT + 1; prev = &chain[i], i++) {
+        chain[i] = BR_MERKLE_BLOCK_NONE;
+        chain[i].blockHash.u32[0] = i + 1;
+        if (prev) chain[i].prevBlock = prev->blockHash;
+        chain[i].height = 1000000 + i;
+        chain[i].version = versions[i % 5];
+        chain[i].timestamp = 1500000000 + i*10 + i % 3;
+        chain[i].target = (i < BLOCK_TIMES_COUNT) ? 0x1b0404cb + (i % 5)*0x100 : 0x1b03b368;
+        BRMerkleBlockSetAncestry(&chain[i], prev);
+    }
+    
+    next.prevBlock = prev->blockHash;
+    next.height = prev->height + 1;
+    next.version = versions[next.height % 5];
+    next.target = 0x1b03b454;
+    if (! BRMerkleBlockVerifyDifficulty(&next, prev, 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockVerifyDifficulty() test 1\n", __func__);
+
+    next.target = chain[BLOCK_TIMES_COUNT - 4].target;
+    if (BRMerkleBlockVerifyDifficulty(&next, prev, 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockVerifyDifficulty() test 2\n", __func__);
+    
+    if (chain[BLOCK_TIMES_COUNT - 1].timesCount != BLOCK_TIMES_COUNT ||
+        ! BRMerkleBlockVerifyDifficulty(&chain[BLOCK_TIMES_COUNT], &chain[BLOCK_TIMES_COUNT - 1], 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockVerifyDifficulty() test 3\n", __func__);
+    
+    chain[BLOCK_TIMES_COUNT].target++;
+    if (BRMerkleBlockVerifyDifficulty(&chain[BLOCK_TIMES_COUNT], &chain[BLOCK_TIMES_COUNT - 1], 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockVerifyDifficulty() test 4\n", __func__);
+#endif
+    
+    // a block at twice the difficulty has more work than two blocks at difficulty 1 built on the same parent
+    BRMerkleBlock easy[2] = { BR_MERKLE_BLOCK_NONE, BR_MERKLE_BLOCK_NONE }, hard = BR_MERKLE_BLOCK_NONE;
+    
+    easy[0].target = easy[1].target = 0x1d00ffff;
+    BRMerkleBlockSetAncestry(&easy[0], NULL);
+    BRMerkleBlockSetAncestry(&easy[1], &easy[0]);
+    if (easy[1].chainWork.u32[0] != 0x00020002 || easy[1].chainWork.u32[1] != 2 || easy[1].chainWork.u32[2] != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSetAncestry() chainwork test 1\n", __func__);
+    
+    hard.target = 0x1c7fff80;
+    BRMerkleBlockSetAncestry(&hard, &easy[0]);
+    if (UInt256Compare(hard.chainWork, easy[1].chainWork) <= 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSetAncestry() chainwork test 2\n", __func__);
+
+    // since height 1430000 the work is that of the geometric mean target of the active algos, so five algos at
+    // difficulty 1 count as one block at difficulty 1, and one of them at twice the difficulty adds a fifth root of 2
+    // (to the 30bit precision of the fixed point geometric mean, the exact values are 0x100010001 and 0x126123e7d)
+    BRMerkleBlock geo = BR_MERKLE_BLOCK_NONE;
+    
+    geo.height = 1430000;
+    for (int i = 0; i < 5; i++) geo.algoHeights[i] = geo.height - i, geo.algoTargets[i] = 0x1d00ffff;
+    geo.algoHeights[7] = 1000000, geo.algoTargets[7] = 0x1b0404cb; // inactive algo
+    if (BRMerkleBlockWork(&geo).u32[1] != 1 || BRMerkleBlockWork(&geo).u32[0] != 0x0000ffd4)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockWork() test 1\n", __func__);
+    
+    geo.algoTargets[2] = hard.target;
+    if (BRMerkleBlockWork(&geo).u32[1] != 1 || BRMerkleBlockWork(&geo).u32[0] != 0x26123e2c)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockWork() test 2\n", __func__);
     
     // TODO: test (CVE-2012-2459) vulnerability
 
@@ -2153,6 +2573,90 @@ int BRMerkleBlockTests()
     return r;
 }
 
+int BRBlockCacheTests()
+{
+    int r = 1;
+    UInt256 inHash = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    UInt160 hashes[2] = { UINT160_ZERO, UINT160_ZERO };
+    uint8_t sig[] = { 0x01, 0x01 }, script[] = { OP_RETURN };
+    BRBlockCache *cache = BRBlockCacheNew(), *parsed;
+    BRTransaction *tx = BRTransactionNew(), *txs[2];
+    uint32_t heights[2];
+    
+    hashes[0].u8[0] = 1, hashes[1].u8[0] = 2;
+    BRTransactionAddInput(tx, inHash, 0, 1, NULL, 0, sig, sizeof(sig), sig, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(tx, 0, script, sizeof(script));
+    
+    BRBlockCacheAddWatched(cache, hashes, 1, 100);
+    BRBlockCacheAddBlock(cache, 101, 1500000000, &tx, 1);
+    BRBlockCacheAddBlock(cache, 102, 1500000015, NULL, 0);
+    
+    if (BRBlockCacheStartHeight(cache, hashes, 1) != 101 || BRBlockCacheStartHeight(cache, hashes, 2) != UINT32_MAX)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBlockCacheStartHeight() test 1\n", __func__);
+    
+    uint8_t buf[BRBlockCacheSerialize(cache, NULL, 0)];
+    size_t len = BRBlockCacheSerialize(cache, buf, sizeof(buf));
+    
+    parsed = BRBlockCacheParse(buf, len);
+    
+    if (! parsed || BRBlockCacheEndHeight(parsed) != 102 ||
+        BRBlockCacheTransactions(parsed, 0, txs, heights, NULL, 2) != 1 || heights[0] != 101 ||
+        BRTransactionSerialize(txs[0], NULL, 0) != BRTransactionSerialize(tx, NULL, 0))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBlockCacheParse() test\n", __func__);
+    
+    if (parsed) BRTransactionFree(txs[0]), BRBlockCacheFree(parsed);
+    
+    // newly watched hashes invalidate cached blocks that were downloaded without them
+    BRBlockCacheAddWatched(cache, &hashes[1], 1, 101);
+    if (BRBlockCacheEndHeight(cache) != 101 || BRBlockCacheStartHeight(cache, hashes, 2) != 102)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBlockCacheAddWatched() test\n", __func__);
+    
+    BRBlockCacheAddBlock(cache, 105, 1500000060, NULL, 0); // a gap restarts the cache
+    if (BRBlockCacheStartHeight(cache, hashes, 1) != 105 || BRBlockCacheTransactions(cache, 0, NULL, NULL, NULL, 0) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBlockCacheAddBlock() test\n", __func__);
+    
+    BRTransactionFree(tx);
+    BRBlockCacheFree(cache);
+    return r;
+}
+
+int BRChainParamsTests()
+{
+    int r = 1;
+    const BRChainParams *params = &BRMainNetParams;
+    const BRCheckPoint *checkpoint;
+    
+    checkpoint = BRChainParamsCheckpointBeforeHeight(params, 4999);
+    if (! checkpoint || checkpoint->height != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainParamsCheckpointBeforeHeight() test 1\n", __func__);
+    
+    checkpoint = BRChainParamsCheckpointBeforeHeight(params, 5000);
+    if (! checkpoint || checkpoint->height != 5000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainParamsCheckpointBeforeHeight() test 2\n", __func__);
+    
+    checkpoint = BRChainParamsCheckpointBeforeHeight(params, UINT32_MAX);
+    if (checkpoint != &params->checkpoints[params->checkpointsCount - 1])
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainParamsCheckpointBeforeHeight() test 3\n", __func__);
+    
+    if (BRChainParamsCheckpointAtHeight(params, 5001) != NULL ||
+        ! BRChainParamsCheckpointAtHeight(params, 10000) ||
+        BRChainParamsCheckpointAtHeight(params, 10000)->height != 10000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainParamsCheckpointAtHeight() test\n", __func__);
+    
+    if (BRChainParamsCheckpointBeforeTime(params, 1389388393) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainParamsCheckpointBeforeTime() test 1\n", __func__);
+    
+    checkpoint = BRChainParamsCheckpointBeforeTime(params, 1389701913);
+    if (! checkpoint || checkpoint->height != 5000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainParamsCheckpointBeforeTime() test 2\n", __func__);
+    
+    checkpoint = BRChainParamsCheckpointBeforeTime(params, 1389996579);
+    if (! checkpoint || checkpoint->height != 5000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRChainParamsCheckpointBeforeTime() test 3\n", __func__);
+    
+    return r;
+}
+
 int BRPaymentProtocolTests()
 {
     int r = 1;
@@ -2601,6 +3105,410 @@ int BRPeerTests()
     return r;
 }
 
+int BRPeerStoreTests()
+{
+    int r = 1;
+    BRPeerStore *store = BRPeerStoreNew();
+    BRPeer peer = BR_PEER_NONE, peers[PEER_STORE_BUCKET_SIZE*2];
+    
+    peer.address = ((UInt128) { .u8 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 10, 1, 0, 1 } });
+    peer.port = 12024;
+    peer.timestamp = 1500000000;
+    
+    if (! BRPeerStoreAdd(store, &peer) || BRPeerStoreAdd(store, &peer) || BRPeerStoreCount(store) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerStoreAdd() test 1\n", __func__);
+    
+    peer.timestamp++;
+    peer.score = 900;
+    BRPeerStoreMarkGood(store, &peer);
+    
+    if (BRPeerStorePeers(store, peers, 2) != 1 || peers[0].timestamp != peer.timestamp || peers[0].score != 900)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerStoreMarkGood() test\n", __func__);
+    
+    for (size_t i = 0; i < PEER_STORE_BUCKET_SIZE*2; i++) { // a single network group only fills one new bucket
+        peer.address.u8[14] = (uint8_t)(i >> 8), peer.address.u8[15] = (uint8_t)i + 2;
+        BRPeerStoreAdd(store, &peer);
+    }
+    
+    if (BRPeerStoreCount(store) != PEER_STORE_BUCKET_SIZE + 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerStoreAdd() test 2\n", __func__);
+    
+    if (BRPeerStoreSelect(store, peers, 10, 1500000000) != 10)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerStoreSelect() test 1\n", __func__);
+    
+    for (size_t i = 0; i < 10; i++) {
+        for (size_t j = i + 1; j < 10; j++) {
+            if (BRPeerEq(&peers[i], &peers[j]))
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerStoreSelect() test 2\n", __func__);
+        }
+    }
+    
+    if (BRPeerStoreSelect(store, peers, PEER_STORE_BUCKET_SIZE*2, 1500000000) != PEER_STORE_BUCKET_SIZE + 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerStoreSelect() test 3\n", __func__);
+    
+    peer.address.u8[14] = 0, peer.address.u8[15] = 1;
+    
+    if (! BRPeerStoreRemove(store, &peer) || BRPeerStoreRemove(store, &peer) ||
+        BRPeerStoreCount(store) != PEER_STORE_BUCKET_SIZE)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerStoreRemove() test\n", __func__);
+    
+    BRPeerStoreFree(store);
+    return r;
+}
+
+int BRStoreTests()
+{
+    int r = 1, fd;
+    char path[] = "/tmp/BRStoreTestsXXXXXX";
+    uint8_t script[] = { 0x76, 0xa9, 0x14, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x88, 0xac };
+    BRTransaction *tx = BRTransactionNew(), *txs[2];
+    BRPeer peer = BR_PEER_NONE, peers[3];
+    UInt256 hash = UINT256_ZERO, branch = UINT256_ZERO;
+    BRMerkleProof proof = { UINT256_ZERO, UINT256_ZERO, 1, 2, &branch, 1 }, *p;
+    uint8_t buf[0x100];
+    BRStore *store;
+    struct stat st;
+    struct rlimit rl, limit;
+    size_t len;
+    int error;
+    
+    fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    store = (fd >= 0) ? BRStoreNew(path) : NULL;
+    if (! store) r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreNew() test 1\n", __func__);
+    if (! store) return r;
+    
+    hash.u8[0] = 1;
+    BRTransactionAddInput(tx, hash, 0, 1000, script, sizeof(script), NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(tx, 900, script, sizeof(script));
+    len = BRTransactionSerialize(tx, buf, sizeof(buf));
+    BRTransactionFree(tx);
+    tx = BRTransactionParse(buf, len); // sets txHash
+    tx->blockHeight = TX_UNCONFIRMED;
+    BRStoreSaveTx(store, tx);
+    BRStoreUpdateTx(store, &tx->txHash, 1, 100, 1500000000);
+    proof.blockHash.u8[0] = branch.u8[0] = 2;
+    proof.txHash = tx->txHash;
+    BRStoreSaveProof(store, &proof);
+    
+    peer.address = ((UInt128) { .u8 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 10, 1, 0, 1 } });
+    peer.port = 12024;
+    peer.score = 900;
+    peers[0] = peer;
+    peers[1] = peer;
+    peers[1].port++;
+    BRStoreSavePeers(store, 0, peers, 2);
+    BRStoreSavePeers(store, 1, &peer, 1); // replaces both
+    
+    if (BRStoreFlush(store) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreFlush() test\n", __func__);
+    BRStoreFree(store);
+    
+    fd = open(path, O_WRONLY | O_APPEND);
+    if (fd >= 0 && write(fd, "\x03torn", 5) != 5) r = 0; // simulate a crash in the middle of appending a record
+    if (fd >= 0) close(fd);
+    store = BRStoreNew(path);
+    if (! store) r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreNew() test 2\n", __func__);
+    if (! store) return r;
+    
+    if (BRStorePeers(store, NULL, 0) != 1 || BRStorePeers(store, peers, 3) != 1 || ! BRPeerEq(&peers[0], &peer) ||
+        peers[0].score != 900) r = 0, fprintf(stderr, "***FAILED*** %s: BRStorePeers() test\n", __func__);
+    
+    if (BRStoreTransactions(store, txs, 2) != 1 || ! UInt256Eq(txs[0]->txHash, tx->txHash) ||
+        txs[0]->blockHeight != 100 || txs[0]->timestamp != 1500000000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreTransactions() test 1\n", __func__);
+    else BRTransactionFree(txs[0]);
+    
+    p = BRStoreProofForTx(store, tx->txHash);
+    if (! p || ! UInt256Eq(p->blockHash, proof.blockHash) || p->index != 1 || p->totalTx != 2 || p->branchCount != 1 ||
+        ! UInt256Eq(p->branch[0], branch))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreProofForTx() test\n", __func__);
+    if (p) BRMerkleProofFree(p);
+    
+    BRStoreDeleteTx(store, tx->txHash);
+    if (BRStoreTransactions(store, NULL, 0) != 0 || BRStoreBlocks(store, NULL, 0) != 0 ||
+        (p = BRStoreProofForTx(store, tx->txHash)) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreTransactions() test 2\n", __func__);
+    
+    // replacing the saved peer over and over grows the file to several times the size of its live records
+    for (size_t i = 0; i < 20000; i++) {
+        peer.score = (uint16_t)i;
+        BRStoreSavePeers(store, 1, &peer, 1);
+    }
+    
+    BRStoreFree(store);
+    if (stat(path, &st) != 0 || st.st_size >= STORE_COMPACT_MIN_SIZE)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreSavePeers() compaction test 1\n", __func__);
+    store = BRStoreNew(path);
+    if (! store) r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreNew() test 3\n", __func__);
+    if (! store) return r;
+    
+    if (BRStorePeers(store, peers, 3) != 1 || ! BRPeerEq(&peers[0], &peer) || peers[0].score != 19999)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreSavePeers() compaction test 2\n", __func__);
+    
+    // a batch cut short by the file size limit must not leave a torn record that later records are appended after
+    signal(SIGXFSZ, SIG_IGN);
+    getrlimit(RLIMIT_FSIZE, &rl);
+    limit = rl;
+    limit.rlim_cur = (rlim_t)st.st_size + 100;
+    setrlimit(RLIMIT_FSIZE, &limit);
+    
+    for (size_t i = 0; i < 100; i++) {
+        peer.port = (uint16_t)(20000 + i);
+        BRStoreSavePeers(store, 0, &peer, 1);
+    }
+    
+    error = BRStoreFlush(store);
+    setrlimit(RLIMIT_FSIZE, &rl);
+    signal(SIGXFSZ, SIG_DFL);
+    if (error != EFBIG) r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreFlush() write error test 1\n", __func__);
+    peer.port = 1;
+    BRStoreSavePeers(store, 0, &peer, 1); // written by rewriting the file along with the lost batch
+    if (BRStoreFlush(store) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreFlush() write error test 2\n", __func__);
+    BRStoreFree(store);
+    
+    store = BRStoreNew(path);
+    if (! store) r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreNew() test 4\n", __func__);
+    if (! store) return r;
+    
+    if (BRStorePeers(store, NULL, 0) != 102)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRStoreFlush() write error test 3\n", __func__);
+    
+    BRStoreFree(store);
+    BRTransactionFree(tx);
+    unlink(path);
+    return r;
+}
+
+int BRTxLogTests()
+{
+    int r = 1, fd;
+    char path[] = "/tmp/BRTxLogTestsXXXXXX";
+    uint8_t script[] = { 0x76, 0xa9, 0x14, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x88, 0xac },
+            sig[] = { 0x01, 0x00 }; // placeholder signature, so the txHash is set when parsed
+    BRTransaction *tx[2], *t;
+    UInt256 hash = UINT256_ZERO, hashes[2];
+    uint8_t buf[0x100], buf2[0x100], script2[0x40];
+    BRMasterPubKey mpk = BRBIP32MasterPubKey("", 1);
+    BRAddress addr;
+    BRWallet *w;
+    BRTxLog *log;
+    struct stat st;
+    size_t len = 0, scriptLen;
+    
+    fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    log = (fd >= 0) ? BRTxLogNew(path) : NULL;
+    if (! log) r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogNew() test 1\n", __func__);
+    if (! log) return r;
+    
+    for (size_t i = 0; i < 2; i++) {
+        hash.u8[0] = i + 1;
+        tx[i] = BRTransactionNew();
+        BRTransactionAddInput(tx[i], hash, 0, 1000, script, sizeof(script), sig, sizeof(sig), NULL, 0, TXIN_SEQUENCE);
+        BRTransactionAddOutput(tx[i], 900, script, sizeof(script));
+        len = BRTransactionSerialize(tx[i], buf, sizeof(buf));
+        BRTransactionFree(tx[i]);
+        tx[i] = BRTransactionParse(buf, len); // sets txHash
+        tx[i]->blockHeight = TX_UNCONFIRMED;
+        if (BRTxLogAdd(log, tx[i]) != 0) r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogAdd() test\n", __func__);
+    }
+    
+    BRTxLogUpdate(log, &tx[1]->txHash, 1, 100, 1500000000);
+    BRTxLogRemove(log, tx[0]->txHash);
+    BRTxLogFree(log);
+    hash = tx[0]->txHash;
+    BRTransactionFree(tx[0]);
+    
+    fd = open(path, O_WRONLY | O_APPEND);
+    if (fd >= 0 && write(fd, "torn", 4) != 4) r = 0; // simulate a crash in the middle of appending a record
+    if (fd >= 0) close(fd);
+    log = BRTxLogNew(path);
+    if (! log) r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogNew() test 2\n", __func__);
+    if (! log) return r;
+    
+    if (BRTxLogHashes(log, NULL, 0) != 1 || BRTxLogHashes(log, hashes, 2) != 1 || ! UInt256Eq(hashes[0], tx[1]->txHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogHashes() test\n", __func__);
+    
+    t = BRTxLogTransaction(log, tx[1]->txHash); // parsed from the mapping on first access
+    if (! t || t->blockHeight != 100 || t->timestamp != 1500000000 ||
+        BRTransactionSerialize(t, buf2, sizeof(buf2)) != len || memcmp(buf, buf2, len) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogTransaction() test 1\n", __func__);
+    
+    if (BRTxLogTransaction(log, hash) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogTransaction() test 2\n", __func__);
+    
+    if (BRTxLogTransactions(log, tx, 2) != 1 || tx[0] != t) // the parsed tx is kept, not parsed again
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogTransactions() test\n", __func__);
+    else BRTransactionFree(tx[0]);
+    
+    BRTransactionFree(t);
+    BRTxLogRemove(log, tx[1]->txHash);
+    w = BRWalletNewWithTxLog(log, mpk);
+    if (! w || BRWalletTransactions(w, NULL, 0) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNewWithTxLog() test 1\n", __func__);
+    
+    if (w) BRWalletFree(w);
+    BRTxLogFree(log);
+    
+    w = BRWalletNew(NULL, 0, mpk);
+    addr = BRWalletReceiveAddress(w);
+    BRWalletFree(w);
+    scriptLen = BRAddressScriptPubKey(script2, sizeof(script2), addr.s);
+    hash.u8[0] = 3;
+    t = BRTransactionNew();
+    BRTransactionAddInput(t, hash, 0, 1000, script, sizeof(script), sig, sizeof(sig), NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(t, SATOSHIS, script2, scriptLen);
+    len = BRTransactionSerialize(t, buf, sizeof(buf));
+    BRTransactionFree(t);
+    t = BRTransactionParse(buf, len);
+    t->blockHeight = 100;
+    t->timestamp = 1500000000;
+    log = BRTxLogNew(path);
+    if (log) BRTxLogAdd(log, t), BRTxLogFree(log);
+    BRTransactionFree(t);
+    log = BRTxLogNew(path);
+    if (! log) r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogNew() test 3\n", __func__);
+    if (! log) return r;
+    
+    w = BRWalletNewWithTxLog(log, mpk); // the wallet's tx are built from the index, without being parsed
+    tx[0] = NULL;
+    if (! w || BRWalletBalance(w) != SATOSHIS)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNewWithTxLog() test 2\n", __func__);
+    
+    if (BRTxLogIndexTransactions(log, tx, 2) != 1 || tx[0]->inputs[0].signature != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogIndexTransactions() test\n", __func__);
+    
+    t = NULL; // parsed when the wallet first hands it out, filling in the same tx
+    if (! w || BRWalletTransactions(w, &t, 1) != 1 || t != tx[0] || ! BRTransactionIsSigned(t) ||
+        BRTransactionSerialize(t, buf2, sizeof(buf2)) != len || memcmp(buf, buf2, len) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletNewWithTxLog() test 3\n", __func__);
+    
+    if (tx[0]) hash = tx[0]->txHash, BRTransactionFree(tx[0]);
+    if (w) BRWalletFree(w);
+    
+    for (uint32_t i = 1; i <= 20000; i++) { // the log is compacted on its own thread as it grows
+        BRTxLogUpdate(log, &hash, 1, 100 + i, 1500000000);
+    }
+    
+    BRTxLogFree(log);
+    if (stat(path, &st) != 0 || st.st_size >= TXLOG_COMPACT_MIN_SIZE)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogUpdate() compaction test\n", __func__);
+    
+    log = BRTxLogNew(path);
+    if (! log) r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogNew() test 4\n", __func__);
+    if (! log) return r;
+    t = BRTxLogTransaction(log, hash);
+    if (! t || t->blockHeight != 20100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogTransaction() test 3\n", __func__);
+    
+    if (t) BRTransactionFree(t);
+    BRTxLogAdd(log, tx[1]);
+    BRTxLogFree(log);
+    
+    fd = open(path, O_RDWR);
+    if (fd < 0 || lseek(fd, -1, SEEK_END) < 0 || read(fd, buf, 1) != 1) r = 0;
+    buf[0] ^= 0xff; // corrupt the last byte of the serialized tx, which the index record's checksum covers
+    if (fd >= 0 && (lseek(fd, -1, SEEK_END) < 0 || write(fd, buf, 1) != 1)) r = 0;
+    if (fd >= 0) close(fd);
+    log = BRTxLogNew(path);
+    if (! log || BRTxLogHashes(log, hashes, 2) != 1 || ! UInt256Eq(hashes[0], hash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRTxLogNew() test 5\n", __func__);
+    
+    if (log) BRTxLogFree(log);
+    BRTransactionFree(tx[1]);
+    unlink(path);
+    return r;
+}
+
+int BRHeaderSnapshotTests()
+{
+    int r = 1;
+    BRMerkleBlock *blocks[3], *parsed[3];
+    BRKey key, other;
+    uint8_t pubKey[65], header[0x100], *buf;
+    size_t i, pkLen, len;
+    BRWallet *w = BRWalletNew(NULL, 0, BRBIP32MasterPubKey("", 1));
+    BRPeerManager *manager;
+    
+    BRKeySetSecret(&key, &uint256("0000000000000000000000000000000000000000000000000000000000000001"), 1);
+    BRKeySetSecret(&other, &uint256("0000000000000000000000000000000000000000000000000000000000000002"), 1);
+    pkLen = BRKeyPubKey(&key, pubKey, sizeof(pubKey));
+    
+    for (i = 0; i < 3; i++) { // three linked headers with no checkpoint at their heights
+        blocks[i] = BRMerkleBlockNew();
+        blocks[i]->version = 0x20000002 | (i << 9);
+        blocks[i]->prevBlock = (i > 0) ? blocks[i - 1]->blockHash : uint256("01");
+        blocks[i]->merkleRoot.u32[0] = (uint32_t)i + 1;
+        blocks[i]->timestamp = 1500000000 + (uint32_t)i*15;
+        blocks[i]->target = 0x1c0fffff;
+        blocks[i]->nonce = (uint32_t)i;
+        blocks[i]->height = 100 + (uint32_t)i;
+        BRMerkleBlockSerialize(blocks[i], header, sizeof(header));
+        BRSHA256_2(&blocks[i]->blockHash, header, 80);
+        BRMerkleBlockSetAncestry(blocks[i], (i > 0) ? blocks[i - 1] : NULL);
+    }
+    
+    len = BRHeaderSnapshotSerialize(blocks, 3, &key, NULL, 0);
+    buf = malloc(len);
+    if (len == 0 || BRHeaderSnapshotSerialize(blocks, 3, &key, buf, len) != len)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotSerialize() test 1\n", __func__);
+    
+    if (BRHeaderSnapshotSerialize(&blocks[1], 2, &key, NULL, 0) == 0 ||
+        BRHeaderSnapshotSerialize((BRMerkleBlock *[]) { blocks[0], blocks[2] }, 2, &key, NULL, 0) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotSerialize() test 2\n", __func__);
+    
+    if (BRHeaderSnapshotParse(buf, len, &BR_CHAIN_PARAMS, pubKey, pkLen, NULL, 0) != 3 ||
+        BRHeaderSnapshotParse(buf, len, &BR_CHAIN_PARAMS, pubKey, pkLen, parsed, 3) != 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotParse() test 1\n", __func__);
+    else {
+        for (i = 0; i < 3; i++) {
+            if (! UInt256Eq(parsed[i]->blockHash, blocks[i]->blockHash) || parsed[i]->height != blocks[i]->height ||
+                ! UInt256Eq(parsed[i]->chainWork, blocks[i]->chainWork) || parsed[i]->timesCount != i + 1 ||
+                parsed[i]->algoHeights[i] != blocks[i]->height) // version bits 9 to 11 hold the algo
+                r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotParse() test 2\n", __func__);
+            
+            BRMerkleBlockFree(parsed[i]);
+        }
+    }
+    
+    // a wallet older than the snapshot loads all of it, while a wallet created after the snapshot's tip keeps only the
+    // headers up to a week before its earliestKeyTime, and syncs the rest as merkleblocks
+    for (i = 0; i < 2; i++) {
+        if (BRHeaderSnapshotParse(buf, len, &BR_CHAIN_PARAMS, pubKey, pkLen, parsed, 3) != 3) {
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotParse() test 6\n", __func__);
+            break;
+        }
+        
+        manager = BRPeerManagerNewEx(&BR_CHAIN_PARAMS, w, (i == 0) ? 1500000000 + 8*24*60*60 :
+                                     1500000000 + 7*24*60*60 - 2*60*60 + 20, parsed, 3, NULL, 0, NULL);
+        if (BRPeerManagerLastBlockHeight(manager) != ((i == 0) ? 102 : 101))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerNewEx() test %zu\n", __func__, i + 1);
+        
+        BRPeerManagerFree(manager);
+    }
+    
+    buf[len/2] ^= 1; // any change invalidates the signature
+    if (BRHeaderSnapshotParse(buf, len, &BR_CHAIN_PARAMS, pubKey, pkLen, parsed, 3) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotParse() test 3\n", __func__);
+    
+    buf[len/2] ^= 1;
+    pkLen = BRKeyPubKey(&other, pubKey, sizeof(pubKey));
+    if (BRHeaderSnapshotParse(buf, len, &BR_CHAIN_PARAMS, pubKey, pkLen, parsed, 3) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotParse() test 4\n", __func__);
+    
+    blocks[0]->height = 5000; // a checkpoint height, where the header doesn't match the checkpoint
+    if (BRHeaderSnapshotSerialize(blocks, 1, &other, buf, len) == 0 ||
+        BRHeaderSnapshotParse(buf, BRHeaderSnapshotSerialize(blocks, 1, &other, NULL, 0), &BR_CHAIN_PARAMS, pubKey,
+                              pkLen, parsed, 3) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRHeaderSnapshotParse() test 5\n", __func__);
+    
+    for (i = 0; i < 3; i++) BRMerkleBlockFree(blocks[i]);
+    BRWalletFree(w);
+    free(buf);
+    return r;
+}
+
 int BRRunTests()
 {
     int fail = 0;
@@ -2643,10 +3551,24 @@ int BRRunTests()
     printf("%s\n", (BRTransactionTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRWalletTests...                    ");
     printf("%s\n", (BRWalletTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRWatchWalletTests...               ");
+    printf("%s\n", (BRWatchWalletTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRBloomFilterTests...               ");
     printf("%s\n", (BRBloomFilterTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRMerkleBlockTests...               ");
     printf("%s\n", (BRMerkleBlockTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRBlockCacheTests...                ");
+    printf("%s\n", (BRBlockCacheTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRChainParamsTests...               ");
+    printf("%s\n", (BRChainParamsTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPeerStoreTests...                 ");
+    printf("%s\n", (BRPeerStoreTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRStoreTests...                     ");
+    printf("%s\n", (BRStoreTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRTxLogTests...                     ");
+    printf("%s\n", (BRTxLogTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRHeaderSnapshotTests...            ");
+    printf("%s\n", (BRHeaderSnapshotTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolTests...           ");
     printf("%s\n", (BRPaymentProtocolTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolEncryptionTests... ");